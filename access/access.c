@@ -19,16 +19,449 @@
 
 #include "access.h"
 
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
+#include "access_cache.h"
+#include "access_precompute.h"
+#include "access_target.h"
+#include "access_timeindex.h"
+#include "config_manager.h"
 #include "pap_plugin.h"
+#include "pdp.h"
 #include "pep.h"
 #include "pep_plugin.h"
 #include "pip.h"
+#include "pip_cache.h"
+#include "pip_plugin.h"
+#include "pip_prefetch.h"
+#include "policy_circuit.h"
 #include "timer.h"
+#include "utils.h"
+
+#define ACCESS_REQUEST_LEN 128
+#define ACCESS_DECISION_CACHE_SIZE 256
+#define ACCESS_DECISION_CACHE_TTL_MS 1000
+#define ACCESS_PIP_PLUGINS_MAX 8
+#define ACCESS_PDP_POLICIES_MAX 32
+#define ACCESS_PEP_PLUGINS_MAX 8
+#define ACCESS_GRANTS_MAX 32
+#define ACCESS_ACTION_ATTRIBUTE "request.action.value"
+#define ACCESS_ATTRIBUTE_URI_AUTHORITY "iota:"
+#define ACCESS_POLICY_ENGINE_LEN 16
+// Relative cost of request attributes for the bytecode engine
+#define ACCESS_ACTION_ATTRIBUTE_COST 1
+#define ACCESS_PIP_ATTRIBUTE_COST 10
+#define ACCESS_PREFETCH_THREADS 4
+#define ACCESS_PREFETCH_DEADLINE_MS 200
+#define ACCESS_ATTRIBUTE_CACHE_SIZE 128
+#define ACCESS_ATTRIBUTE_TTL_MS 250
+#define ACCESS_ATTRIBUTE_TTLS_MAX 8
+// Below the decision cache TTL, so precomputed decisions do not expire between refreshes
+#define ACCESS_PRECOMPUTE_REFRESH_MS 500
+
+typedef struct {
+  int item;
+  pdp_decision_e decision;
+  pdp_action_t action;
+} access_evaluation_t;
+
+// Request a circuit is evaluated for, the rest of its attributes come from the PIP plugins.
+// Subject and object are only given by a resolve naming its target.
+typedef struct {
+  const char *policy_id;
+  int policy_id_len;
+  const char *action;
+  int action_len;
+  const char *subject;
+  int subject_len;
+  const char *object;
+  int object_len;
+} access_circuit_request_t;
+
+// Subjects a circuit is evaluated for in bulk, on top of the request
+typedef struct {
+  access_circuit_request_t request;
+  const access_subject_column_t *columns;
+  int columns_num;
+} access_subjects_request_t;
+
+// Callbacks of the registered PAP plugin, called from the ones keeping the
+// decision cache and the policy circuits in step with the stored policies
+static plugin_cb pap_put_cb;
+static plugin_cb pap_del_cb;
+
+typedef struct {
+  plugin_t plugin;
+  // The plugin's own acquire callback, its place in the callbacks goes through the attribute cache
+  plugin_cb acquire;
+  int ttl_ms;
+  access_attribute_ttl_t ttls[ACCESS_ATTRIBUTE_TTLS_MAX];
+  int ttls_num;
+} access_pip_plugin_t;
+
+// Plugin and URI of one acquisition through the attribute cache
+typedef struct {
+  access_pip_plugin_t *pip_plugin;
+  plugin_t *plugin;
+  char *uri;
+} access_acquisition_t;
+
+static access_pip_plugin_t pip_plugins[ACCESS_PIP_PLUGINS_MAX];
+static int pip_plugins_num;
+static int attribute_ttl_ms;
+
+static int prefetch_deadline_ms;
+
+// Request attributes of the stored policies the circuit cannot compile. They are
+// prefetched into the attribute cache before the PDP asks for them one at a time.
+typedef struct {
+  char policy_id[ACCESS_TARGET_ID_LEN];
+  char types[PIP_PREFETCH_URIS_MAX][POLICY_CIRCUIT_VALUE_LEN];
+  // 0 for a free entry
+  int types_num;
+} access_pdp_policy_t;
+
+static pthread_mutex_t pdp_policies_lock = PTHREAD_MUTEX_INITIALIZER;
+static access_pdp_policy_t pdp_policies[ACCESS_PDP_POLICIES_MAX];
+
+static plugin_t pep_plugins[ACCESS_PEP_PLUGINS_MAX];
+static int pep_plugins_num;
+
+// Action and obligation the PDP gave with the last grant of a policy. A grant
+// decided without the PDP is enforced with them.
+typedef struct {
+  char policy_id[ACCESS_TARGET_ID_LEN];
+  pdp_action_t action;
+  char obligation[PDP_STR_LEN];
+} access_grant_t;
+
+static pthread_mutex_t grants_lock = PTHREAD_MUTEX_INITIALIZER;
+static access_grant_t grants[ACCESS_GRANTS_MAX];
+// Entry replaced next when no entry of the policy exists
+static int grants_next;
+
+static pdp_decision_e precompute_policy(const char *policy_id, int policy_id_len, const char *action, int action_len);
+static void time_boundary_passed(void);
+
+static int is_action_attribute(const char *type, int type_len) {
+  return type_len == strlen(ACCESS_ACTION_ATTRIBUTE) && memcmp(type, ACCESS_ACTION_ATTRIBUTE, type_len) == 0;
+}
+
+static int is_time_attribute(const char *type, int type_len) {
+  return type_len == strlen(ACCESS_TIMEINDEX_ATTRIBUTE) && memcmp(type, ACCESS_TIMEINDEX_ATTRIBUTE, type_len) == 0;
+}
+
+static int attribute_cost(const char *type, int type_len) {
+  // The action comes with the request and the time from the clock, everything else is a PIP round trip
+  return is_action_attribute(type, type_len) || is_time_attribute(type, type_len) ? ACCESS_ACTION_ATTRIBUTE_COST
+                                                                                   : ACCESS_PIP_ATTRIBUTE_COST;
+}
+
+static int fetch_attribute(void *fetch_data, pip_attribute_object_t *attribute) {
+  access_acquisition_t *acquisition = (access_acquisition_t *)fetch_data;
+  pip_plugin_args_t args;
+
+  memset(&args, 0, sizeof(args));
+  args.uri = acquisition->uri;
+  int ret = acquisition->pip_plugin->acquire(acquisition->plugin, &args);
+  *attribute = args.attribute;
+
+  return ret;
+}
+
+static int plugin_acquire(int index, plugin_t *plugin, pip_plugin_args_t *args) {
+  access_pip_plugin_t *pip_plugin = &pip_plugins[index];
+  access_acquisition_t acquisition = {pip_plugin, plugin, args->uri};
+  int ttl_ms = pip_plugin->ttl_ms;
+
+  // The first attribute TTL whose prefix matches the URI, or the attribute type after the policy id, overrides the
+  // plugin's
+  const char *type = strchr(args->uri, '/');
+  for (int i = 0; i < pip_plugin->ttls_num; i++) {
+    if (strncmp(args->uri, pip_plugin->ttls[i].uri, strlen(pip_plugin->ttls[i].uri)) == 0 ||
+        (type != NULL && strncmp(type + 1, pip_plugin->ttls[i].uri, strlen(pip_plugin->ttls[i].uri)) == 0)) {
+      ttl_ms = pip_plugin->ttls[i].ttl_ms;
+      break;
+    }
+  }
+
+  return pip_cache_acquire(index, args->uri, ttl_ms, fetch_attribute, &acquisition, &args->attribute);
+}
+
+static int cached_acquire_cb(plugin_t *plugin, void *data) {
+  // Copies of a plugin share its callbacks, which tell the registered plugin apart
+  for (int i = 0; i < pip_plugins_num; i++) {
+    if (pip_plugins[i].plugin.callbacks == plugin->callbacks) {
+      return plugin_acquire(i, plugin, (pip_plugin_args_t *)data);
+    }
+  }
+  return -1;
+}
+
+static int acquire_attribute(const char *uri, char *value, int value_size) {
+  // First plugin that knows the attribute answers
+  for (int i = 0; i < pip_plugins_num; i++) {
+    pip_plugin_args_t args;
+    memset(&args, 0, sizeof(args));
+    args.uri = (char *)uri;
+    if (pip_plugins[i].acquire != NULL && plugin_acquire(i, &pip_plugins[i].plugin, &args) == 0 &&
+        args.attribute.value[0] != '\0') {
+      int len = strnlen(args.attribute.value, PIP_MAX_STR_LEN);
+      if (len >= value_size) {
+        return -1;
+      }
+      memcpy(value, args.attribute.value, len);
+      return len;
+    }
+  }
+
+  return -1;
+}
+
+// The PDP asks the plugins for an attribute of the policy it evaluates by the URI
+// iota:<policy id>/<attribute type>?<value>. Request attributes carry no value in the policy.
+static int attribute_uri(const access_circuit_request_t *request, const char *type, int type_len, char *uri,
+                         int uri_size) {
+  int len = snprintf(uri, uri_size, ACCESS_ATTRIBUTE_URI_AUTHORITY "%.*s/%.*s?", request->policy_id_len,
+                     request->policy_id, type_len, type);
+  return request->policy_id == NULL || len < 0 || len >= uri_size ? -1 : len;
+}
+
+static int is_target_attribute(const access_circuit_request_t *request, const char *type, int type_len) {
+  return (request->subject != NULL && type_len == strlen(ACCESS_TARGET_SUBJECT_ATTRIBUTE) &&
+          memcmp(type, ACCESS_TARGET_SUBJECT_ATTRIBUTE, type_len) == 0) ||
+         (request->object != NULL && type_len == strlen(ACCESS_TARGET_OBJECT_ATTRIBUTE) &&
+          memcmp(type, ACCESS_TARGET_OBJECT_ATTRIBUTE, type_len) == 0);
+}
+
+// Fetches the attributes concurrently, lens[i] tells for types[i] what came of it. Returns the number of URIs fetched.
+static int prefetch_types(const access_circuit_request_t *request, const char *const *types, const int *type_lens,
+                          int types_num, char (*values)[PIP_PREFETCH_VALUE_LEN], int *lens, int *type_of) {
+  char uris[PIP_PREFETCH_URIS_MAX][PIP_PREFETCH_URI_LEN];
+  const char *uri_list[PIP_PREFETCH_URIS_MAX];
+  int uris_num = 0;
+
+  // The action, the time and a named target are at hand, every other attribute is a PIP round trip
+  for (int i = 0; i < types_num && uris_num < PIP_PREFETCH_URIS_MAX; i++) {
+    if (is_action_attribute(types[i], type_lens[i]) || is_time_attribute(types[i], type_lens[i]) ||
+        is_target_attribute(request, types[i], type_lens[i]) ||
+        attribute_uri(request, types[i], type_lens[i], uris[uris_num], PIP_PREFETCH_URI_LEN) < 0) {
+      continue;
+    }
+    uri_list[uris_num] = uris[uris_num];
+    type_of[uris_num++] = i;
+  }
+
+  // A single attribute gains nothing from a worker
+  if (uris_num < 2 || pip_prefetch_fetch(uri_list, uris_num, values, lens, prefetch_deadline_ms) < 0) {
+    return 0;
+  }
+  return uris_num;
+}
+
+static void prefetch_attributes(const policy_circuit_t *circuit, policy_slot_value_t *slots, void *user_data) {
+  const char *types[POLICY_CIRCUIT_SLOTS_MAX];
+  int type_lens[POLICY_CIRCUIT_SLOTS_MAX];
+  char values[PIP_PREFETCH_URIS_MAX][PIP_PREFETCH_VALUE_LEN];
+  int lens[PIP_PREFETCH_URIS_MAX];
+  int slot_of[PIP_PREFETCH_URIS_MAX];
+
+  for (int i = 0; i < circuit->slots_num; i++) {
+    types[i] = circuit->strings + circuit->slot_offsets[i];
+    type_lens[i] = circuit->slot_lens[i];
+  }
+
+  int uris_num = prefetch_types((access_circuit_request_t *)user_data, types, type_lens, circuit->slots_num, values,
+                                lens, slot_of);
+  for (int i = 0; i < uris_num; i++) {
+    // Attributes late for the deadline count as unavailable rather than being fetched again
+    if (lens[i] == PIP_PREFETCH_PENDING) {
+      slots[slot_of[i]].resolved = -1;
+    } else if (lens[i] >= 0) {
+      policy_circuit_set_slot(&slots[slot_of[i]], values[i], lens[i]);
+    }
+  }
+}
+
+static access_pdp_policy_t *find_pdp_policy(const char *policy_id, int policy_id_len) {
+  for (int i = 0; i < ACCESS_PDP_POLICIES_MAX; i++) {
+    if (pdp_policies[i].types_num > 0 && strlen(pdp_policies[i].policy_id) == policy_id_len &&
+        strncasecmp(pdp_policies[i].policy_id, policy_id, policy_id_len) == 0) {
+      return &pdp_policies[i];
+    }
+  }
+  return NULL;
+}
+
+static void pdp_policy_set(const char *policy_id, const char *policy_object, int policy_object_len) {
+  char types[PIP_PREFETCH_URIS_MAX][POLICY_CIRCUIT_VALUE_LEN];
+  int types_num = policy_circuit_attributes(policy_object, policy_object_len, types, PIP_PREFETCH_URIS_MAX);
+
+  pthread_mutex_lock(&pdp_policies_lock);
+  access_pdp_policy_t *policy = find_pdp_policy(policy_id, strlen(policy_id));
+  for (int i = 0; i < ACCESS_PDP_POLICIES_MAX && policy == NULL && types_num > 0; i++) {
+    if (pdp_policies[i].types_num == 0) {
+      policy = &pdp_policies[i];
+    }
+  }
+  if (policy != NULL) {
+    strcpy(policy->policy_id, policy_id);
+    policy->types_num = types_num < 0 ? 0 : types_num;
+    memcpy(policy->types, types, policy->types_num * POLICY_CIRCUIT_VALUE_LEN);
+  }
+  pthread_mutex_unlock(&pdp_policies_lock);
+}
+
+static void pdp_policy_remove(const char *policy_id) {
+  pthread_mutex_lock(&pdp_policies_lock);
+  access_pdp_policy_t *policy = find_pdp_policy(policy_id, strlen(policy_id));
+  if (policy != NULL) {
+    policy->types_num = 0;
+  }
+  pthread_mutex_unlock(&pdp_policies_lock);
+}
+
+static access_grant_t *find_grant(const char *policy_id, int policy_id_len) {
+  for (int i = 0; i < ACCESS_GRANTS_MAX; i++) {
+    if (grants[i].policy_id[0] != '\0' && strlen(grants[i].policy_id) == policy_id_len &&
+        strncasecmp(grants[i].policy_id, policy_id, policy_id_len) == 0) {
+      return &grants[i];
+    }
+  }
+  return NULL;
+}
+
+static int grant_get(const char *policy_id, int policy_id_len, access_grant_t *grant) {
+  pthread_mutex_lock(&grants_lock);
+  access_grant_t *found = find_grant(policy_id, policy_id_len);
+  if (found != NULL) {
+    *grant = *found;
+  }
+  pthread_mutex_unlock(&grants_lock);
+
+  return found != NULL ? 0 : -1;
+}
+
+static void grant_set(const char *policy_id, int policy_id_len, const pdp_action_t *action, const char *obligation) {
+  if (policy_id_len >= ACCESS_TARGET_ID_LEN) {
+    return;
+  }
+
+  pthread_mutex_lock(&grants_lock);
+  access_grant_t *grant = find_grant(policy_id, policy_id_len);
+  if (grant == NULL) {
+    grant = &grants[grants_next];
+    grants_next = (grants_next + 1) % ACCESS_GRANTS_MAX;
+  }
+  memcpy(grant->policy_id, policy_id, policy_id_len);
+  grant->policy_id[policy_id_len] = '\0';
+  grant->action = *action;
+  strncpy(grant->obligation, obligation, PDP_STR_LEN - 1);
+  grant->obligation[PDP_STR_LEN - 1] = '\0';
+  pthread_mutex_unlock(&grants_lock);
+}
+
+static void grant_remove(const char *policy_id) {
+  pthread_mutex_lock(&grants_lock);
+  access_grant_t *grant = find_grant(policy_id, strlen(policy_id));
+  if (grant != NULL) {
+    grant->policy_id[0] = '\0';
+  }
+  pthread_mutex_unlock(&grants_lock);
+}
+
+// Fetches the PIP attributes of a policy the PDP is about to evaluate. Only policies the circuit cannot
+// compile are known here. Has no effect with attribute_ttl_ms 0.
+static void prefetch_policy(const char *policy_id, int policy_id_len) {
+  char types[PIP_PREFETCH_URIS_MAX][POLICY_CIRCUIT_VALUE_LEN];
+  const char *type_list[PIP_PREFETCH_URIS_MAX];
+  int type_lens[PIP_PREFETCH_URIS_MAX];
+  int types_num = 0;
+  char values[PIP_PREFETCH_URIS_MAX][PIP_PREFETCH_VALUE_LEN];
+  int lens[PIP_PREFETCH_URIS_MAX];
+  int type_of[PIP_PREFETCH_URIS_MAX];
+
+  pthread_mutex_lock(&pdp_policies_lock);
+  access_pdp_policy_t *policy = find_pdp_policy(policy_id, policy_id_len);
+  if (policy != NULL) {
+    types_num = policy->types_num;
+    memcpy(types, policy->types, types_num * POLICY_CIRCUIT_VALUE_LEN);
+  }
+  pthread_mutex_unlock(&pdp_policies_lock);
+
+  for (int i = 0; i < types_num; i++) {
+    type_list[i] = types[i];
+    type_lens[i] = strlen(types[i]);
+  }
+
+  // The values land in the attribute cache, where the PDP finds them
+  access_circuit_request_t request = {.policy_id = policy_id, .policy_id_len = policy_id_len};
+  prefetch_types(&request, type_list, type_lens, types_num, values, lens, type_of);
+}
 
 void access_init() {
+  int cache_size;
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("access", "decision_cache_size", &cache_size) ||
+      cache_size < 0) {
+    cache_size = ACCESS_DECISION_CACHE_SIZE;
+  }
+  int cache_ttl_ms;
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("access", "decision_cache_ttl_ms", &cache_ttl_ms) ||
+      cache_ttl_ms < 0) {
+    cache_ttl_ms = ACCESS_DECISION_CACHE_TTL_MS;
+  }
+  access_cache_init(cache_size, cache_ttl_ms);
+
+  char engine[ACCESS_POLICY_ENGINE_LEN] = {0};
+  if (CONFIG_MANAGER_OK == config_manager_get_option_string("access", "policy_engine", engine, sizeof(engine)) &&
+      strcmp(engine, "vm") == 0) {
+    policy_circuit_set_engine(POLICY_ENGINE_VM, attribute_cost);
+  } else {
+    policy_circuit_set_engine(POLICY_ENGINE_CIRCUIT, NULL);
+  }
+
+  int attribute_cache_size;
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("access", "attribute_cache_size", &attribute_cache_size) ||
+      attribute_cache_size < 0) {
+    attribute_cache_size = ACCESS_ATTRIBUTE_CACHE_SIZE;
+  }
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("access", "attribute_ttl_ms", &attribute_ttl_ms) ||
+      attribute_ttl_ms < 0) {
+    attribute_ttl_ms = ACCESS_ATTRIBUTE_TTL_MS;
+  }
+  pip_cache_init(attribute_cache_size);
+
+  int prefetch_threads;
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("access", "attribute_prefetch_threads", &prefetch_threads) ||
+      prefetch_threads < 0) {
+    prefetch_threads = ACCESS_PREFETCH_THREADS;
+  }
+  if (CONFIG_MANAGER_OK !=
+          config_manager_get_option_int("access", "attribute_prefetch_deadline_ms", &prefetch_deadline_ms) ||
+      prefetch_deadline_ms <= 0) {
+    prefetch_deadline_ms = ACCESS_PREFETCH_DEADLINE_MS;
+  }
+  if (prefetch_threads > 0 && pip_prefetch_init(prefetch_threads, acquire_attribute) == 0) {
+    policy_circuit_set_prefetch(prefetch_attributes);
+  } else {
+    policy_circuit_set_prefetch(NULL);
+  }
+
+  int precompute_refresh_ms;
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("access", "precompute_refresh_ms", &precompute_refresh_ms) ||
+      precompute_refresh_ms < 0) {
+    precompute_refresh_ms = ACCESS_PRECOMPUTE_REFRESH_MS;
+  }
+  access_precompute_init(precompute_refresh_ms, precompute_policy);
+
+  if (access_timeindex_init(time_boundary_passed) == 0) {
+    access_cache_set_lifetime(access_timeindex_lifetime);
+  }
+
   pep_init();
   pip_init();
 }
@@ -40,16 +473,422 @@ void access_start() {
 void access_term() {
   pip_term();
   pep_term();
+  access_cache_set_lifetime(NULL);
+  access_timeindex_term();
+  access_precompute_term();
+  policy_circuit_set_prefetch(NULL);
+  pip_prefetch_term();
+  pip_cache_term();
+  access_cache_term();
+  access_target_clear();
+  policy_circuit_clear();
+  pthread_mutex_lock(&pdp_policies_lock);
+  memset(pdp_policies, 0, sizeof(pdp_policies));
+  pthread_mutex_unlock(&pdp_policies_lock);
+  pthread_mutex_lock(&grants_lock);
+  memset(grants, 0, sizeof(grants));
+  pthread_mutex_unlock(&grants_lock);
+  pep_plugins_num = 0;
 }
 
 int access_register_pep_plugin(plugin_t *plugin) {
+  // Resolves call the plugins directly, other requests through the PEP
+  if (pep_plugins_num < ACCESS_PEP_PLUGINS_MAX) {
+    pep_plugins[pep_plugins_num++] = *plugin;
+  }
+
   pep_register_plugin(plugin);
+  return 0;
 }
 
 int access_register_pip_plugin(plugin_t *plugin) {
-  pip_register_plugin(plugin);
+  return access_register_pip_plugin_ttl(plugin, attribute_ttl_ms, NULL, 0);
+}
+
+int access_register_pip_plugin_ttl(plugin_t *plugin, int ttl_ms, const access_attribute_ttl_t *ttls, int ttls_num) {
+  // Circuits ask the plugins for attributes directly, the PDP through the PIP
+  if (pip_plugins_num < ACCESS_PIP_PLUGINS_MAX) {
+    access_pip_plugin_t *pip_plugin = &pip_plugins[pip_plugins_num++];
+    pip_plugin->plugin = *plugin;
+    pip_plugin->ttl_ms = ttl_ms;
+    pip_plugin->ttls_num = 0;
+    for (int i = 0; i < ttls_num && i < ACCESS_ATTRIBUTE_TTLS_MAX; i++) {
+      pip_plugin->ttls[pip_plugin->ttls_num++] = ttls[i];
+    }
+    if (plugin->callbacks_num > PIP_PLUGIN_ACQUIRE_CB && plugin->callbacks[PIP_PLUGIN_ACQUIRE_CB] != NULL) {
+      pip_plugin->acquire = plugin->callbacks[PIP_PLUGIN_ACQUIRE_CB];
+      plugin->callbacks[PIP_PLUGIN_ACQUIRE_CB] = cached_acquire_cb;
+    }
+  }
+
+  return pip_register_plugin(plugin);
+}
+
+static int policy_id_string(char *policy_id, char *policy_id_str) {
+  // PAP plugins get the raw policy id, requests name the policy by its hex string
+  return hex_to_str(policy_id, policy_id_str, PAP_POL_ID_MAX_LEN) == UTILS_STRING_SUCCESS ? 0 : -1;
+}
+
+static int pap_put_policy_cb(plugin_t *plugin, void *data) {
+  pap_policy_t *policy = (pap_policy_t *)data;
+  char policy_id_str[PAP_POL_ID_MAX_LEN * 2 + 1] = {0};
+  policy_circuit_t *circuit;
+  int ret = pap_put_cb(plugin, data);
+
+  if (policy_id_string(policy->policy_id, policy_id_str) == 0) {
+    // Compiled once here, so evaluating the policy parses no JSON. A policy
+    // the circuit cannot express is left to the PDP.
+    if (policy_circuit_compile(policy->policy_object.policy_object, policy->policy_object.policy_object_size,
+                               &circuit) == POLICY_CIRCUIT_OK) {
+      // Indexed and subscribed before the store takes the circuit over
+      access_target_add(policy_id_str, strlen(policy_id_str), circuit);
+      access_timeindex_add(policy_id_str, strlen(policy_id_str), circuit);
+      if (circuit->precompute) {
+        access_precompute_subscribe(policy_id_str, strlen(policy_id_str), circuit);
+      } else {
+        access_precompute_unsubscribe(policy_id_str, strlen(policy_id_str));
+      }
+      policy_circuit_store(policy_id_str, strlen(policy_id_str), circuit);
+      pdp_policy_remove(policy_id_str);
+    } else {
+      pdp_policy_set(policy_id_str, policy->policy_object.policy_object, policy->policy_object.policy_object_size);
+      access_target_remove(policy_id_str, strlen(policy_id_str));
+      access_timeindex_remove(policy_id_str, strlen(policy_id_str));
+      access_precompute_unsubscribe(policy_id_str, strlen(policy_id_str));
+      policy_circuit_drop(policy_id_str, strlen(policy_id_str));
+    }
+    access_cache_invalidate_policy(policy_id_str, strlen(policy_id_str));
+    grant_remove(policy_id_str);
+  }
+
+  return ret;
+}
+
+static int pap_del_policy_cb(plugin_t *plugin, void *data) {
+  char policy_id_str[PAP_POL_ID_MAX_LEN * 2 + 1] = {0};
+  int ret = pap_del_cb(plugin, data);
+
+  if (policy_id_string((char *)data, policy_id_str) == 0) {
+    pdp_policy_remove(policy_id_str);
+    access_target_remove(policy_id_str, strlen(policy_id_str));
+    access_timeindex_remove(policy_id_str, strlen(policy_id_str));
+    access_precompute_unsubscribe(policy_id_str, strlen(policy_id_str));
+    policy_circuit_drop(policy_id_str, strlen(policy_id_str));
+    access_cache_invalidate_policy(policy_id_str, strlen(policy_id_str));
+    grant_remove(policy_id_str);
+  }
+
+  return ret;
 }
 
 int access_register_pap_plugin(plugin_t *plugin) {
+  // Every policy write reaches the plugin, from pap_add_policy as well as from the policy loader
+  if (plugin->callbacks_num > PAP_PLUGIN_DEL_CB) {
+    if (plugin->callbacks[PAP_PLUGIN_PUT_CB] != NULL) {
+      pap_put_cb = plugin->callbacks[PAP_PLUGIN_PUT_CB];
+      plugin->callbacks[PAP_PLUGIN_PUT_CB] = pap_put_policy_cb;
+    }
+    if (plugin->callbacks[PAP_PLUGIN_DEL_CB] != NULL) {
+      pap_del_cb = plugin->callbacks[PAP_PLUGIN_DEL_CB];
+      plugin->callbacks[PAP_PLUGIN_DEL_CB] = pap_del_policy_cb;
+    }
+  }
+
   pap_register_plugin(plugin);
 }
+
+void access_notify_attribute_change() {
+  pip_cache_invalidate();
+  access_cache_attributes_changed();
+  access_precompute_signal(NULL);
+}
+
+void access_notify_signal_change(const char *signal) {
+  pip_cache_invalidate();
+  access_cache_attributes_changed();
+  access_precompute_signal(signal);
+}
+
+static void time_boundary_passed(void) {
+  // PIP attributes stay valid. Bumping the attribute version also rejects decisions evaluated
+  // before the boundary and stored after it.
+  access_cache_attributes_changed();
+  access_precompute_signal(ACCESS_TIMEINDEX_ATTRIBUTE);
+}
+
+static int resolve_attribute(const char *type, int type_len, void *user_data, char *value, int value_size) {
+  access_circuit_request_t *request = (access_circuit_request_t *)user_data;
+
+  if (is_action_attribute(type, type_len)) {
+    if (request->action == NULL || request->action_len >= value_size) {
+      return -1;
+    }
+    memcpy(value, request->action, request->action_len);
+    return request->action_len;
+  }
+  if (is_time_attribute(type, type_len)) {
+    return access_timeindex_now(value, value_size);
+  }
+  if (request->subject != NULL && type_len == strlen(ACCESS_TARGET_SUBJECT_ATTRIBUTE) &&
+      memcmp(type, ACCESS_TARGET_SUBJECT_ATTRIBUTE, type_len) == 0) {
+    if (request->subject_len >= value_size) {
+      return -1;
+    }
+    memcpy(value, request->subject, request->subject_len);
+    return request->subject_len;
+  }
+  if (request->object != NULL && type_len == strlen(ACCESS_TARGET_OBJECT_ATTRIBUTE) &&
+      memcmp(type, ACCESS_TARGET_OBJECT_ATTRIBUTE, type_len) == 0) {
+    if (request->object_len >= value_size) {
+      return -1;
+    }
+    memcpy(value, request->object, request->object_len);
+    return request->object_len;
+  }
+
+  char uri[PIP_MAX_STR_LEN];
+  if (attribute_uri(request, type, type_len, uri, PIP_MAX_STR_LEN) < 0) {
+    return -1;
+  }
+
+  return acquire_attribute(uri, value, value_size);
+}
+
+static pdp_decision_e precompute_policy(const char *policy_id, int policy_id_len, const char *action, int action_len) {
+  access_circuit_request_t request = {
+      .policy_id = policy_id, .policy_id_len = policy_id_len, .action = action, .action_len = action_len};
+  return policy_circuit_evaluate_stored(policy_id, policy_id_len, resolve_attribute, &request);
+}
+
+static pdp_decision_e evaluate_policy(const char *policy_id, int policy_id_len, pdp_action_t *action,
+                                      char *obligation) {
+  char request[ACCESS_REQUEST_LEN];
+
+  memset(action, 0, sizeof(pdp_action_t));
+  memset(obligation, 0, PDP_STR_LEN);
+  // Same normalized form pep_request_access hands to the PDP for a resolve
+  if (snprintf(request, ACCESS_REQUEST_LEN, "{\"cmd\":\"resolve\",\"policy_id\":\"%.*s\"}", policy_id_len,
+               policy_id) >= ACCESS_REQUEST_LEN) {
+    return PDP_ERROR;
+  }
+
+  return pdp_calculate_decision(request, obligation, action);
+}
+
+// Same arguments pep_request_access gives the PEP plugins
+static void enforce(pdp_action_t *action, char *obligation) {
+  for (int i = 0; i < pep_plugins_num; i++) {
+    plugin_cb action_cb =
+        pep_plugins[i].callbacks_num > PEP_PLUGIN_ACTION_CB ? pep_plugins[i].callbacks[PEP_PLUGIN_ACTION_CB] : NULL;
+    pep_plugin_args_t args;
+    memset(&args, 0, sizeof(args));
+    args.action = *action;
+    args.obligation = obligation;
+    if (action_cb != NULL) {
+      action_cb(&pep_plugins[i], &args);
+    }
+  }
+}
+
+pdp_decision_e access_resolve(const char *policy_id, int policy_id_len, pthread_mutex_t *core_lock) {
+  access_grant_t grant;
+  pdp_action_t action;
+  char obligation[PDP_STR_LEN];
+  pdp_decision_e decision;
+  // Read before evaluating, so decisions racing with an attribute change are not cached
+  unsigned long long attribute_version = access_cache_attribute_version();
+
+  if (policy_id == NULL || core_lock == NULL) {
+    return PDP_ERROR;
+  }
+
+  // A resolve names no action, it asks about the one the policy granted before
+  int granted = grant_get(policy_id, policy_id_len, &grant) == 0;
+  const char *granted_action = granted ? grant.action.value : NULL;
+  int granted_action_len = granted ? strlen(grant.action.value) : 0;
+
+  // Precomputed decisions are stored without an action for a policy of one action, and under each one otherwise
+  if (access_cache_lookup(policy_id, policy_id_len, NULL, 0, NULL, 0, &decision) != ACCESS_CACHE_HIT &&
+      (!granted || access_cache_lookup(policy_id, policy_id_len, NULL, 0, granted_action, granted_action_len,
+                                       &decision) != ACCESS_CACHE_HIT)) {
+    access_circuit_request_t request = {.policy_id = policy_id,
+                                        .policy_id_len = policy_id_len,
+                                        .action = granted_action,
+                                        .action_len = granted_action_len};
+    decision = policy_circuit_evaluate_stored(policy_id, policy_id_len, resolve_attribute, &request);
+    if (decision != PDP_ERROR) {
+      access_cache_store(policy_id, policy_id_len, NULL, 0, NULL, 0, attribute_version, decision);
+    }
+  }
+
+  // Only the PEP plugins run for a grant the PDP has given the action and obligation of before
+  if (decision == PDP_GRANT && granted) {
+    pthread_mutex_lock(core_lock);
+    enforce(&grant.action, grant.obligation);
+    pthread_mutex_unlock(core_lock);
+    return decision;
+  }
+  if (decision != PDP_ERROR && decision != PDP_GRANT) {
+    return decision;
+  }
+
+  // Outside the core lock, other requests need not wait for these fetches
+  prefetch_policy(policy_id, policy_id_len);
+
+  pthread_mutex_lock(core_lock);
+  decision = evaluate_policy(policy_id, policy_id_len, &action, obligation);
+  if (decision == PDP_GRANT) {
+    grant_set(policy_id, policy_id_len, &action, obligation);
+  }
+  if (decision != PDP_ERROR) {
+    access_cache_store(policy_id, policy_id_len, NULL, 0, NULL, 0, attribute_version, decision);
+  }
+  enforce(&action, obligation);
+  pthread_mutex_unlock(core_lock);
+
+  return decision;
+}
+
+int access_resolve_batch(access_batch_item_t *items, int items_num) {
+  access_evaluation_t *evaluations;
+  int evaluations_num = 0;
+  char obligation[PDP_STR_LEN];
+  // Read before evaluating, so decisions racing with an attribute change are not cached
+  unsigned long long attribute_version = access_cache_attribute_version();
+
+  if (items == NULL || items_num < 0 || items_num > ACCESS_BATCH_MAX) {
+    return -1;
+  }
+
+  evaluations = malloc(items_num * sizeof(access_evaluation_t));
+  if (evaluations == NULL && items_num > 0) {
+    return -1;
+  }
+
+  for (int i = 0; i < items_num; i++) {
+    access_evaluation_t *evaluation = NULL;
+
+    if (access_cache_lookup(items[i].policy_id, items[i].policy_id_len, NULL, 0, items[i].action, items[i].action_len,
+                            &items[i].decision) == ACCESS_CACHE_HIT) {
+      continue;
+    }
+
+    // A compiled policy is asked about the item's action directly
+    access_circuit_request_t request = {.policy_id = items[i].policy_id,
+                                        .policy_id_len = items[i].policy_id_len,
+                                        .action = items[i].action,
+                                        .action_len = items[i].action_len};
+    items[i].decision =
+        policy_circuit_evaluate_stored(items[i].policy_id, items[i].policy_id_len, resolve_attribute, &request);
+    if (items[i].decision != PDP_ERROR) {
+      access_cache_store(items[i].policy_id, items[i].policy_id_len, NULL, 0, items[i].action, items[i].action_len,
+                         attribute_version, items[i].decision);
+      continue;
+    }
+
+    // Otherwise the PDP evaluates the policy, once per distinct policy in the batch
+    for (int j = 0; j < evaluations_num; j++) {
+      access_batch_item_t *evaluated = &items[evaluations[j].item];
+      if (evaluated->policy_id_len == items[i].policy_id_len &&
+          memcmp(evaluated->policy_id, items[i].policy_id, items[i].policy_id_len) == 0) {
+        evaluation = &evaluations[j];
+        break;
+      }
+    }
+
+    if (evaluation == NULL) {
+      evaluation = &evaluations[evaluations_num++];
+      evaluation->item = i;
+      prefetch_policy(items[i].policy_id, items[i].policy_id_len);
+      evaluation->decision =
+          evaluate_policy(items[i].policy_id, items[i].policy_id_len, &evaluation->action, obligation);
+    }
+
+    items[i].decision = evaluation->decision;
+    if (items[i].decision == PDP_GRANT && items[i].action != NULL &&
+        (strlen(evaluation->action.value) != items[i].action_len ||
+         memcmp(evaluation->action.value, items[i].action, items[i].action_len) != 0)) {
+      // The policy grants a different action than the one asked about
+      items[i].decision = PDP_DENY;
+    }
+    access_cache_store(items[i].policy_id, items[i].policy_id_len, NULL, 0, items[i].action, items[i].action_len,
+                       attribute_version, items[i].decision);
+  }
+
+  free(evaluations);
+
+  return 0;
+}
+
+int access_resolve_target(access_target_request_t *request) {
+  char policy_ids[ACCESS_TARGET_CANDIDATES_MAX][ACCESS_TARGET_ID_LEN];
+
+  if (request == NULL || request->subject == NULL || request->action == NULL || request->object == NULL) {
+    return -1;
+  }
+
+  request->decision = PDP_UNDEFINED;
+  request->policy_id[0] = '\0';
+  int candidates_num = access_target_find(request->subject, request->subject_len, request->action,
+                                          request->action_len, request->object, request->object_len, policy_ids,
+                                          ACCESS_TARGET_CANDIDATES_MAX);
+  if (candidates_num > ACCESS_TARGET_CANDIDATES_MAX) {
+    request->decision = PDP_ERROR;
+    return -1;
+  }
+
+  // Policies left out by the index are undefined for the request, which the join ignores
+  access_circuit_request_t circuit_request = {.action = request->action,
+                                              .action_len = request->action_len,
+                                              .subject = request->subject,
+                                              .subject_len = request->subject_len,
+                                              .object = request->object,
+                                              .object_len = request->object_len};
+  for (int i = 0; i < candidates_num; i++) {
+    circuit_request.policy_id = policy_ids[i];
+    circuit_request.policy_id_len = strlen(policy_ids[i]);
+    pdp_decision_e decision =
+        policy_circuit_evaluate_stored(policy_ids[i], strlen(policy_ids[i]), resolve_attribute, &circuit_request);
+    if (decision == PDP_GRANT && request->policy_id[0] == '\0') {
+      strcpy(request->policy_id, policy_ids[i]);
+    }
+    request->decision = policy_circuit_join(request->decision, decision);
+  }
+
+  return candidates_num;
+}
+
+static int subject_column(const char *type, int type_len, void *user_data, policy_column_t *column) {
+  access_subjects_request_t *subjects = (access_subjects_request_t *)user_data;
+
+  for (int i = 0; i < subjects->columns_num; i++) {
+    if (strlen(subjects->columns[i].type) == type_len && memcmp(subjects->columns[i].type, type, type_len) == 0) {
+      column->values = subjects->columns[i].values;
+      column->lens = subjects->columns[i].lens;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int resolve_shared_attribute(const char *type, int type_len, void *user_data, char *value, int value_size) {
+  return resolve_attribute(type, type_len, &((access_subjects_request_t *)user_data)->request, value, value_size);
+}
+
+int access_resolve_subjects(const char *policy_id, int policy_id_len, const char *action, int action_len,
+                            const access_subject_column_t *columns, int columns_num, int subjects_num,
+                            uint64_t *granted) {
+  if (policy_id == NULL || (columns == NULL && columns_num > 0) || subjects_num < 0 || granted == NULL) {
+    return -1;
+  }
+
+  access_subjects_request_t subjects = {
+      .request = {.policy_id = policy_id, .policy_id_len = policy_id_len, .action = action, .action_len = action_len},
+      .columns = columns,
+      .columns_num = columns_num};
+  int granted_num = policy_circuit_evaluate_stored_batch(policy_id, policy_id_len, subjects_num, subject_column,
+                                                         resolve_shared_attribute, &subjects, granted);
+
+  return granted_num < 0 ? -1 : granted_num;
+}
@@ -20,9 +20,51 @@
 #ifndef _ACCESS_H_
 #define _ACCESS_H_
 
+#include <pthread.h>
+
+#include "access_cache.h"
+#include "access_target.h"
+#include "pdp.h"
 #include "plugin.h"
 #include "wallet.h"
 
+#define ACCESS_BATCH_MAX 64
+
+// One (policy_id, action) question of a batched resolve. Strings point into
+// the caller's buffer and are not terminated; action may be NULL to accept
+// whatever action the policy grants.
+typedef struct {
+  const char *policy_id;
+  int policy_id_len;
+  const char *action;
+  int action_len;
+  pdp_decision_e decision;
+} access_batch_item_t;
+
+// A resolve naming its target instead of a policy. Strings point into the
+// caller's buffer and are not terminated.
+typedef struct {
+  const char *subject;
+  int subject_len;
+  const char *action;
+  int action_len;
+  const char *object;
+  int object_len;
+  // Set by access_resolve_target
+  pdp_decision_e decision;
+  // A policy granting the request, terminated, empty unless the decision is a grant
+  char policy_id[ACCESS_TARGET_ID_LEN];
+} access_target_request_t;
+
+// Values of one attribute for every subject of a bulk evaluation
+typedef struct {
+  // Attribute type, e.g. "request.subject.value", terminated
+  const char *type;
+  // Value of subject i, not terminated, NULL if the subject has none
+  const char *const *values;
+  const int *lens;
+} access_subject_column_t;
+
 void access_init();
 
 void access_start();
@@ -31,8 +73,122 @@ void access_term();
 
 int access_register_pep_plugin(plugin_t *plugin);
 
+/**
+ * @brief Register PIP plugin
+ *
+ * Attributes the plugin acquires are cached for the [access] attribute_ttl_ms
+ * setting.
+ */
 int access_register_pip_plugin(plugin_t *plugin);
 
+// Lifetime of the attributes whose URI, or attribute type within the URI, starts with uri
+typedef struct {
+  const char *uri;
+  int ttl_ms;
+} access_attribute_ttl_t;
+
+/**
+ * @brief Register PIP plugin with its own attribute lifetimes
+ *
+ * The plugin's acquire callback is wrapped by the attribute cache (see
+ * pip_cache.h), for the PDP as well as for circuits. Concurrent requests for
+ * the same attribute share one acquisition.
+ *
+ * @param plugin Plugin
+ * @param ttl_ms Lifetime of the plugin's attributes, 0 never caches them
+ * @param ttls Lifetimes of single attributes, overriding ttl_ms; the URIs must outlive the plugin
+ * @param ttls_num Number of attribute lifetimes
+ */
+int access_register_pip_plugin_ttl(plugin_t *plugin, int ttl_ms, const access_attribute_ttl_t *ttls, int ttls_num);
+
+/**
+ * @brief Register PAP plugin
+ *
+ * Storing or deleting a policy through the plugin drops the cached decisions
+ * of that policy. A stored policy is also compiled into a circuit (see
+ * policy_circuit.h) which batched resolves evaluate instead of the PDP.
+ */
 int access_register_pap_plugin(plugin_t *plugin);
 
+/**
+ * @brief Notify that an attribute PIP plugins provide has changed
+ *
+ * Cached decisions and attributes may depend on it and are not served any more. Plugins
+ * should only call this when a value actually changes, not on every sample.
+ */
+void access_notify_attribute_change();
+
+/**
+ * @brief Notify that a named signal PIP plugins provide has changed
+ *
+ * Same as access_notify_attribute_change(), in addition the policies opted into precomputation
+ * ("precompute":true) which read an attribute containing the signal name are evaluated again in
+ * the background, so their decisions are ready in the decision cache before they are requested.
+ * With a NULL signal, all of them are.
+ */
+void access_notify_signal_change(const char *signal);
+
+/**
+ * @brief Resolve a request for a stored policy and enforce the decision
+ *
+ * The decision comes from the decision cache, where precomputed decisions are
+ * stored as well, or else from the policy's circuit, and from the PDP for a
+ * policy without one. A grant is enforced by the registered PEP plugins with
+ * the action and obligation the PDP gave with the last grant of the policy; a
+ * grant of a policy the PDP has not granted yet is decided by the PDP. A
+ * decision of the PDP is enforced as pep_request_access does, denies from the
+ * cache or the circuit are not.
+ *
+ * @param core_lock Held while the PDP and the PEP plugins are called
+ * @return The decision, PDP_ERROR if the policy could not be evaluated
+ */
+pdp_decision_e access_resolve(const char *policy_id, int policy_id_len, pthread_mutex_t *core_lock);
+
+/**
+ * @brief Evaluate a batch of access questions without enforcing them
+ *
+ * A policy with a circuit is evaluated for each item, with the item's action
+ * as request.action.value. Any other policy is evaluated by the PDP once and
+ * its decision is shared by all items naming it; a grant then only holds for
+ * items whose action matches the action of the policy. No PEP plugin is
+ * triggered.
+ *
+ * @param items Questions, decision is filled in for each of them
+ * @param items_num Number of items, at most ACCESS_BATCH_MAX
+ * @return 0 on success, -1 on bad input
+ */
+int access_resolve_batch(access_batch_item_t *items, int items_num);
+
+/**
+ * @brief Decide a request by the policies applying to its subject, action and object
+ *
+ * The stored policies are looked up in the target index (see access_target.h),
+ * which is kept when policies are stored through the PAP plugin. The decisions of
+ * the policies found are joined in Belnap's logic, so a grant and a deny make a
+ * conflict. Only policies compiled into a circuit are found. Like a batched
+ * resolve, this is a query and triggers no PEP action.
+ *
+ * @return Number of policies evaluated, -1 on bad input or if more than
+ * ACCESS_TARGET_CANDIDATES_MAX policies apply
+ */
+int access_resolve_target(access_target_request_t *request);
+
+/**
+ * @brief Find which of many subjects a policy grants an action
+ *
+ * The circuit of the policy is evaluated once for all subjects (see
+ * policy_circuit_evaluate_batch). Attributes with a column are read per
+ * subject, any other attribute is resolved once and shared. A subject missing
+ * an attribute the policy compares is not granted. Like a batched resolve, this
+ * is a query and triggers no PEP action.
+ *
+ * @param columns Subject attributes, each holding subjects_num values
+ * @param granted Subjects granted, subject i is bit i % 64 of word i / 64, (subjects_num + 63) / 64 words
+ * @return Number of subjects granted, -1 on bad input, if the policy has no circuit or if a shared attribute
+ * is unavailable
+ */
+int access_resolve_subjects(const char *policy_id, int policy_id_len, const char *action, int action_len,
+                            const access_subject_column_t *columns, int columns_num, int subjects_num,
+                            uint64_t *granted);
+
 #endif
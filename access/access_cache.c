@@ -0,0 +1,366 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_cache.c
+ * \brief
+ * Implementation of the PDP decision cache
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 26.10.2020. Initial version.
+ ****************************************************************************/
+
+#include "access_cache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+typedef struct access_cache_entry access_cache_entry_t;
+
+struct access_cache_entry {
+  int used;
+  unsigned int hash;
+  // policy_id, requester and action, back to back and not terminated
+  char key[ACCESS_CACHE_KEY_LEN];
+  int policy_id_len;
+  int requester_len;
+  int action_len;
+  unsigned long long attribute_version;
+  unsigned long long expires_us;
+  pdp_decision_e decision;
+  access_cache_entry_t *bucket_next;
+  // Recency list, most recently used entry first
+  access_cache_entry_t *prev;
+  access_cache_entry_t *next;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static access_cache_entry_t *entries;
+static access_cache_entry_t **buckets;
+static unsigned int bucket_mask;
+static access_cache_entry_t *head;
+static access_cache_entry_t *tail;
+static access_cache_entry_t *free_list;
+static int capacity;
+static int count;
+static unsigned long long ttl_us;
+static access_cache_lifetime_cb lifetime_cb;
+static unsigned long long attribute_version;
+static unsigned long long hits;
+static unsigned long long misses;
+static unsigned long long evictions;
+static unsigned long long invalidations;
+
+static unsigned long long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// FNV-1a, continued over every part of the key
+static unsigned int hash_part(unsigned int hash, const char *str, int len) {
+  for (int i = 0; i < len; i++) {
+    hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+  }
+  return (hash ^ 0xff) * 16777619u;
+}
+
+static unsigned int key_hash(const char *policy_id, int policy_id_len, const char *requester, int requester_len,
+                             const char *action, int action_len) {
+  unsigned int hash = 2166136261u;
+  hash = hash_part(hash, policy_id, policy_id_len);
+  hash = hash_part(hash, requester, requester_len);
+  return hash_part(hash, action, action_len);
+}
+
+static int key_equals(access_cache_entry_t *entry, const char *policy_id, int policy_id_len, const char *requester,
+                      int requester_len, const char *action, int action_len) {
+  return entry->policy_id_len == policy_id_len && entry->requester_len == requester_len &&
+         entry->action_len == action_len && memcmp(entry->key, policy_id, policy_id_len) == 0 &&
+         memcmp(entry->key + policy_id_len, requester, requester_len) == 0 &&
+         memcmp(entry->key + policy_id_len + requester_len, action, action_len) == 0;
+}
+
+static access_cache_entry_t *find(unsigned int hash, const char *policy_id, int policy_id_len, const char *requester,
+                                  int requester_len, const char *action, int action_len) {
+  for (access_cache_entry_t *entry = buckets[hash & bucket_mask]; entry != NULL; entry = entry->bucket_next) {
+    if (entry->hash == hash &&
+        key_equals(entry, policy_id, policy_id_len, requester, requester_len, action, action_len)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void list_unlink(access_cache_entry_t *entry) {
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    tail = entry->prev;
+  }
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+static void list_push(access_cache_entry_t *entry) {
+  entry->prev = NULL;
+  entry->next = head;
+  if (head != NULL) {
+    head->prev = entry;
+  } else {
+    tail = entry;
+  }
+  head = entry;
+}
+
+static void remove_entry(access_cache_entry_t *entry) {
+  access_cache_entry_t **link = &buckets[entry->hash & bucket_mask];
+  while (*link != entry) {
+    link = &(*link)->bucket_next;
+  }
+  *link = entry->bucket_next;
+
+  list_unlink(entry);
+  entry->used = 0;
+  entry->bucket_next = free_list;
+  free_list = entry;
+  count--;
+}
+
+static access_cache_entry_t *take_free(void) {
+  if (count == capacity) {
+    // Least recently used decision makes room
+    remove_entry(tail);
+    evictions++;
+  }
+  access_cache_entry_t *entry = free_list;
+  free_list = entry->bucket_next;
+  return entry;
+}
+
+int access_cache_init(int cache_capacity, int ttl_ms) {
+  access_cache_term();
+
+  pthread_mutex_lock(&cache_lock);
+  ttl_us = ttl_ms > 0 ? (unsigned long long)ttl_ms * 1000ULL : 0;
+  if (cache_capacity <= 0) {
+    pthread_mutex_unlock(&cache_lock);
+    return 0;
+  }
+
+  // At least two buckets per entry keeps chains short
+  unsigned int bucket_count = 1;
+  while (bucket_count < 2u * cache_capacity) {
+    bucket_count <<= 1;
+  }
+
+  entries = calloc(cache_capacity, sizeof(access_cache_entry_t));
+  buckets = calloc(bucket_count, sizeof(access_cache_entry_t *));
+  if (entries == NULL || buckets == NULL) {
+    free(entries);
+    free(buckets);
+    entries = NULL;
+    buckets = NULL;
+    pthread_mutex_unlock(&cache_lock);
+    return -1;
+  }
+  for (int i = cache_capacity - 1; i >= 0; i--) {
+    entries[i].bucket_next = free_list;
+    free_list = &entries[i];
+  }
+  bucket_mask = bucket_count - 1;
+  capacity = cache_capacity;
+  pthread_mutex_unlock(&cache_lock);
+
+  return 0;
+}
+
+void access_cache_term(void) {
+  pthread_mutex_lock(&cache_lock);
+  free(entries);
+  free(buckets);
+  entries = NULL;
+  buckets = NULL;
+  head = NULL;
+  tail = NULL;
+  free_list = NULL;
+  capacity = 0;
+  count = 0;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+int access_cache_lookup(const char *policy_id, int policy_id_len, const char *requester, int requester_len,
+                        const char *action, int action_len, pdp_decision_e *decision) {
+  int ret = ACCESS_CACHE_MISS;
+
+  if (requester == NULL) {
+    requester = "";
+    requester_len = 0;
+  }
+  if (action == NULL) {
+    action = "";
+    action_len = 0;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  if (capacity == 0) {
+    pthread_mutex_unlock(&cache_lock);
+    return ACCESS_CACHE_MISS;
+  }
+
+  unsigned int hash = key_hash(policy_id, policy_id_len, requester, requester_len, action, action_len);
+  access_cache_entry_t *entry = find(hash, policy_id, policy_id_len, requester, requester_len, action, action_len);
+  if (entry != NULL && (entry->attribute_version != attribute_version || entry->expires_us <= now_us())) {
+    // Computed from attributes or at a time that no longer hold
+    remove_entry(entry);
+    invalidations++;
+    entry = NULL;
+  }
+
+  if (entry != NULL) {
+    list_unlink(entry);
+    list_push(entry);
+    *decision = entry->decision;
+    hits++;
+    ret = ACCESS_CACHE_HIT;
+  } else {
+    misses++;
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  return ret;
+}
+
+void access_cache_store(const char *policy_id, int policy_id_len, const char *requester, int requester_len,
+                        const char *action, int action_len, unsigned long long version, pdp_decision_e decision) {
+  if (requester == NULL) {
+    requester = "";
+    requester_len = 0;
+  }
+  if (action == NULL) {
+    action = "";
+    action_len = 0;
+  }
+
+  // Errors are not decisions, the next request has to retry them
+  if (decision == PDP_ERROR || policy_id_len + requester_len + action_len > ACCESS_CACHE_KEY_LEN) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  access_cache_lifetime_cb lifetime = lifetime_cb;
+  pthread_mutex_unlock(&cache_lock);
+  int lifetime_ms = lifetime != NULL ? lifetime(policy_id, policy_id_len) : -1;
+
+  pthread_mutex_lock(&cache_lock);
+  if (capacity == 0 || version != attribute_version) {
+    pthread_mutex_unlock(&cache_lock);
+    return;
+  }
+
+  // Without a TTL entries live until they are invalidated anyway
+  unsigned long long lifetime_us = ttl_us;
+  if (ttl_us > 0 && lifetime_ms > 0 && (unsigned long long)lifetime_ms * 1000ULL > ttl_us) {
+    lifetime_us = (unsigned long long)lifetime_ms * 1000ULL;
+  }
+
+  unsigned int hash = key_hash(policy_id, policy_id_len, requester, requester_len, action, action_len);
+  access_cache_entry_t *entry = find(hash, policy_id, policy_id_len, requester, requester_len, action, action_len);
+  if (entry != NULL) {
+    list_unlink(entry);
+  } else {
+    entry = take_free();
+    entry->used = 1;
+    entry->hash = hash;
+    entry->policy_id_len = policy_id_len;
+    entry->requester_len = requester_len;
+    entry->action_len = action_len;
+    memcpy(entry->key, policy_id, policy_id_len);
+    memcpy(entry->key + policy_id_len, requester, requester_len);
+    memcpy(entry->key + policy_id_len + requester_len, action, action_len);
+    entry->bucket_next = buckets[hash & bucket_mask];
+    buckets[hash & bucket_mask] = entry;
+    count++;
+  }
+
+  entry->attribute_version = version;
+  entry->expires_us = lifetime_us > 0 ? now_us() + lifetime_us : ~0ULL;
+  entry->decision = decision;
+  list_push(entry);
+  pthread_mutex_unlock(&cache_lock);
+}
+
+unsigned long long access_cache_attribute_version(void) {
+  pthread_mutex_lock(&cache_lock);
+  unsigned long long version = attribute_version;
+  pthread_mutex_unlock(&cache_lock);
+
+  return version;
+}
+
+void access_cache_invalidate_policy(const char *policy_id, int policy_id_len) {
+  pthread_mutex_lock(&cache_lock);
+  // Policy writes are rare, a scan keeps the entries free of a per-policy index.
+  // Hex ids match in either case, as the PDP accepts both.
+  for (int i = 0; i < capacity; i++) {
+    if (entries[i].used && entries[i].policy_id_len == policy_id_len &&
+        strncasecmp(entries[i].key, policy_id, policy_id_len) == 0) {
+      remove_entry(&entries[i]);
+      invalidations++;
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+void access_cache_attributes_changed(void) {
+  pthread_mutex_lock(&cache_lock);
+  attribute_version++;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+void access_cache_set_lifetime(access_cache_lifetime_cb lifetime) {
+  pthread_mutex_lock(&cache_lock);
+  lifetime_cb = lifetime;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+void access_cache_get_stats(access_cache_stats_t *stats) {
+  pthread_mutex_lock(&cache_lock);
+  stats->hits = hits;
+  stats->misses = misses;
+  stats->evictions = evictions;
+  stats->invalidations = invalidations;
+  stats->attribute_version = attribute_version;
+  stats->entries = count;
+  stats->capacity = capacity;
+  pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,129 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_cache.h
+ * \brief
+ * Cache of PDP decisions
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Entries are keyed by (policy_id, requester, action) and tagged with the
+ * attribute snapshot version they were computed under. Any attribute change
+ * bumps the version, so older entries miss from then on; storing or deleting
+ * a policy drops the entries of that policy. The cache holds a fixed number
+ * of entries and evicts the least recently used one. All functions are
+ * thread safe.
+ *
+ * \history
+ * 26.10.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _ACCESS_CACHE_H_
+#define _ACCESS_CACHE_H_
+
+#include "pdp.h"
+
+#define ACCESS_CACHE_KEY_LEN 192
+
+#define ACCESS_CACHE_HIT 0
+#define ACCESS_CACHE_MISS -1
+
+typedef struct {
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long evictions;
+  unsigned long long invalidations;
+  unsigned long long attribute_version;
+  int entries;
+  int capacity;
+} access_cache_stats_t;
+
+/**
+ * @brief Lifetime of the decisions of a policy
+ *
+ * @return Lifetime in milliseconds, or -1 for the cache's TTL
+ */
+typedef int (*access_cache_lifetime_cb)(const char *policy_id, int policy_id_len);
+
+/**
+ * @brief Allocate the cache
+ *
+ * @param capacity Maximum number of entries, 0 disables the cache
+ * @param ttl_ms Lifetime of an entry, bounds how long a decision depending on time can be served
+ * @return 0 on success, -1 if the entries could not be allocated
+ */
+int access_cache_init(int capacity, int ttl_ms);
+
+/**
+ * @brief Release the cache
+ */
+void access_cache_term(void);
+
+/**
+ * @brief Look a decision up
+ *
+ * Strings are not terminated; requester and action may be NULL.
+ *
+ * @return ACCESS_CACHE_HIT with decision filled in, or ACCESS_CACHE_MISS
+ */
+int access_cache_lookup(const char *policy_id, int policy_id_len, const char *requester, int requester_len,
+                        const char *action, int action_len, pdp_decision_e *decision);
+
+/**
+ * @brief Store a decision computed under the given attribute version
+ *
+ * The version must be read with access_cache_attribute_version() before the
+ * decision is computed, so a change racing with the evaluation is not lost.
+ */
+void access_cache_store(const char *policy_id, int policy_id_len, const char *requester, int requester_len,
+                        const char *action, int action_len, unsigned long long attribute_version,
+                        pdp_decision_e decision);
+
+/**
+ * @brief Current attribute snapshot version
+ */
+unsigned long long access_cache_attribute_version(void);
+
+/**
+ * @brief Drop all entries of a policy
+ */
+void access_cache_invalidate_policy(const char *policy_id, int policy_id_len);
+
+/**
+ * @brief Start a new attribute snapshot, entries of older ones no longer hit
+ */
+void access_cache_attributes_changed(void);
+
+/**
+ * @brief Set the function extending the lifetime of decisions beyond the TTL, NULL for none
+ *
+ * A policy whose decisions cannot change before a known instant, unless an attribute changes
+ * first, may keep them until then. The function is called without the cache locked.
+ */
+void access_cache_set_lifetime(access_cache_lifetime_cb lifetime);
+
+/**
+ * @brief Copy the counters of the cache
+ */
+void access_cache_get_stats(access_cache_stats_t *stats);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_flight.c
+ * \brief
+ * Implementation of the evaluation coalescing
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 30.11.2020. Initial version.
+ ****************************************************************************/
+
+#include "access_flight.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct access_flight {
+  char key[ACCESS_FLIGHT_KEY_LEN];
+  int key_len;
+  int done;
+  int result;
+  // Leader and followers still holding the flight
+  int refs;
+  pthread_cond_t landed;
+  access_flight_t *next;
+};
+
+static pthread_mutex_t flight_lock = PTHREAD_MUTEX_INITIALIZER;
+// Only evaluations in progress are listed, and few of them overlap
+static access_flight_t *flights;
+static int in_flight;
+static unsigned long long evaluations;
+static unsigned long long saved;
+
+static void flight_release(access_flight_t *flight) {
+  if (--flight->refs == 0) {
+    pthread_cond_destroy(&flight->landed);
+    free(flight);
+  }
+}
+
+int access_flight_begin(const char *key, int key_len, access_flight_t **flight, int *result) {
+  access_flight_t *found;
+
+  if (key_len <= 0 || key_len > ACCESS_FLIGHT_KEY_LEN) {
+    return ACCESS_FLIGHT_ERROR;
+  }
+
+  pthread_mutex_lock(&flight_lock);
+  for (found = flights; found != NULL; found = found->next) {
+    if (found->key_len == key_len && memcmp(found->key, key, key_len) == 0) {
+      break;
+    }
+  }
+
+  if (found != NULL) {
+    found->refs++;
+    saved++;
+    while (!found->done) {
+      pthread_cond_wait(&found->landed, &flight_lock);
+    }
+    *result = found->result;
+    flight_release(found);
+    pthread_mutex_unlock(&flight_lock);
+    return ACCESS_FLIGHT_FOLLOWER;
+  }
+
+  found = calloc(1, sizeof(access_flight_t));
+  if (found == NULL) {
+    pthread_mutex_unlock(&flight_lock);
+    return ACCESS_FLIGHT_ERROR;
+  }
+  memcpy(found->key, key, key_len);
+  found->key_len = key_len;
+  found->refs = 1;
+  pthread_cond_init(&found->landed, NULL);
+  found->next = flights;
+  flights = found;
+  in_flight++;
+  pthread_mutex_unlock(&flight_lock);
+
+  *flight = found;
+  return ACCESS_FLIGHT_LEADER;
+}
+
+void access_flight_end(access_flight_t *flight, int result) {
+  pthread_mutex_lock(&flight_lock);
+  access_flight_t **link = &flights;
+  while (*link != flight) {
+    link = &(*link)->next;
+  }
+  // Callers from now on evaluate again
+  *link = flight->next;
+  in_flight--;
+  evaluations++;
+
+  flight->result = result;
+  flight->done = 1;
+  pthread_cond_broadcast(&flight->landed);
+  flight_release(flight);
+  pthread_mutex_unlock(&flight_lock);
+}
+
+void access_flight_get_stats(access_flight_stats_t *stats) {
+  pthread_mutex_lock(&flight_lock);
+  stats->evaluations = evaluations;
+  stats->saved = saved;
+  stats->in_flight = in_flight;
+  pthread_mutex_unlock(&flight_lock);
+}
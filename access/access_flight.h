@@ -0,0 +1,77 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_flight.h
+ * \brief
+ * Coalescing of identical evaluations in progress
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * The first caller asking for a key becomes the leader and computes the
+ * result; callers asking for the same key before the leader is done wait for
+ * it and receive the leader's result instead of computing their own. Once
+ * the leader is done the key is free again, so results are never reused
+ * after the fact. All functions are thread safe.
+ *
+ * \history
+ * 30.11.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _ACCESS_FLIGHT_H_
+#define _ACCESS_FLIGHT_H_
+
+#define ACCESS_FLIGHT_KEY_LEN 192
+
+#define ACCESS_FLIGHT_LEADER 0
+#define ACCESS_FLIGHT_FOLLOWER 1
+#define ACCESS_FLIGHT_ERROR -1
+
+typedef struct access_flight access_flight_t;
+
+typedef struct {
+  // Results computed by a leader
+  unsigned long long evaluations;
+  // Results a follower received instead of computing them
+  unsigned long long saved;
+  int in_flight;
+} access_flight_stats_t;
+
+/**
+ * @brief Join the evaluation of a key
+ *
+ * @param key Key, not terminated
+ * @param key_len Length of the key, at most ACCESS_FLIGHT_KEY_LEN
+ * @param flight Evaluation the leader has to end with access_flight_end
+ * @param result Leader's result, for a follower
+ * @return ACCESS_FLIGHT_LEADER, ACCESS_FLIGHT_FOLLOWER, or ACCESS_FLIGHT_ERROR
+ * if the caller has to evaluate on its own
+ */
+int access_flight_begin(const char *key, int key_len, access_flight_t **flight, int *result);
+
+/**
+ * @brief End an evaluation, handing its result to the followers
+ */
+void access_flight_end(access_flight_t *flight, int result);
+
+void access_flight_get_stats(access_flight_stats_t *stats);
+
+#endif
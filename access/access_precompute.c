@@ -0,0 +1,374 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_precompute.c
+ * \brief
+ * Implementation of the background policy evaluation
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 07.12.2020. Initial version.
+ ****************************************************************************/
+
+#include "access_precompute.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "access_cache.h"
+
+#define ACCESS_PRECOMPUTE_POLICIES_MAX 32
+#define ACCESS_PRECOMPUTE_ID_LEN 128
+#define ACCESS_PRECOMPUTE_ACTIONS_MAX 4
+#define ACCESS_PRECOMPUTE_ACTION_LEN 64
+#define ACCESS_PRECOMPUTE_ACTION_ATTRIBUTE "request.action.value"
+// Refreshes after which a policy is evaluated although no attribute change was
+// reported, bounding the age of attributes from plugins that report none
+#define ACCESS_PRECOMPUTE_REVALIDATE_REFRESHES 20
+
+typedef struct {
+  int used;
+  // Set on a change of a watched attribute, the policy is evaluated again
+  int dirty;
+  // Set by the periodic refresh, which keeps the last decisions cached if no attribute changed
+  int refresh;
+  int refreshes;
+  char policy_id[ACCESS_PRECOMPUTE_ID_LEN];
+  int policy_id_len;
+  // Attribute types the circuit reads, terminated
+  char watched[POLICY_CIRCUIT_SLOTS_MAX][POLICY_CIRCUIT_VALUE_LEN];
+  int watched_num;
+  // Actions the circuit compares the requested action with
+  char actions[ACCESS_PRECOMPUTE_ACTIONS_MAX][ACCESS_PRECOMPUTE_ACTION_LEN];
+  int action_lens[ACCESS_PRECOMPUTE_ACTIONS_MAX];
+  int actions_num;
+  int reads_action;
+  // Decisions of the last evaluation, for the actions and for a request without one
+  int evaluated;
+  unsigned long long version;
+  pdp_decision_e decisions[ACCESS_PRECOMPUTE_ACTIONS_MAX];
+  pdp_decision_e decision;
+} access_precompute_policy_t;
+
+static pthread_mutex_t precompute_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t precompute_cond;
+static pthread_t thread;
+static int running;
+static int stopping;
+static int refresh_period_ms;
+static access_precompute_evaluate_cb evaluate_cb;
+static access_precompute_policy_t policies[ACCESS_PRECOMPUTE_POLICIES_MAX];
+static unsigned long long evaluations;
+
+static int slot_is_action(const policy_circuit_t *circuit, int slot) {
+  return circuit->slot_lens[slot] == strlen(ACCESS_PRECOMPUTE_ACTION_ATTRIBUTE) &&
+         memcmp(circuit->strings + circuit->slot_offsets[slot], ACCESS_PRECOMPUTE_ACTION_ATTRIBUTE,
+                circuit->slot_lens[slot]) == 0;
+}
+
+static void add_action(access_precompute_policy_t *policy, const char *action, int action_len) {
+  if (policy->actions_num == ACCESS_PRECOMPUTE_ACTIONS_MAX || action_len >= ACCESS_PRECOMPUTE_ACTION_LEN) {
+    return;
+  }
+  for (int i = 0; i < policy->actions_num; i++) {
+    if (policy->action_lens[i] == action_len && memcmp(policy->actions[i], action, action_len) == 0) {
+      return;
+    }
+  }
+  memcpy(policy->actions[policy->actions_num], action, action_len);
+  policy->action_lens[policy->actions_num++] = action_len;
+}
+
+static void analyze(access_precompute_policy_t *policy, const policy_circuit_t *circuit) {
+  policy->watched_num = 0;
+  policy->actions_num = 0;
+  policy->reads_action = 0;
+
+  for (int i = 0; i < circuit->slots_num; i++) {
+    if (slot_is_action(circuit, i)) {
+      policy->reads_action = 1;
+    } else if (circuit->slot_lens[i] < POLICY_CIRCUIT_VALUE_LEN) {
+      memcpy(policy->watched[policy->watched_num], circuit->strings + circuit->slot_offsets[i], circuit->slot_lens[i]);
+      policy->watched[policy->watched_num++][circuit->slot_lens[i]] = '\0';
+    }
+  }
+
+  // Actions the policy is about are the constants the action is tested for equality with
+  for (int i = 0; i < circuit->gates_num; i++) {
+    const policy_gate_t *gate = &circuit->gates[i];
+    if (gate->op != POLICY_GATE_EQ) {
+      continue;
+    }
+    const policy_term_t *lhs = &circuit->terms[gate->a];
+    const policy_term_t *rhs = &circuit->terms[gate->b];
+    if (lhs->slot >= 0 && rhs->slot < 0 && slot_is_action(circuit, lhs->slot)) {
+      add_action(policy, circuit->strings + rhs->offset, rhs->len);
+    } else if (rhs->slot >= 0 && lhs->slot < 0 && slot_is_action(circuit, rhs->slot)) {
+      add_action(policy, circuit->strings + lhs->offset, lhs->len);
+    }
+  }
+}
+
+static int has_error(const access_precompute_policy_t *policy) {
+  if (!policy->reads_action) {
+    return policy->decision == PDP_ERROR;
+  }
+  for (int i = 0; i < policy->actions_num; i++) {
+    if (policy->decisions[i] == PDP_ERROR) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void store(const access_precompute_policy_t *policy) {
+  if (!policy->reads_action) {
+    access_cache_store(policy->policy_id, policy->policy_id_len, NULL, 0, NULL, 0, policy->version, policy->decision);
+    return;
+  }
+
+  for (int i = 0; i < policy->actions_num; i++) {
+    access_cache_store(policy->policy_id, policy->policy_id_len, NULL, 0, policy->actions[i], policy->action_lens[i],
+                       policy->version, policy->decisions[i]);
+    // A resolve names no action, it asks about the one the policy is for
+    if (policy->actions_num == 1) {
+      access_cache_store(policy->policy_id, policy->policy_id_len, NULL, 0, NULL, 0, policy->version,
+                         policy->decisions[i]);
+    }
+  }
+}
+
+// Returns 1 if the policy was evaluated, 0 if its last decisions were stored again
+static int precompute(access_precompute_policy_t *policy, int refresh) {
+  // Read before evaluating, so a change during the evaluation rejects the stale decision
+  unsigned long long version = access_cache_attribute_version();
+
+  // Without a change since the last evaluation the attributes would be fetched only to give the same decisions
+  if (refresh && policy->evaluated && policy->version == version && !has_error(policy) &&
+      ++policy->refreshes < ACCESS_PRECOMPUTE_REVALIDATE_REFRESHES) {
+    store(policy);
+    return 0;
+  }
+
+  policy->version = version;
+  policy->refreshes = 0;
+  if (!policy->reads_action) {
+    policy->decision = evaluate_cb(policy->policy_id, policy->policy_id_len, NULL, 0);
+  }
+  for (int i = 0; i < policy->actions_num && policy->reads_action; i++) {
+    policy->decisions[i] =
+        evaluate_cb(policy->policy_id, policy->policy_id_len, policy->actions[i], policy->action_lens[i]);
+  }
+  policy->evaluated = 1;
+  store(policy);
+  return 1;
+}
+
+static void *precompute_function(void *arg) {
+  access_precompute_policy_t work;
+
+  pthread_mutex_lock(&precompute_lock);
+  while (!stopping) {
+    int found = -1;
+    for (int i = 0; i < ACCESS_PRECOMPUTE_POLICIES_MAX && found < 0; i++) {
+      if (policies[i].used && (policies[i].dirty || policies[i].refresh)) {
+        found = i;
+      }
+    }
+
+    if (found < 0) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      deadline.tv_sec += refresh_period_ms / 1000;
+      deadline.tv_nsec += (refresh_period_ms % 1000) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      if (pthread_cond_timedwait(&precompute_cond, &precompute_lock, &deadline) != 0) {
+        // Refresh everything before the cached decisions expire
+        for (int i = 0; i < ACCESS_PRECOMPUTE_POLICIES_MAX; i++) {
+          policies[i].refresh = policies[i].used;
+        }
+      }
+      continue;
+    }
+
+    // Evaluated from a copy, the subscription may change meanwhile
+    int refresh = !policies[found].dirty;
+    policies[found].dirty = 0;
+    policies[found].refresh = 0;
+    work = policies[found];
+    pthread_mutex_unlock(&precompute_lock);
+    int evaluated = precompute(&work, refresh);
+    pthread_mutex_lock(&precompute_lock);
+    // Decisions are kept unless the policy was subscribed again meanwhile, which evaluates it anyway
+    if (policies[found].used && !policies[found].dirty && policies[found].policy_id_len == work.policy_id_len &&
+        memcmp(policies[found].policy_id, work.policy_id, work.policy_id_len) == 0) {
+      policies[found].evaluated = work.evaluated;
+      policies[found].version = work.version;
+      policies[found].refreshes = work.refreshes;
+      policies[found].decision = work.decision;
+      memcpy(policies[found].decisions, work.decisions, sizeof(work.decisions));
+    }
+    evaluations += evaluated;
+  }
+  pthread_mutex_unlock(&precompute_lock);
+
+  return NULL;
+}
+
+int access_precompute_init(int refresh_ms, access_precompute_evaluate_cb evaluate) {
+  pthread_condattr_t attr;
+
+  access_precompute_term();
+  if (refresh_ms <= 0 || evaluate == NULL) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&precompute_lock);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&precompute_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  refresh_period_ms = refresh_ms;
+  evaluate_cb = evaluate;
+  stopping = 0;
+  running = pthread_create(&thread, NULL, precompute_function, NULL) == 0;
+  if (!running) {
+    pthread_cond_destroy(&precompute_cond);
+  }
+  pthread_mutex_unlock(&precompute_lock);
+
+  return running ? 0 : -1;
+}
+
+void access_precompute_term(void) {
+  pthread_mutex_lock(&precompute_lock);
+  int was_running = running;
+  stopping = 1;
+  running = 0;
+  if (was_running) {
+    pthread_cond_signal(&precompute_cond);
+  }
+  pthread_mutex_unlock(&precompute_lock);
+
+  if (was_running) {
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&precompute_cond);
+  }
+
+  pthread_mutex_lock(&precompute_lock);
+  memset(policies, 0, sizeof(policies));
+  pthread_mutex_unlock(&precompute_lock);
+}
+
+static access_precompute_policy_t *find_policy(const char *policy_id, int policy_id_len) {
+  for (int i = 0; i < ACCESS_PRECOMPUTE_POLICIES_MAX; i++) {
+    if (policies[i].used && policies[i].policy_id_len == policy_id_len &&
+        strncasecmp(policies[i].policy_id, policy_id, policy_id_len) == 0) {
+      return &policies[i];
+    }
+  }
+  return NULL;
+}
+
+void access_precompute_subscribe(const char *policy_id, int policy_id_len, const policy_circuit_t *circuit) {
+  if (policy_id_len >= ACCESS_PRECOMPUTE_ID_LEN) {
+    return;
+  }
+
+  pthread_mutex_lock(&precompute_lock);
+  if (!running) {
+    pthread_mutex_unlock(&precompute_lock);
+    return;
+  }
+
+  access_precompute_policy_t *policy = find_policy(policy_id, policy_id_len);
+  for (int i = 0; i < ACCESS_PRECOMPUTE_POLICIES_MAX && policy == NULL; i++) {
+    if (!policies[i].used) {
+      policy = &policies[i];
+    }
+  }
+  if (policy != NULL) {
+    memcpy(policy->policy_id, policy_id, policy_id_len);
+    policy->policy_id_len = policy_id_len;
+    analyze(policy, circuit);
+    policy->evaluated = 0;
+    policy->used = 1;
+    policy->dirty = 1;
+    pthread_cond_signal(&precompute_cond);
+  }
+  pthread_mutex_unlock(&precompute_lock);
+}
+
+void access_precompute_unsubscribe(const char *policy_id, int policy_id_len) {
+  pthread_mutex_lock(&precompute_lock);
+  access_precompute_policy_t *policy = find_policy(policy_id, policy_id_len);
+  if (policy != NULL) {
+    policy->used = 0;
+    policy->dirty = 0;
+    policy->refresh = 0;
+  }
+  pthread_mutex_unlock(&precompute_lock);
+}
+
+void access_precompute_signal(const char *signal) {
+  int woken = 0;
+
+  pthread_mutex_lock(&precompute_lock);
+  for (int i = 0; i < ACCESS_PRECOMPUTE_POLICIES_MAX && running; i++) {
+    if (!policies[i].used) {
+      continue;
+    }
+    for (int k = 0; k < policies[i].watched_num; k++) {
+      if (signal == NULL || strstr(policies[i].watched[k], signal) != NULL) {
+        policies[i].dirty = 1;
+        woken = 1;
+        break;
+      }
+    }
+    if (signal == NULL) {
+      policies[i].dirty = 1;
+      woken = 1;
+    }
+  }
+  if (woken) {
+    pthread_cond_signal(&precompute_cond);
+  }
+  pthread_mutex_unlock(&precompute_lock);
+}
+
+void access_precompute_get_stats(access_precompute_stats_t *stats) {
+  pthread_mutex_lock(&precompute_lock);
+  stats->subscriptions = 0;
+  for (int i = 0; i < ACCESS_PRECOMPUTE_POLICIES_MAX; i++) {
+    stats->subscriptions += policies[i].used;
+  }
+  stats->evaluations = evaluations;
+  pthread_mutex_unlock(&precompute_lock);
+}
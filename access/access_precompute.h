@@ -0,0 +1,92 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_precompute.h
+ * \brief
+ * Background evaluation of subscribed policies
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * A policy compiled with "precompute":true is subscribed to the attributes
+ * its circuit reads. When a PIP plugin signals that one of them changed, a
+ * background thread evaluates the policy again and stores the decision in
+ * the decision cache, for every action the policy compares the requested
+ * action with. All subscriptions are also refreshed periodically, so their
+ * decisions stay in the cache although cache entries expire. A refresh
+ * stores the last decisions again unless an attribute changed since the
+ * policy was evaluated, or the policy has gone through many refreshes
+ * without a change reported.
+ *
+ * \history
+ * 07.12.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _ACCESS_PRECOMPUTE_H_
+#define _ACCESS_PRECOMPUTE_H_
+
+#include "pdp.h"
+#include "policy_circuit.h"
+
+typedef struct {
+  int subscriptions;
+  unsigned long long evaluations;
+} access_precompute_stats_t;
+
+/**
+ * @brief Evaluate a policy for an action
+ *
+ * @param action Requested action, NULL for a request without one
+ */
+typedef pdp_decision_e (*access_precompute_evaluate_cb)(const char *policy_id, int policy_id_len, const char *action,
+                                                        int action_len);
+
+/**
+ * @brief Start the background thread
+ *
+ * @param refresh_ms Period of the refresh of all subscriptions, 0 disables precomputation
+ * @param evaluate Function evaluating a policy
+ * @return 0 on success, -1 if the thread could not be started
+ */
+int access_precompute_init(int refresh_ms, access_precompute_evaluate_cb evaluate);
+
+/**
+ * @brief Stop the background thread and drop all subscriptions
+ */
+void access_precompute_term(void);
+
+/**
+ * @brief Subscribe a policy to the attributes of its circuit, replacing an earlier subscription
+ */
+void access_precompute_subscribe(const char *policy_id, int policy_id_len, const policy_circuit_t *circuit);
+
+void access_precompute_unsubscribe(const char *policy_id, int policy_id_len);
+
+/**
+ * @brief Evaluate the policies watching a signal again
+ *
+ * @param signal Name contained in the attribute types of the watching policies, NULL for all policies
+ */
+void access_precompute_signal(const char *signal);
+
+void access_precompute_get_stats(access_precompute_stats_t *stats);
+
+#endif
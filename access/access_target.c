@@ -0,0 +1,461 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_target.c
+ * \brief
+ * Implementation of the target index
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 21.12.2020. Initial version.
+ ****************************************************************************/
+
+#include "access_target.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define ACCESS_TARGET_DIMENSIONS 3
+#define ACCESS_TARGET_VALUES_MAX 4
+#define ACCESS_TARGET_VALUE_LEN 64
+#define ACCESS_TARGET_BUCKETS 256
+
+static const char *const dimension_attributes[ACCESS_TARGET_DIMENSIONS] = {
+    ACCESS_TARGET_SUBJECT_ATTRIBUTE, ACCESS_TARGET_ACTION_ATTRIBUTE, ACCESS_TARGET_OBJECT_ATTRIBUTE};
+
+typedef struct {
+  int used;
+  char policy_id[ACCESS_TARGET_ID_LEN];
+  int policy_id_len;
+  // Per dimension, the policy applies to any value or to one of values only
+  int any[ACCESS_TARGET_DIMENSIONS];
+  char values[ACCESS_TARGET_DIMENSIONS][ACCESS_TARGET_VALUES_MAX][ACCESS_TARGET_VALUE_LEN];
+  int value_lens[ACCESS_TARGET_DIMENSIONS][ACCESS_TARGET_VALUES_MAX];
+  int values_num[ACCESS_TARGET_DIMENSIONS];
+} access_target_policy_t;
+
+// Policies applying to one value of a dimension, or to any value if the value is empty
+typedef struct access_target_posting access_target_posting_t;
+struct access_target_posting {
+  int dimension;
+  char value[ACCESS_TARGET_VALUE_LEN];
+  int value_len;
+  int *policies;
+  int policies_num;
+  int policies_cap;
+  access_target_posting_t *next;
+};
+
+// Constant terms bounding a slot, without duplicates
+typedef struct {
+  int terms[ACCESS_TARGET_VALUES_MAX];
+  int terms_num;
+} access_target_set_t;
+
+static pthread_rwlock_t target_lock = PTHREAD_RWLOCK_INITIALIZER;
+static access_target_posting_t *postings[ACCESS_TARGET_BUCKETS];
+static int postings_num;
+static access_target_policy_t *policies;
+static int policies_num;
+static int policies_cap;
+static int indexed;
+static unsigned long long lookups;
+static unsigned long long candidates;
+
+static int find_slot(const policy_circuit_t *circuit, const char *type) {
+  for (int i = 0; i < circuit->slots_num; i++) {
+    if (circuit->slot_lens[i] == strlen(type) &&
+        memcmp(circuit->strings + circuit->slot_offsets[i], type, circuit->slot_lens[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int set_add(const policy_circuit_t *circuit, access_target_set_t *set, int term) {
+  const policy_term_t *added = &circuit->terms[term];
+
+  for (int i = 0; i < set->terms_num; i++) {
+    const policy_term_t *present = &circuit->terms[set->terms[i]];
+    if (present->len == added->len &&
+        memcmp(circuit->strings + present->offset, circuit->strings + added->offset, added->len) == 0) {
+      return 0;
+    }
+  }
+  if (set->terms_num == ACCESS_TARGET_VALUES_MAX) {
+    return -1;
+  }
+  set->terms[set->terms_num++] = term;
+  return 0;
+}
+
+// 1 if the gate can only hold while the slot equals one of the constants in set, 0 if it may hold for any value
+static int gate_bound(const policy_circuit_t *circuit, int gate_index, int slot, access_target_set_t *set) {
+  const policy_gate_t *gate = &circuit->gates[gate_index];
+  access_target_set_t operand;
+  int bounded = 0;
+
+  switch (gate->op) {
+    case POLICY_GATE_FALSE:
+      set->terms_num = 0;
+      return 1;
+    case POLICY_GATE_EQ:
+      // Numbers are equal in more than one spelling, only strings bound the slot
+      set->terms_num = 0;
+      if (circuit->terms[gate->a].slot == slot && circuit->terms[gate->b].slot < 0 &&
+          !circuit->terms[gate->b].is_number) {
+        return set_add(circuit, set, gate->b) == 0;
+      } else if (circuit->terms[gate->b].slot == slot && circuit->terms[gate->a].slot < 0 &&
+                 !circuit->terms[gate->a].is_number) {
+        return set_add(circuit, set, gate->a) == 0;
+      }
+      return 0;
+    case POLICY_GATE_AND:
+      // Every operand has to hold, so the tightest bound of any of them bounds the gate
+      for (int k = gate->a; k < gate->a + gate->b; k++) {
+        if (gate_bound(circuit, circuit->operands[k], slot, &operand) &&
+            (!bounded || operand.terms_num < set->terms_num)) {
+          *set = operand;
+          bounded = 1;
+        }
+      }
+      return bounded;
+    case POLICY_GATE_OR:
+      // One operand holding is enough, so all of them must be bounded
+      set->terms_num = 0;
+      for (int k = gate->a; k < gate->a + gate->b; k++) {
+        if (!gate_bound(circuit, circuit->operands[k], slot, &operand)) {
+          return 0;
+        }
+        for (int i = 0; i < operand.terms_num; i++) {
+          if (set_add(circuit, set, operand.terms[i]) != 0) {
+            return 0;
+          }
+        }
+      }
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void analyze_dimension(access_target_policy_t *policy, int dimension, const policy_circuit_t *circuit) {
+  access_target_set_t bound = {{0}, 0};
+  access_target_set_t root_bound;
+  int roots[2] = {circuit->goc, circuit->doc};
+  int slot = find_slot(circuit, dimension_attributes[dimension]);
+
+  policy->any[dimension] = 1;
+  policy->values_num[dimension] = 0;
+  if (slot < 0) {
+    return;
+  }
+
+  // A condition that is missing never holds and bounds nothing
+  for (int i = 0; i < 2; i++) {
+    if (roots[i] < 0) {
+      continue;
+    }
+    if (!gate_bound(circuit, roots[i], slot, &root_bound)) {
+      return;
+    }
+    for (int k = 0; k < root_bound.terms_num; k++) {
+      if (set_add(circuit, &bound, root_bound.terms[k]) != 0) {
+        return;
+      }
+    }
+  }
+
+  for (int i = 0; i < bound.terms_num; i++) {
+    const policy_term_t *term = &circuit->terms[bound.terms[i]];
+    if (term->len == 0 || term->len >= ACCESS_TARGET_VALUE_LEN) {
+      return;
+    }
+  }
+  for (int i = 0; i < bound.terms_num; i++) {
+    const policy_term_t *term = &circuit->terms[bound.terms[i]];
+    memcpy(policy->values[dimension][i], circuit->strings + term->offset, term->len);
+    policy->value_lens[dimension][i] = term->len;
+  }
+  policy->values_num[dimension] = bound.terms_num;
+  policy->any[dimension] = 0;
+}
+
+static unsigned int posting_bucket(int dimension, const char *value, int value_len) {
+  unsigned int hash = 2166136261u ^ (unsigned int)dimension;
+  for (int i = 0; i < value_len; i++) {
+    hash = (hash ^ (unsigned char)value[i]) * 16777619u;
+  }
+  return hash % ACCESS_TARGET_BUCKETS;
+}
+
+static access_target_posting_t **posting_find(int dimension, const char *value, int value_len) {
+  access_target_posting_t **link = &postings[posting_bucket(dimension, value, value_len)];
+  while (*link != NULL && ((*link)->dimension != dimension || (*link)->value_len != value_len ||
+                           memcmp((*link)->value, value, value_len) != 0)) {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+static int posting_add(int dimension, const char *value, int value_len, int policy) {
+  access_target_posting_t **link = posting_find(dimension, value, value_len);
+  access_target_posting_t *posting = *link;
+
+  if (posting == NULL) {
+    posting = calloc(1, sizeof(access_target_posting_t));
+    if (posting == NULL) {
+      return -1;
+    }
+    posting->dimension = dimension;
+    memcpy(posting->value, value, value_len);
+    posting->value_len = value_len;
+    *link = posting;
+    postings_num++;
+  }
+
+  if (posting->policies_num == posting->policies_cap) {
+    int cap = posting->policies_cap > 0 ? posting->policies_cap * 2 : 4;
+    int *grown = realloc(posting->policies, cap * sizeof(int));
+    if (grown == NULL) {
+      return -1;
+    }
+    posting->policies = grown;
+    posting->policies_cap = cap;
+  }
+  posting->policies[posting->policies_num++] = policy;
+  return 0;
+}
+
+static void posting_remove(int dimension, const char *value, int value_len, int policy) {
+  access_target_posting_t **link = posting_find(dimension, value, value_len);
+  access_target_posting_t *posting = *link;
+
+  if (posting == NULL) {
+    return;
+  }
+  for (int i = 0; i < posting->policies_num; i++) {
+    if (posting->policies[i] == policy) {
+      posting->policies[i] = posting->policies[--posting->policies_num];
+      break;
+    }
+  }
+  if (posting->policies_num == 0) {
+    *link = posting->next;
+    free(posting->policies);
+    free(posting);
+    postings_num--;
+  }
+}
+
+static void policy_unindex(int index) {
+  access_target_policy_t *policy = &policies[index];
+
+  for (int d = 0; d < ACCESS_TARGET_DIMENSIONS; d++) {
+    if (policy->any[d]) {
+      posting_remove(d, "", 0, index);
+    }
+    for (int i = 0; i < policy->values_num[d]; i++) {
+      posting_remove(d, policy->values[d][i], policy->value_lens[d][i], index);
+    }
+  }
+  policy->used = 0;
+  indexed--;
+}
+
+static int policy_index(int index) {
+  access_target_policy_t *policy = &policies[index];
+  int ret = 0;
+
+  policy->used = 1;
+  indexed++;
+  for (int d = 0; d < ACCESS_TARGET_DIMENSIONS; d++) {
+    if (policy->any[d]) {
+      ret |= posting_add(d, "", 0, index);
+    }
+    for (int i = 0; i < policy->values_num[d]; i++) {
+      ret |= posting_add(d, policy->values[d][i], policy->value_lens[d][i], index);
+    }
+  }
+  if (ret != 0) {
+    policy_unindex(index);
+  }
+  return ret;
+}
+
+static int policy_find(const char *policy_id, int policy_id_len) {
+  // Policy writes are rare, lookups by target go through the postings
+  for (int i = 0; i < policies_num; i++) {
+    if (policies[i].used && policies[i].policy_id_len == policy_id_len &&
+        strncasecmp(policies[i].policy_id, policy_id, policy_id_len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int access_target_add(const char *policy_id, int policy_id_len, const policy_circuit_t *circuit) {
+  access_target_policy_t analyzed;
+  int ret;
+
+  if (policy_id_len <= 0 || policy_id_len >= ACCESS_TARGET_ID_LEN) {
+    return -1;
+  }
+
+  memset(&analyzed, 0, sizeof(analyzed));
+  memcpy(analyzed.policy_id, policy_id, policy_id_len);
+  analyzed.policy_id_len = policy_id_len;
+  for (int d = 0; d < ACCESS_TARGET_DIMENSIONS; d++) {
+    analyze_dimension(&analyzed, d, circuit);
+  }
+
+  pthread_rwlock_wrlock(&target_lock);
+  int index = policy_find(policy_id, policy_id_len);
+  if (index >= 0) {
+    policy_unindex(index);
+  } else {
+    for (index = 0; index < policies_num && policies[index].used; index++) {
+    }
+    if (index == policies_num && policies_num == policies_cap) {
+      int cap = policies_cap > 0 ? policies_cap * 2 : 16;
+      access_target_policy_t *grown = realloc(policies, cap * sizeof(access_target_policy_t));
+      if (grown == NULL) {
+        pthread_rwlock_unlock(&target_lock);
+        return -1;
+      }
+      policies = grown;
+      policies_cap = cap;
+    }
+    if (index == policies_num) {
+      policies_num++;
+    }
+  }
+  policies[index] = analyzed;
+  ret = policy_index(index);
+  pthread_rwlock_unlock(&target_lock);
+
+  return ret;
+}
+
+void access_target_remove(const char *policy_id, int policy_id_len) {
+  pthread_rwlock_wrlock(&target_lock);
+  int index = policy_find(policy_id, policy_id_len);
+  if (index >= 0) {
+    policy_unindex(index);
+  }
+  pthread_rwlock_unlock(&target_lock);
+}
+
+void access_target_clear(void) {
+  pthread_rwlock_wrlock(&target_lock);
+  for (int i = 0; i < ACCESS_TARGET_BUCKETS; i++) {
+    while (postings[i] != NULL) {
+      access_target_posting_t *posting = postings[i];
+      postings[i] = posting->next;
+      free(posting->policies);
+      free(posting);
+    }
+  }
+  free(policies);
+  policies = NULL;
+  policies_num = 0;
+  policies_cap = 0;
+  postings_num = 0;
+  indexed = 0;
+  pthread_rwlock_unlock(&target_lock);
+}
+
+static int policy_matches(const access_target_policy_t *policy, int dimension, const char *value, int value_len) {
+  if (policy->any[dimension]) {
+    return 1;
+  }
+  for (int i = 0; i < policy->values_num[dimension]; i++) {
+    if (policy->value_lens[dimension][i] == value_len && memcmp(policy->values[dimension][i], value, value_len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int access_target_find(const char *subject, int subject_len, const char *action, int action_len, const char *object,
+                       int object_len, char policy_ids[][ACCESS_TARGET_ID_LEN], int candidates_max) {
+  const char *values[ACCESS_TARGET_DIMENSIONS] = {subject, action, object};
+  int value_lens[ACCESS_TARGET_DIMENSIONS] = {subject_len, action_len, object_len};
+  access_target_posting_t *lists[ACCESS_TARGET_DIMENSIONS][2];
+  int best = 0;
+  int best_size = -1;
+  int found = 0;
+
+  pthread_rwlock_rdlock(&target_lock);
+  // Only the shortest pair of lists is walked, the other dimensions are checked per policy
+  for (int d = 0; d < ACCESS_TARGET_DIMENSIONS; d++) {
+    if (values[d] == NULL || value_lens[d] < 0) {
+      value_lens[d] = 0;
+    }
+    lists[d][0] = value_lens[d] > 0 ? *posting_find(d, values[d], value_lens[d]) : NULL;
+    lists[d][1] = *posting_find(d, "", 0);
+    int size = (lists[d][0] != NULL ? lists[d][0]->policies_num : 0) +
+               (lists[d][1] != NULL ? lists[d][1]->policies_num : 0);
+    if (best_size < 0 || size < best_size) {
+      best = d;
+      best_size = size;
+    }
+  }
+
+  for (int l = 0; l < 2; l++) {
+    access_target_posting_t *posting = lists[best][l];
+    for (int i = 0; posting != NULL && i < posting->policies_num; i++) {
+      access_target_policy_t *policy = &policies[posting->policies[i]];
+      int matches = 1;
+      for (int d = 0; d < ACCESS_TARGET_DIMENSIONS && matches; d++) {
+        matches = d == best || policy_matches(policy, d, values[d], value_lens[d]);
+      }
+      if (!matches) {
+        continue;
+      }
+      if (found < candidates_max) {
+        memcpy(policy_ids[found], policy->policy_id, policy->policy_id_len);
+        policy_ids[found][policy->policy_id_len] = '\0';
+      }
+      found++;
+    }
+  }
+  pthread_rwlock_unlock(&target_lock);
+
+  __atomic_fetch_add(&lookups, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&candidates, found, __ATOMIC_RELAXED);
+
+  return found;
+}
+
+void access_target_get_stats(access_target_stats_t *stats) {
+  pthread_rwlock_rdlock(&target_lock);
+  stats->policies = indexed;
+  stats->keys = postings_num;
+  pthread_rwlock_unlock(&target_lock);
+  stats->lookups = __atomic_load_n(&lookups, __ATOMIC_RELAXED);
+  stats->candidates = __atomic_load_n(&candidates, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_target.h
+ * \brief
+ * Index of the stored policies by subject, action and object
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * A policy applies to a request when its GoC or its DoC holds, otherwise its
+ * decision is undefined. For each of the subject, the action and the object,
+ * the circuit of a policy is searched for the constants the request
+ * attribute must equal for one of the conditions to hold; a policy without
+ * such a bound applies to any value. Looking a request up in the index
+ * returns the policies that may apply to it, and leaves out only policies
+ * whose decision is undefined for it. All functions are thread safe.
+ *
+ * \history
+ * 21.12.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _ACCESS_TARGET_H_
+#define _ACCESS_TARGET_H_
+
+#include "policy_circuit.h"
+
+#define ACCESS_TARGET_SUBJECT_ATTRIBUTE "request.subject.value"
+#define ACCESS_TARGET_ACTION_ATTRIBUTE "request.action.value"
+#define ACCESS_TARGET_OBJECT_ATTRIBUTE "request.object.value"
+
+#define ACCESS_TARGET_ID_LEN 128
+#define ACCESS_TARGET_CANDIDATES_MAX 64
+
+typedef struct {
+  int policies;
+  // Distinct (attribute, value) keys in the index
+  int keys;
+  unsigned long long lookups;
+  unsigned long long candidates;
+} access_target_stats_t;
+
+/**
+ * @brief Index a policy by its circuit, replacing an earlier entry
+ *
+ * @return 0 on success, -1 if the policy could not be indexed
+ */
+int access_target_add(const char *policy_id, int policy_id_len, const policy_circuit_t *circuit);
+
+void access_target_remove(const char *policy_id, int policy_id_len);
+
+/**
+ * @brief Drop all policies from the index
+ */
+void access_target_clear(void);
+
+/**
+ * @brief Find the policies that may apply to a request
+ *
+ * Strings are not terminated, an empty or NULL one only matches policies applying to any value.
+ *
+ * @param policy_ids Ids of the policies found, terminated
+ * @param candidates_max Size of policy_ids
+ * @return Number of policies found, only the first candidates_max of them are written
+ */
+int access_target_find(const char *subject, int subject_len, const char *action, int action_len, const char *object,
+                       int object_len, char policy_ids[][ACCESS_TARGET_ID_LEN], int candidates_max);
+
+void access_target_get_stats(access_target_stats_t *stats);
+
+#endif
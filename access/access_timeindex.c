@@ -0,0 +1,380 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_timeindex.c
+ * \brief
+ * Implementation of the time boundary index
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 14.12.2020. Initial version.
+ ****************************************************************************/
+
+#include "access_timeindex.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define ACCESS_TIMEINDEX_POLICIES_MAX 32
+#define ACCESS_TIMEINDEX_ID_LEN 128
+#define ACCESS_TIMEINDEX_BOUNDARIES_MAX 16
+#define ACCESS_TIMEINDEX_MINUTES_PER_DAY 1440
+// Clock adjustments and daylight saving move the boundaries, so they are looked up again at least this often
+#define ACCESS_TIMEINDEX_RECHECK_S 60
+#define ACCESS_TIMEINDEX_ACTION_ATTRIBUTE "request.action.value"
+
+typedef struct {
+  int used;
+  char policy_id[ACCESS_TIMEINDEX_ID_LEN];
+  int policy_id_len;
+  // Minutes of the day at which a time comparison changes its outcome, ascending
+  int boundaries[ACCESS_TIMEINDEX_BOUNDARIES_MAX];
+  int boundaries_num;
+  // The policy reads the time and the action only, and every time comparison is indexed
+  int time_only;
+} access_timeindex_policy_t;
+
+static pthread_mutex_t timeindex_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timeindex_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static int running;
+static int stopping;
+static access_timeindex_boundary_cb boundary_cb;
+static access_timeindex_policy_t policies[ACCESS_TIMEINDEX_POLICIES_MAX];
+// Boundary the thread waits for, 0 while there is none
+static time_t next_boundary;
+static unsigned long long boundaries_passed;
+
+static int slot_is(const policy_circuit_t *circuit, int slot, const char *type) {
+  return circuit->slot_lens[slot] == strlen(type) &&
+         memcmp(circuit->strings + circuit->slot_offsets[slot], type, circuit->slot_lens[slot]) == 0;
+}
+
+static void add_boundary(access_timeindex_policy_t *policy, int minute) {
+  int i = 0;
+
+  minute %= ACCESS_TIMEINDEX_MINUTES_PER_DAY;
+  while (i < policy->boundaries_num && policy->boundaries[i] < minute) {
+    i++;
+  }
+  if (i < policy->boundaries_num && policy->boundaries[i] == minute) {
+    return;
+  }
+  if (policy->boundaries_num == ACCESS_TIMEINDEX_BOUNDARIES_MAX) {
+    // Changes the index misses are left to the TTL
+    policy->time_only = 0;
+    return;
+  }
+  memmove(&policy->boundaries[i + 1], &policy->boundaries[i], (policy->boundaries_num - i) * sizeof(int));
+  policy->boundaries[i] = minute;
+  policy->boundaries_num++;
+}
+
+// Boundaries of "time op constant", with the time on the left
+static int index_comparison(access_timeindex_policy_t *policy, policy_gate_e op, const policy_term_t *constant) {
+  int hhmm = (int)constant->number;
+
+  if (!constant->is_number || hhmm != constant->number || hhmm < 0 || hhmm > 2400 || hhmm % 100 >= 60) {
+    return -1;
+  }
+
+  // The time takes whole minutes, "time <= 0900" changes at 0900 and at 0901
+  int minute = hhmm / 100 * 60 + hhmm % 100;
+  switch (op) {
+    case POLICY_GATE_LT:
+    case POLICY_GATE_GEQ:
+      add_boundary(policy, minute);
+      break;
+    case POLICY_GATE_LEQ:
+    case POLICY_GATE_GT:
+      add_boundary(policy, minute + 1);
+      break;
+    case POLICY_GATE_EQ:
+      add_boundary(policy, minute);
+      add_boundary(policy, minute + 1);
+      break;
+    default:
+      return -1;
+  }
+
+  return 0;
+}
+
+static policy_gate_e mirror(policy_gate_e op) {
+  switch (op) {
+    case POLICY_GATE_LT:
+      return POLICY_GATE_GT;
+    case POLICY_GATE_LEQ:
+      return POLICY_GATE_GEQ;
+    case POLICY_GATE_GT:
+      return POLICY_GATE_LT;
+    case POLICY_GATE_GEQ:
+      return POLICY_GATE_LEQ;
+    default:
+      return op;
+  }
+}
+
+static void analyze(access_timeindex_policy_t *policy, const policy_circuit_t *circuit) {
+  int time_slot = -1;
+
+  policy->boundaries_num = 0;
+  policy->time_only = 1;
+  for (int i = 0; i < circuit->slots_num; i++) {
+    if (slot_is(circuit, i, ACCESS_TIMEINDEX_ATTRIBUTE)) {
+      time_slot = i;
+    } else if (!slot_is(circuit, i, ACCESS_TIMEINDEX_ACTION_ATTRIBUTE)) {
+      policy->time_only = 0;
+    }
+  }
+  if (time_slot < 0) {
+    return;
+  }
+
+  for (int i = 0; i < circuit->gates_num; i++) {
+    const policy_gate_t *gate = &circuit->gates[i];
+    if (gate->op != POLICY_GATE_EQ && gate->op != POLICY_GATE_LT && gate->op != POLICY_GATE_LEQ &&
+        gate->op != POLICY_GATE_GT && gate->op != POLICY_GATE_GEQ) {
+      continue;
+    }
+    const policy_term_t *lhs = &circuit->terms[gate->a];
+    const policy_term_t *rhs = &circuit->terms[gate->b];
+    int indexed = -1;
+    if (lhs->slot == time_slot && rhs->slot < 0) {
+      indexed = index_comparison(policy, gate->op, rhs);
+    } else if (rhs->slot == time_slot && lhs->slot < 0) {
+      indexed = index_comparison(policy, mirror(gate->op), lhs);
+    } else if (lhs->slot != time_slot && rhs->slot != time_slot) {
+      continue;
+    }
+    // A comparison the index cannot follow still has its decisions expire with the TTL
+    if (indexed < 0) {
+      policy->time_only = 0;
+    }
+  }
+}
+
+// First boundary after now, 0 if there is none
+static time_t boundary_after(time_t now, const int *boundaries, int boundaries_num) {
+  struct tm local;
+  int i = 0;
+
+  if (boundaries_num == 0 || localtime_r(&now, &local) == NULL) {
+    return 0;
+  }
+
+  int minute = local.tm_hour * 60 + local.tm_min;
+  while (i < boundaries_num && boundaries[i] <= minute) {
+    i++;
+  }
+  if (i == boundaries_num) {
+    // The first one tomorrow, mktime normalizes the day
+    i = 0;
+    local.tm_mday++;
+  }
+  local.tm_hour = boundaries[i] / 60;
+  local.tm_min = boundaries[i] % 60;
+  local.tm_sec = 0;
+  local.tm_isdst = -1;
+
+  time_t boundary = mktime(&local);
+  return boundary > now ? boundary : 0;
+}
+
+static time_t next_boundary_locked(time_t now) {
+  time_t next = 0;
+
+  for (int i = 0; i < ACCESS_TIMEINDEX_POLICIES_MAX; i++) {
+    if (policies[i].used) {
+      time_t boundary = boundary_after(now, policies[i].boundaries, policies[i].boundaries_num);
+      if (boundary != 0 && (next == 0 || boundary < next)) {
+        next = boundary;
+      }
+    }
+  }
+
+  return next;
+}
+
+static void *timeindex_function(void *arg) {
+  pthread_mutex_lock(&timeindex_lock);
+  while (!stopping) {
+    time_t now = time(NULL);
+
+    if (next_boundary != 0 && now >= next_boundary) {
+      next_boundary = 0;
+      boundaries_passed++;
+      pthread_mutex_unlock(&timeindex_lock);
+      boundary_cb();
+      pthread_mutex_lock(&timeindex_lock);
+      continue;
+    }
+
+    next_boundary = next_boundary_locked(now);
+    struct timespec wake = {now + ACCESS_TIMEINDEX_RECHECK_S, 0};
+    if (next_boundary != 0 && next_boundary < wake.tv_sec) {
+      wake.tv_sec = next_boundary;
+    }
+    pthread_cond_timedwait(&timeindex_cond, &timeindex_lock, &wake);
+  }
+  pthread_mutex_unlock(&timeindex_lock);
+
+  return NULL;
+}
+
+int access_timeindex_init(access_timeindex_boundary_cb boundary) {
+  access_timeindex_term();
+  if (boundary == NULL) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&timeindex_lock);
+  boundary_cb = boundary;
+  next_boundary = 0;
+  stopping = 0;
+  running = pthread_create(&thread, NULL, timeindex_function, NULL) == 0;
+  pthread_mutex_unlock(&timeindex_lock);
+
+  return running ? 0 : -1;
+}
+
+void access_timeindex_term(void) {
+  pthread_mutex_lock(&timeindex_lock);
+  int was_running = running;
+  stopping = 1;
+  running = 0;
+  pthread_cond_signal(&timeindex_cond);
+  pthread_mutex_unlock(&timeindex_lock);
+
+  if (was_running) {
+    pthread_join(thread, NULL);
+  }
+
+  pthread_mutex_lock(&timeindex_lock);
+  memset(policies, 0, sizeof(policies));
+  next_boundary = 0;
+  pthread_mutex_unlock(&timeindex_lock);
+}
+
+static access_timeindex_policy_t *find_policy(const char *policy_id, int policy_id_len) {
+  for (int i = 0; i < ACCESS_TIMEINDEX_POLICIES_MAX; i++) {
+    if (policies[i].used && policies[i].policy_id_len == policy_id_len &&
+        strncasecmp(policies[i].policy_id, policy_id, policy_id_len) == 0) {
+      return &policies[i];
+    }
+  }
+  return NULL;
+}
+
+int access_timeindex_add(const char *policy_id, int policy_id_len, const policy_circuit_t *circuit) {
+  access_timeindex_policy_t analyzed;
+
+  analyze(&analyzed, circuit);
+  if (analyzed.boundaries_num == 0 || policy_id_len >= ACCESS_TIMEINDEX_ID_LEN) {
+    access_timeindex_remove(policy_id, policy_id_len);
+    return 0;
+  }
+
+  pthread_mutex_lock(&timeindex_lock);
+  if (!running) {
+    pthread_mutex_unlock(&timeindex_lock);
+    return 0;
+  }
+  access_timeindex_policy_t *policy = find_policy(policy_id, policy_id_len);
+  for (int i = 0; i < ACCESS_TIMEINDEX_POLICIES_MAX && policy == NULL; i++) {
+    if (!policies[i].used) {
+      policy = &policies[i];
+    }
+  }
+  if (policy != NULL) {
+    *policy = analyzed;
+    memcpy(policy->policy_id, policy_id, policy_id_len);
+    policy->policy_id_len = policy_id_len;
+    policy->used = 1;
+    // The thread may be waiting for a later boundary
+    pthread_cond_signal(&timeindex_cond);
+  }
+  pthread_mutex_unlock(&timeindex_lock);
+
+  return policy != NULL ? analyzed.boundaries_num : 0;
+}
+
+void access_timeindex_remove(const char *policy_id, int policy_id_len) {
+  pthread_mutex_lock(&timeindex_lock);
+  access_timeindex_policy_t *policy = find_policy(policy_id, policy_id_len);
+  if (policy != NULL) {
+    policy->used = 0;
+  }
+  pthread_mutex_unlock(&timeindex_lock);
+}
+
+int access_timeindex_lifetime(const char *policy_id, int policy_id_len) {
+  struct timespec now;
+  int lifetime_ms = -1;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  pthread_mutex_lock(&timeindex_lock);
+  access_timeindex_policy_t *policy = find_policy(policy_id, policy_id_len);
+  // Until the thread has handled a passed boundary, a decision may be from before it
+  if (policy != NULL && policy->time_only && next_boundary != 0 && now.tv_sec < next_boundary) {
+    time_t boundary = boundary_after(now.tv_sec, policy->boundaries, policy->boundaries_num);
+    if (boundary != 0) {
+      long long ms = (long long)(boundary - now.tv_sec) * 1000LL - now.tv_nsec / 1000000L;
+      lifetime_ms = ms > 0x7fffffffLL ? 0x7fffffff : (int)ms;
+    }
+  }
+  pthread_mutex_unlock(&timeindex_lock);
+
+  return lifetime_ms;
+}
+
+int access_timeindex_now(char *value, int value_size) {
+  time_t now = time(NULL);
+  struct tm local;
+
+  if (localtime_r(&now, &local) == NULL) {
+    return -1;
+  }
+  int len = snprintf(value, value_size, "%02d%02d", local.tm_hour, local.tm_min);
+  return len < value_size ? len : -1;
+}
+
+void access_timeindex_get_stats(access_timeindex_stats_t *stats) {
+  pthread_mutex_lock(&timeindex_lock);
+  stats->policies = 0;
+  stats->boundaries = 0;
+  for (int i = 0; i < ACCESS_TIMEINDEX_POLICIES_MAX; i++) {
+    if (policies[i].used) {
+      stats->policies++;
+      stats->boundaries += policies[i].boundaries_num;
+    }
+  }
+  stats->boundaries_passed = boundaries_passed;
+  pthread_mutex_unlock(&timeindex_lock);
+}
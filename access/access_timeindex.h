@@ -0,0 +1,98 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_timeindex.h
+ * \brief
+ * Index of the instants at which time-dependent policies change
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * The local time of day is the request attribute ACCESS_TIMEINDEX_ATTRIBUTE,
+ * a number of the form HHMM, so "0900 <= time <= 2000" is written as leq
+ * comparisons against the constants 900 and 2000. Comparing the time with
+ * constants only, a condition can change its outcome at a few minutes of the
+ * day. These boundaries are extracted from the compiled circuit of every
+ * stored policy, and a thread calls the boundary callback when one is
+ * reached. Decisions of a policy reading nothing but the time and the action
+ * stay valid until its next boundary.
+ *
+ * \history
+ * 14.12.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _ACCESS_TIMEINDEX_H_
+#define _ACCESS_TIMEINDEX_H_
+
+#include "policy_circuit.h"
+
+#define ACCESS_TIMEINDEX_ATTRIBUTE "request.time.value"
+
+typedef struct {
+  int policies;
+  // Boundaries in the index, over all policies
+  int boundaries;
+  unsigned long long boundaries_passed;
+} access_timeindex_stats_t;
+
+/**
+ * @brief Called when a boundary of an indexed policy is reached
+ */
+typedef void (*access_timeindex_boundary_cb)(void);
+
+/**
+ * @brief Start the thread waiting for the boundaries
+ *
+ * @return 0 on success, -1 if the thread could not be started
+ */
+int access_timeindex_init(access_timeindex_boundary_cb boundary);
+
+/**
+ * @brief Stop the thread and empty the index
+ */
+void access_timeindex_term(void);
+
+/**
+ * @brief Index the boundaries of a policy, replacing earlier ones
+ *
+ * @return Number of boundaries, 0 if the policy does not depend on the time
+ */
+int access_timeindex_add(const char *policy_id, int policy_id_len, const policy_circuit_t *circuit);
+
+void access_timeindex_remove(const char *policy_id, int policy_id_len);
+
+/**
+ * @brief Milliseconds until the decisions of a policy may change, see access_cache_lifetime_cb
+ *
+ * @return -1 unless the policy reads nothing but the time and the action
+ */
+int access_timeindex_lifetime(const char *policy_id, int policy_id_len);
+
+/**
+ * @brief Write the current local time of day as HHMM
+ *
+ * @return Length of the value, -1 if it does not fit
+ */
+int access_timeindex_now(char *value, int value_size);
+
+void access_timeindex_get_stats(access_timeindex_stats_t *stats);
+
+#endif
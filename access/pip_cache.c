@@ -0,0 +1,296 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file pip_cache.c
+ * \brief
+ * Implementation of the PIP attribute cache
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 23.11.2020. Initial version.
+ ****************************************************************************/
+
+#include "pip_cache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum {
+  PIP_CACHE_FREE,
+  // Being fetched, callers asking for it wait
+  PIP_CACHE_FETCHING,
+  PIP_CACHE_VALID,
+  // Fetched but not kept, dropped once the last waiter has read it
+  PIP_CACHE_DONE
+} pip_cache_state_e;
+
+typedef struct pip_cache_entry pip_cache_entry_t;
+
+struct pip_cache_entry {
+  pip_cache_state_e state;
+  int source;
+  unsigned int hash;
+  char uri[PIP_MAX_STR_LEN];
+  unsigned long long generation;
+  unsigned long long expires_us;
+  pip_attribute_object_t attribute;
+  int result;
+  int waiters;
+  pip_cache_entry_t *bucket_next;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fetched_cond = PTHREAD_COND_INITIALIZER;
+static pip_cache_entry_t *entries;
+static pip_cache_entry_t **buckets;
+static unsigned int bucket_mask;
+static pip_cache_entry_t *free_list;
+static int capacity;
+static int count;
+static unsigned long long generation;
+static unsigned long long hits;
+static unsigned long long misses;
+static unsigned long long coalesced;
+
+static unsigned long long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// FNV-1a over the source and the URI
+static unsigned int key_hash(int source, const char *uri) {
+  unsigned int hash = (2166136261u ^ (unsigned int)source) * 16777619u;
+  for (; *uri != '\0'; uri++) {
+    hash = (hash ^ (unsigned char)*uri) * 16777619u;
+  }
+  return hash;
+}
+
+static pip_cache_entry_t *find(unsigned int hash, int source, const char *uri) {
+  for (pip_cache_entry_t *entry = buckets[hash & bucket_mask]; entry != NULL; entry = entry->bucket_next) {
+    if (entry->state != PIP_CACHE_DONE && entry->hash == hash && entry->source == source &&
+        strcmp(entry->uri, uri) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void remove_entry(pip_cache_entry_t *entry) {
+  pip_cache_entry_t **link = &buckets[entry->hash & bucket_mask];
+  while (*link != entry) {
+    link = &(*link)->bucket_next;
+  }
+  *link = entry->bucket_next;
+
+  entry->state = PIP_CACHE_FREE;
+  entry->bucket_next = free_list;
+  free_list = entry;
+  count--;
+}
+
+static pip_cache_entry_t *take_free(void) {
+  if (count == capacity) {
+    // An expired attribute makes room, otherwise the one closest to expiry
+    unsigned long long now = now_us();
+    pip_cache_entry_t *victim = NULL;
+    for (int i = 0; i < capacity; i++) {
+      pip_cache_entry_t *entry = &entries[i];
+      if (entry->state != PIP_CACHE_VALID || entry->waiters > 0) {
+        continue;
+      }
+      if (entry->generation != generation || entry->expires_us <= now) {
+        victim = entry;
+        break;
+      }
+      if (victim == NULL || entry->expires_us < victim->expires_us) {
+        victim = entry;
+      }
+    }
+    if (victim == NULL) {
+      // Every entry is being fetched or read
+      return NULL;
+    }
+    remove_entry(victim);
+  }
+
+  pip_cache_entry_t *entry = free_list;
+  free_list = entry->bucket_next;
+  return entry;
+}
+
+int pip_cache_init(int cache_capacity) {
+  pip_cache_term();
+
+  if (cache_capacity <= 0) {
+    return 0;
+  }
+
+  unsigned int bucket_count = 1;
+  while (bucket_count < 2u * cache_capacity) {
+    bucket_count <<= 1;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  entries = calloc(cache_capacity, sizeof(pip_cache_entry_t));
+  buckets = calloc(bucket_count, sizeof(pip_cache_entry_t *));
+  if (entries == NULL || buckets == NULL) {
+    free(entries);
+    free(buckets);
+    entries = NULL;
+    buckets = NULL;
+    pthread_mutex_unlock(&cache_lock);
+    return -1;
+  }
+  for (int i = cache_capacity - 1; i >= 0; i--) {
+    entries[i].bucket_next = free_list;
+    free_list = &entries[i];
+  }
+  bucket_mask = bucket_count - 1;
+  capacity = cache_capacity;
+  pthread_mutex_unlock(&cache_lock);
+
+  return 0;
+}
+
+void pip_cache_term(void) {
+  pthread_mutex_lock(&cache_lock);
+  free(entries);
+  free(buckets);
+  entries = NULL;
+  buckets = NULL;
+  free_list = NULL;
+  capacity = 0;
+  count = 0;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+int pip_cache_acquire(int source, const char *uri, int ttl_ms, pip_cache_fetch_cb fetch, void *fetch_data,
+                      pip_attribute_object_t *attribute) {
+  pip_cache_entry_t *entry;
+  pip_attribute_object_t fetched;
+  int ret;
+
+  if (ttl_ms <= 0 || strlen(uri) >= PIP_MAX_STR_LEN) {
+    return fetch(fetch_data, attribute);
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  if (capacity == 0) {
+    pthread_mutex_unlock(&cache_lock);
+    return fetch(fetch_data, attribute);
+  }
+
+  unsigned int hash = key_hash(source, uri);
+  entry = find(hash, source, uri);
+  if (entry != NULL && entry->state == PIP_CACHE_VALID) {
+    if (entry->generation == generation && entry->expires_us > now_us()) {
+      *attribute = entry->attribute;
+      hits++;
+      pthread_mutex_unlock(&cache_lock);
+      return 0;
+    }
+    if (entry->waiters > 0) {
+      // Callers of the last fetch have yet to read it
+      pthread_mutex_unlock(&cache_lock);
+      return fetch(fetch_data, attribute);
+    }
+    remove_entry(entry);
+    entry = NULL;
+  }
+
+  if (entry != NULL) {
+    // Someone is fetching it already, share the result
+    coalesced++;
+    entry->waiters++;
+    while (entry->state == PIP_CACHE_FETCHING) {
+      pthread_cond_wait(&fetched_cond, &cache_lock);
+    }
+    *attribute = entry->attribute;
+    ret = entry->result;
+    if (--entry->waiters == 0 && entry->state == PIP_CACHE_DONE) {
+      remove_entry(entry);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return ret;
+  }
+
+  misses++;
+  entry = take_free();
+  if (entry == NULL) {
+    pthread_mutex_unlock(&cache_lock);
+    return fetch(fetch_data, attribute);
+  }
+  entry->state = PIP_CACHE_FETCHING;
+  entry->source = source;
+  entry->hash = hash;
+  strcpy(entry->uri, uri);
+  entry->generation = generation;
+  entry->waiters = 0;
+  entry->bucket_next = buckets[hash & bucket_mask];
+  buckets[hash & bucket_mask] = entry;
+  count++;
+  pthread_mutex_unlock(&cache_lock);
+
+  memset(&fetched, 0, sizeof(fetched));
+  ret = fetch(fetch_data, &fetched);
+
+  pthread_mutex_lock(&cache_lock);
+  entry->attribute = fetched;
+  entry->result = ret;
+  // A fetch that raced with an invalidation may hold the old value
+  if (ret == 0 && entry->generation == generation) {
+    entry->state = PIP_CACHE_VALID;
+    entry->expires_us = now_us() + (unsigned long long)ttl_ms * 1000ULL;
+  } else {
+    entry->state = PIP_CACHE_DONE;
+    if (entry->waiters == 0) {
+      remove_entry(entry);
+    }
+  }
+  pthread_cond_broadcast(&fetched_cond);
+  pthread_mutex_unlock(&cache_lock);
+
+  *attribute = fetched;
+  return ret;
+}
+
+void pip_cache_invalidate(void) {
+  pthread_mutex_lock(&cache_lock);
+  generation++;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+void pip_cache_get_stats(pip_cache_stats_t *stats) {
+  pthread_mutex_lock(&cache_lock);
+  stats->hits = hits;
+  stats->misses = misses;
+  stats->coalesced = coalesced;
+  stats->entries = count;
+  stats->capacity = capacity;
+  pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,101 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file pip_cache.h
+ * \brief
+ * Cache of attributes acquired from PIP plugins
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Attributes are keyed by the plugin that provided them and their URI, and
+ * kept for the lifetime the caller gives with every acquisition. While an
+ * attribute is being fetched, other callers asking for it wait for that
+ * fetch instead of starting their own. Failed fetches are not kept. When
+ * the cache is full, an expired entry or else the one closest to expiry
+ * makes room. All functions are thread safe.
+ *
+ * \history
+ * 23.11.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _PIP_CACHE_H_
+#define _PIP_CACHE_H_
+
+#include "pip_plugin.h"
+
+typedef struct {
+  unsigned long long hits;
+  unsigned long long misses;
+  // Acquisitions answered by a fetch another caller started
+  unsigned long long coalesced;
+  int entries;
+  int capacity;
+} pip_cache_stats_t;
+
+/**
+ * @brief Fetch an attribute on a miss
+ *
+ * @param fetch_data Data given to pip_cache_acquire
+ * @param attribute Fetched attribute
+ * @return 0 on success, anything else is returned to every caller waiting for the fetch
+ */
+typedef int (*pip_cache_fetch_cb)(void *fetch_data, pip_attribute_object_t *attribute);
+
+/**
+ * @brief Allocate the cache
+ *
+ * @param capacity Maximum number of attributes, 0 disables the cache
+ * @return 0 on success, -1 if the entries could not be allocated
+ */
+int pip_cache_init(int capacity);
+
+/**
+ * @brief Release the cache
+ *
+ * No acquisition may be in progress.
+ */
+void pip_cache_term(void);
+
+/**
+ * @brief Acquire an attribute, from the cache if it holds a live copy
+ *
+ * @param source Plugin the attribute comes from
+ * @param uri Attribute URI, terminated
+ * @param ttl_ms Lifetime of a fetched attribute, 0 or less bypasses the cache
+ * @param fetch Function fetching the attribute on a miss
+ * @param fetch_data Data given to fetch
+ * @param attribute Acquired attribute
+ * @return Result of the fetch, 0 for a cached attribute
+ */
+int pip_cache_acquire(int source, const char *uri, int ttl_ms, pip_cache_fetch_cb fetch, void *fetch_data,
+                      pip_attribute_object_t *attribute);
+
+/**
+ * @brief Forget every cached attribute
+ *
+ * Fetches in progress still answer the callers waiting for them, but are not kept.
+ */
+void pip_cache_invalidate(void);
+
+void pip_cache_get_stats(pip_cache_stats_t *stats);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file pip_prefetch.c
+ * \brief
+ * Implementation of the concurrent PIP attribute acquisition
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 16.11.2020. Initial version.
+ ****************************************************************************/
+
+#include "pip_prefetch.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PIP_PREFETCH_THREADS_MAX 16
+#define PIP_PREFETCH_QUEUE_LEN 256
+
+// Attributes of one call; shared with the workers, freed by whoever lets go last
+typedef struct {
+  char uris[PIP_PREFETCH_URIS_MAX][PIP_PREFETCH_URI_LEN];
+  char values[PIP_PREFETCH_URIS_MAX][PIP_PREFETCH_VALUE_LEN];
+  int lens[PIP_PREFETCH_URIS_MAX];
+  int pending;
+  int refs;
+  // Set once the caller stopped waiting, queued attributes are not fetched anymore
+  int abandoned;
+  pthread_cond_t done;
+} pip_prefetch_batch_t;
+
+typedef struct {
+  pip_prefetch_batch_t *batch;
+  int index;
+} pip_prefetch_job_t;
+
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[PIP_PREFETCH_THREADS_MAX];
+static int workers_num;
+static int stopping;
+static pip_prefetch_fetch_cb fetch_cb;
+static pip_prefetch_job_t queue[PIP_PREFETCH_QUEUE_LEN];
+static int queue_head;
+static int queue_len;
+
+static void batch_release(pip_prefetch_batch_t *batch) {
+  if (--batch->refs == 0) {
+    pthread_cond_destroy(&batch->done);
+    free(batch);
+  }
+}
+
+static void *worker_function(void *arg) {
+  char value[PIP_PREFETCH_VALUE_LEN];
+
+  pthread_mutex_lock(&prefetch_lock);
+  for (;;) {
+    while (queue_len == 0 && !stopping) {
+      pthread_cond_wait(&work_cond, &prefetch_lock);
+    }
+    if (queue_len == 0) {
+      break;
+    }
+
+    pip_prefetch_job_t job = queue[queue_head];
+    queue_head = (queue_head + 1) % PIP_PREFETCH_QUEUE_LEN;
+    queue_len--;
+
+    pip_prefetch_batch_t *batch = job.batch;
+    if (!batch->abandoned) {
+      pthread_mutex_unlock(&prefetch_lock);
+      int len = fetch_cb(batch->uris[job.index], value, PIP_PREFETCH_VALUE_LEN);
+      pthread_mutex_lock(&prefetch_lock);
+
+      if (len >= 0 && len <= PIP_PREFETCH_VALUE_LEN) {
+        memcpy(batch->values[job.index], value, len);
+      } else {
+        len = -1;
+      }
+      batch->lens[job.index] = len;
+      if (--batch->pending == 0) {
+        pthread_cond_signal(&batch->done);
+      }
+    }
+    batch_release(batch);
+  }
+  pthread_mutex_unlock(&prefetch_lock);
+
+  return NULL;
+}
+
+int pip_prefetch_init(int threads, pip_prefetch_fetch_cb fetch) {
+  pip_prefetch_term();
+
+  if (threads <= 0 || fetch == NULL) {
+    return 0;
+  }
+  if (threads > PIP_PREFETCH_THREADS_MAX) {
+    threads = PIP_PREFETCH_THREADS_MAX;
+  }
+
+  pthread_mutex_lock(&prefetch_lock);
+  fetch_cb = fetch;
+  stopping = 0;
+  pthread_mutex_unlock(&prefetch_lock);
+
+  int started = 0;
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&workers[started], NULL, worker_function, NULL) == 0) {
+      started++;
+    }
+  }
+
+  pthread_mutex_lock(&prefetch_lock);
+  workers_num = started;
+  pthread_mutex_unlock(&prefetch_lock);
+
+  return started > 0 ? 0 : -1;
+}
+
+void pip_prefetch_term(void) {
+  pthread_mutex_lock(&prefetch_lock);
+  int threads = workers_num;
+  stopping = 1;
+  workers_num = 0;
+  pthread_cond_broadcast(&work_cond);
+  pthread_mutex_unlock(&prefetch_lock);
+
+  // Workers drain the queue before they exit, so every batch is released
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+}
+
+int pip_prefetch_fetch(const char **uris, int uris_num, char (*values)[PIP_PREFETCH_VALUE_LEN], int *lens,
+                       int deadline_ms) {
+  pip_prefetch_batch_t *batch;
+  pthread_condattr_t attr;
+  struct timespec deadline;
+  int fetched = 0;
+
+  if (uris_num <= 0 || uris_num > PIP_PREFETCH_URIS_MAX) {
+    return -1;
+  }
+
+  batch = calloc(1, sizeof(pip_prefetch_batch_t));
+  if (batch == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < uris_num; i++) {
+    strncpy(batch->uris[i], uris[i], PIP_PREFETCH_URI_LEN - 1);
+    batch->lens[i] = PIP_PREFETCH_PENDING;
+  }
+  // The deadline is measured on the monotonic clock, wall clock steps do not move it
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&batch->done, &attr);
+  pthread_condattr_destroy(&attr);
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += deadline_ms / 1000;
+  deadline.tv_nsec += (deadline_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&prefetch_lock);
+  if (workers_num == 0 || queue_len + uris_num > PIP_PREFETCH_QUEUE_LEN) {
+    pthread_mutex_unlock(&prefetch_lock);
+    pthread_cond_destroy(&batch->done);
+    free(batch);
+    return -1;
+  }
+
+  batch->refs = uris_num + 1;
+  batch->pending = uris_num;
+  for (int i = 0; i < uris_num; i++) {
+    pip_prefetch_job_t *job = &queue[(queue_head + queue_len++) % PIP_PREFETCH_QUEUE_LEN];
+    job->batch = batch;
+    job->index = i;
+  }
+  pthread_cond_broadcast(&work_cond);
+
+  while (batch->pending > 0) {
+    if (pthread_cond_timedwait(&batch->done, &prefetch_lock, &deadline) != 0) {
+      break;
+    }
+  }
+
+  for (int i = 0; i < uris_num; i++) {
+    lens[i] = batch->lens[i];
+    if (lens[i] >= 0) {
+      memcpy(values[i], batch->values[i], lens[i]);
+      fetched++;
+    }
+  }
+  batch->abandoned = 1;
+  batch_release(batch);
+  pthread_mutex_unlock(&prefetch_lock);
+
+  return fetched;
+}
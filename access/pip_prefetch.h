@@ -0,0 +1,86 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file pip_prefetch.h
+ * \brief
+ * Concurrent acquisition of PIP attributes
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * A fixed pool of worker threads fetches the attributes of one evaluation
+ * side by side, so the evaluation waits for the slowest attribute instead of
+ * the sum of all of them. The caller waits until every attribute is fetched
+ * or its deadline passes; attributes still outstanding by then are reported
+ * as not fetched and their results are dropped when they arrive.
+ *
+ * \history
+ * 16.11.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _PIP_PREFETCH_H_
+#define _PIP_PREFETCH_H_
+
+#define PIP_PREFETCH_URIS_MAX 16
+#define PIP_PREFETCH_URI_LEN 256
+#define PIP_PREFETCH_VALUE_LEN 256
+
+// Length of an attribute the deadline passed for
+#define PIP_PREFETCH_PENDING -2
+
+/**
+ * @brief Fetch one attribute, called from the worker threads
+ *
+ * @param uri Attribute URI
+ * @param value Buffer for the value
+ * @param value_size Size of the buffer
+ * @return Length of the value, or -1 if the attribute is not available
+ */
+typedef int (*pip_prefetch_fetch_cb)(const char *uri, char *value, int value_size);
+
+/**
+ * @brief Start the worker threads
+ *
+ * @param threads Number of workers, 0 disables prefetching
+ * @param fetch Function fetching an attribute
+ * @return 0 on success, -1 if no worker could be started
+ */
+int pip_prefetch_init(int threads, pip_prefetch_fetch_cb fetch);
+
+/**
+ * @brief Stop the worker threads
+ */
+void pip_prefetch_term(void);
+
+/**
+ * @brief Fetch attributes concurrently
+ *
+ * @param uris Attribute URIs, terminated strings
+ * @param uris_num Number of URIs, at most PIP_PREFETCH_URIS_MAX
+ * @param values Values, not terminated
+ * @param lens Length of every value, -1 if not available or PIP_PREFETCH_PENDING
+ * @param deadline_ms Longest time to wait for the attributes
+ * @return Number of attributes fetched, or -1 if prefetching is disabled
+ */
+int pip_prefetch_fetch(const char **uris, int uris_num, char (*values)[PIP_PREFETCH_VALUE_LEN], int *lens,
+                       int deadline_ms);
+
+#endif
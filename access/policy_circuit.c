@@ -0,0 +1,882 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file policy_circuit.c
+ * \brief
+ * Implementation of the policy circuit compiler and evaluator
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 02.11.2020. Initial version.
+ ****************************************************************************/
+
+#include "policy_circuit.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "jsmn.h"
+#include "policy_vm.h"
+
+#define POLICY_CIRCUIT_TERMS_MAX (2 * POLICY_CIRCUIT_GATES_MAX)
+#define POLICY_CIRCUIT_FANIN_MAX 64
+#define POLICY_CIRCUIT_DEPTH_MAX 32
+#define POLICY_CIRCUIT_STORE_BUCKETS 64
+#define POLICY_CIRCUIT_SLOT_PREFIX "request."
+#define POLICY_CIRCUIT_WORD_BITS 64
+
+typedef struct {
+  const char *json;
+  jsmntok_t *tokens;
+  int num_of_tokens;
+  policy_circuit_t *circuit;
+} policy_compiler_t;
+
+typedef struct policy_circuit_entry policy_circuit_entry_t;
+
+struct policy_circuit_entry {
+  char *policy_id;
+  int policy_id_len;
+  policy_circuit_t *circuit;
+  // Bytecode of the circuit, NULL when stored for the circuit engine
+  policy_vm_program_t *program;
+  policy_circuit_entry_t *next;
+};
+
+static pthread_rwlock_t store_lock = PTHREAD_RWLOCK_INITIALIZER;
+static policy_circuit_entry_t *store[POLICY_CIRCUIT_STORE_BUCKETS];
+static policy_engine_e engine_selected = POLICY_ENGINE_CIRCUIT;
+static policy_circuit_cost_cb engine_cost;
+static policy_circuit_prefetch_cb engine_prefetch;
+
+static int token_equals(policy_compiler_t *compiler, int token, const char *str) {
+  jsmntok_t *tok = &compiler->tokens[token];
+  int len = strlen(str);
+  return tok->end - tok->start == len && memcmp(compiler->json + tok->start, str, len) == 0;
+}
+
+// Index of the first token after the value starting at token
+static int skip(policy_compiler_t *compiler, int token) {
+  int end = compiler->tokens[token].end;
+  int i = token + 1;
+  while (i < compiler->num_of_tokens && compiler->tokens[i].start < end) {
+    i++;
+  }
+  return i;
+}
+
+static int object_get(policy_compiler_t *compiler, int object, const char *key) {
+  if (object < 0 || compiler->tokens[object].type != JSMN_OBJECT) {
+    return -1;
+  }
+
+  int i = object + 1;
+  for (int k = 0; k < compiler->tokens[object].size && i + 1 < compiler->num_of_tokens; k++) {
+    if (token_equals(compiler, i, key)) {
+      return i + 1;
+    }
+    i = skip(compiler, i + 1);
+  }
+  return -1;
+}
+
+static int parse_number(const char *str, int len, double *number) {
+  char buf[64];
+  char *end;
+
+  if (len == 0 || len >= (int)sizeof(buf)) {
+    return 0;
+  }
+  memcpy(buf, str, len);
+  buf[len] = '\0';
+  *number = strtod(buf, &end);
+  return *end == '\0';
+}
+
+static int add_string(policy_circuit_t *circuit, const char *str, int len) {
+  int offset = circuit->strings_len;
+  memcpy(circuit->strings + offset, str, len);
+  circuit->strings_len += len;
+  return offset;
+}
+
+static int add_gate(policy_circuit_t *circuit, policy_gate_e op, int a, int b) {
+  if (circuit->gates_num == POLICY_CIRCUIT_GATES_MAX) {
+    return -1;
+  }
+
+  policy_gate_t *gate = &circuit->gates[circuit->gates_num];
+  gate->op = op;
+  gate->a = a;
+  gate->b = b;
+  return circuit->gates_num++;
+}
+
+static int compile_term(policy_compiler_t *compiler, int node) {
+  policy_circuit_t *circuit = compiler->circuit;
+  int type = object_get(compiler, node, "type");
+  int value = object_get(compiler, node, "value");
+
+  if (type < 0 || value < 0 || circuit->terms_num == POLICY_CIRCUIT_TERMS_MAX) {
+    return -1;
+  }
+
+  const char *type_str = compiler->json + compiler->tokens[type].start;
+  int type_len = compiler->tokens[type].end - compiler->tokens[type].start;
+  policy_term_t *term = &circuit->terms[circuit->terms_num];
+
+  if (type_len > (int)strlen(POLICY_CIRCUIT_SLOT_PREFIX) &&
+      memcmp(type_str, POLICY_CIRCUIT_SLOT_PREFIX, strlen(POLICY_CIRCUIT_SLOT_PREFIX)) == 0) {
+    // Every request attribute is fetched once per evaluation, however often it is compared
+    int slot = 0;
+    while (slot < circuit->slots_num && (circuit->slot_lens[slot] != type_len ||
+                                         memcmp(circuit->strings + circuit->slot_offsets[slot], type_str, type_len))) {
+      slot++;
+    }
+    if (slot == circuit->slots_num) {
+      if (slot == POLICY_CIRCUIT_SLOTS_MAX) {
+        return -1;
+      }
+      circuit->slot_offsets[slot] = add_string(circuit, type_str, type_len);
+      circuit->slot_lens[slot] = type_len;
+      circuit->slots_num++;
+    }
+    term->slot = slot;
+    term->offset = circuit->slot_offsets[slot];
+    term->len = type_len;
+    term->is_number = 0;
+  } else {
+    const char *value_str = compiler->json + compiler->tokens[value].start;
+    int value_len = compiler->tokens[value].end - compiler->tokens[value].start;
+    term->slot = -1;
+    term->offset = add_string(circuit, value_str, value_len);
+    term->len = value_len;
+    term->is_number = parse_number(value_str, value_len, &term->number);
+  }
+
+  return circuit->terms_num++;
+}
+
+static int compile_condition(policy_compiler_t *compiler, int node, int depth) {
+  policy_circuit_t *circuit = compiler->circuit;
+  int operation = object_get(compiler, node, "operation");
+
+  if (depth > POLICY_CIRCUIT_DEPTH_MAX) {
+    return -1;
+  }
+
+  if (operation < 0) {
+    // Constant conditions are written as boolean attributes
+    int type = object_get(compiler, node, "type");
+    int value = object_get(compiler, node, "value");
+    if (type >= 0 && token_equals(compiler, type, "boolean") && value >= 0) {
+      return add_gate(circuit, token_equals(compiler, value, "true") ? POLICY_GATE_TRUE : POLICY_GATE_FALSE, 0, 0);
+    }
+    return -1;
+  }
+
+  int list = object_get(compiler, node, "attribute_list");
+  if (list < 0 || compiler->tokens[list].type != JSMN_ARRAY) {
+    return -1;
+  }
+  int list_size = compiler->tokens[list].size;
+  int first = list + 1;
+
+  if (token_equals(compiler, operation, "and") || token_equals(compiler, operation, "or")) {
+    unsigned short args[POLICY_CIRCUIT_FANIN_MAX];
+    if (list_size < 1 || list_size > POLICY_CIRCUIT_FANIN_MAX) {
+      return -1;
+    }
+    // Children are emitted first, so they precede the gate reading them
+    for (int i = 0, child = first; i < list_size; i++, child = skip(compiler, child)) {
+      int gate = compile_condition(compiler, child, depth + 1);
+      if (gate < 0) {
+        return -1;
+      }
+      args[i] = gate;
+    }
+    int offset = circuit->operands_num;
+    memcpy(circuit->operands + offset, args, list_size * sizeof(unsigned short));
+    circuit->operands_num += list_size;
+    return add_gate(circuit, token_equals(compiler, operation, "and") ? POLICY_GATE_AND : POLICY_GATE_OR, offset,
+                    list_size);
+  }
+
+  if (token_equals(compiler, operation, "not")) {
+    int gate = list_size == 1 ? compile_condition(compiler, first, depth + 1) : -1;
+    return gate < 0 ? -1 : add_gate(circuit, POLICY_GATE_NOT, gate, 0);
+  }
+
+  policy_gate_e op;
+  if (token_equals(compiler, operation, "eq")) {
+    op = POLICY_GATE_EQ;
+  } else if (token_equals(compiler, operation, "lt")) {
+    op = POLICY_GATE_LT;
+  } else if (token_equals(compiler, operation, "leq")) {
+    op = POLICY_GATE_LEQ;
+  } else if (token_equals(compiler, operation, "gt")) {
+    op = POLICY_GATE_GT;
+  } else if (token_equals(compiler, operation, "geq")) {
+    op = POLICY_GATE_GEQ;
+  } else {
+    return -1;
+  }
+
+  if (list_size != 2) {
+    return -1;
+  }
+  int lhs = compile_term(compiler, first);
+  int rhs = lhs < 0 ? -1 : compile_term(compiler, skip(compiler, first));
+  return rhs < 0 ? -1 : add_gate(circuit, op, lhs, rhs);
+}
+
+static policy_circuit_t *circuit_alloc(int strings_size) {
+  policy_circuit_t *circuit = calloc(1, sizeof(policy_circuit_t));
+
+  if (circuit != NULL) {
+    circuit->gates = malloc(POLICY_CIRCUIT_GATES_MAX * sizeof(policy_gate_t));
+    circuit->operands = malloc(POLICY_CIRCUIT_GATES_MAX * sizeof(unsigned short));
+    circuit->terms = malloc(POLICY_CIRCUIT_TERMS_MAX * sizeof(policy_term_t));
+    circuit->strings = malloc(strings_size > 0 ? strings_size : 1);
+    if (circuit->gates == NULL || circuit->operands == NULL || circuit->terms == NULL || circuit->strings == NULL) {
+      policy_circuit_free(circuit);
+      return NULL;
+    }
+  }
+
+  return circuit;
+}
+
+// Compiling works on worst case sized arrays; the kept circuit only holds what is used
+static void circuit_shrink(policy_circuit_t *circuit) {
+  void *p;
+
+  if ((p = realloc(circuit->gates, (circuit->gates_num ? circuit->gates_num : 1) * sizeof(policy_gate_t)))) {
+    circuit->gates = p;
+  }
+  if ((p = realloc(circuit->operands, (circuit->operands_num ? circuit->operands_num : 1) * sizeof(unsigned short)))) {
+    circuit->operands = p;
+  }
+  if ((p = realloc(circuit->terms, (circuit->terms_num ? circuit->terms_num : 1) * sizeof(policy_term_t)))) {
+    circuit->terms = p;
+  }
+}
+
+int policy_circuit_compile(const char *policy_object, int policy_object_len, policy_circuit_t **circuit) {
+  policy_compiler_t compiler;
+  jsmn_parser parser;
+
+  if (policy_object == NULL || circuit == NULL) {
+    return POLICY_CIRCUIT_ERROR;
+  }
+
+  jsmn_init(&parser);
+  int num_of_tokens = jsmn_parse(&parser, policy_object, policy_object_len, NULL, 0);
+  if (num_of_tokens <= 0) {
+    return POLICY_CIRCUIT_ERROR;
+  }
+
+  compiler.json = policy_object;
+  compiler.tokens = malloc(num_of_tokens * sizeof(jsmntok_t));
+  compiler.circuit = circuit_alloc(policy_object_len);
+  if (compiler.tokens == NULL || compiler.circuit == NULL) {
+    free(compiler.tokens);
+    policy_circuit_free(compiler.circuit);
+    return POLICY_CIRCUIT_ERROR;
+  }
+
+  jsmn_init(&parser);
+  compiler.num_of_tokens = jsmn_parse(&parser, policy_object, policy_object_len, compiler.tokens, num_of_tokens);
+
+  int ret = POLICY_CIRCUIT_ERROR;
+  if (compiler.num_of_tokens > 0 && compiler.tokens[0].type == JSMN_OBJECT) {
+    int goc = object_get(&compiler, 0, "policy_goc");
+    int doc = object_get(&compiler, 0, "policy_doc");
+    int precompute = object_get(&compiler, 0, "precompute");
+    compiler.circuit->precompute = precompute >= 0 && token_equals(&compiler, precompute, "true");
+
+    // A policy without a condition never reaches that side of the join
+    compiler.circuit->goc = goc < 0 ? -1 : compile_condition(&compiler, goc, 0);
+    compiler.circuit->doc = doc < 0 ? -1 : compile_condition(&compiler, doc, 0);
+    if ((goc >= 0 || doc >= 0) && (goc < 0 || compiler.circuit->goc >= 0) && (doc < 0 || compiler.circuit->doc >= 0)) {
+      ret = POLICY_CIRCUIT_OK;
+    }
+  }
+  free(compiler.tokens);
+
+  if (ret != POLICY_CIRCUIT_OK) {
+    policy_circuit_free(compiler.circuit);
+    return ret;
+  }
+
+  circuit_shrink(compiler.circuit);
+  *circuit = compiler.circuit;
+  return POLICY_CIRCUIT_OK;
+}
+
+int policy_circuit_attributes(const char *policy_object, int policy_object_len,
+                              char types[][POLICY_CIRCUIT_VALUE_LEN], int types_max) {
+  policy_compiler_t compiler = {policy_object, NULL, 0, NULL};
+  jsmn_parser parser;
+  int types_num = 0;
+
+  if (policy_object == NULL || types == NULL) {
+    return -1;
+  }
+
+  jsmn_init(&parser);
+  int num_of_tokens = jsmn_parse(&parser, policy_object, policy_object_len, NULL, 0);
+  if (num_of_tokens <= 0 || (compiler.tokens = malloc(num_of_tokens * sizeof(jsmntok_t))) == NULL) {
+    return -1;
+  }
+  jsmn_init(&parser);
+  compiler.num_of_tokens = jsmn_parse(&parser, policy_object, policy_object_len, compiler.tokens, num_of_tokens);
+
+  // Every "type" key with a request attribute as its value, wherever the operation holding it
+  for (int i = 0; i + 1 < compiler.num_of_tokens && types_num < types_max; i++) {
+    jsmntok_t *value = &compiler.tokens[i + 1];
+    const char *type = policy_object + value->start;
+    int type_len = value->end - value->start;
+    if (compiler.tokens[i].type != JSMN_STRING || !token_equals(&compiler, i, "type") || value->type != JSMN_STRING ||
+        type_len < strlen(POLICY_CIRCUIT_SLOT_PREFIX) || type_len >= POLICY_CIRCUIT_VALUE_LEN ||
+        strncmp(type, POLICY_CIRCUIT_SLOT_PREFIX, strlen(POLICY_CIRCUIT_SLOT_PREFIX)) != 0) {
+      continue;
+    }
+    int k = 0;
+    while (k < types_num && (strlen(types[k]) != type_len || memcmp(types[k], type, type_len) != 0)) {
+      k++;
+    }
+    if (k == types_num) {
+      memcpy(types[types_num], type, type_len);
+      types[types_num++][type_len] = '\0';
+    }
+  }
+  free(compiler.tokens);
+
+  return types_num;
+}
+
+void policy_circuit_free(policy_circuit_t *circuit) {
+  if (circuit != NULL) {
+    free(circuit->gates);
+    free(circuit->operands);
+    free(circuit->terms);
+    free(circuit->strings);
+    free(circuit);
+  }
+}
+
+int policy_circuit_gates(const policy_circuit_t *circuit) { return circuit->gates_num; }
+
+static int term_value(const policy_circuit_t *circuit, const policy_term_t *term, policy_slot_value_t *slots,
+                      policy_circuit_resolve_cb resolve, void *user_data, const char **str, int *len, double *number) {
+  if (term->slot < 0) {
+    *str = circuit->strings + term->offset;
+    *len = term->len;
+    *number = term->number;
+    return term->is_number;
+  }
+
+  policy_slot_value_t *slot = &slots[term->slot];
+  if (slot->resolved == 0) {
+    char value[POLICY_CIRCUIT_VALUE_LEN];
+    int len = resolve(circuit->strings + term->offset, term->len, user_data, value, POLICY_CIRCUIT_VALUE_LEN);
+    if (len < 0 || len >= POLICY_CIRCUIT_VALUE_LEN) {
+      slot->resolved = -1;
+    } else {
+      policy_circuit_set_slot(slot, value, len);
+    }
+  }
+  if (slot->resolved < 0) {
+    return -1;
+  }
+  *str = slot->value;
+  *len = slot->len;
+  *number = slot->number;
+  return slot->is_number;
+}
+
+static int ordering(const char *lhs, int lhs_len, const char *rhs, int rhs_len) {
+  int ret = memcmp(lhs, rhs, lhs_len < rhs_len ? lhs_len : rhs_len);
+  return ret != 0 ? ret : lhs_len - rhs_len;
+}
+
+// Numbers compare by value, anything else by its bytes
+static int values_order(const char *lhs, int lhs_len, int lhs_is_number, double lhs_number, const char *rhs,
+                        int rhs_len, int rhs_is_number, double rhs_number) {
+  if (lhs_is_number && rhs_is_number) {
+    return (lhs_number > rhs_number) - (lhs_number < rhs_number);
+  }
+  return ordering(lhs, lhs_len, rhs, rhs_len);
+}
+
+static int order_holds(unsigned char op, int order) {
+  switch (op) {
+    case POLICY_GATE_EQ:
+      return order == 0;
+    case POLICY_GATE_LT:
+      return order < 0;
+    case POLICY_GATE_LEQ:
+      return order <= 0;
+    case POLICY_GATE_GT:
+      return order > 0;
+    default:
+      return order >= 0;
+  }
+}
+
+int policy_circuit_compare(const policy_circuit_t *circuit, const policy_gate_t *gate, policy_slot_value_t *slots,
+                           policy_circuit_resolve_cb resolve, void *user_data) {
+  const char *lhs, *rhs;
+  int lhs_len, rhs_len;
+  double lhs_number, rhs_number;
+  int lhs_is_number =
+      term_value(circuit, &circuit->terms[gate->a], slots, resolve, user_data, &lhs, &lhs_len, &lhs_number);
+  int rhs_is_number =
+      lhs_is_number < 0 ? -1
+                        : term_value(circuit, &circuit->terms[gate->b], slots, resolve, user_data, &rhs, &rhs_len,
+                                     &rhs_number);
+  if (rhs_is_number < 0) {
+    return -1;
+  }
+
+  return order_holds(gate->op,
+                     values_order(lhs, lhs_len, lhs_is_number, lhs_number, rhs, rhs_len, rhs_is_number, rhs_number));
+}
+
+void policy_circuit_set_slot(policy_slot_value_t *slot, const char *value, int len) {
+  if (len < 0 || len >= POLICY_CIRCUIT_VALUE_LEN) {
+    slot->resolved = -1;
+    return;
+  }
+  memcpy(slot->value, value, len);
+  slot->len = len;
+  slot->is_number = parse_number(slot->value, slot->len, &slot->number);
+  slot->resolved = 1;
+}
+
+pdp_decision_e policy_circuit_evaluate(const policy_circuit_t *circuit, policy_circuit_resolve_cb resolve,
+                                       void *user_data) {
+  policy_slot_value_t slots[POLICY_CIRCUIT_SLOTS_MAX];
+
+  for (int i = 0; i < circuit->slots_num; i++) {
+    slots[i].resolved = 0;
+  }
+
+  return policy_circuit_evaluate_slots(circuit, slots, resolve, user_data);
+}
+
+pdp_decision_e policy_circuit_evaluate_slots(const policy_circuit_t *circuit, policy_slot_value_t *slots,
+                                             policy_circuit_resolve_cb resolve, void *user_data) {
+  unsigned char values[POLICY_CIRCUIT_GATES_MAX];
+
+  for (int i = 0; i < circuit->gates_num; i++) {
+    const policy_gate_t *gate = &circuit->gates[i];
+
+    switch (gate->op) {
+      case POLICY_GATE_TRUE:
+        values[i] = 1;
+        break;
+      case POLICY_GATE_FALSE:
+        values[i] = 0;
+        break;
+      case POLICY_GATE_AND:
+        values[i] = 1;
+        for (int k = gate->a; k < gate->a + gate->b; k++) {
+          values[i] &= values[circuit->operands[k]];
+        }
+        break;
+      case POLICY_GATE_OR:
+        values[i] = 0;
+        for (int k = gate->a; k < gate->a + gate->b; k++) {
+          values[i] |= values[circuit->operands[k]];
+        }
+        break;
+      case POLICY_GATE_NOT:
+        values[i] = !values[gate->a];
+        break;
+      default: {
+        int holds = policy_circuit_compare(circuit, gate, slots, resolve, user_data);
+        if (holds < 0) {
+          return PDP_ERROR;
+        }
+        values[i] = holds;
+        break;
+      }
+    }
+  }
+
+  return policy_circuit_decision(circuit->goc >= 0 && values[circuit->goc], circuit->doc >= 0 && values[circuit->doc]);
+}
+
+// Rows of a batch whose values are not shared
+typedef struct {
+  policy_column_t column;
+  unsigned char *is_number;
+  double *numbers;
+} policy_batch_column_t;
+
+static int batch_columns(const policy_circuit_t *circuit, int rows, policy_circuit_column_cb column, void *user_data,
+                         policy_batch_column_t *columns) {
+  for (int i = 0; i < circuit->slots_num; i++) {
+    policy_batch_column_t *batch_column = &columns[i];
+    if (column(circuit->strings + circuit->slot_offsets[i], circuit->slot_lens[i], user_data, &batch_column->column) !=
+        1) {
+      continue;
+    }
+
+    // Rows are parsed once, not once per comparison reading them
+    batch_column->is_number = calloc(rows, sizeof(unsigned char));
+    batch_column->numbers = malloc(rows * sizeof(double));
+    if (batch_column->is_number == NULL || batch_column->numbers == NULL) {
+      return -1;
+    }
+    for (int r = 0; r < rows; r++) {
+      if (batch_column->column.values[r] != NULL) {
+        batch_column->is_number[r] =
+            parse_number(batch_column->column.values[r], batch_column->column.lens[r], &batch_column->numbers[r]);
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Comparison over all rows; a row without a value is marked in errors
+static int compare_rows(const policy_circuit_t *circuit, const policy_gate_t *gate, policy_slot_value_t *slots,
+                        const policy_batch_column_t *columns, int rows, policy_circuit_resolve_cb resolve,
+                        void *user_data, uint64_t *value, uint64_t *errors) {
+  const policy_term_t *terms[2] = {&circuit->terms[gate->a], &circuit->terms[gate->b]};
+  const policy_batch_column_t *term_columns[2];
+  const char *str[2];
+  int len[2];
+  int is_number[2];
+  double number[2];
+  int words = (rows + POLICY_CIRCUIT_WORD_BITS - 1) / POLICY_CIRCUIT_WORD_BITS;
+
+  for (int t = 0; t < 2; t++) {
+    term_columns[t] =
+        terms[t]->slot >= 0 && columns[terms[t]->slot].numbers != NULL ? &columns[terms[t]->slot] : NULL;
+  }
+
+  // Same outcome for every row
+  if (term_columns[0] == NULL && term_columns[1] == NULL) {
+    int holds = policy_circuit_compare(circuit, gate, slots, resolve, user_data);
+    if (holds < 0) {
+      return -1;
+    }
+    for (int w = 0; w < words; w++) {
+      value[w] = (uint64_t)0 - (uint64_t)holds;
+    }
+    return 0;
+  }
+
+  for (int t = 0; t < 2; t++) {
+    if (term_columns[t] == NULL &&
+        (is_number[t] = term_value(circuit, terms[t], slots, resolve, user_data, &str[t], &len[t], &number[t])) < 0) {
+      return -1;
+    }
+  }
+
+  memset(value, 0, words * sizeof(uint64_t));
+  for (int r = 0; r < rows; r++) {
+    int missing = 0;
+    for (int t = 0; t < 2; t++) {
+      if (term_columns[t] != NULL) {
+        str[t] = term_columns[t]->column.values[r];
+        len[t] = term_columns[t]->column.lens[r];
+        is_number[t] = term_columns[t]->is_number[r];
+        number[t] = term_columns[t]->numbers[r];
+        missing |= str[t] == NULL || len[t] < 0 || len[t] >= POLICY_CIRCUIT_VALUE_LEN;
+      }
+    }
+
+    uint64_t bit = (uint64_t)1 << (r % POLICY_CIRCUIT_WORD_BITS);
+    if (missing) {
+      errors[r / POLICY_CIRCUIT_WORD_BITS] |= bit;
+      continue;
+    }
+    int holds = order_holds(gate->op, values_order(str[0], len[0], is_number[0], number[0], str[1], len[1],
+                                                   is_number[1], number[1]));
+    value[r / POLICY_CIRCUIT_WORD_BITS] |= bit & ((uint64_t)0 - (uint64_t)holds);
+  }
+
+  return 0;
+}
+
+int policy_circuit_evaluate_batch(const policy_circuit_t *circuit, int rows, policy_circuit_column_cb column,
+                                  policy_circuit_resolve_cb resolve, void *user_data, uint64_t *granted) {
+  policy_slot_value_t slots[POLICY_CIRCUIT_SLOTS_MAX];
+  policy_batch_column_t columns[POLICY_CIRCUIT_SLOTS_MAX];
+  int words = (rows + POLICY_CIRCUIT_WORD_BITS - 1) / POLICY_CIRCUIT_WORD_BITS;
+  uint64_t *values = NULL;
+  uint64_t *errors = NULL;
+  int ret = POLICY_CIRCUIT_ERROR;
+
+  if (rows <= 0) {
+    return rows == 0 ? 0 : POLICY_CIRCUIT_ERROR;
+  }
+
+  memset(columns, 0, sizeof(columns));
+  for (int i = 0; i < circuit->slots_num; i++) {
+    slots[i].resolved = 0;
+  }
+  // One bitset per gate, plus an all-zero one for a missing root
+  values = malloc((circuit->gates_num + 1) * words * sizeof(uint64_t));
+  errors = calloc(words, sizeof(uint64_t));
+  if (values == NULL || errors == NULL || batch_columns(circuit, rows, column, user_data, columns) != 0) {
+    goto done;
+  }
+
+  for (int i = 0; i < circuit->gates_num; i++) {
+    const policy_gate_t *gate = &circuit->gates[i];
+    uint64_t *value = values + i * words;
+
+    switch (gate->op) {
+      case POLICY_GATE_TRUE:
+      case POLICY_GATE_FALSE:
+        memset(value, gate->op == POLICY_GATE_TRUE ? 0xFF : 0, words * sizeof(uint64_t));
+        break;
+      case POLICY_GATE_AND:
+        memset(value, 0xFF, words * sizeof(uint64_t));
+        for (int k = gate->a; k < gate->a + gate->b; k++) {
+          const uint64_t *operand = values + circuit->operands[k] * words;
+          for (int w = 0; w < words; w++) {
+            value[w] &= operand[w];
+          }
+        }
+        break;
+      case POLICY_GATE_OR:
+        memset(value, 0, words * sizeof(uint64_t));
+        for (int k = gate->a; k < gate->a + gate->b; k++) {
+          const uint64_t *operand = values + circuit->operands[k] * words;
+          for (int w = 0; w < words; w++) {
+            value[w] |= operand[w];
+          }
+        }
+        break;
+      case POLICY_GATE_NOT: {
+        const uint64_t *operand = values + gate->a * words;
+        for (int w = 0; w < words; w++) {
+          value[w] = ~operand[w];
+        }
+        break;
+      }
+      default:
+        if (compare_rows(circuit, gate, slots, columns, rows, resolve, user_data, value, errors) != 0) {
+          goto done;
+        }
+        break;
+    }
+  }
+
+  // Granted where GoC holds and DoC does not, like policy_circuit_decision
+  uint64_t *none = values + circuit->gates_num * words;
+  memset(none, 0, words * sizeof(uint64_t));
+  const uint64_t *goc = circuit->goc >= 0 ? values + circuit->goc * words : none;
+  const uint64_t *doc = circuit->doc >= 0 ? values + circuit->doc * words : none;
+  ret = 0;
+  for (int w = 0; w < words; w++) {
+    granted[w] = goc[w] & ~doc[w] & ~errors[w];
+  }
+  if (rows % POLICY_CIRCUIT_WORD_BITS != 0) {
+    granted[words - 1] &= ((uint64_t)1 << (rows % POLICY_CIRCUIT_WORD_BITS)) - 1;
+  }
+  for (int w = 0; w < words; w++) {
+    ret += __builtin_popcountll(granted[w]);
+  }
+
+done:
+  for (int i = 0; i < circuit->slots_num; i++) {
+    free(columns[i].is_number);
+    free(columns[i].numbers);
+  }
+  free(values);
+  free(errors);
+
+  return ret;
+}
+
+pdp_decision_e policy_circuit_decision(int goc, int doc) {
+  // pol = (grant if GoC(pol)) join (deny if DoC(pol))
+  if (goc && doc) {
+    return PDP_CONFLICT;
+  } else if (goc) {
+    return PDP_GRANT;
+  } else if (doc) {
+    return PDP_DENY;
+  }
+  return PDP_UNDEFINED;
+}
+
+pdp_decision_e policy_circuit_join(pdp_decision_e a, pdp_decision_e b) {
+  if (a == PDP_ERROR || b == PDP_ERROR) {
+    return PDP_ERROR;
+  } else if (a == PDP_UNDEFINED || a == b) {
+    return b;
+  } else if (b == PDP_UNDEFINED) {
+    return a;
+  }
+  return PDP_CONFLICT;
+}
+
+static unsigned int store_bucket(const char *policy_id, int policy_id_len) {
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < policy_id_len; i++) {
+    // Hex ids name the same policy in either case
+    unsigned char c = policy_id[i];
+    hash = (hash ^ (c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c)) * 16777619u;
+  }
+  return hash % POLICY_CIRCUIT_STORE_BUCKETS;
+}
+
+static policy_circuit_entry_t **store_find(const char *policy_id, int policy_id_len) {
+  policy_circuit_entry_t **link = &store[store_bucket(policy_id, policy_id_len)];
+  while (*link != NULL &&
+         ((*link)->policy_id_len != policy_id_len || strncasecmp((*link)->policy_id, policy_id, policy_id_len))) {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+static void entry_release(policy_circuit_entry_t *entry) {
+  // The program refers to the circuit, so it goes first
+  policy_vm_free(entry->program);
+  policy_circuit_free(entry->circuit);
+  entry->program = NULL;
+  entry->circuit = NULL;
+}
+
+void policy_circuit_set_engine(policy_engine_e engine, policy_circuit_cost_cb cost) {
+  pthread_rwlock_wrlock(&store_lock);
+  engine_selected = engine;
+  engine_cost = cost;
+  pthread_rwlock_unlock(&store_lock);
+}
+
+void policy_circuit_set_prefetch(policy_circuit_prefetch_cb prefetch) {
+  pthread_rwlock_wrlock(&store_lock);
+  engine_prefetch = prefetch;
+  pthread_rwlock_unlock(&store_lock);
+}
+
+void policy_circuit_store(const char *policy_id, int policy_id_len, policy_circuit_t *circuit) {
+  policy_circuit_entry_t *entry = NULL;
+  policy_vm_program_t *program = NULL;
+
+  pthread_rwlock_wrlock(&store_lock);
+  // Without a program the circuit engine still evaluates the policy
+  if (engine_selected == POLICY_ENGINE_VM && policy_vm_compile(circuit, engine_cost, &program) != POLICY_CIRCUIT_OK) {
+    program = NULL;
+  }
+
+  policy_circuit_entry_t **link = store_find(policy_id, policy_id_len);
+  if (*link != NULL) {
+    entry = *link;
+    entry_release(entry);
+  } else if ((entry = calloc(1, sizeof(policy_circuit_entry_t))) != NULL &&
+             (entry->policy_id = malloc(policy_id_len)) != NULL) {
+    memcpy(entry->policy_id, policy_id, policy_id_len);
+    entry->policy_id_len = policy_id_len;
+    *link = entry;
+  } else {
+    free(entry);
+    entry = NULL;
+  }
+
+  if (entry != NULL) {
+    entry->circuit = circuit;
+    entry->program = program;
+  } else {
+    policy_vm_free(program);
+    policy_circuit_free(circuit);
+  }
+  pthread_rwlock_unlock(&store_lock);
+}
+
+void policy_circuit_drop(const char *policy_id, int policy_id_len) {
+  pthread_rwlock_wrlock(&store_lock);
+  policy_circuit_entry_t **link = store_find(policy_id, policy_id_len);
+  policy_circuit_entry_t *entry = *link;
+  if (entry != NULL) {
+    *link = entry->next;
+    entry_release(entry);
+    free(entry->policy_id);
+    free(entry);
+  }
+  pthread_rwlock_unlock(&store_lock);
+}
+
+pdp_decision_e policy_circuit_evaluate_stored(const char *policy_id, int policy_id_len,
+                                              policy_circuit_resolve_cb resolve, void *user_data) {
+  pdp_decision_e decision = PDP_ERROR;
+
+  pthread_rwlock_rdlock(&store_lock);
+  policy_circuit_entry_t *entry = *store_find(policy_id, policy_id_len);
+  if (entry != NULL) {
+    policy_slot_value_t slots[POLICY_CIRCUIT_SLOTS_MAX];
+    for (int i = 0; i < entry->circuit->slots_num; i++) {
+      slots[i].resolved = 0;
+    }
+    if (engine_prefetch != NULL) {
+      engine_prefetch(entry->circuit, slots, user_data);
+    }
+    decision = entry->program != NULL ? policy_vm_run(entry->program, slots, resolve, user_data)
+                                      : policy_circuit_evaluate_slots(entry->circuit, slots, resolve, user_data);
+  }
+  pthread_rwlock_unlock(&store_lock);
+
+  return decision;
+}
+
+int policy_circuit_evaluate_stored_batch(const char *policy_id, int policy_id_len, int rows,
+                                         policy_circuit_column_cb column, policy_circuit_resolve_cb resolve,
+                                         void *user_data, uint64_t *granted) {
+  int ret = POLICY_CIRCUIT_ERROR;
+
+  pthread_rwlock_rdlock(&store_lock);
+  policy_circuit_entry_t *entry = *store_find(policy_id, policy_id_len);
+  if (entry != NULL) {
+    ret = policy_circuit_evaluate_batch(entry->circuit, rows, column, resolve, user_data, granted);
+  }
+  pthread_rwlock_unlock(&store_lock);
+
+  return ret;
+}
+
+void policy_circuit_clear(void) {
+  pthread_rwlock_wrlock(&store_lock);
+  for (int i = 0; i < POLICY_CIRCUIT_STORE_BUCKETS; i++) {
+    while (store[i] != NULL) {
+      policy_circuit_entry_t *entry = store[i];
+      store[i] = entry->next;
+      entry_release(entry);
+      free(entry->policy_id);
+      free(entry);
+    }
+  }
+  pthread_rwlock_unlock(&store_lock);
+}
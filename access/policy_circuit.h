@@ -0,0 +1,318 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file policy_circuit.h
+ * \brief
+ * Policies compiled into flat Boolean circuits
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * The policy_goc and policy_doc conditions of a policy object are compiled
+ * once into a single gate array in topological order: every gate comes after
+ * the gates it reads. Attribute terms whose type starts with "request." become
+ * slots, resolved through a callback the first time a gate needs them; all
+ * other terms are constants. Evaluation is one pass over the gate array and
+ * the two roots are joined into a decision as described in
+ * docs/06-policy-specs.md.
+ *
+ * \history
+ * 02.11.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _POLICY_CIRCUIT_H_
+#define _POLICY_CIRCUIT_H_
+
+#include <stdint.h>
+
+#include "pdp.h"
+
+#define POLICY_CIRCUIT_GATES_MAX 256
+#define POLICY_CIRCUIT_SLOTS_MAX 16
+#define POLICY_CIRCUIT_VALUE_LEN 256
+
+#define POLICY_CIRCUIT_OK 0
+#define POLICY_CIRCUIT_ERROR -1
+
+typedef enum {
+  POLICY_GATE_TRUE,
+  POLICY_GATE_FALSE,
+  POLICY_GATE_AND,
+  POLICY_GATE_OR,
+  POLICY_GATE_NOT,
+  POLICY_GATE_EQ,
+  POLICY_GATE_LT,
+  POLICY_GATE_LEQ,
+  POLICY_GATE_GT,
+  POLICY_GATE_GEQ
+} policy_gate_e;
+
+// AND and OR read operands[a] to operands[a + b - 1], NOT reads gate a and
+// comparisons compare term a with term b
+typedef struct {
+  unsigned char op;
+  unsigned short a;
+  unsigned short b;
+} policy_gate_t;
+
+typedef struct {
+  // Slot index, or -1 for a constant
+  short slot;
+  unsigned short len;
+  // Constant value or slot type, in the string pool
+  int offset;
+  int is_number;
+  double number;
+} policy_term_t;
+
+typedef struct policy_circuit {
+  policy_gate_t *gates;
+  int gates_num;
+  unsigned short *operands;
+  int operands_num;
+  policy_term_t *terms;
+  int terms_num;
+  // Type of every slot, in the string pool
+  int slot_offsets[POLICY_CIRCUIT_SLOTS_MAX];
+  unsigned short slot_lens[POLICY_CIRCUIT_SLOTS_MAX];
+  int slots_num;
+  char *strings;
+  int strings_len;
+  // Root gates of GoC and DoC, -1 when the policy has no such condition
+  int goc;
+  int doc;
+  // The policy object asks for its decisions to be precomputed ("precompute":true)
+  int precompute;
+} policy_circuit_t;
+
+// Value of a slot during one evaluation
+typedef struct {
+  // 1 once resolved, 0 until then, -1 if known to be unavailable
+  int resolved;
+  int is_number;
+  double number;
+  int len;
+  char value[POLICY_CIRCUIT_VALUE_LEN];
+} policy_slot_value_t;
+
+// Values of a slot for every row of a batch
+typedef struct {
+  // Value of row i, not terminated, NULL if the row has no value
+  const char *const *values;
+  const int *lens;
+} policy_column_t;
+
+typedef enum { POLICY_ENGINE_CIRCUIT, POLICY_ENGINE_VM } policy_engine_e;
+
+/**
+ * @brief Resolve a request attribute
+ *
+ * @param type Attribute type, e.g. "request.action.value", not terminated
+ * @param type_len Length of the type
+ * @param user_data Data given to the evaluation
+ * @param value Buffer for the value
+ * @param value_size Size of the buffer
+ * @return Length of the value, or -1 if the attribute is not available
+ */
+typedef int (*policy_circuit_resolve_cb)(const char *type, int type_len, void *user_data, char *value,
+                                         int value_size);
+
+/**
+ * @brief Resolve slots ahead of an evaluation
+ *
+ * Called with every slot unresolved; slots left that way are resolved on
+ * demand during the evaluation.
+ *
+ * @param circuit Circuit about to be evaluated
+ * @param slots Slots of the circuit
+ * @param user_data Data given to the evaluation
+ */
+typedef void (*policy_circuit_prefetch_cb)(const policy_circuit_t *circuit, policy_slot_value_t *slots,
+                                           void *user_data);
+
+/**
+ * @brief Provide the values of a slot for every row of a batch
+ *
+ * @param type Attribute type, not terminated
+ * @param type_len Length of the type
+ * @param user_data Data given to the evaluation
+ * @param column Values of the rows
+ * @return 1 if column is set, 0 if the slot has one value for all rows, resolved through the resolve callback
+ */
+typedef int (*policy_circuit_column_cb)(const char *type, int type_len, void *user_data, policy_column_t *column);
+
+/**
+ * @brief Relative cost of fetching a request attribute
+ *
+ * @return 0 or more, higher for attributes that need a round trip
+ */
+typedef int (*policy_circuit_cost_cb)(const char *type, int type_len);
+
+/**
+ * @brief Compile the conditions of a policy object
+ *
+ * @param policy_object Policy object JSON holding policy_goc and policy_doc
+ * @param policy_object_len Length of the JSON
+ * @param circuit Compiled circuit, to be released with policy_circuit_free
+ * @return POLICY_CIRCUIT_OK, or POLICY_CIRCUIT_ERROR if the policy uses
+ * anything the circuit does not support
+ */
+int policy_circuit_compile(const char *policy_object, int policy_object_len, policy_circuit_t **circuit);
+
+/**
+ * @brief List the request attributes a policy object reads
+ *
+ * Works on policies the circuit cannot compile as well.
+ *
+ * @param policy_object Policy object JSON
+ * @param policy_object_len Length of the JSON
+ * @param types Distinct attribute types, terminated
+ * @param types_max Size of types
+ * @return Number of types, or -1 if the JSON could not be parsed
+ */
+int policy_circuit_attributes(const char *policy_object, int policy_object_len,
+                              char types[][POLICY_CIRCUIT_VALUE_LEN], int types_max);
+
+/**
+ * @brief Release a compiled circuit
+ */
+void policy_circuit_free(policy_circuit_t *circuit);
+
+/**
+ * @brief Evaluate a circuit
+ *
+ * @return Decision, or PDP_ERROR if a slot could not be resolved
+ */
+pdp_decision_e policy_circuit_evaluate(const policy_circuit_t *circuit, policy_circuit_resolve_cb resolve,
+                                       void *user_data);
+
+/**
+ * @brief Evaluate a circuit with slots resolved beforehand
+ *
+ * @param slots Slots of the circuit, unresolved ones are resolved on demand
+ * @return Decision, or PDP_ERROR if a slot is unavailable
+ */
+pdp_decision_e policy_circuit_evaluate_slots(const policy_circuit_t *circuit, policy_slot_value_t *slots,
+                                             policy_circuit_resolve_cb resolve, void *user_data);
+
+/**
+ * @brief Evaluate a circuit for every row of a batch
+ *
+ * Gates are evaluated over bitsets with one bit per row, AND, OR and NOT a
+ * word of 64 rows at a time. A comparison reading a column is evaluated per
+ * row, any other once for all rows. A row is granted where GoC holds and DoC
+ * does not; a row missing a value a comparison reads is not granted.
+ *
+ * @param rows Number of rows
+ * @param column Provides the columns of the slots
+ * @param granted Rows granted, row i is bit i % 64 of word i / 64, (rows + 63) / 64 words
+ * @return Number of rows granted, or POLICY_CIRCUIT_ERROR if a slot shared by all rows could not be resolved
+ */
+int policy_circuit_evaluate_batch(const policy_circuit_t *circuit, int rows, policy_circuit_column_cb column,
+                                  policy_circuit_resolve_cb resolve, void *user_data, uint64_t *granted);
+
+/**
+ * @brief Resolve a slot to a value
+ */
+void policy_circuit_set_slot(policy_slot_value_t *slot, const char *value, int len);
+
+/**
+ * @brief Evaluate a comparison gate, resolving the slots it reads
+ *
+ * @return 1 if the comparison holds, 0 if not, -1 if a slot could not be resolved
+ */
+int policy_circuit_compare(const policy_circuit_t *circuit, const policy_gate_t *gate, policy_slot_value_t *slots,
+                           policy_circuit_resolve_cb resolve, void *user_data);
+
+/**
+ * @brief Join the values of GoC and DoC into a decision
+ */
+pdp_decision_e policy_circuit_decision(int goc, int doc);
+
+/**
+ * @brief Join two decisions in the knowledge order of Belnap's logic
+ *
+ * Undefined joins to the other decision, grant and deny join to conflict, and an error joins to an error.
+ */
+pdp_decision_e policy_circuit_join(pdp_decision_e a, pdp_decision_e b);
+
+/**
+ * @brief Number of gates of a circuit
+ */
+int policy_circuit_gates(const policy_circuit_t *circuit);
+
+/**
+ * @brief Select how stored policies are evaluated
+ *
+ * With POLICY_ENGINE_VM, every circuit stored from then on is also compiled
+ * to bytecode (see policy_vm.h), ordering comparisons by the cost of the
+ * attributes they fetch.
+ *
+ * @param engine Engine evaluating stored policies
+ * @param cost Cost of attributes, NULL counts every attribute the same
+ */
+void policy_circuit_set_engine(policy_engine_e engine, policy_circuit_cost_cb cost);
+
+/**
+ * @brief Resolve the slots of stored circuits before they are evaluated
+ *
+ * @param prefetch Function resolving slots, NULL resolves every slot on demand
+ */
+void policy_circuit_set_prefetch(policy_circuit_prefetch_cb prefetch);
+
+/**
+ * @brief Keep the circuit of a policy, replacing the previous one
+ *
+ * The store takes ownership of the circuit. Stored circuits may be evaluated
+ * concurrently with policies being stored and dropped.
+ */
+void policy_circuit_store(const char *policy_id, int policy_id_len, policy_circuit_t *circuit);
+
+/**
+ * @brief Drop the circuit of a policy
+ */
+void policy_circuit_drop(const char *policy_id, int policy_id_len);
+
+/**
+ * @brief Evaluate the stored circuit of a policy
+ *
+ * @return Decision, or PDP_ERROR if the policy has no circuit or a slot could
+ * not be resolved
+ */
+pdp_decision_e policy_circuit_evaluate_stored(const char *policy_id, int policy_id_len,
+                                              policy_circuit_resolve_cb resolve, void *user_data);
+
+/**
+ * @brief Evaluate the stored circuit of a policy for every row of a batch, see policy_circuit_evaluate_batch
+ *
+ * @return Number of rows granted, or POLICY_CIRCUIT_ERROR if the policy has no circuit or a slot shared by all
+ * rows could not be resolved
+ */
+int policy_circuit_evaluate_stored_batch(const char *policy_id, int policy_id_len, int rows,
+                                         policy_circuit_column_cb column, policy_circuit_resolve_cb resolve,
+                                         void *user_data, uint64_t *granted);
+
+/**
+ * @brief Release all stored circuits
+ */
+void policy_circuit_clear(void);
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file policy_vm.c
+ * \brief
+ * Implementation of the policy bytecode compiler and interpreter
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 09.11.2020. Initial version.
+ ****************************************************************************/
+
+#include "policy_vm.h"
+
+#include <stdlib.h>
+
+// Every gate becomes at most one instruction, plus the two register sets,
+// the return and a jump for each missing condition
+#define POLICY_VM_CODE_MAX (POLICY_CIRCUIT_GATES_MAX + 5)
+#define POLICY_VM_LABELS_MAX (POLICY_CIRCUIT_GATES_MAX + 4)
+
+#define POLICY_VM_REG_GOC 0
+#define POLICY_VM_REG_DOC 1
+
+typedef struct {
+  const policy_circuit_t *circuit;
+  policy_circuit_cost_cb cost;
+  policy_vm_insn_t *code;
+  int code_len;
+  // Instruction each label points to; branches hold label ids until the end of compilation
+  int labels[POLICY_VM_LABELS_MAX];
+  int labels_num;
+  int costs[POLICY_CIRCUIT_GATES_MAX];
+} policy_vm_compiler_t;
+
+static int new_label(policy_vm_compiler_t *compiler) {
+  compiler->labels[compiler->labels_num] = -1;
+  return compiler->labels_num++;
+}
+
+static void place_label(policy_vm_compiler_t *compiler, int label) { compiler->labels[label] = compiler->code_len; }
+
+static void emit(policy_vm_compiler_t *compiler, policy_vm_op_e op, int a, int t, int f) {
+  policy_vm_insn_t *insn = &compiler->code[compiler->code_len++];
+  insn->op = op;
+  insn->a = a;
+  insn->t = t;
+  insn->f = f;
+}
+
+static int term_cost(policy_vm_compiler_t *compiler, int term_index) {
+  const policy_term_t *term = &compiler->circuit->terms[term_index];
+
+  if (term->slot < 0) {
+    return 0;
+  }
+  return compiler->cost != NULL ? compiler->cost(compiler->circuit->strings + term->offset, term->len) : 1;
+}
+
+static void gate_costs(policy_vm_compiler_t *compiler) {
+  const policy_circuit_t *circuit = compiler->circuit;
+
+  // Operands precede the gates reading them, so one pass in order is enough
+  for (int i = 0; i < circuit->gates_num; i++) {
+    const policy_gate_t *gate = &circuit->gates[i];
+    switch (gate->op) {
+      case POLICY_GATE_TRUE:
+      case POLICY_GATE_FALSE:
+        compiler->costs[i] = 0;
+        break;
+      case POLICY_GATE_NOT:
+        compiler->costs[i] = compiler->costs[gate->a];
+        break;
+      case POLICY_GATE_AND:
+      case POLICY_GATE_OR:
+        compiler->costs[i] = 0;
+        for (int k = gate->a; k < gate->a + gate->b; k++) {
+          compiler->costs[i] += compiler->costs[circuit->operands[k]];
+        }
+        break;
+      default:
+        compiler->costs[i] = term_cost(compiler, gate->a) + term_cost(compiler, gate->b);
+        break;
+    }
+  }
+}
+
+// Jumping code: control reaches on_true if the gate holds, on_false otherwise
+static void generate(policy_vm_compiler_t *compiler, int gate_index, int on_true, int on_false) {
+  const policy_circuit_t *circuit = compiler->circuit;
+  const policy_gate_t *gate = &circuit->gates[gate_index];
+
+  switch (gate->op) {
+    case POLICY_GATE_TRUE:
+      emit(compiler, POLICY_VM_JMP, 0, on_true, 0);
+      break;
+    case POLICY_GATE_FALSE:
+      emit(compiler, POLICY_VM_JMP, 0, on_false, 0);
+      break;
+    case POLICY_GATE_NOT:
+      generate(compiler, gate->a, on_false, on_true);
+      break;
+    case POLICY_GATE_AND:
+    case POLICY_GATE_OR: {
+      unsigned short order[POLICY_CIRCUIT_GATES_MAX];
+      int n = gate->b;
+
+      // Cheapest operand first, stable so equal costs keep the policy's order
+      for (int k = 0; k < n; k++) {
+        unsigned short operand = circuit->operands[gate->a + k];
+        int j = k;
+        while (j > 0 && compiler->costs[order[j - 1]] > compiler->costs[operand]) {
+          order[j] = order[j - 1];
+          j--;
+        }
+        order[j] = operand;
+      }
+
+      for (int k = 0; k < n - 1; k++) {
+        int next = new_label(compiler);
+        if (gate->op == POLICY_GATE_AND) {
+          generate(compiler, order[k], next, on_false);
+        } else {
+          generate(compiler, order[k], on_true, next);
+        }
+        place_label(compiler, next);
+      }
+      generate(compiler, order[n - 1], on_true, on_false);
+      break;
+    }
+    default:
+      emit(compiler, POLICY_VM_CMP, gate_index, on_true, on_false);
+      break;
+  }
+}
+
+int policy_vm_compile(const policy_circuit_t *circuit, policy_circuit_cost_cb cost, policy_vm_program_t **program) {
+  policy_vm_compiler_t *compiler;
+
+  if (circuit == NULL || program == NULL) {
+    return POLICY_CIRCUIT_ERROR;
+  }
+
+  compiler = calloc(1, sizeof(policy_vm_compiler_t));
+  policy_vm_program_t *compiled = calloc(1, sizeof(policy_vm_program_t));
+  if (compiler == NULL || compiled == NULL ||
+      (compiler->code = malloc(POLICY_VM_CODE_MAX * sizeof(policy_vm_insn_t))) == NULL) {
+    free(compiler);
+    free(compiled);
+    return POLICY_CIRCUIT_ERROR;
+  }
+  compiler->circuit = circuit;
+  compiler->cost = cost;
+  gate_costs(compiler);
+
+  int goc_true = new_label(compiler);
+  int doc_start = new_label(compiler);
+  int doc_true = new_label(compiler);
+  int end = new_label(compiler);
+
+  if (circuit->goc >= 0) {
+    generate(compiler, circuit->goc, goc_true, doc_start);
+  } else {
+    emit(compiler, POLICY_VM_JMP, 0, doc_start, 0);
+  }
+  place_label(compiler, goc_true);
+  emit(compiler, POLICY_VM_SET, POLICY_VM_REG_GOC, 0, 0);
+
+  place_label(compiler, doc_start);
+  if (circuit->doc >= 0) {
+    generate(compiler, circuit->doc, doc_true, end);
+  } else {
+    emit(compiler, POLICY_VM_JMP, 0, end, 0);
+  }
+  place_label(compiler, doc_true);
+  emit(compiler, POLICY_VM_SET, POLICY_VM_REG_DOC, 0, 0);
+
+  place_label(compiler, end);
+  emit(compiler, POLICY_VM_RET, 0, 0, 0);
+
+  // Labels are all placed now, branches get their instruction indexes
+  for (int i = 0; i < compiler->code_len; i++) {
+    policy_vm_insn_t *insn = &compiler->code[i];
+    if (insn->op == POLICY_VM_JMP || insn->op == POLICY_VM_CMP) {
+      insn->t = compiler->labels[insn->t];
+    }
+    if (insn->op == POLICY_VM_CMP) {
+      insn->f = compiler->labels[insn->f];
+    }
+  }
+
+  compiled->circuit = circuit;
+  compiled->code_len = compiler->code_len;
+  compiled->code = realloc(compiler->code, compiler->code_len * sizeof(policy_vm_insn_t));
+  if (compiled->code == NULL) {
+    compiled->code = compiler->code;
+  }
+  free(compiler);
+
+  *program = compiled;
+  return POLICY_CIRCUIT_OK;
+}
+
+void policy_vm_free(policy_vm_program_t *program) {
+  if (program != NULL) {
+    free(program->code);
+    free(program);
+  }
+}
+
+pdp_decision_e policy_vm_run(const policy_vm_program_t *program, policy_slot_value_t *slots,
+                             policy_circuit_resolve_cb resolve, void *user_data) {
+  const policy_circuit_t *circuit = program->circuit;
+  int registers[2] = {0, 0};
+  int pc = 0;
+
+  // Every branch goes forward, so the loop ends at the return
+  for (;;) {
+    const policy_vm_insn_t *insn = &program->code[pc];
+
+    switch (insn->op) {
+      case POLICY_VM_JMP:
+        pc = insn->t;
+        break;
+      case POLICY_VM_CMP: {
+        int holds = policy_circuit_compare(circuit, &circuit->gates[insn->a], slots, resolve, user_data);
+        if (holds < 0) {
+          return PDP_ERROR;
+        }
+        pc = holds ? insn->t : insn->f;
+        break;
+      }
+      case POLICY_VM_SET:
+        registers[insn->a] = 1;
+        pc++;
+        break;
+      default:
+        return policy_circuit_decision(registers[POLICY_VM_REG_GOC], registers[POLICY_VM_REG_DOC]);
+    }
+  }
+}
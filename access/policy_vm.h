@@ -0,0 +1,100 @@
+/*
+ * This file is part of the IOTA Access Distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file policy_vm.h
+ * \brief
+ * Bytecode for policy circuits
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * A circuit is compiled into branching code: every comparison is one
+ * instruction that jumps to one of two targets, and "and", "or" and "not"
+ * only decide where those targets point. Evaluation stops testing a
+ * condition as soon as its outcome is known, so attributes of the untested
+ * comparisons are never fetched. Operands of "and" and "or" are reordered by
+ * the cost of the attributes they fetch, cheapest first. Two registers hold
+ * GoC and DoC; the last instruction joins them into the decision.
+ *
+ * \history
+ * 09.11.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _POLICY_VM_H_
+#define _POLICY_VM_H_
+
+#include "policy_circuit.h"
+
+typedef enum {
+  // Continue at t
+  POLICY_VM_JMP,
+  // Comparison gate a of the circuit: continue at t if it holds, at f otherwise
+  POLICY_VM_CMP,
+  // Set register a and continue with the next instruction
+  POLICY_VM_SET,
+  // Join register 0 (GoC) and register 1 (DoC) into the decision
+  POLICY_VM_RET
+} policy_vm_op_e;
+
+typedef struct {
+  unsigned char op;
+  unsigned short a;
+  unsigned short t;
+  unsigned short f;
+} policy_vm_insn_t;
+
+typedef struct {
+  // Terms, slots and comparisons the code refers to
+  const policy_circuit_t *circuit;
+  policy_vm_insn_t *code;
+  int code_len;
+} policy_vm_program_t;
+
+/**
+ * @brief Compile a circuit to bytecode
+ *
+ * The program refers to the circuit, which must outlive it.
+ *
+ * @param circuit Compiled policy
+ * @param cost Cost of attributes, NULL counts every attribute the same
+ * @param program Compiled program, to be released with policy_vm_free
+ * @return POLICY_CIRCUIT_OK or POLICY_CIRCUIT_ERROR
+ */
+int policy_vm_compile(const policy_circuit_t *circuit, policy_circuit_cost_cb cost, policy_vm_program_t **program);
+
+/**
+ * @brief Release a program
+ */
+void policy_vm_free(policy_vm_program_t *program);
+
+/**
+ * @brief Run a program
+ *
+ * @param program Compiled program
+ * @param slots Slots of the program's circuit, unresolved ones are resolved on demand
+ * @param resolve Function resolving slots
+ * @param user_data Data given to resolve
+ * @return Decision, or PDP_ERROR if a slot the evaluation needed could not be resolved
+ */
+pdp_decision_e policy_vm_run(const policy_vm_program_t *program, policy_slot_value_t *slots,
+                             policy_circuit_resolve_cb resolve, void *user_data);
+
+#endif
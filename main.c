@@ -19,13 +19,16 @@
 
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "access.h"
 #include "config_manager.h"
 #include "dataset.h"
 #include "network.h"
+#include "network_dispatch.h"
 #include "pap_plugin_posix.h"
+#include "pep_obligation.h"
 #include "pep_plugin_print.h"
 #include "policy_loader.h"
 
@@ -33,6 +36,11 @@
 #define MAX_STR_LEN 512
 #define SEED_LEN 81 + 1
 #define MAX_PEM_LEN 4 * 1024
+#define TX_HASH_LEN 81
+#define OBLIGATION_JOURNAL "obligations.journal"
+#define OBLIGATION_WORKERS 1
+#define OBLIGATION_RETRIES 5
+#define OBLIGATION_RETRY_DELAY_MS 1000
 
 static char client_name[MAX_CLIENT_NAME];
 int g_task_sleep_time;
@@ -81,6 +89,43 @@ int wallet_init() {
   return 0;
 }
 
+static int notify_transaction(network_request_t *request, network_response_t *response, void *user_data) {
+  wallet_ctx_t *wallet = (wallet_ctx_t *)user_data;
+  char tx_hash[TX_HASH_LEN + 1] = {0};
+
+  if (network_request_copy(request, "transaction_hash", tx_hash, sizeof(tx_hash)) != TX_HASH_LEN) {
+    return network_response_printf(response, "{\"error\":\"invalid transaction\"}");
+  }
+
+  if (wallet_check_confirmation(wallet, tx_hash)) {
+    return network_response_printf(response, "{\"response\":\"transaction confirmed\"}");
+  }
+
+  return network_response_printf(response, "{\"response\":\"transaction pending\"}");
+}
+
+// Obligations go on after the request, Tangle logging is retried while the node is unreachable
+static int obligation_init() {
+  char journal[MAX_STR_LEN] = OBLIGATION_JOURNAL;
+  int workers, retries, retry_delay_ms;
+
+  if (CONFIG_MANAGER_OK != config_manager_get_option_string("pep", "obligation_journal", journal, MAX_STR_LEN)) {
+    strcpy(journal, OBLIGATION_JOURNAL);
+  }
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("pep", "obligation_workers", &workers) || workers <= 0) {
+    workers = OBLIGATION_WORKERS;
+  }
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("pep", "obligation_retries", &retries) || retries <= 0) {
+    retries = OBLIGATION_RETRIES;
+  }
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("pep", "obligation_retry_delay_ms", &retry_delay_ms) ||
+      retry_delay_ms < 0) {
+    retry_delay_ms = OBLIGATION_RETRY_DELAY_MS;
+  }
+
+  return pep_obligation_init(journal, workers, retries, retry_delay_ms);
+}
+
 int main(int argc, char **argv) {
   
   signal(SIGINT, signal_handler);
@@ -99,6 +144,11 @@ int main(int argc, char **argv) {
     printf("\nERROR[%s]: Wallet creation failed. Aborting.\n", __FUNCTION__);
   }
 
+  if (obligation_init() != 0) {
+    printf("\nERROR[%s]: Obligation queue could not be started, obligations run in the request path.\n",
+           __FUNCTION__);
+  }
+
   // register plugins
   plugin_t plugin;
 
@@ -114,6 +164,11 @@ int main(int argc, char **argv) {
 
   network_init(&network_context);
 
+  // Confirmation lookups go to the IOTA node and do not need the Access Core lock
+  if (wallet_context != NULL) {
+    network_dispatch_register(COMMAND_NOTIFY_TRANSACTION, "notify_transaction", notify_transaction, wallet_context, 0);
+  }
+
   access_start();
   if (network_start(network_context) != 0) {
     fprintf(stderr, "Error starting Network actor\n");
@@ -125,6 +180,9 @@ int main(int argc, char **argv) {
   // Stop threads
   network_stop(network_context);
 
+  // Before the PEP plugins go with the Access Core, the handlers are theirs and still use the wallet
+  pep_obligation_term();
+
   access_term();
 
   policyloader_stop();
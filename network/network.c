@@ -31,6 +31,9 @@
  * 07.11.2019. Initial version.
  ****************************************************************************/
 
+// For struct ucred of SO_PEERCRED
+#define _GNU_SOURCE
+
 #include "tcpip.h"
 #include "network.h"
 #include "auth.h"
@@ -39,69 +42,279 @@
 #include "network_logger.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "access.h"
+#include "access_flight.h"
+#include "access_precompute.h"
+#include "access_timeindex.h"
 #include "auth_helper.h"
 #include "config_manager.h"
-#include "globals_declarations.h"
-#include "json_helper.h"
+#include "jsmn.h"
+#include "network_binary.h"
+#include "network_dispatch.h"
+#include "network_mac.h"
+#include "network_response.h"
+#include "network_stats.h"
+#include "network_timer.h"
 #include "pap.h"
 #include "pap_plugin.h"
 #include "pep.h"
 #include "pip.h"
+#include "pip_cache.h"
 #include "policy_updater.h"
 #include "utils.h"
 
 #define SEND_BUFF_LEN 4096
 #define READ_BUFF_LEN 1025
 #define BUF_LEN 80
+#define PEP_REQUEST_LEN 256
 #define CONNECTION_BACKLOG_LEN 10
 #define POL_ID_HEX_LEN 32
 #define POL_ID_STR_LEN 64
 #define USERNAME_LEN 128
 #define USER_DATA_LEN 4096
-#define TIME_50MS 50000
-#define MAX_TRY_NUM 350
+// Users the PAP lists for get_all_users and who_can, rendered into one buffer
+#define USER_LIST_LEN (1024 * 1024)
+// Lists the SDK renders for get_policy_list and get_dataset
+#define POLICY_LIST_LEN (256 * 1024)
+#define DATASET_LEN (64 * 1024)
+#define USER_KEY "username"
+#define USER_FIELDS_MAX 16
+#define USER_FIELD_TYPE_LEN 64
+#define TIME_50MS 50
+#define MAX_EPOLL_EVENTS 64
+#define MAX_WORKER_THREADS 64
+#define IDLE_TIMEOUT_MS 5000
+#define HANDSHAKE_TIMEOUT_MS 5000
+#define REQUEST_TIMEOUT_MS 10000
+#define DEADLINE_TICK_US 10000ULL
+#define QUEUE_HIGH_WATERMARK 64
+#define BUSY_RETRY_AFTER_MS 200
+#define STATS_DUMP_INTERVAL_S 60
+#define UNIX_PATH_LEN 108
+#define TRUSTED_UIDS_LEN 256
+#define MAX_TRUSTED_UIDS 16
+#define PLAIN_HEADER_LEN 2
+#define RECEIVE_PENDING 1
+#define AUTH_FAILED_MSG "{\"error\":\"authentication failed\"}"
+#define RESPONSE_TOO_LARGE_MSG "{\"error\":\"response too large, request it chunked\"}"
+
+// Session resumption: a returning client opens with RESUME_MAGIC, the ticket
+// id, a fresh nonce and a MAC over both under the ticket key, instead of the
+// first key exchange message.
+#define RESUME_MAGIC "ASRT"
+#define RESUME_MAGIC_LEN 4
+#define RESUME_TICKET_LEN 16
+#define RESUME_NONCE_LEN 16
+#define RESUME_PREAMBLE_LEN (RESUME_MAGIC_LEN + RESUME_TICKET_LEN + RESUME_NONCE_LEN + NETWORK_MAC_LEN)
+#define RESUME_PENDING 1
+#define RESUME_MAGIC_PENDING 2
+#define RESUME_CACHE_SIZE 64
+#define RESUME_CACHE_SIZE_MAX 4096
+#define RESUME_TICKET_LIFETIME_S 300
+#define RESUMED_MSG "{\"response\":\"resumed\"}"
+#define RESUME_FAILED_MSG "{\"error\":\"resumption failed\"}"
 
 #define NO_ERROR 0
 #define ERROR_BIND_FAILED 1
 #define ERROR_LISTEN_FAILED 2
 #define ERROR_CREATE_THREAD_FAILED 3
+#define ERROR_EPOLL_FAILED 4
+
+// Every accepted client walks through these phases; the event loop moves a
+// connection one phase forward whenever its socket has something to read.
+typedef enum {
+  NETWORK_CONN_AUTH,
+  NETWORK_CONN_RECEIVE,
+  NETWORK_CONN_DECIDE,
+  NETWORK_CONN_SEND,
+  NETWORK_CONN_CLOSE
+} network_conn_state_e;
+
+// What the connection's deadline timer currently guards
+typedef enum { NETWORK_DEADLINE_HANDSHAKE, NETWORK_DEADLINE_IDLE, NETWORK_DEADLINE_REQUEST } network_deadline_e;
+
+typedef struct network_conn {
+  int fd;
+  network_conn_state_e state;
+  auth_ctx_t session;
+  int has_session;
+  // Local peer with a trusted UID: no handshake, plain length-prefixed frames
+  int trusted;
+
+  char *recv_data;
+  unsigned short recv_len;
+  network_response_t response;
+  // Plain frame received so far: its header, then recv_got bytes of the payload
+  unsigned char plain_header[PLAIN_HEADER_LEN];
+  int plain_header_len;
+  unsigned short recv_got;
+  // Set once the first byte of the current request was read, zero in between
+  unsigned long long receive_start_us;
+  // Cleared once the socket was handed to the auth layer
+  int nonblocking;
+
+  // Keep-alive bookkeeping, in microseconds of CLOCK_MONOTONIC
+  unsigned long long accepted_us;
+  unsigned long long handshake_us;
+  unsigned int requests;
+
+  // One timer per connection, moved to the deadline of each phase
+  network_timer_t deadline;
+  network_deadline_e deadline_kind;
+  // Looks at the connection again while part of the resumption magic waits in the socket
+  network_timer_t retry;
+
+  // Ticket handed out on this session; the session is parked under it on close
+  unsigned char ticket[RESUME_TICKET_LEN];
+  unsigned char ticket_key[NETWORK_MAC_KEY_LEN];
+  int has_ticket;
+
+  // Resumption preamble read so far; it may arrive over several wakeups
+  unsigned char preamble[RESUME_PREAMBLE_LEN];
+  int preamble_len;
+
+  struct network_shard *shard;
+  struct network_conn *prev;
+  struct network_conn *next;
+  struct network_conn *queue_next;
+} network_conn_t;
+
+// Authenticated session parked after its connection closed. The auth context
+// keeps the keys derived from K and H, so a client holding the same context
+// can go on exchanging frames on a new socket without another key exchange.
+typedef struct network_resume_entry {
+  unsigned char ticket[RESUME_TICKET_LEN];
+  unsigned char key[NETWORK_MAC_KEY_LEN];
+  auth_ctx_t session;
+  unsigned long long expires_us;
+  int used;
+
+  struct network_resume_entry *prev;
+  struct network_resume_entry *next;
+} network_resume_entry_t;
 
-#define COMMAND_RESOLVE 0
-#define COMMAND_GET_POL_LIST 1
-#define COMMAND_ENABLE_POLICY 2
-#define COMMAND_SET_DATASET 3
-#define COMMAND_GET_DATASET 4
-#define COMMAND_GET_USER_OBJ 5
-#define COMMAND_GET_USERID 6
-#define COMMAND_REDISTER_USER 7
-#define COMMAND_GET_ALL_USER 8
-#define COMMAND_CLEAR_ALL_USER 9
-#define COMMAND_NOTIFY_TRANSACTION 10
+typedef struct network_ctx_internal network_ctx_internal_t;
+typedef struct network_shard network_shard_t;
 
 typedef struct {
   pthread_t thread;
-  auth_ctx_t session;
-  int state;
-  int DAC_AUTH;
+  int running;
+  network_ctx_internal_t *ctx;
+  network_shard_t *shard;
   char send_buffer[SEND_BUFF_LEN];
-
+  // Written only by this worker, merged by readers
+  network_stats_t stats;
+} network_worker_t;
+
+// Listening socket with its own event loop, worker queue and deadlines. With
+// several shards each one binds tcp_port with SO_REUSEPORT and the kernel
+// spreads new connections over them, so shards share nothing on the accept path.
+struct network_shard {
+  network_ctx_internal_t *ctx;
+  pthread_t thread;
+  int running;
+  int listenfd;
+  int epollfd;
+
+  // Open connections and the queue of connections ready for a worker
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  network_conn_t *conns;
+  network_conn_t *queue_head;
+  network_conn_t *queue_tail;
+  int queue_len;
+  int shedding;
+  unsigned long long accepted;
+  unsigned long long shed;
+
+  // Deadlines of the shard's connections, guarded by lock
+  network_timer_wheel_t deadlines;
+  unsigned long long deadlines_expired;
+
+  // Keep-alive counters, guarded by lock
+  unsigned long long handshakes;
+  unsigned long long handshake_us_total;
+  unsigned long long requests_reused;
+
+  // Workers serving this shard's queue, a slice of the context's workers
+  network_worker_t *workers;
+  int worker_count;
+};
+
+struct network_ctx_internal {
   unsigned short port;
+  int backlog;
+  int keepalive;
+  int idle_timeout_ms;
+  int handshake_timeout_ms;
+  int request_timeout_ms;
   int end;
 
-  int listenfd;
-  int connfd;
-} network_ctx_internal_t;
+  // Admission control on the worker queue, with hysteresis between the marks
+  int queue_high_watermark;
+  int queue_low_watermark;
+  int busy_retry_after_ms;
+  int stats_dump_interval_s;
+
+  network_shard_t *shards;
+  int shard_count;
+
+  // Optional AF_UNIX listener for clients on the same board, on the first shard
+  char unix_path[UNIX_PATH_LEN];
+  int unix_listenfd;
+  uid_t trusted_uids[MAX_TRUSTED_UIDS];
+  int trusted_uids_num;
+
+  network_worker_t *workers;
+  int worker_count;
+
+  // Serializes calls into the Access Core API, which keeps shared parser state
+  pthread_mutex_t core_lock;
+
+  // Resumption ticket cache, most recently parked session first
+  pthread_mutex_t resume_lock;
+  network_resume_entry_t *resume_entries;
+  network_resume_entry_t *resume_head;
+  network_resume_entry_t *resume_tail;
+  int resume_capacity;
+  int resume_count;
+  unsigned long long resume_lifetime_us;
+  unsigned long long resumptions;
+};
 
 static void *network_thread_function(void *ptr);
+static unsigned long long now_us(void);
+static void *network_worker_function(void *ptr);
+static void conn_close(network_ctx_internal_t *ctx, network_conn_t *conn);
+static void resume_clear(network_ctx_internal_t *ctx);
+static void register_commands(network_ctx_internal_t *ctx);
+static int unix_listen(network_ctx_internal_t *ctx);
+static void unix_close(network_ctx_internal_t *ctx);
+static int command_get_stats(network_request_t *request, network_response_t *response, void *user_data);
+static int issue_ticket(network_ctx_internal_t *ctx, network_conn_t *conn, network_response_t *response);
 
 int network_init(network_ctx_t *network_context) {
   network_ctx_internal_t *ctx = malloc(sizeof(network_ctx_internal_t));
 
+  // Loggers first, so problems with the configuration are reported
+  logger_init_network(LOGGER_INFO);
+  logger_init_auth(LOGGER_INFO);
+  logger_init_crypto(LOGGER_INFO);
+
   config_manager_init("config.ini");
   int tcp_port;
   if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "tcp_port", &tcp_port)) {
@@ -110,322 +323,1863 @@ int network_init(network_ctx_t *network_context) {
     ctx->port = tcp_port;
   }
 
-  ctx->state = 0;
-  ctx->DAC_AUTH = 1;
+  int backlog;
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "connection_backlog", &backlog) || backlog <= 0) {
+    ctx->backlog = CONNECTION_BACKLOG_LEN;
+  } else {
+    ctx->backlog = backlog;
+  }
+
+  int worker_count;
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "worker_threads", &worker_count) ||
+      worker_count <= 0) {
+    worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  ctx->worker_count = worker_count < 1 ? 1 : (worker_count > MAX_WORKER_THREADS ? MAX_WORKER_THREADS : worker_count);
+
+  // Every shard needs at least one worker of its own
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "listen_shards", &ctx->shard_count) ||
+      ctx->shard_count <= 0) {
+    ctx->shard_count = 1;
+  } else if (ctx->shard_count > ctx->worker_count) {
+    ctx->shard_count = ctx->worker_count;
+  }
+
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "keepalive", &ctx->keepalive)) {
+    ctx->keepalive = 0;
+  }
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "idle_timeout_ms", &ctx->idle_timeout_ms) ||
+      ctx->idle_timeout_ms <= 0) {
+    ctx->idle_timeout_ms = IDLE_TIMEOUT_MS;
+  }
+  if (CONFIG_MANAGER_OK !=
+          config_manager_get_option_int("network", "handshake_timeout_ms", &ctx->handshake_timeout_ms) ||
+      ctx->handshake_timeout_ms <= 0) {
+    ctx->handshake_timeout_ms = HANDSHAKE_TIMEOUT_MS;
+  }
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "request_timeout_ms", &ctx->request_timeout_ms) ||
+      ctx->request_timeout_ms <= 0) {
+    ctx->request_timeout_ms = REQUEST_TIMEOUT_MS;
+  }
+
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "queue_high_watermark", &ctx->queue_high_watermark) ||
+      ctx->queue_high_watermark <= 0) {
+    ctx->queue_high_watermark = QUEUE_HIGH_WATERMARK;
+  }
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "queue_low_watermark", &ctx->queue_low_watermark) ||
+      ctx->queue_low_watermark < 0 || ctx->queue_low_watermark >= ctx->queue_high_watermark) {
+    ctx->queue_low_watermark = ctx->queue_high_watermark / 2;
+  }
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "busy_retry_after_ms", &ctx->busy_retry_after_ms) ||
+      ctx->busy_retry_after_ms < 0) {
+    ctx->busy_retry_after_ms = BUSY_RETRY_AFTER_MS;
+  }
+
+  if (CONFIG_MANAGER_OK !=
+          config_manager_get_option_int("network", "stats_dump_interval_s", &ctx->stats_dump_interval_s) ||
+      ctx->stats_dump_interval_s < 0) {
+    ctx->stats_dump_interval_s = STATS_DUMP_INTERVAL_S;
+  }
+
+  if (CONFIG_MANAGER_OK != config_manager_get_option_string("network", "unix_socket_path", ctx->unix_path,
+                                                            UNIX_PATH_LEN)) {
+    ctx->unix_path[0] = '\0';
+  }
+
+  char trusted_uids[TRUSTED_UIDS_LEN] = {0};
+  ctx->trusted_uids_num = 0;
+  if (CONFIG_MANAGER_OK ==
+      config_manager_get_option_string("network", "unix_trusted_uids", trusted_uids, TRUSTED_UIDS_LEN)) {
+    char *save = NULL;
+    for (char *uid = strtok_r(trusted_uids, ", ", &save); uid != NULL && ctx->trusted_uids_num < MAX_TRUSTED_UIDS;
+         uid = strtok_r(NULL, ", ", &save)) {
+      // A typo must not turn into UID 0, so only whole unsigned numbers count
+      char *end = NULL;
+      errno = 0;
+      unsigned long value = strtoul(uid, &end, 10);
+      if (uid[0] < '0' || uid[0] > '9' || *end != '\0' || errno == ERANGE || value != (uid_t)value) {
+        log_error(network_logger_id, "[%s:%d] ignoring invalid trusted uid \"%s\".\n", __func__, __LINE__, uid);
+        continue;
+      }
+      ctx->trusted_uids[ctx->trusted_uids_num++] = (uid_t)value;
+    }
+  }
+
+  int resume_lifetime_s;
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "resume_cache_size", &ctx->resume_capacity) ||
+      ctx->resume_capacity < 0) {
+    ctx->resume_capacity = RESUME_CACHE_SIZE;
+  } else if (ctx->resume_capacity > RESUME_CACHE_SIZE_MAX) {
+    ctx->resume_capacity = RESUME_CACHE_SIZE_MAX;
+  }
+  if (CONFIG_MANAGER_OK != config_manager_get_option_int("network", "resume_ticket_lifetime_s", &resume_lifetime_s) ||
+      resume_lifetime_s <= 0) {
+    resume_lifetime_s = RESUME_TICKET_LIFETIME_S;
+  }
+  ctx->resume_lifetime_us = (unsigned long long)resume_lifetime_s * 1000000ULL;
+
   ctx->end = 0;
-  ctx->listenfd = 0;
-  ctx->connfd = 0;
+  ctx->unix_listenfd = -1;
+  ctx->workers = NULL;
+  ctx->shards = calloc(ctx->shard_count, sizeof(network_shard_t));
+  if (ctx->shards == NULL) {
+    log_error(network_logger_id, "[%s:%d] could not allocate listen shards.\n", __func__, __LINE__);
+    free(ctx);
+    return -1;
+  }
+  for (int i = 0; i < ctx->shard_count; i++) {
+    network_shard_t *shard = &ctx->shards[i];
+    shard->ctx = ctx;
+    shard->listenfd = -1;
+    shard->epollfd = -1;
+    pthread_mutex_init(&shard->lock, NULL);
+    pthread_cond_init(&shard->ready, NULL);
+  }
+  ctx->resume_entries = ctx->resume_capacity > 0 ? calloc(ctx->resume_capacity, sizeof(network_resume_entry_t)) : NULL;
+  if (ctx->resume_entries == NULL) {
+    ctx->resume_capacity = 0;
+  }
+  ctx->resume_head = NULL;
+  ctx->resume_tail = NULL;
+  ctx->resume_count = 0;
+  ctx->resumptions = 0;
+  register_commands(ctx);
+  network_dispatch_register(COMMAND_GET_STATS, "get_stats", command_get_stats, ctx, 0);
+  pthread_mutex_init(&ctx->core_lock, NULL);
+  pthread_mutex_init(&ctx->resume_lock, NULL);
 
   policyupdater_init();
 
   *network_context = (void *)ctx;
 
-  logger_init_network(LOGGER_INFO);
-  logger_init_auth(LOGGER_INFO);
-  logger_init_crypto(LOGGER_INFO);
-
   return 0;
 }
 
-int network_start(network_ctx_t network_context) {
-  network_ctx_internal_t *ctx = (network_ctx_internal_t *)network_context;
+static void shards_close(network_ctx_internal_t *ctx) {
+  for (int i = 0; i < ctx->shard_count; i++) {
+    if (ctx->shards[i].epollfd >= 0) {
+      close(ctx->shards[i].epollfd);
+      ctx->shards[i].epollfd = -1;
+    }
+    if (ctx->shards[i].listenfd >= 0) {
+      close(ctx->shards[i].listenfd);
+      ctx->shards[i].listenfd = -1;
+    }
+  }
+}
+
+static void start_failed(network_ctx_internal_t *ctx) {
+  unix_close(ctx);
+  shards_close(ctx);
+  free(ctx->workers);
+  free(ctx->shards);
+  free(ctx);
+}
 
+static int shard_listen(network_ctx_internal_t *ctx, network_shard_t *shard) {
   struct sockaddr_in serv_addr;
-  char read_buffer[READ_BUFF_LEN];
+  int enable = 1;
 
-  ctx->listenfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  shard->listenfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
   memset(&serv_addr, '0', sizeof(serv_addr));
-  memset(read_buffer, '0', sizeof(read_buffer));
 
   serv_addr.sin_family = AF_INET;
   serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
   serv_addr.sin_port = htons(ctx->port);
 
-  int retstat = bind(ctx->listenfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+  // A restart must not wait for connections of the previous run to leave TIME_WAIT
+  setsockopt(shard->listenfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  if (ctx->shard_count > 1 && setsockopt(shard->listenfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0) {
+    log_error(network_logger_id, "[%s:%d] SO_REUSEPORT not supported.\n", __func__, __LINE__);
+    return ERROR_BIND_FAILED;
+  }
+
+  int retstat = bind(shard->listenfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
   if (retstat != 0) {
     log_error(network_logger_id, "[%s:%d] bind failed.\n", __func__, __LINE__);
-    free(ctx);
     return ERROR_BIND_FAILED;
   }
 
   if (ctx->end != 1) {
-    retstat = listen(ctx->listenfd, CONNECTION_BACKLOG_LEN);
+    retstat = listen(shard->listenfd, ctx->backlog);
     if (retstat != 0) {
       log_error(network_logger_id, "[%s:%d] listen failed.\n", __func__, __LINE__);
-      free(ctx);
       return ERROR_LISTEN_FAILED;
     }
   }
 
-  if (pthread_create(&ctx->thread, NULL, network_thread_function, ctx)) {
-    log_error(network_logger_id, "[%s:%d] error creating thread.\n", __func__, __LINE__);
-    free(ctx);
+  // Listen socket is drained on every edge, so it must never block
+  fcntl(shard->listenfd, F_SETFL, fcntl(shard->listenfd, F_GETFL, 0) | O_NONBLOCK);
+
+  // Listening sockets are told apart from connections by their event data
+  shard->epollfd = epoll_create1(0);
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.ptr = &shard->listenfd};
+  if (shard->epollfd < 0 || epoll_ctl(shard->epollfd, EPOLL_CTL_ADD, shard->listenfd, &ev) != 0) {
+    log_error(network_logger_id, "[%s:%d] epoll setup failed.\n", __func__, __LINE__);
+    return ERROR_EPOLL_FAILED;
+  }
+
+  return NO_ERROR;
+}
+
+int network_start(network_ctx_t network_context) {
+  network_ctx_internal_t *ctx = (network_ctx_internal_t *)network_context;
+
+  for (int i = 0; i < ctx->shard_count; i++) {
+    int ret = shard_listen(ctx, &ctx->shards[i]);
+    if (ret != NO_ERROR) {
+      start_failed(ctx);
+      return ret;
+    }
+  }
+
+  if (ctx->unix_path[0] != '\0' && unix_listen(ctx) != 0) {
+    start_failed(ctx);
+    return ERROR_BIND_FAILED;
+  }
+
+  // Allocated before the loops start, as they read worker stats
+  ctx->workers = calloc(ctx->worker_count, sizeof(network_worker_t));
+  if (ctx->workers == NULL) {
+    log_error(network_logger_id, "[%s:%d] could not allocate workers.\n", __func__, __LINE__);
+    start_failed(ctx);
     return ERROR_CREATE_THREAD_FAILED;
   }
 
+  // Workers are split evenly, the first shards get the remainder
+  int first_worker = 0;
+  for (int i = 0; i < ctx->shard_count; i++) {
+    network_shard_t *shard = &ctx->shards[i];
+    shard->workers = &ctx->workers[first_worker];
+    shard->worker_count = ctx->worker_count / ctx->shard_count + (i < ctx->worker_count % ctx->shard_count ? 1 : 0);
+    for (int j = 0; j < shard->worker_count; j++) {
+      shard->workers[j].ctx = ctx;
+      shard->workers[j].shard = shard;
+    }
+    first_worker += shard->worker_count;
+    network_timer_wheel_init(&shard->deadlines, DEADLINE_TICK_US, now_us());
+  }
+
+  // Loops and workers already started have to be stopped on failure
+  for (int i = 0; i < ctx->shard_count; i++) {
+    if (pthread_create(&ctx->shards[i].thread, NULL, network_thread_function, &ctx->shards[i])) {
+      log_error(network_logger_id, "[%s:%d] error creating thread.\n", __func__, __LINE__);
+      network_stop(ctx);
+      return ERROR_CREATE_THREAD_FAILED;
+    }
+    ctx->shards[i].running = 1;
+  }
+  for (int i = 0; i < ctx->worker_count; i++) {
+    if (pthread_create(&ctx->workers[i].thread, NULL, network_worker_function, &ctx->workers[i])) {
+      log_error(network_logger_id, "[%s:%d] error creating worker thread.\n", __func__, __LINE__);
+      network_stop(ctx);
+      return ERROR_CREATE_THREAD_FAILED;
+    }
+    ctx->workers[i].running = 1;
+  }
+
+  log_info(network_logger_id, "[%s:%d] serving on port %d with %d listen shards and %d workers.\n", __func__,
+           __LINE__, ctx->port, ctx->shard_count, ctx->worker_count);
+
   return NO_ERROR;
 }
 
+void network_get_admission_stats(network_ctx_t network_context, network_admission_stats_t *stats) {
+  network_ctx_internal_t *ctx = (network_ctx_internal_t *)network_context;
+
+  memset(stats, 0, sizeof(network_admission_stats_t));
+  for (int i = 0; i < ctx->shard_count; i++) {
+    network_shard_t *shard = &ctx->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    stats->accepted += shard->accepted;
+    stats->shed += shard->shed;
+    stats->queue_len += shard->queue_len;
+    stats->shedding |= shard->shedding;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
 void network_stop(network_ctx_t network_context) {
   network_ctx_internal_t *ctx = (network_ctx_internal_t *)network_context;
   if (ctx != NULL) {
     ctx->end = 1;
-    pthread_join(ctx->thread, NULL);
+    for (int i = 0; i < ctx->shard_count; i++) {
+      pthread_mutex_lock(&ctx->shards[i].lock);
+      pthread_cond_broadcast(&ctx->shards[i].ready);
+      pthread_mutex_unlock(&ctx->shards[i].lock);
+    }
+
+    for (int i = 0; i < ctx->shard_count; i++) {
+      if (ctx->shards[i].running) {
+        pthread_join(ctx->shards[i].thread, NULL);
+      }
+    }
+    for (int i = 0; i < ctx->worker_count; i++) {
+      if (ctx->workers != NULL && ctx->workers[i].running) {
+        pthread_join(ctx->workers[i].thread, NULL);
+      }
+    }
+
+    for (int i = 0; i < ctx->shard_count; i++) {
+      while (ctx->shards[i].conns != NULL) {
+        conn_close(ctx, ctx->shards[i].conns);
+      }
+    }
+
+    resume_clear(ctx);
+
+    unix_close(ctx);
+    shards_close(ctx);
+    pthread_mutex_destroy(&ctx->resume_lock);
+    pthread_mutex_destroy(&ctx->core_lock);
+    for (int i = 0; i < ctx->shard_count; i++) {
+      pthread_cond_destroy(&ctx->shards[i].ready);
+      pthread_mutex_destroy(&ctx->shards[i].lock);
+    }
+    free(ctx->resume_entries);
+    free(ctx->workers);
+    free(ctx->shards);
     free(ctx);
   }
 }
 
-static int get_server_state(network_ctx_internal_t *ctx) { return ctx->state; }
+static const char grant[] = "{\"response\":\"access granted\"}";
+static const char deny[] = "{\"response\":\"access denied \"}";
+
+// Renderers of the SDK fill one caller buffer, so their output is staged in the
+// worker's buffer before it goes into the response. Lists, which can outgrow
+// that buffer, are staged on the heap instead.
+static int write_scratch(network_response_t *response) {
+  return network_response_write(response, response->scratch, strlen(response->scratch));
+}
 
-static unsigned int calculate_decision(char **recv_data, network_ctx_internal_t *ctx) {
-  int request_code = -1;
-  unsigned int buffer_position = 0;
+static int write_staged(network_response_t *response, char *staged) {
+  int ret;
 
-  char grant[] = "{\"response\":\"access granted\"}";
-  char deny[] = "{\"response\":\"access denied \"}";
-  char *msg;
+  if (staged == NULL) {
+    return network_response_write(response, deny, strlen(deny));
+  }
 
-  int num_of_tokens = jsonhelper_parser_init(*recv_data);
+  ret = network_response_write(response, staged, strlen(staged));
+  free(staged);
+  return ret;
+}
 
-  request_code = auth_helper_check_msg_format(*recv_data);
+static int binary_failure(network_response_t *response, unsigned char command, const char *message) {
+  network_binary_write_header(response, command);
+  return network_binary_write_field(response, NETWORK_BINARY_FAILURE, message, strlen(message));
+}
 
-  if (request_code == COMMAND_RESOLVE) {
-    char decision[BUF_LEN] = {0};
-    //@TODO: Should this be moved to access actor? Network should just send cb here to notify request.
-    pep_request_access(*recv_data, (void *)decision);
+// The PEP plugins enforce a granted action and its obligations
+static unsigned char pep_resolve(network_ctx_internal_t *ctx, const char *policy_id, int policy_id_len) {
+  return access_resolve(policy_id, policy_id_len, &ctx->core_lock) == PDP_GRANT ? NETWORK_BINARY_GRANT
+                                                                                : NETWORK_BINARY_DENY;
+}
 
-    if (memcmp(decision, "grant", strlen("grant"))) {
-      msg = grant;
+static int command_resolve(network_request_t *request, network_response_t *response, void *user_data) {
+  network_ctx_internal_t *ctx = (network_ctx_internal_t *)user_data;
+  char flight_key[PEP_REQUEST_LEN];
+  int flight_key_len = -1;
+  const char *policy_id = NULL;
+  int policy_id_len = 0;
+
+  if (request->binary) {
+    network_binary_field_t *field = network_request_field(request, NETWORK_BINARY_POLICY_ID);
+    if (field == NULL) {
+      return binary_failure(response, COMMAND_RESOLVE, "invalid policy_id");
+    }
+    policy_id = field->value;
+    policy_id_len = field->len;
+  } else {
+    jsmntok_t *token = network_request_get(request, "policy_id");
+    if (token != NULL && token->type == JSMN_STRING) {
+      policy_id = request->json + token->start;
+      policy_id_len = token->end - token->start;
+    }
+  }
+
+  unsigned char verdict = NETWORK_BINARY_DENY;
+  access_flight_t *flight;
+  int shared;
+  if (policy_id != NULL) {
+    // A resolve reads nothing but the policy id, so that alone tells resolves apart
+    flight_key_len = snprintf(flight_key, PEP_REQUEST_LEN, "{\"cmd\":\"resolve\",\"policy_id\":\"%.*s\"}",
+                              policy_id_len, policy_id);
+    if (flight_key_len >= PEP_REQUEST_LEN && request->binary) {
+      return binary_failure(response, COMMAND_RESOLVE, "invalid policy_id");
+    }
+  }
+
+  // A resolve naming no policy is denied
+  if (policy_id != NULL) {
+    // Identical resolves arriving while one is decided share its verdict,
+    // so the granted action is enforced once for all of them
+    int role = flight_key_len > 0 && flight_key_len < PEP_REQUEST_LEN
+                   ? access_flight_begin(flight_key, flight_key_len, &flight, &shared)
+                   : ACCESS_FLIGHT_ERROR;
+
+    if (role == ACCESS_FLIGHT_FOLLOWER) {
+      verdict = (unsigned char)shared;
     } else {
-      msg = deny;
+      verdict = pep_resolve(ctx, policy_id, policy_id_len);
+
+      if (role == ACCESS_FLIGHT_LEADER) {
+        access_flight_end(flight, verdict);
+      }
     }
+  }
+
+  if (request->binary) {
+    network_binary_write_header(response, COMMAND_RESOLVE);
+    return network_binary_write_field(response, NETWORK_BINARY_DECISION, &verdict, 1);
+  }
 
-    if (ctx->DAC_AUTH == 1) {
-      free(*recv_data);
+  return verdict == NETWORK_BINARY_GRANT ? network_response_write(response, grant, sizeof(grant))
+                                         : network_response_write(response, deny, sizeof(deny));
+}
+
+static int command_get_policy_list(network_request_t *request, network_response_t *response, void *user_data) {
+  char *policy_list = calloc(POLICY_LIST_LEN, 1);
+
+  //@TODO: Should this be moved to access actor? Network should just send cb here to notify request.
+  if (policy_list != NULL) {
+    pep_request_access(request->json, (void *)policy_list);
+  }
+
+  return write_staged(response, policy_list);
+}
+
+static int command_set_dataset(network_request_t *request, network_response_t *response, void *user_data) {
+  jsmntok_t *dataset_list = network_request_get(request, "dataset_list");
+
+  if (dataset_list == NULL || dataset_list->type != JSMN_ARRAY) {
+    return network_response_write(response, deny, strlen(deny));
+  }
+
+  pip_set_dataset(request->json + dataset_list->start, dataset_list->end - dataset_list->start);
+  return network_response_write(response, grant, strlen(grant));
+}
+
+static int command_get_dataset(network_request_t *request, network_response_t *response, void *user_data) {
+  unsigned int response_len = 0;
+  char *dataset = calloc(DATASET_LEN, 1);
+  int ret;
+
+  if (dataset == NULL) {
+    return request->binary ? binary_failure(response, COMMAND_GET_DATASET, "out of memory")
+                           : network_response_write(response, deny, strlen(deny));
+  }
+
+  pip_get_dataset(dataset, &response_len);
+
+  if (request->binary && response_len > 0xFFFF) {
+    ret = binary_failure(response, COMMAND_GET_DATASET, "dataset too large");
+  } else if (request->binary) {
+    // The dataset stays JSON text, inside one field
+    network_binary_write_header(response, COMMAND_GET_DATASET);
+    ret = network_binary_write_field(response, NETWORK_BINARY_DATASET, dataset, response_len);
+  } else {
+    ret = network_response_write(response, dataset, response_len);
+  }
+
+  free(dataset);
+  return ret;
+}
+
+static int command_get_user(network_request_t *request, network_response_t *response, void *user_data) {
+  char username[USERNAME_LEN] = "";
+
+  network_request_copy(request, "username", username, USERNAME_LEN);
+
+  log_info(network_logger_id, "[%s:%d] get user\n", __func__, __LINE__);
+  response->scratch[0] = '\0';
+  pap_user_management_action(PAP_USERMNG_GET_USER, username, response->scratch);
+  return write_scratch(response);
+}
+
+static int command_get_user_id(network_request_t *request, network_response_t *response, void *user_data) {
+  char username[USERNAME_LEN] = "";
+
+  network_request_copy(request, "username", username, USERNAME_LEN);
+
+  log_info(network_logger_id, "[%s:%d] get auth id\n", __func__, __LINE__);
+  response->scratch[0] = '\0';
+  pap_user_management_action(PAP_USERMNG_GET_USER_ID, username, response->scratch);
+  return write_scratch(response);
+}
+
+static int command_register_user(network_request_t *request, network_response_t *response, void *user_data) {
+  char user_data_json[USER_DATA_LEN] = "";
+
+  network_request_copy(request, "user", user_data_json, USER_DATA_LEN);
+
+  log_info(network_logger_id, "[%s:%d] put user\n", __func__, __LINE__);
+  response->scratch[0] = '\0';
+  pap_user_management_action(PAP_USERMNG_PUT_USER, user_data_json, response->scratch);
+  return write_scratch(response);
+}
+
+static int command_get_all_users(network_request_t *request, network_response_t *response, void *user_data) {
+  char *user_list = calloc(USER_LIST_LEN, 1);
+
+  log_info(network_logger_id, "[%s:%d] get all users\n", __func__, __LINE__);
+  if (user_list != NULL) {
+    pap_user_management_action(PAP_USERMNG_GET_ALL_USR, user_list);
+  }
+  return write_staged(response, user_list);
+}
+
+static int command_clear_all_users(network_request_t *request, network_response_t *response, void *user_data) {
+  log_info(network_logger_id, "[%s:%d] clear all users\n", __func__, __LINE__);
+  response->scratch[0] = '\0';
+  pap_user_management_action(PAP_USERMNG_CLR_ALL_USR, response->scratch);
+  return write_scratch(response);
+}
+
+static const char *decision_name(pdp_decision_e decision) {
+  switch (decision) {
+    case PDP_GRANT:
+      return "grant";
+    case PDP_DENY:
+      return "deny";
+    case PDP_CONFLICT:
+      return "conflict";
+    case PDP_UNDEFINED:
+      return "undefined";
+    default:
+      return "error";
+  }
+}
+
+static unsigned char decision_byte(pdp_decision_e decision) {
+  switch (decision) {
+    case PDP_GRANT:
+      return NETWORK_BINARY_GRANT;
+    case PDP_DENY:
+      return NETWORK_BINARY_DENY;
+    case PDP_CONFLICT:
+      return NETWORK_BINARY_CONFLICT;
+    case PDP_UNDEFINED:
+      return NETWORK_BINARY_UNDEFINED;
+    default:
+      return NETWORK_BINARY_INVALID;
+  }
+}
+
+// Every array element is a flat {"policy_id":"...","action":"..."} object
+static int batch_items_json(network_request_t *request, access_batch_item_t *items) {
+  int items_num = 0;
+  jsmntok_t *requests = network_request_get(request, "requests");
+
+  if (requests == NULL || requests->type != JSMN_ARRAY || requests->size > ACCESS_BATCH_MAX) {
+    return -1;
+  }
+
+  jsmntok_t *token = requests + 1;
+  jsmntok_t *tokens_end = request->tokens + request->num_of_tokens;
+  while (token < tokens_end && token->start < requests->end) {
+    if (token->type != JSMN_OBJECT) {
+      return -1;
     }
 
-    memcpy(ctx->send_buffer, msg, sizeof(grant));
-    *recv_data = ctx->send_buffer;
-    buffer_position = sizeof(grant);
-  } else if (request_code == COMMAND_GET_POL_LIST) {
-    //@TODO: Should this be moved to access actor? Network should just send cb here to notify request.
-    pep_request_access(*recv_data, (void *)ctx->send_buffer);
+    access_batch_item_t *item = &items[items_num++];
+    int object_end = token->end;
+    memset(item, 0, sizeof(access_batch_item_t));
+
+    for (token++; token + 1 < tokens_end && token->start < object_end; token += 2) {
+      int key_len = token->end - token->start;
+      const char *key = request->json + token->start;
+      jsmntok_t *value = token + 1;
+
+      if (key_len == strlen("policy_id") && memcmp(key, "policy_id", key_len) == 0) {
+        item->policy_id = request->json + value->start;
+        item->policy_id_len = value->end - value->start;
+      } else if (key_len == strlen("action") && memcmp(key, "action", key_len) == 0) {
+        item->action = request->json + value->start;
+        item->action_len = value->end - value->start;
+      }
+    }
 
-    buffer_position = strlen(ctx->send_buffer);
+    if (item->policy_id == NULL) {
+      return -1;
+    }
+  }
+
+  return items_num;
+}
+
+// Every policy_id field starts an item, an action field belongs to the item before it
+static int batch_items_binary(network_request_t *request, access_batch_item_t *items) {
+  int items_num = 0;
 
-    if (ctx->DAC_AUTH == 1) {
-      free(*recv_data);
+  for (int i = 0; i < request->fields_num; i++) {
+    network_binary_field_t *field = &request->fields[i];
+
+    if (field->type == NETWORK_BINARY_POLICY_ID) {
+      if (items_num == ACCESS_BATCH_MAX) {
+        return -1;
+      }
+      memset(&items[items_num], 0, sizeof(access_batch_item_t));
+      items[items_num].policy_id = field->value;
+      items[items_num].policy_id_len = field->len;
+      items_num++;
+    } else if (field->type == NETWORK_BINARY_ACTION) {
+      if (items_num == 0) {
+        return -1;
+      }
+      items[items_num - 1].action = field->value;
+      items[items_num - 1].action_len = field->len;
     }
+  }
 
-    *recv_data = ctx->send_buffer;
-  } else if (request_code == COMMAND_ENABLE_POLICY) {
-    //@FIXME: Will be refactored
-#if 0
-        int policy_id_index = -1;
+  return items_num;
+}
 
-        for (int i = 0; i < num_of_tokens; i++)
-        {
-            if (memcmp(*recv_data + jsonhelper_get_token_start(i), "policy_id", strlen("policy_id")) == 0)
-            {
-                policy_id_index = i + 1;
-                break;
-            }
-        }
+static int command_resolve_batch(network_request_t *request, network_response_t *response, void *user_data) {
+  access_batch_item_t items[ACCESS_BATCH_MAX];
+  int items_num = request->binary ? batch_items_binary(request, items) : batch_items_json(request, items);
 
-        if (policy_id_index == -1)
-        {
-            return buffer_position;
-        }
+  if (items_num < 0) {
+    return request->binary ? binary_failure(response, COMMAND_RESOLVE_BATCH, "invalid batch")
+                           : network_response_write(response, deny, sizeof(deny));
+  }
 
-        char* pol_id_hex = calloc(jsonhelper_token_size(policy_id_index) / 2, 1);
-        str_to_hex(*recv_data + jsonhelper_get_token_start(policy_id_index), pol_id_hex, jsonhelper_token_size(policy_id_index));
+  access_resolve_batch(items, items_num);
 
-        int ret = -1;
+  if (request->binary) {
+    unsigned char decisions[ACCESS_BATCH_MAX];
+    for (int i = 0; i < items_num; i++) {
+      decisions[i] = decision_byte(items[i].decision);
+    }
+    network_binary_write_header(response, COMMAND_RESOLVE_BATCH);
+    return network_binary_write_field(response, NETWORK_BINARY_DECISIONS, decisions, items_num);
+  }
 
-        if (pol_id_hex != NULL)
-        {
-            ret = PolicyStore_enable_policy(pol_id_hex, jsonhelper_token_size(policy_id_index) / 2);
-        }
-        free(pol_id_hex);
+  network_response_printf(response, "{\"decisions\":[");
+  for (int i = 0; i < items_num; i++) {
+    network_response_printf(response, "%s\"%s\"", i > 0 ? "," : "", decision_name(items[i].decision));
+  }
 
-        if (ret == 0)
-        {
-            memcpy(send_buffer, grant, sizeof(grant));
-            *recv_data = send_buffer;
-            buffer_position = sizeof(grant);
-        }
-        else
-        {
-            memcpy(send_buffer, deny, sizeof(deny));
-            *recv_data = send_buffer;
-            buffer_position = sizeof(deny);
-        }
-#endif
-  } else if (request_code == COMMAND_SET_DATASET) {
-    int dataset_list_index = -1;
+  return network_response_printf(response, "]}");
+}
+
+static int target_request_json(network_request_t *request, access_target_request_t *target) {
+  const char *keys[] = {"subject", "action", "object"};
+  const char **values[] = {&target->subject, &target->action, &target->object};
+  int *lens[] = {&target->subject_len, &target->action_len, &target->object_len};
+
+  for (int i = 0; i < 3; i++) {
+    jsmntok_t *token = network_request_get(request, keys[i]);
+    if (token == NULL || token->type != JSMN_STRING) {
+      return -1;
+    }
+    *values[i] = request->json + token->start;
+    *lens[i] = token->end - token->start;
+  }
+
+  return 0;
+}
+
+static int target_request_binary(network_request_t *request, access_target_request_t *target) {
+  network_binary_field_t *subject = network_request_field(request, NETWORK_BINARY_SUBJECT);
+  network_binary_field_t *action = network_request_field(request, NETWORK_BINARY_ACTION);
+  network_binary_field_t *object = network_request_field(request, NETWORK_BINARY_OBJECT);
+
+  if (subject == NULL || action == NULL || object == NULL) {
+    return -1;
+  }
+  target->subject = subject->value;
+  target->subject_len = subject->len;
+  target->action = action->value;
+  target->action_len = action->len;
+  target->object = object->value;
+  target->object_len = object->len;
+
+  return 0;
+}
+
+static int command_resolve_target(network_request_t *request, network_response_t *response, void *user_data) {
+  network_ctx_internal_t *ctx = (network_ctx_internal_t *)user_data;
+  access_target_request_t target;
+
+  memset(&target, 0, sizeof(target));
+  int parsed = request->binary ? target_request_binary(request, &target) : target_request_json(request, &target);
+  int policies_num = parsed == 0 ? access_resolve_target(&target) : -1;
+  if (policies_num < 0) {
+    return request->binary ? binary_failure(response, COMMAND_RESOLVE_TARGET, "invalid target")
+                           : network_response_write(response, deny, sizeof(deny));
+  }
+
+  // A grant is enforced as a resolve of one of the granting policies, the PEP may still deny it
+  if (target.decision == PDP_GRANT &&
+      pep_resolve(ctx, target.policy_id, strlen(target.policy_id)) != NETWORK_BINARY_GRANT) {
+    target.decision = PDP_DENY;
+  }
+
+  if (request->binary) {
+    unsigned char verdict = decision_byte(target.decision);
+    network_binary_write_header(response, COMMAND_RESOLVE_TARGET);
+    int ret = network_binary_write_field(response, NETWORK_BINARY_DECISION, &verdict, 1);
+    if (ret == NETWORK_RESPONSE_OK && target.decision == PDP_GRANT) {
+      ret = network_binary_write_field(response, NETWORK_BINARY_POLICY_ID, target.policy_id, strlen(target.policy_id));
+    }
+    return ret;
+  }
+
+  if (target.decision == PDP_GRANT) {
+    return network_response_printf(response, "{\"decision\":\"grant\",\"policies\":%d,\"policy_id\":\"%s\"}",
+                                   policies_num, target.policy_id);
+  }
+  return network_response_printf(response, "{\"decision\":\"%s\",\"policies\":%d}", decision_name(target.decision),
+                                 policies_num);
+}
+
+// Subjects of who_can, one per user object of the PAP user list
+typedef struct {
+  jsmntok_t *tokens;
+  int tokens_num;
+  int users_num;
+  char types[USER_FIELDS_MAX][USER_FIELD_TYPE_LEN];
+  access_subject_column_t columns[USER_FIELDS_MAX];
+  int columns_num;
+} network_users_t;
+
+static int token_next(jsmntok_t *tokens, int tokens_num, int i) {
+  int end = tokens[i].end;
+  for (i++; i < tokens_num && tokens[i].start < end; i++) {
+  }
+  return i;
+}
+
+static int token_is(const char *json, jsmntok_t *token, const char *str) {
+  return token->end - token->start == strlen(str) && memcmp(json + token->start, str, token->end - token->start) == 0;
+}
+
+static int user_field_column(network_users_t *users, const char *json, jsmntok_t *key) {
+  char type[USER_FIELD_TYPE_LEN];
+
+  if (snprintf(type, USER_FIELD_TYPE_LEN, "request.subject.%.*s", key->end - key->start, json + key->start) >=
+      USER_FIELD_TYPE_LEN) {
+    return -1;
+  }
+  for (int i = 0; i < users->columns_num; i++) {
+    if (strcmp(users->types[i], type) == 0) {
+      return i;
+    }
+  }
+  if (users->columns_num == USER_FIELDS_MAX) {
+    return -1;
+  }
+  strcpy(users->types[users->columns_num], type);
+  users->columns[users->columns_num].type = users->types[users->columns_num];
+  return users->columns_num++;
+}
 
-    for (int i = 0; i < num_of_tokens; i++) {
-      if (memcmp(*recv_data + jsonhelper_get_token_start(i), "dataset_list", strlen("dataset_list")) == 0) {
-        dataset_list_index = i;
+// Every object with a USER_KEY string is a user. Its key is request.subject.value and each of its
+// scalar fields request.subject.<field>. With values NULL, only the users and columns are counted.
+static void users_scan(network_users_t *users, const char *json, const char **values, int *lens) {
+  users->users_num = 0;
+  for (int i = 0; i < users->tokens_num; i++) {
+    jsmntok_t *object = &users->tokens[i];
+    int user = -1;
+
+    if (object->type != JSMN_OBJECT) {
+      continue;
+    }
+    for (int k = i + 1; k + 1 < users->tokens_num && users->tokens[k].start < object->end;
+         k = token_next(users->tokens, users->tokens_num, k + 1)) {
+      if (token_is(json, &users->tokens[k], USER_KEY) && users->tokens[k + 1].type == JSMN_STRING) {
+        user = users->users_num++;
         break;
       }
     }
+    if (user < 0) {
+      continue;
+    }
 
-    int arr_start = dataset_list_index + 1;
+    for (int k = i + 1; k + 1 < users->tokens_num && users->tokens[k].start < object->end;
+         k = token_next(users->tokens, users->tokens_num, k + 1)) {
+      jsmntok_t *value = &users->tokens[k + 1];
+      if (value->type != JSMN_STRING && value->type != JSMN_PRIMITIVE) {
+        continue;
+      }
+      int columns[2] = {user_field_column(users, json, &users->tokens[k]),
+                        token_is(json, &users->tokens[k], USER_KEY) ? 0 : -1};
+      for (int c = 0; c < 2 && values != NULL; c++) {
+        if (columns[c] >= 0) {
+          values[columns[c] * users->tokens_num + user] = json + value->start;
+          lens[columns[c] * users->tokens_num + user] = value->end - value->start;
+        }
+      }
+    }
+  }
+}
+
+static int users_parse(network_users_t *users, const char *json, const char ***values, int **lens) {
+  jsmn_parser parser;
+
+  memset(users, 0, sizeof(network_users_t));
+  // The user key comes first, so it is column 0
+  strcpy(users->types[0], ACCESS_TARGET_SUBJECT_ATTRIBUTE);
+  users->columns[0].type = users->types[0];
+  users->columns_num = 1;
+
+  jsmn_init(&parser);
+  users->tokens_num = jsmn_parse(&parser, json, strlen(json), NULL, 0);
+  if (users->tokens_num <= 0 || (users->tokens = malloc(users->tokens_num * sizeof(jsmntok_t))) == NULL) {
+    return -1;
+  }
+  jsmn_init(&parser);
+  jsmn_parse(&parser, json, strlen(json), users->tokens, users->tokens_num);
+
+  // A column has room for one value per token, never fewer than there are users
+  users_scan(users, json, NULL, NULL);
+  *values = calloc(users->columns_num * users->tokens_num, sizeof(const char *));
+  *lens = calloc(users->columns_num * users->tokens_num, sizeof(int));
+  if (*values == NULL || *lens == NULL) {
+    return -1;
+  }
+  users_scan(users, json, *values, *lens);
+  for (int i = 0; i < users->columns_num; i++) {
+    users->columns[i].values = *values + i * users->tokens_num;
+    users->columns[i].lens = *lens + i * users->tokens_num;
+  }
+
+  return 0;
+}
+
+static int who_can_request(network_request_t *request, const char **policy_id, int *policy_id_len,
+                           const char **action, int *action_len) {
+  if (request->binary) {
+    network_binary_field_t *policy_field = network_request_field(request, NETWORK_BINARY_POLICY_ID);
+    network_binary_field_t *action_field = network_request_field(request, NETWORK_BINARY_ACTION);
+    if (policy_field == NULL || action_field == NULL) {
+      return -1;
+    }
+    *policy_id = policy_field->value;
+    *policy_id_len = policy_field->len;
+    *action = action_field->value;
+    *action_len = action_field->len;
+    return 0;
+  }
 
-    if ((dataset_list_index == -1) || (jsonhelper_get_token_at(arr_start).type != JSMN_ARRAY)) {
-      memcpy(ctx->send_buffer, deny, strlen(deny));
-      buffer_position = strlen(deny);
+  jsmntok_t *policy_token = network_request_get(request, "policy_id");
+  jsmntok_t *action_token = network_request_get(request, "action");
+  if (policy_token == NULL || policy_token->type != JSMN_STRING || action_token == NULL ||
+      action_token->type != JSMN_STRING) {
+    return -1;
+  }
+  *policy_id = request->json + policy_token->start;
+  *policy_id_len = policy_token->end - policy_token->start;
+  *action = request->json + action_token->start;
+  *action_len = action_token->end - action_token->start;
+  return 0;
+}
+
+static int command_who_can(network_request_t *request, network_response_t *response, void *user_data) {
+  network_users_t users;
+  const char *policy_id, *action;
+  int policy_id_len, action_len;
+  const char **values = NULL;
+  int *lens = NULL;
+  uint64_t *granted = NULL;
+  unsigned char *bitmap = NULL;
+  char *user_list = NULL;
+  int granted_num = -1;
+  int ret;
+
+  memset(&users, 0, sizeof(network_users_t));
+  if (who_can_request(request, &policy_id, &policy_id_len, &action, &action_len) == 0 &&
+      (user_list = calloc(USER_LIST_LEN, 1)) != NULL) {
+    log_info(network_logger_id, "[%s:%d] who can\n", __func__, __LINE__);
+    pap_user_management_action(PAP_USERMNG_GET_ALL_USR, user_list);
+    if (users_parse(&users, user_list, &values, &lens) == 0 &&
+        (granted = calloc(users.users_num / 64 + 1, sizeof(uint64_t))) != NULL) {
+      granted_num = access_resolve_subjects(policy_id, policy_id_len, action, action_len, users.columns,
+                                            users.columns_num, users.users_num, granted);
+    }
+  }
+
+  // Bit i of the bitmap is user i, least significant bit of each byte first
+  int bitmap_len = (users.users_num + 7) / 8;
+  if (granted_num >= 0 && (bitmap = malloc(bitmap_len * 2 + 1)) != NULL) {
+    for (int i = 0; i < bitmap_len; i++) {
+      bitmap[i] = (granted[i / 8] >> (i % 8 * 8)) & 0xFF;
+    }
+  }
+
+  if (bitmap == NULL || (request->binary && bitmap_len > 0xFFFF)) {
+    ret = request->binary ? binary_failure(response, COMMAND_WHO_CAN, "invalid policy or user list")
+                          : network_response_write(response, deny, sizeof(deny));
+  } else if (request->binary) {
+    network_binary_write_header(response, COMMAND_WHO_CAN);
+    ret = network_binary_write_field(response, NETWORK_BINARY_BITMAP, bitmap, bitmap_len);
+  } else {
+    // Hex digits written back to front, so they do not overwrite bytes still to be converted
+    for (int i = bitmap_len - 1; i >= 0; i--) {
+      unsigned char byte = bitmap[i];
+      bitmap[i * 2] = "0123456789abcdef"[byte >> 4];
+      bitmap[i * 2 + 1] = "0123456789abcdef"[byte & 0xF];
+    }
+    network_response_printf(response, "{\"subjects\":%d,\"granted\":%d,\"bitmap\":\"", users.users_num, granted_num);
+    network_response_write(response, (char *)bitmap, bitmap_len * 2);
+    ret = network_response_printf(response, "\"}");
+  }
+
+  free(bitmap);
+  free(granted);
+  free(values);
+  free(lens);
+  free(users.tokens);
+  free(user_list);
+
+  return ret;
+}
+
+static void register_commands(network_ctx_internal_t *ctx) {
+  // COMMAND_ENABLE_POLICY stays unregistered until policy enabling is
+  // refactored, so it gets the same deny as an unknown command.
+  // Resolve takes the Access Core lock itself, only around the PDP and the PEP
+  // plugins, and not for a resolve answered by an identical one in progress.
+  network_dispatch_register(COMMAND_RESOLVE, "resolve", command_resolve, ctx, NETWORK_COMMAND_BINARY);
+  network_dispatch_register(COMMAND_GET_POL_LIST, "get_policy_list", command_get_policy_list, NULL,
+                            NETWORK_COMMAND_USES_CORE);
+  network_dispatch_register(COMMAND_SET_DATASET, "set_dataset", command_set_dataset, NULL, NETWORK_COMMAND_USES_CORE);
+  network_dispatch_register(COMMAND_GET_DATASET, "get_dataset", command_get_dataset, NULL,
+                            NETWORK_COMMAND_USES_CORE | NETWORK_COMMAND_BINARY);
+  network_dispatch_register(COMMAND_GET_USER_OBJ, "get_user", command_get_user, NULL, NETWORK_COMMAND_USES_CORE);
+  network_dispatch_register(COMMAND_GET_USERID, "get_auth_user_id", command_get_user_id, NULL,
+                            NETWORK_COMMAND_USES_CORE);
+  network_dispatch_register(COMMAND_REDISTER_USER, "register_user", command_register_user, NULL,
+                            NETWORK_COMMAND_USES_CORE);
+  network_dispatch_register(COMMAND_GET_ALL_USER, "get_all_users", command_get_all_users, NULL,
+                            NETWORK_COMMAND_USES_CORE);
+  network_dispatch_register(COMMAND_CLEAR_ALL_USER, "clear_all_users", command_clear_all_users, NULL,
+                            NETWORK_COMMAND_USES_CORE);
+  network_dispatch_register(COMMAND_RESOLVE_BATCH, "resolve_batch", command_resolve_batch, NULL,
+                            NETWORK_COMMAND_USES_CORE | NETWORK_COMMAND_BINARY);
+  network_dispatch_register(COMMAND_RESOLVE_TARGET, "resolve_target", command_resolve_target, ctx,
+                            NETWORK_COMMAND_BINARY);
+  network_dispatch_register(COMMAND_WHO_CAN, "who_can", command_who_can, NULL,
+                            NETWORK_COMMAND_USES_CORE | NETWORK_COMMAND_BINARY);
+}
+
+static network_stats_t *stats_snapshot(network_ctx_internal_t *ctx) {
+  network_stats_t *merged = calloc(1, sizeof(network_stats_t));
+
+  if (merged != NULL) {
+    for (int i = 0; i < ctx->worker_count; i++) {
+      network_stats_merge(merged, &ctx->workers[i].stats);
+    }
+  }
+
+  return merged;
+}
+
+static int command_get_stats(network_request_t *request, network_response_t *response, void *user_data) {
+  network_ctx_internal_t *ctx = (network_ctx_internal_t *)user_data;
+  network_admission_stats_t admission;
+  network_stats_t *merged = stats_snapshot(ctx);
+
+  if (merged == NULL) {
+    return network_response_write(response, deny, sizeof(deny));
+  }
+
+  network_get_admission_stats(ctx, &admission);
+  network_response_printf(response, "{\"requests\":%llu,\"accepted\":%llu,\"shed\":%llu,\"queue_len\":%d,",
+                          network_stats_requests(merged), admission.accepted, admission.shed, admission.queue_len);
+
+  // Connections accepted by each shard show how evenly the kernel spreads them
+  unsigned long long deadlines_expired = 0;
+  network_response_printf(response, "\"shards\":[");
+  for (int i = 0; i < ctx->shard_count; i++) {
+    pthread_mutex_lock(&ctx->shards[i].lock);
+    unsigned long long accepted = ctx->shards[i].accepted;
+    int queue_len = ctx->shards[i].queue_len;
+    deadlines_expired += ctx->shards[i].deadlines_expired;
+    pthread_mutex_unlock(&ctx->shards[i].lock);
+    network_response_printf(response, "%s{\"accepted\":%llu,\"queue_len\":%d}", i > 0 ? "," : "", accepted,
+                            queue_len);
+  }
+  network_response_printf(response, "],\"deadlines_expired\":%llu,", deadlines_expired);
+
+  access_cache_stats_t cache;
+  access_cache_get_stats(&cache);
+  network_response_printf(response,
+                          "\"decision_cache\":{\"hits\":%llu,\"misses\":%llu,\"evictions\":%llu,"
+                          "\"invalidations\":%llu,\"entries\":%d,\"capacity\":%d},",
+                          cache.hits, cache.misses, cache.evictions, cache.invalidations, cache.entries,
+                          cache.capacity);
+
+  access_flight_stats_t flights;
+  access_flight_get_stats(&flights);
+  network_response_printf(response, "\"resolve_coalescing\":{\"evaluations\":%llu,\"saved\":%llu,\"in_flight\":%d},",
+                          flights.evaluations, flights.saved, flights.in_flight);
+
+  pip_cache_stats_t attributes;
+  pip_cache_get_stats(&attributes);
+  network_response_printf(response,
+                          "\"attribute_cache\":{\"hits\":%llu,\"misses\":%llu,\"coalesced\":%llu,\"entries\":%d,"
+                          "\"capacity\":%d},",
+                          attributes.hits, attributes.misses, attributes.coalesced, attributes.entries,
+                          attributes.capacity);
+
+  access_precompute_stats_t precomputed;
+  access_precompute_get_stats(&precomputed);
+  network_response_printf(response, "\"precompute\":{\"subscriptions\":%d,\"evaluations\":%llu},",
+                          precomputed.subscriptions, precomputed.evaluations);
+
+  access_target_stats_t targets;
+  access_target_get_stats(&targets);
+  network_response_printf(response,
+                          "\"target_index\":{\"policies\":%d,\"keys\":%d,\"lookups\":%llu,\"candidates\":%llu},",
+                          targets.policies, targets.keys, targets.lookups, targets.candidates);
+
+  access_timeindex_stats_t timeindex;
+  access_timeindex_get_stats(&timeindex);
+  network_response_printf(response,
+                          "\"time_index\":{\"policies\":%d,\"boundaries\":%d,\"boundaries_passed\":%llu},\"latency\":",
+                          timeindex.policies, timeindex.boundaries, timeindex.boundaries_passed);
+  network_response_write(response, response->scratch,
+                         network_stats_render(merged, response->scratch, response->scratch_size));
+  free(merged);
+
+  return network_response_write(response, "}", 1);
+}
+
+static void calculate_decision(network_ctx_internal_t *ctx, network_conn_t *conn, network_response_t *response,
+                               int *command_code) {
+  char *recv_data = conn->recv_data;
+  unsigned short recv_len = conn->recv_len;
+  network_request_t request;
+  const network_command_t *command = NULL;
+
+  *command_code = -1;
+
+  // One tokenization serves both routing and the handler's key lookups
+  int parsed = network_request_parse(&request, recv_data, recv_len) == NETWORK_DISPATCH_OK;
+  if (parsed) {
+    if (network_request_is(&request, "cmd", "get_ticket")) {
+      // Tickets belong to the connection's session, not to the Access Core
+      issue_ticket(ctx, conn, response);
+      network_request_release(&request);
+      return;
+    }
+    command = network_dispatch_find(&request);
+    response->chunked = network_request_is(&request, "chunked", "true");
+  }
+
+  if (request.binary && command == NULL) {
+    // Binary requests only reach commands that can decode them
+    binary_failure(response, request.command, parsed ? "unsupported request" : "malformed request");
+    network_request_release(&request);
+    return;
+  }
+
+  pthread_mutex_lock(&ctx->core_lock);
+  if (command == NULL) {
+    // Commands the SDK knows under a different "cmd" spelling still route by code
+    command = network_dispatch_get(auth_helper_check_msg_format(recv_data));
+  }
+  if (command != NULL && !(command->flags & NETWORK_COMMAND_USES_CORE)) {
+    pthread_mutex_unlock(&ctx->core_lock);
+  }
+
+  if (command != NULL) {
+    *command_code = command->code;
+    // Chunks only go out while the handler runs if that does not stall the
+    // Access Core lock on a slow reader; otherwise they wait for the send phase
+    response->stream = !(command->flags & NETWORK_COMMAND_USES_CORE);
+    command->cb(&request, response, command->user_data);
+  } else {
+    log_info(network_logger_id, "[%s:%d] request message format not valid\n > %.*s\n", __func__, __LINE__,
+             (int)recv_len, recv_data);
+    network_response_write(response, deny, sizeof(deny));
+  }
+
+  if (command == NULL || (command->flags & NETWORK_COMMAND_USES_CORE)) {
+    pthread_mutex_unlock(&ctx->core_lock);
+  }
+  network_request_release(&request);
+}
+
+static unsigned long long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void resume_unlink(network_ctx_internal_t *ctx, network_resume_entry_t *entry) {
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    ctx->resume_head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    ctx->resume_tail = entry->prev;
+  }
+  entry->prev = NULL;
+  entry->next = NULL;
+  entry->used = 0;
+  ctx->resume_count--;
+}
+
+static void resume_drop(network_ctx_internal_t *ctx, network_resume_entry_t *entry) {
+  resume_unlink(ctx, entry);
+  auth_release(&entry->session);
+  memset(entry->ticket, 0, RESUME_TICKET_LEN);
+  memset(entry->key, 0, NETWORK_MAC_KEY_LEN);
+}
+
+static void resume_expire(network_ctx_internal_t *ctx, unsigned long long now) {
+  // Entries are ordered by park time and share one lifetime, so the expired
+  // ones all sit at the tail
+  while (ctx->resume_tail != NULL && ctx->resume_tail->expires_us <= now) {
+    resume_drop(ctx, ctx->resume_tail);
+  }
+}
+
+static void resume_park(network_ctx_internal_t *ctx, unsigned char *ticket, unsigned char *key, auth_ctx_t *session) {
+  network_resume_entry_t *entry = NULL;
+
+  pthread_mutex_lock(&ctx->resume_lock);
+  resume_expire(ctx, now_us());
+  if (ctx->resume_count == ctx->resume_capacity) {
+    // Least recently parked session makes room
+    resume_drop(ctx, ctx->resume_tail);
+  }
+  for (int i = 0; i < ctx->resume_capacity; i++) {
+    if (!ctx->resume_entries[i].used) {
+      entry = &ctx->resume_entries[i];
+      break;
+    }
+  }
+
+  memcpy(entry->ticket, ticket, RESUME_TICKET_LEN);
+  memcpy(entry->key, key, NETWORK_MAC_KEY_LEN);
+  entry->session = *session;
+  entry->session.ext = NULL;
+  entry->expires_us = now_us() + ctx->resume_lifetime_us;
+  entry->used = 1;
+  entry->prev = NULL;
+  entry->next = ctx->resume_head;
+  if (ctx->resume_head != NULL) {
+    ctx->resume_head->prev = entry;
+  } else {
+    ctx->resume_tail = entry;
+  }
+  ctx->resume_head = entry;
+  ctx->resume_count++;
+  pthread_mutex_unlock(&ctx->resume_lock);
+}
+
+static int resume_take(network_ctx_internal_t *ctx, unsigned char *preamble, auth_ctx_t *session) {
+  unsigned char *ticket = preamble + RESUME_MAGIC_LEN;
+  unsigned char *mac = ticket + RESUME_TICKET_LEN + RESUME_NONCE_LEN;
+  unsigned char expected[NETWORK_MAC_LEN];
+  int ret = -1;
+
+  // Tickets are single use: a redeemed session is removed from the cache and
+  // only comes back if the client asks for a new ticket. The ticket id alone
+  // travels in the clear, so the entry stays put until the MAC proves the
+  // client holds the ticket key, which was only ever sent under the session.
+  pthread_mutex_lock(&ctx->resume_lock);
+  resume_expire(ctx, now_us());
+  for (network_resume_entry_t *entry = ctx->resume_head; entry != NULL; entry = entry->next) {
+    if (memcmp(entry->ticket, ticket, RESUME_TICKET_LEN) == 0) {
+      network_mac_compute(entry->key, NETWORK_MAC_KEY_LEN, ticket, RESUME_TICKET_LEN + RESUME_NONCE_LEN, expected);
+      if (network_mac_compare(expected, mac) == 0) {
+        *session = entry->session;
+        resume_unlink(ctx, entry);
+        memset(entry->ticket, 0, RESUME_TICKET_LEN);
+        memset(entry->key, 0, NETWORK_MAC_KEY_LEN);
+        ctx->resumptions++;
+        ret = 0;
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ctx->resume_lock);
+
+  return ret;
+}
+
+static void resume_clear(network_ctx_internal_t *ctx) {
+  pthread_mutex_lock(&ctx->resume_lock);
+  while (ctx->resume_head != NULL) {
+    resume_drop(ctx, ctx->resume_head);
+  }
+  pthread_mutex_unlock(&ctx->resume_lock);
+}
+
+static int issue_ticket(network_ctx_internal_t *ctx, network_conn_t *conn, network_response_t *response) {
+  char ticket_hex[RESUME_TICKET_LEN * 2 + 1];
+  char key_hex[NETWORK_MAC_KEY_LEN * 2 + 1];
+
+  // A trusted local peer has no session keys, the ticket key would travel in the clear
+  if (conn->trusted || ctx->resume_capacity == 0 ||
+      getrandom(conn->ticket, RESUME_TICKET_LEN, 0) != RESUME_TICKET_LEN ||
+      getrandom(conn->ticket_key, NETWORK_MAC_KEY_LEN, 0) != NETWORK_MAC_KEY_LEN) {
+    conn->has_ticket = 0;
+    return network_response_printf(response, "{\"error\":\"no ticket\"}");
+  }
+
+  // A newer ticket replaces the previous one of the same session. The reply
+  // goes out under the session keys, so only this client learns the key.
+  conn->has_ticket = 1;
+  for (int i = 0; i < RESUME_TICKET_LEN; i++) {
+    sprintf(&ticket_hex[2 * i], "%02x", conn->ticket[i]);
+  }
+  for (int i = 0; i < NETWORK_MAC_KEY_LEN; i++) {
+    sprintf(&key_hex[2 * i], "%02x", conn->ticket_key[i]);
+  }
+
+  return network_response_printf(response, "{\"ticket\":\"%s\",\"key\":\"%s\",\"lifetime\":%llu}", ticket_hex,
+                                 key_hex, ctx->resume_lifetime_us / 1000000ULL);
+}
+
+// Client sockets are non-blocking, so reads this file does itself return to the
+// event loop when the peer pauses. The auth layer reads and writes whole frames
+// from the descriptor and cannot pick up a half-read frame later, so a socket
+// it takes over becomes blocking for good. It is only called once the peer has
+// sent something, and the connection's deadline shuts the socket down if the
+// peer stalls in the middle of a frame.
+static void conn_enter_auth_layer(network_conn_t *conn) {
+  if (conn->nonblocking) {
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL, 0) & ~O_NONBLOCK);
+    conn->nonblocking = 0;
+  }
+}
+
+static int conn_resume(network_ctx_internal_t *ctx, network_conn_t *conn, int *resumed) {
+  ssize_t len;
+
+  *resumed = 0;
+  if (ctx->resume_capacity == 0) {
+    return 0;
+  }
+
+  if (conn->preamble_len == 0) {
+    // Peek without waiting: bytes that do not start the magic belong to the
+    // full key exchange, which then reads them itself. Nothing is taken until
+    // the whole magic has arrived, so a key exchange message that starts like
+    // it still reaches the key exchange.
+    len = recv(conn->fd, conn->preamble, RESUME_MAGIC_LEN, MSG_PEEK | MSG_DONTWAIT);
+    if (len <= 0 || memcmp(conn->preamble, RESUME_MAGIC, len) != 0) {
+      return 0;
+    }
+    if (len < RESUME_MAGIC_LEN) {
+      return RESUME_MAGIC_PENDING;
+    }
+  }
+
+  // Take whatever part of the preamble has arrived and hand the connection
+  // back to the event loop for the rest; the handshake deadline still applies
+  *resumed = 1;
+  len = recv(conn->fd, conn->preamble + conn->preamble_len, RESUME_PREAMBLE_LEN - conn->preamble_len, MSG_DONTWAIT);
+  if (len > 0) {
+    conn->preamble_len += len;
+  } else if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+    return -1;
+  }
+  if (conn->preamble_len < RESUME_PREAMBLE_LEN) {
+    return RESUME_PENDING;
+  }
+
+  if (resume_take(ctx, conn->preamble, &conn->session) != 0) {
+    log_info(network_logger_id, "[%s:%d] unknown, expired or unproven resumption ticket.\n", __func__, __LINE__);
+    conn_enter_auth_layer(conn);
+    tcpip_write_socket(&conn->fd, RESUME_FAILED_MSG, sizeof(RESUME_FAILED_MSG));
+    return -1;
+  }
+
+  // Continue the parked session on this socket. The confirmation is the first
+  // frame under the old keys, so a peer without them cannot use the session.
+  conn->session.ext = &conn->fd;
+  conn->has_session = 1;
+  conn_enter_auth_layer(conn);
+  if (auth_send(&conn->session, (const unsigned char *)RESUMED_MSG, sizeof(RESUMED_MSG)) != 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static void conn_close(network_ctx_internal_t *ctx, network_conn_t *conn) {
+  network_shard_t *shard = conn->shard;
+
+  // Cancelled before the descriptor is closed, so an expiring deadline can
+  // never shut down a reused descriptor number
+  pthread_mutex_lock(&shard->lock);
+  network_timer_cancel(&shard->deadlines, &conn->deadline);
+  network_timer_cancel(&shard->deadlines, &conn->retry);
+  pthread_mutex_unlock(&shard->lock);
+
+  // A session that was given a ticket outlives its socket until the ticket is
+  // redeemed, evicted or expired. Closing the descriptor also removes it from
+  // the epoll set.
+  if (conn->has_session) {
+    if (conn->has_ticket && !ctx->end) {
+      resume_park(ctx, conn->ticket, conn->ticket_key, &conn->session);
     } else {
-      pip_set_dataset(*recv_data + jsonhelper_get_token_at(arr_start).start,
-                      jsonhelper_get_token_at(arr_start).end - jsonhelper_get_token_at(arr_start).start);
-      memcpy(ctx->send_buffer, grant, strlen(grant));
-      buffer_position = strlen(grant);
-    }
-    *recv_data = ctx->send_buffer;
-  } else if (request_code == COMMAND_GET_DATASET) {
-    pip_get_dataset((char *)ctx->send_buffer, &buffer_position);
-    *recv_data = ctx->send_buffer;
-  } else if (request_code == COMMAND_GET_USER_OBJ) {
-    char username[USERNAME_LEN] = "";
-
-    for (int i = 0; i < num_of_tokens; i++) {
-      if (memcmp(*recv_data + jsonhelper_get_token_start(i), "username", strlen("username")) == 0) {
-        strncpy(username, *recv_data + jsonhelper_get_token_start(i + 1), jsonhelper_token_size(i + 1));
-        username[jsonhelper_token_size(i + 1)] = '\0';
-        break;
+      auth_release(&conn->session);
+    }
+  }
+  close(conn->fd);
+  // A plain frame cut short; the auth layer cleans up after its own failed reads
+  if (conn->trusted) {
+    free(conn->recv_data);
+  }
+
+  pthread_mutex_lock(&shard->lock);
+  if (conn->handshake_us > 0) {
+    shard->handshakes++;
+    shard->handshake_us_total += conn->handshake_us;
+  }
+  if (conn->requests > 1 && shard->handshakes > 0) {
+    // Every request after the first one rode on the existing session
+    shard->requests_reused += conn->requests - 1;
+    log_info(network_logger_id, "[%s:%d] session served %u requests, ~%llu us of handshakes avoided.\n", __func__,
+             __LINE__, conn->requests, (conn->requests - 1) * (shard->handshake_us_total / shard->handshakes));
+  }
+
+  if (conn->prev != NULL) {
+    conn->prev->next = conn->next;
+  } else {
+    shard->conns = conn->next;
+  }
+  if (conn->next != NULL) {
+    conn->next->prev = conn->prev;
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  memset(conn->ticket_key, 0, NETWORK_MAC_KEY_LEN);
+  free(conn);
+}
+
+
+static void conn_set_deadline(network_ctx_internal_t *ctx, network_conn_t *conn, network_deadline_e kind) {
+  int timeout_ms = kind == NETWORK_DEADLINE_HANDSHAKE
+                       ? ctx->handshake_timeout_ms
+                       : (kind == NETWORK_DEADLINE_IDLE ? ctx->idle_timeout_ms : ctx->request_timeout_ms);
+
+  pthread_mutex_lock(&conn->shard->lock);
+  conn->deadline_kind = kind;
+  network_timer_schedule(&conn->shard->deadlines, &conn->deadline, now_us() + (unsigned long long)timeout_ms * 1000ULL);
+  pthread_mutex_unlock(&conn->shard->lock);
+}
+
+// The magic's first bytes stay in the socket, so epoll would report them again
+// at once. The connection goes back to a worker at the next tick instead.
+static void conn_retry(network_conn_t *conn) {
+  pthread_mutex_lock(&conn->shard->lock);
+  network_timer_schedule(&conn->shard->deadlines, &conn->retry, now_us() + DEADLINE_TICK_US);
+  pthread_mutex_unlock(&conn->shard->lock);
+}
+
+static int conn_has_input(network_conn_t *conn) {
+  char byte;
+  ssize_t ret = recv(conn->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+  // Pending data, EOF and hard errors all let the phase run (and fail fast)
+  return ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+static void conn_rearm(network_ctx_internal_t *ctx, network_conn_t *conn) {
+  // One-shot registration: re-arming re-polls the socket, so input that arrived
+  // while a worker owned the connection is reported straight away.
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT, .data.ptr = conn};
+  if (epoll_ctl(conn->shard->epollfd, EPOLL_CTL_MOD, conn->fd, &ev) != 0) {
+    log_error(network_logger_id, "[%s:%d] could not re-arm client socket.\n", __func__, __LINE__);
+    conn_close(ctx, conn);
+  }
+}
+
+// Once the socket is drained, a short read leaves what came so far in the
+// connection and the next wakeup carries on from there
+static int plain_receive_failed(ssize_t len) {
+  return len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? RECEIVE_PENDING : -1;
+}
+
+static int plain_receive(network_conn_t *conn) {
+  ssize_t len;
+
+  // Same frame as the auth layer's plaintext: 2-byte big endian length, then payload
+  while (conn->plain_header_len < PLAIN_HEADER_LEN) {
+    len = recv(conn->fd, conn->plain_header + conn->plain_header_len, PLAIN_HEADER_LEN - conn->plain_header_len, 0);
+    if (len <= 0) {
+      if (len < 0 && errno == EINTR) {
+        continue;
       }
+      return plain_receive_failed(len);
     }
+    conn->plain_header_len += len;
+  }
 
-    log_info(network_logger_id, "[%s:%d] get user\n", __func__, __LINE__);
-    pap_user_management_action(PAP_USERMNG_GET_USER, username, ctx->send_buffer);
-    *recv_data = ctx->send_buffer;
-    buffer_position = strlen(ctx->send_buffer);
-  } else if (request_code == COMMAND_GET_USERID) {
-    char username[USERNAME_LEN] = "";
+  if (conn->recv_data == NULL) {
+    conn->recv_len = (conn->plain_header[0] << 8) | conn->plain_header[1];
+    conn->recv_got = 0;
+    conn->recv_data = malloc(conn->recv_len + 1);
+    if (conn->recv_data == NULL) {
+      return -1;
+    }
+  }
+  while (conn->recv_got < conn->recv_len) {
+    len = recv(conn->fd, conn->recv_data + conn->recv_got, conn->recv_len - conn->recv_got, 0);
+    if (len <= 0) {
+      if (len < 0 && errno == EINTR) {
+        continue;
+      }
+      return plain_receive_failed(len);
+    }
+    conn->recv_got += len;
+  }
+  conn->recv_data[conn->recv_len] = '\0';
+  conn->plain_header_len = 0;
 
-    for (int i = 0; i < num_of_tokens; i++) {
-      if (memcmp(*recv_data + jsonhelper_get_token_start(i), "username", strlen("username")) == 0) {
-        strncpy(username, *recv_data + jsonhelper_get_token_start(i + 1), jsonhelper_token_size(i + 1));
-        username[jsonhelper_token_size(i + 1)] = '\0';
-        break;
+  return 0;
+}
+
+static int plain_send(network_conn_t *conn, char *data, unsigned int len) {
+  unsigned char header[PLAIN_HEADER_LEN] = {(len >> 8) & 0xFF, len & 0xFF};
+  struct iovec iov[2] = {{.iov_base = header, .iov_len = PLAIN_HEADER_LEN}, {.iov_base = data, .iov_len = len}};
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+
+  while (msg.msg_iovlen > 0) {
+    ssize_t sent = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return -1;
+      }
+      // Responses are written from the worker that rendered them. A peer that
+      // stops reading holds it until the request deadline shuts the socket
+      // down, which wakes the poll and fails the next write.
+      struct pollfd pfd = {.fd = conn->fd, .events = POLLOUT};
+      if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+        return -1;
+      }
+      continue;
+    }
+
+    // Skip what went out and send the rest
+    while (msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov->iov_len) {
+      sent -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + sent;
+      msg.msg_iov->iov_len -= sent;
+    }
+  }
+
+  return 0;
+}
+
+static int conn_send_frame(void *send_ctx, char *data, unsigned int len) {
+  network_conn_t *conn = (network_conn_t *)send_ctx;
+  int ret = conn->trusted ? plain_send(conn, data, len)
+                          : auth_helper_send_decision(len, &conn->session, data, len);
+
+  return ret == 0 ? NETWORK_RESPONSE_OK : NETWORK_RESPONSE_ERROR;
+}
+
+static void conn_advance(network_worker_t *worker, network_conn_t *conn) {
+  network_ctx_internal_t *ctx = worker->ctx;
+
+  // Keep stepping while input is already buffered; the connection goes back to
+  // the event loop as soon as the next phase would have to wait for the peer.
+  while (conn->state != NETWORK_CONN_CLOSE) {
+    if (conn->trusted && conn->state == NETWORK_CONN_AUTH) {
+      // Peer credentials were checked by the kernel when it was accepted
+      conn->state = NETWORK_CONN_RECEIVE;
     }
 
-    log_info(network_logger_id, "[%s:%d] get auth id\n", __func__, __LINE__);
-    pap_user_management_action(PAP_USERMNG_GET_USER_ID, username, ctx->send_buffer);
-    *recv_data = ctx->send_buffer;
-    buffer_position = strlen(ctx->send_buffer);
-  } else if (request_code == COMMAND_REDISTER_USER) {
-    char user_data[USER_DATA_LEN];
-    for (int i = 0; i < num_of_tokens; i++) {
-      if (memcmp(*recv_data + jsonhelper_get_token_start(i), "user", strlen("user")) == 0) {
-        strncpy(user_data, *recv_data + jsonhelper_get_token_start(i + 1), jsonhelper_token_size(i + 1));
-        user_data[jsonhelper_token_size(i + 1)] = '\0';
+    if ((conn->state == NETWORK_CONN_AUTH || conn->state == NETWORK_CONN_RECEIVE) && !conn_has_input(conn)) {
+      conn_rearm(ctx, conn);
+      return;
+    }
+
+    switch (conn->state) {
+      case NETWORK_CONN_AUTH: {
+        int resumed;
+        unsigned long long start_us = now_us();
+        if (conn->preamble_len == 0) {
+          network_stats_record(&worker->stats.phases[NETWORK_PHASE_ACCEPT_WAIT], start_us - conn->accepted_us);
+        }
+
+        int ret = conn_resume(ctx, conn, &resumed);
+        if (ret == RESUME_PENDING) {
+          conn_rearm(ctx, conn);
+          return;
+        } else if (ret == RESUME_MAGIC_PENDING) {
+          conn_retry(conn);
+          return;
+        } else if (ret != 0) {
+          conn->state = NETWORK_CONN_CLOSE;
+          break;
+        } else if (resumed) {
+          network_stats_record(&worker->stats.phases[NETWORK_PHASE_AUTH], now_us() - start_us);
+          conn_set_deadline(ctx, conn, NETWORK_DEADLINE_IDLE);
+          conn->state = NETWORK_CONN_RECEIVE;
+          break;
+        }
+
+        auth_init_server(&conn->session, &conn->fd);
+        conn->has_session = 1;
+        conn_enter_auth_layer(conn);
+        if (auth_authenticate(&conn->session) == 0) {
+          conn->handshake_us = now_us() - start_us;
+          network_stats_record(&worker->stats.phases[NETWORK_PHASE_AUTH], conn->handshake_us);
+          conn_set_deadline(ctx, conn, NETWORK_DEADLINE_IDLE);
+          conn->state = NETWORK_CONN_RECEIVE;
+        } else {
+          log_error(network_logger_id, "[%s:%d] Authentication failed.\n", __func__, __LINE__);
+          tcpip_write_socket(&conn->fd, AUTH_FAILED_MSG, sizeof(AUTH_FAILED_MSG));
+          conn->state = NETWORK_CONN_CLOSE;
+        }
         break;
       }
+      case NETWORK_CONN_RECEIVE: {
+        if (conn->receive_start_us == 0) {
+          conn->receive_start_us = now_us();
+          // The request has started: receive, decide and send share one deadline
+          conn_set_deadline(ctx, conn, NETWORK_DEADLINE_REQUEST);
+        }
+        int ret = conn->trusted ? plain_receive(conn)
+                                : auth_receive(&conn->session, (unsigned char **)&conn->recv_data, &conn->recv_len);
+        if (ret == RECEIVE_PENDING) {
+          conn_rearm(ctx, conn);
+          return;
+        } else if (ret != 0 || conn->recv_data == NULL) {
+          conn->state = NETWORK_CONN_CLOSE;
+        } else {
+          network_stats_record(&worker->stats.phases[NETWORK_PHASE_RECEIVE], now_us() - conn->receive_start_us);
+          conn->receive_start_us = 0;
+          conn->state = NETWORK_CONN_DECIDE;
+        }
+        break;
+      }
+      case NETWORK_CONN_DECIDE: {
+        int command_code;
+        unsigned long long start_us = now_us();
+        // The worker's buffer stages output of renderers that need one buffer
+        network_response_init(&conn->response, worker->send_buffer, SEND_BUFF_LEN, conn_send_frame, conn);
+        calculate_decision(ctx, conn, &conn->response, &command_code);
+        free(conn->recv_data);
+        conn->recv_data = NULL;
+
+        unsigned long long decide_us = now_us() - start_us;
+        network_stats_record(&worker->stats.phases[NETWORK_PHASE_DECIDE], decide_us);
+        if (command_code >= 0) {
+          network_stats_record(&worker->stats.commands[command_code], decide_us);
+        }
+        conn->state = NETWORK_CONN_SEND;
+        break;
+      }
+      case NETWORK_CONN_SEND: {
+        unsigned long long start_us = now_us();
+        int sent = network_response_finish(&conn->response);
+        if (sent < 0 && !conn->response.chunked && conn->response.len > NETWORK_RESPONSE_FRAME_MAX) {
+          log_error(network_logger_id, "[%s:%d] response of %u bytes needs a chunked request.\n", __func__, __LINE__,
+                    conn->response.len);
+          conn_send_frame(conn, (char *)RESPONSE_TOO_LARGE_MSG, sizeof(RESPONSE_TOO_LARGE_MSG));
+        }
+        network_response_release(&conn->response);
+        network_stats_record(&worker->stats.phases[NETWORK_PHASE_SEND], now_us() - start_us);
+        conn->requests++;
+        // With keep-alive the authenticated session waits for the next frame
+        conn->state = ctx->keepalive && sent >= 0 ? NETWORK_CONN_RECEIVE : NETWORK_CONN_CLOSE;
+        if (conn->state == NETWORK_CONN_RECEIVE) {
+          conn_set_deadline(ctx, conn, NETWORK_DEADLINE_IDLE);
+        }
+        break;
+      }
+      default:
+        conn->state = NETWORK_CONN_CLOSE;
+        break;
     }
+  }
 
-    log_info(network_logger_id, "[%s:%d] put user\n", __func__, __LINE__);
-    pap_user_management_action(PAP_USERMNG_PUT_USER, user_data, ctx->send_buffer);
-    *recv_data = ctx->send_buffer;
-    buffer_position = strlen(ctx->send_buffer);
-  } else if (request_code == COMMAND_GET_ALL_USER) {
-    log_info(network_logger_id, "[%s:%d] get all users\n", __func__, __LINE__);
-    pap_user_management_action(PAP_USERMNG_GET_ALL_USR, ctx->send_buffer);
-    *recv_data = ctx->send_buffer;
-    buffer_position = strlen(ctx->send_buffer);
-  } else if (request_code == COMMAND_CLEAR_ALL_USER) {
-    log_info(network_logger_id, "[%s:%d] clear all users\n", __func__, __LINE__);
-    pap_user_management_action(PAP_USERMNG_CLR_ALL_USR, ctx->send_buffer);
-    *recv_data = ctx->send_buffer;
-    buffer_position = strlen(ctx->send_buffer);
+  conn_close(ctx, conn);
+}
+
+// Called with the shard lock held
+static void queue_connection(network_shard_t *shard, network_conn_t *conn) {
+  conn->queue_next = NULL;
+  if (shard->queue_tail != NULL) {
+    shard->queue_tail->queue_next = conn;
   } else {
-    log_info(network_logger_id, "[%s:%d] request message format not valid\n > %s\n", __func__, __LINE__, *recv_data);
-    memset(*recv_data, '0', sizeof(ctx->send_buffer));
-    memcpy(ctx->send_buffer, deny, sizeof(deny));
-    *recv_data = ctx->send_buffer;
-    buffer_position = sizeof(deny);
+    shard->queue_head = conn;
+  }
+  shard->queue_tail = conn;
+  shard->queue_len++;
+  if (!shard->shedding && shard->queue_len >= shard->ctx->queue_high_watermark) {
+    shard->shedding = 1;
+    log_info(network_logger_id, "[%s:%d] %d requests pending, shedding new connections.\n", __func__, __LINE__,
+             shard->queue_len);
   }
+  pthread_cond_signal(&shard->ready);
+}
 
-  return buffer_position;
+static void enqueue_connection(network_shard_t *shard, network_conn_t *conn) {
+  pthread_mutex_lock(&shard->lock);
+  queue_connection(shard, conn);
+  pthread_mutex_unlock(&shard->lock);
 }
 
-static void *network_thread_function(void *ptr) {
-  network_ctx_internal_t *ctx = (network_ctx_internal_t *)ptr;
-  while (!ctx->end) {
-    struct timeval tv = {0, TIME_50MS};
-    int result;
-    fd_set rfds;
+static network_conn_t *dequeue_connection(network_shard_t *shard) {
+  network_conn_t *conn = NULL;
 
-    FD_ZERO(&rfds);
-    FD_SET(ctx->listenfd, &rfds);
+  pthread_mutex_lock(&shard->lock);
+  while (!shard->ctx->end && shard->queue_head == NULL) {
+    pthread_cond_wait(&shard->ready, &shard->lock);
+  }
+  if (!shard->ctx->end) {
+    conn = shard->queue_head;
+    shard->queue_head = conn->queue_next;
+    if (shard->queue_head == NULL) {
+      shard->queue_tail = NULL;
+    }
+    shard->queue_len--;
+    if (shard->shedding && shard->queue_len <= shard->ctx->queue_low_watermark) {
+      shard->shedding = 0;
+      log_info(network_logger_id, "[%s:%d] %llu connections shed so far, admitting again.\n", __func__, __LINE__,
+               shard->shed);
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
 
-    result = select(ctx->listenfd + 1, &rfds, (fd_set *)0, (fd_set *)0, &tv);
+  return conn;
+}
 
-    if (0 < result) {
-      int ret, n = 0;
+static int admit_connection(network_shard_t *shard, int fd) {
+  char busy_msg[BUF_LEN];
+  int shedding;
 
-      ctx->connfd = accept(ctx->listenfd, (struct sockaddr *)NULL, NULL);
+  pthread_mutex_lock(&shard->lock);
+  shedding = shard->shedding;
+  if (shedding) {
+    shard->shed++;
+  } else {
+    shard->accepted++;
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  if (shedding) {
+    // Answered before any handshake work; the socket buffer of a fresh
+    // connection always has room for it, so the loop thread never blocks
+    int len = snprintf(busy_msg, BUF_LEN, "{\"error\":\"busy\",\"retry_after\":%d}", shard->ctx->busy_retry_after_ms);
+    send(fd, busy_msg, len + 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+  }
 
-      time_t now;
-      struct tm ts;
-      char buf[BUF_LEN];
+  return !shedding;
+}
 
-      // Get current time
-      time(&now);
+static int unix_listen(network_ctx_internal_t *ctx) {
+  struct sockaddr_un addr;
 
-      // Format time, "ddd yyyy-mm-dd hh:mm:ss zzz"
-      ts = *localtime(&now);
-      strftime(buf, sizeof(buf), "%h:%M:%S", &ts);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, ctx->unix_path, sizeof(addr.sun_path) - 1);
 
-      log_info(network_logger_id, "[%s:%d] Client connected.\n", __func__, __LINE__);
+  // A socket file left behind by a previous run would make bind fail
+  unlink(ctx->unix_path);
 
-      // START
+  ctx->unix_listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (ctx->unix_listenfd < 0 || bind(ctx->unix_listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(ctx->unix_listenfd, ctx->backlog) != 0) {
+    log_error(network_logger_id, "[%s:%d] could not listen on %s.\n", __func__, __LINE__, ctx->unix_path);
+    unix_close(ctx);
+    return -1;
+  }
 
-      if ((ctx->state == 0)) {
-        ctx->state = 1;
-        char *recv_data = NULL;
-        unsigned short recv_len = 0;
-        int auth = -1;
-        int decision = -1;
+  fcntl(ctx->unix_listenfd, F_SETFL, fcntl(ctx->unix_listenfd, F_GETFL, 0) | O_NONBLOCK);
 
-        auth_init_server(&ctx->session, &ctx->connfd);
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.ptr = &ctx->unix_listenfd};
+  if (epoll_ctl(ctx->shards[0].epollfd, EPOLL_CTL_ADD, ctx->unix_listenfd, &ev) != 0) {
+    log_error(network_logger_id, "[%s:%d] epoll setup failed.\n", __func__, __LINE__);
+    unix_close(ctx);
+    return -1;
+  }
 
-        auth = auth_authenticate(&ctx->session);
+  log_info(network_logger_id, "[%s:%d] serving on %s, %d trusted uids.\n", __func__, __LINE__, ctx->unix_path,
+           ctx->trusted_uids_num);
 
-        if (auth == 0) {
-          auth_receive(&ctx->session, (unsigned char **)&recv_data, &recv_len);
-          decision = calculate_decision(&recv_data, ctx);
-          auth_helper_send_decision(decision, &ctx->session, recv_data, decision);
-        } else {
-          time(&now);
+  return 0;
+}
 
-          // Format time, "ddd yyyy-mm-dd hh:mm:ss zzz"
-          ts = *localtime(&now);
-          strftime(buf, sizeof(buf), "%h:%M:%S", &ts);
+static void unix_close(network_ctx_internal_t *ctx) {
+  if (ctx->unix_listenfd >= 0) {
+    close(ctx->unix_listenfd);
+    unlink(ctx->unix_path);
+    ctx->unix_listenfd = -1;
+  }
+}
 
-          log_error(network_logger_id, "[%s:%d] Authentication failed.\n", __func__, __LINE__);
+static int is_trusted_peer(network_ctx_internal_t *ctx, int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
 
-          decision = 0;
-          int size = 34;
-          tcpip_write_socket(&ctx->connfd, "{\"error\":\"authentication failed\"}", size);
-        }
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+    return 0;
+  }
 
-        ctx->state = 0;
+  for (int i = 0; i < ctx->trusted_uids_num; i++) {
+    if (cred.uid == ctx->trusted_uids[i]) {
+      return 1;
+    }
+  }
 
-        auth_release(&ctx->session);
+  return 0;
+}
+
+static void accept_connections(network_shard_t *shard, int listenfd) {
+  network_ctx_internal_t *ctx = shard->ctx;
 
-        unsigned char try_count = 0;
-        while ((get_server_state(ctx) != 0) && (try_count++ < MAX_TRY_NUM))
-          ;
+  while (1) {
+    int fd = accept(listenfd, (struct sockaddr *)NULL, NULL);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        log_error(network_logger_id, "[%s:%d] accept failed.\n", __func__, __LINE__);
       }
+      if (errno != EINTR) {
+        return;
+      }
+      continue;
+    }
+
+    if (!admit_connection(shard, fd)) {
+      continue;
+    }
+
+    network_conn_t *conn = calloc(1, sizeof(network_conn_t));
+    if (conn == NULL) {
+      close(fd);
+      continue;
+    }
+
+    // A connection is only handed to a worker once the peer has sent something,
+    // and a worker never waits for the rest of a frame it reads itself
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    conn->fd = fd;
+    conn->nonblocking = 1;
+    conn->shard = shard;
+    conn->state = NETWORK_CONN_AUTH;
+    conn->trusted = listenfd == ctx->unix_listenfd && is_trusted_peer(ctx, fd);
+    conn->accepted_us = now_us();
+    // Trusted peers skip the handshake and wait for their first request
+    int timeout_ms = conn->trusted ? ctx->idle_timeout_ms : ctx->handshake_timeout_ms;
+    network_timer_init(&conn->deadline, conn);
+    network_timer_init(&conn->retry, conn);
+    conn->deadline_kind = conn->trusted ? NETWORK_DEADLINE_IDLE : NETWORK_DEADLINE_HANDSHAKE;
+
+    pthread_mutex_lock(&shard->lock);
+    network_timer_schedule(&shard->deadlines, &conn->deadline,
+                           conn->accepted_us + (unsigned long long)timeout_ms * 1000ULL);
+    conn->next = shard->conns;
+    if (shard->conns != NULL) {
+      shard->conns->prev = conn;
+    }
+    shard->conns = conn;
+    pthread_mutex_unlock(&shard->lock);
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT, .data.ptr = conn};
+    if (epoll_ctl(shard->epollfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      log_error(network_logger_id, "[%s:%d] could not watch client socket.\n", __func__, __LINE__);
+      conn_close(ctx, conn);
+      continue;
+    }
+
+    log_info(network_logger_id, "[%s:%d] Client connected.\n", __func__, __LINE__);
+  }
+}
+
+static void deadline_expired(network_timer_t *timer) {
+  static const char *deadline_names[] = {"handshake", "idle", "request"};
+  network_conn_t *conn = (network_conn_t *)timer->data;
 
-      // END
+  // Called with the shard lock held. The connection is armed in epoll for
+  // neither, so the retry alone hands it to a worker.
+  if (timer == &conn->retry) {
+    queue_connection(conn->shard, conn);
+    return;
+  }
+
+  conn->shard->deadlines_expired++;
+  // Shutting the socket down wakes up whoever waits on it, so a blocked
+  // worker fails its read and closes the connection as usual
+  log_info(network_logger_id, "[%s:%d] %s deadline expired.\n", __func__, __LINE__,
+           deadline_names[conn->deadline_kind]);
+  shutdown(conn->fd, SHUT_RDWR);
+}
+
+static void expire_deadlines(network_shard_t *shard) {
+  pthread_mutex_lock(&shard->lock);
+  network_timer_advance(&shard->deadlines, now_us(), deadline_expired);
+  pthread_mutex_unlock(&shard->lock);
+}
+
+static void dump_stats(network_ctx_internal_t *ctx, unsigned long long *last_requests) {
+  char dump[SEND_BUFF_LEN];
+  network_stats_t *merged = stats_snapshot(ctx);
+
+  if (merged == NULL) {
+    return;
+  }
 
-      close(ctx->connfd);
+  unsigned long long requests = network_stats_requests(merged);
+  network_stats_render(merged, dump, SEND_BUFF_LEN);
+  log_info(network_logger_id, "[%s:%d] %llu requests/s over the last %d s, %s\n", __func__, __LINE__,
+           (requests - *last_requests) / ctx->stats_dump_interval_s, ctx->stats_dump_interval_s, dump);
+  *last_requests = requests;
+  free(merged);
+}
+
+static void *network_thread_function(void *ptr) {
+  network_shard_t *shard = (network_shard_t *)ptr;
+  network_ctx_internal_t *ctx = shard->ctx;
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  unsigned long long last_dump_us = now_us();
+  unsigned long long last_requests = 0;
+
+  while (!ctx->end) {
+    int n = epoll_wait(shard->epollfd, events, MAX_EPOLL_EVENTS, TIME_50MS);
+
+    expire_deadlines(shard);
+
+    // Stats cover the whole server, so only the first shard dumps them
+    if (shard == &ctx->shards[0] && ctx->stats_dump_interval_s > 0 &&
+        now_us() - last_dump_us >= (unsigned long long)ctx->stats_dump_interval_s * 1000000ULL) {
+      dump_stats(ctx, &last_requests);
+      last_dump_us = now_us();
     }
 
-    usleep(g_task_sleep_time);
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == &shard->listenfd || events[i].data.ptr == &ctx->unix_listenfd) {
+        accept_connections(shard, *(int *)events[i].data.ptr);
+      } else {
+        enqueue_connection(shard, (network_conn_t *)events[i].data.ptr);
+      }
+    }
   }
+
+  return NULL;
+}
+
+static void *network_worker_function(void *ptr) {
+  network_worker_t *worker = (network_worker_t *)ptr;
+  network_conn_t *conn;
+
+  while ((conn = dequeue_connection(worker->shard)) != NULL) {
+    conn_advance(worker, conn);
+  }
+
+  return NULL;
 }
@@ -36,8 +36,16 @@
 
 typedef void *network_ctx_t;
 
+typedef struct {
+  unsigned long long accepted;  // connections let through to the handshake
+  unsigned long long shed;      // connections answered with a busy frame
+  int queue_len;                // requests waiting for a worker
+  int shedding;                 // queue went over the high watermark and is not yet back under the low one
+} network_admission_stats_t;
+
 int network_init(network_ctx_t *network_context);
 int network_start(network_ctx_t network_context);
 void network_stop(network_ctx_t network_context);
+void network_get_admission_stats(network_ctx_t network_context, network_admission_stats_t *stats);
 
 #endif
@@ -0,0 +1,84 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_binary.c
+ * \brief
+ * Implementation of compact TLV encoding of requests and responses
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 19.10.2020. Initial version.
+ ****************************************************************************/
+
+#include "network_binary.h"
+
+int network_binary_is(const char *data, unsigned short len) {
+  return len >= NETWORK_BINARY_HEADER_LEN && (unsigned char)data[0] == NETWORK_BINARY_MAGIC;
+}
+
+int network_binary_parse(const char *data, unsigned short len, unsigned char *command, network_binary_field_t *fields,
+                         int *fields_num) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  unsigned int pos = NETWORK_BINARY_HEADER_LEN;
+
+  *fields_num = 0;
+  if (!network_binary_is(data, len)) {
+    return NETWORK_BINARY_ERROR;
+  }
+  *command = bytes[1];
+
+  while (pos < len) {
+    if (pos + NETWORK_BINARY_FIELD_HEADER_LEN > len || *fields_num >= NETWORK_BINARY_FIELDS_MAX) {
+      return NETWORK_BINARY_ERROR;
+    }
+
+    network_binary_field_t *field = &fields[(*fields_num)++];
+    field->type = bytes[pos];
+    field->len = (bytes[pos + 1] << 8) | bytes[pos + 2];
+    field->value = data + pos + NETWORK_BINARY_FIELD_HEADER_LEN;
+    pos += NETWORK_BINARY_FIELD_HEADER_LEN + field->len;
+    if (pos > len) {
+      return NETWORK_BINARY_ERROR;
+    }
+  }
+
+  return NETWORK_BINARY_OK;
+}
+
+int network_binary_write_header(network_response_t *response, unsigned char command) {
+  char header[NETWORK_BINARY_HEADER_LEN] = {(char)NETWORK_BINARY_MAGIC, (char)command};
+
+  return network_response_write(response, header, NETWORK_BINARY_HEADER_LEN);
+}
+
+int network_binary_write_field(network_response_t *response, unsigned char type, const void *value,
+                               unsigned short len) {
+  char header[NETWORK_BINARY_FIELD_HEADER_LEN] = {(char)type, (char)(len >> 8), (char)(len & 0xFF)};
+
+  if (network_response_write(response, header, NETWORK_BINARY_FIELD_HEADER_LEN) != NETWORK_RESPONSE_OK) {
+    return NETWORK_RESPONSE_ERROR;
+  }
+
+  return network_response_write(response, value, len);
+}
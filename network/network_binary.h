@@ -0,0 +1,112 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_binary.h
+ * \brief
+ * Compact TLV encoding of requests and responses
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * A binary message starts with NETWORK_BINARY_MAGIC, which can never start a
+ * JSON request, followed by the command code and a sequence of fields:
+ *
+ *   | magic (1) | command (1) | type (1) | length (2, big endian) | value | ...
+ *
+ * Decoded fields point into the received buffer, nothing is copied.
+ *
+ * \history
+ * 19.10.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _NETWORK_BINARY_H_
+#define _NETWORK_BINARY_H_
+
+#include "network_response.h"
+
+#define NETWORK_BINARY_MAGIC 0xA5
+#define NETWORK_BINARY_HEADER_LEN 2
+#define NETWORK_BINARY_FIELD_HEADER_LEN 3
+#define NETWORK_BINARY_FIELDS_MAX 130
+
+#define NETWORK_BINARY_OK 0
+#define NETWORK_BINARY_ERROR -1
+
+// Request fields
+#define NETWORK_BINARY_POLICY_ID 0x01
+#define NETWORK_BINARY_ACTION 0x02
+#define NETWORK_BINARY_SUBJECT 0x03
+#define NETWORK_BINARY_OBJECT 0x04
+
+// Response fields
+#define NETWORK_BINARY_DECISION 0x10
+#define NETWORK_BINARY_DECISIONS 0x11
+#define NETWORK_BINARY_DATASET 0x12
+#define NETWORK_BINARY_BITMAP 0x13
+#define NETWORK_BINARY_FAILURE 0x1F
+
+// Values of a decision byte
+#define NETWORK_BINARY_DENY 0
+#define NETWORK_BINARY_GRANT 1
+#define NETWORK_BINARY_CONFLICT 2
+#define NETWORK_BINARY_UNDEFINED 3
+#define NETWORK_BINARY_INVALID 4
+
+typedef struct {
+  unsigned char type;
+  unsigned short len;
+  const char *value;
+} network_binary_field_t;
+
+/**
+ * @brief Check if a received message is binary encoded
+ *
+ * @return 1 if it is, 0 otherwise
+ */
+int network_binary_is(const char *data, unsigned short len);
+
+/**
+ * @brief Split a binary message into its fields
+ *
+ * @param command Command code of the message
+ * @param fields Fields, pointing into data
+ * @param fields_num Number of fields
+ * @return NETWORK_BINARY_OK or NETWORK_BINARY_ERROR if a field overruns the message
+ */
+int network_binary_parse(const char *data, unsigned short len, unsigned char *command, network_binary_field_t *fields,
+                         int *fields_num);
+
+/**
+ * @brief Start a binary response
+ *
+ * @return NETWORK_RESPONSE_OK or NETWORK_RESPONSE_ERROR
+ */
+int network_binary_write_header(network_response_t *response, unsigned char command);
+
+/**
+ * @brief Append one field to a binary response
+ *
+ * @return NETWORK_RESPONSE_OK or NETWORK_RESPONSE_ERROR
+ */
+int network_binary_write_field(network_response_t *response, unsigned char type, const void *value,
+                               unsigned short len);
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_dispatch.c
+ * \brief
+ * Implementation of command dispatch table for network requests
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 14.09.2020. Initial version.
+ ****************************************************************************/
+
+#include "network_dispatch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static network_command_t commands[NETWORK_COMMAND_MAX];
+
+static int token_equals(const char *json, jsmntok_t *token, const char *str) {
+  int len = strlen(str);
+  return token->end - token->start == len && memcmp(json + token->start, str, len) == 0;
+}
+
+int network_dispatch_register(int command, const char *name, network_command_cb cb, void *user_data, int flags) {
+  if (command < 0 || command >= NETWORK_COMMAND_MAX || name == NULL || cb == NULL) {
+    return NETWORK_DISPATCH_ERROR;
+  }
+
+  commands[command].code = command;
+  commands[command].name = name;
+  commands[command].cb = cb;
+  commands[command].user_data = user_data;
+  commands[command].flags = flags;
+
+  return NETWORK_DISPATCH_OK;
+}
+
+const network_command_t *network_dispatch_get(int command) {
+  if (command < 0 || command >= NETWORK_COMMAND_MAX || commands[command].cb == NULL) {
+    return NULL;
+  }
+
+  return &commands[command];
+}
+
+const network_command_t *network_dispatch_find(network_request_t *request) {
+  if (request->binary) {
+    const network_command_t *command = network_dispatch_get(request->command);
+    return command != NULL && (command->flags & NETWORK_COMMAND_BINARY) ? command : NULL;
+  }
+
+  jsmntok_t *cmd = network_request_get(request, "cmd");
+
+  if (cmd == NULL || cmd->type != JSMN_STRING) {
+    return NULL;
+  }
+
+  for (int i = 0; i < NETWORK_COMMAND_MAX; i++) {
+    if (commands[i].cb != NULL && token_equals(request->json, cmd, commands[i].name)) {
+      return &commands[i];
+    }
+  }
+
+  return NULL;
+}
+
+int network_request_parse(network_request_t *request, char *json, unsigned short json_len) {
+  jsmn_parser parser;
+
+  request->json = json;
+  request->json_len = json_len;
+  request->tokens = request->token_storage;
+  request->num_of_tokens = 0;
+  request->keys_num = 0;
+  request->fields_num = 0;
+
+  request->binary = network_binary_is(json, json_len);
+  if (request->binary) {
+    return network_binary_parse(json, json_len, &request->command, request->fields, &request->fields_num) ==
+                   NETWORK_BINARY_OK
+               ? NETWORK_DISPATCH_OK
+               : NETWORK_DISPATCH_ERROR;
+  }
+
+  jsmn_init(&parser);
+  request->num_of_tokens = jsmn_parse(&parser, json, json_len, request->tokens, NETWORK_REQUEST_TOK_NUM);
+
+  if (request->num_of_tokens == JSMN_ERROR_NOMEM) {
+    // Large requests (e.g. long dataset lists) get their tokens from the heap
+    jsmn_init(&parser);
+    int num_of_tokens = jsmn_parse(&parser, json, json_len, NULL, 0);
+    if (num_of_tokens <= 0 || (request->tokens = malloc(num_of_tokens * sizeof(jsmntok_t))) == NULL) {
+      request->tokens = request->token_storage;
+      request->num_of_tokens = 0;
+      return NETWORK_DISPATCH_ERROR;
+    }
+    jsmn_init(&parser);
+    request->num_of_tokens = jsmn_parse(&parser, json, json_len, request->tokens, num_of_tokens);
+  }
+
+  if (request->num_of_tokens < 1 || request->tokens[0].type != JSMN_OBJECT) {
+    request->num_of_tokens = 0;
+    return NETWORK_DISPATCH_ERROR;
+  }
+
+  // Walk the top-level keys only, skipping each value with everything nested in it
+  int i = 1;
+  while (i + 1 < request->num_of_tokens && request->keys_num < NETWORK_REQUEST_KEYS_MAX) {
+    request->keys[request->keys_num++] = i;
+
+    int value_end = request->tokens[i + 1].end;
+    i += 2;
+    while (i < request->num_of_tokens && request->tokens[i].start < value_end) {
+      i++;
+    }
+  }
+
+  return NETWORK_DISPATCH_OK;
+}
+
+void network_request_release(network_request_t *request) {
+  if (request->tokens != request->token_storage) {
+    free(request->tokens);
+    request->tokens = request->token_storage;
+  }
+  request->num_of_tokens = 0;
+  request->keys_num = 0;
+  request->fields_num = 0;
+}
+
+network_binary_field_t *network_request_field(network_request_t *request, unsigned char type) {
+  for (int i = 0; i < request->fields_num; i++) {
+    if (request->fields[i].type == type) {
+      return &request->fields[i];
+    }
+  }
+
+  return NULL;
+}
+
+jsmntok_t *network_request_get(network_request_t *request, const char *key) {
+  for (int i = 0; i < request->keys_num; i++) {
+    if (token_equals(request->json, &request->tokens[request->keys[i]], key)) {
+      return &request->tokens[request->keys[i] + 1];
+    }
+  }
+
+  return NULL;
+}
+
+int network_request_is(network_request_t *request, const char *key, const char *value) {
+  jsmntok_t *token = network_request_get(request, key);
+
+  return token != NULL && token_equals(request->json, token, value);
+}
+
+int network_request_copy(network_request_t *request, const char *key, char *buf, int buf_size) {
+  jsmntok_t *value = network_request_get(request, key);
+
+  if (value == NULL || value->end - value->start >= buf_size) {
+    return -1;
+  }
+
+  int len = value->end - value->start;
+  memcpy(buf, request->json + value->start, len);
+  buf[len] = '\0';
+
+  return len;
+}
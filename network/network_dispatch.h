@@ -0,0 +1,178 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_dispatch.h
+ * \brief
+ * Command dispatch table for network requests
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Commands are registered once at startup, before the network is started.
+ * A request is tokenized once; handlers look its top-level keys up in the
+ * parsed key map instead of scanning the tokens themselves.
+ *
+ * \history
+ * 14.09.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _NETWORK_DISPATCH_H_
+#define _NETWORK_DISPATCH_H_
+
+#include "jsmn.h"
+#include "network_binary.h"
+#include "network_response.h"
+
+#define NETWORK_COMMAND_MAX 32
+#define NETWORK_REQUEST_KEYS_MAX 16
+#define NETWORK_REQUEST_TOK_NUM 128
+
+#define NETWORK_DISPATCH_OK 0
+#define NETWORK_DISPATCH_ERROR -1
+
+// Command flags
+#define NETWORK_COMMAND_USES_CORE 0x1
+#define NETWORK_COMMAND_BINARY 0x2
+
+#define COMMAND_RESOLVE 0
+#define COMMAND_GET_POL_LIST 1
+#define COMMAND_ENABLE_POLICY 2
+#define COMMAND_SET_DATASET 3
+#define COMMAND_GET_DATASET 4
+#define COMMAND_GET_USER_OBJ 5
+#define COMMAND_GET_USERID 6
+#define COMMAND_REDISTER_USER 7
+#define COMMAND_GET_ALL_USER 8
+#define COMMAND_CLEAR_ALL_USER 9
+#define COMMAND_NOTIFY_TRANSACTION 10
+#define COMMAND_RESOLVE_BATCH 11
+#define COMMAND_GET_STATS 12
+#define COMMAND_RESOLVE_TARGET 13
+#define COMMAND_WHO_CAN 14
+
+typedef struct {
+  char *json;
+  unsigned short json_len;
+
+  // Tokens live in token_storage unless the request needs more of them
+  jsmntok_t *tokens;
+  int num_of_tokens;
+  jsmntok_t token_storage[NETWORK_REQUEST_TOK_NUM];
+
+  // Token index of every top-level key; its value is the token right after it
+  int keys[NETWORK_REQUEST_KEYS_MAX];
+  int keys_num;
+
+  // Binary requests carry a command code and fields instead of JSON
+  int binary;
+  unsigned char command;
+  network_binary_field_t fields[NETWORK_BINARY_FIELDS_MAX];
+  int fields_num;
+} network_request_t;
+
+/**
+ * @brief Command handler
+ *
+ * @param request Parsed request
+ * @param response Response to write into
+ * @param user_data Data given at registration
+ * @return NETWORK_RESPONSE_OK or NETWORK_RESPONSE_ERROR
+ */
+typedef int (*network_command_cb)(network_request_t *request, network_response_t *response, void *user_data);
+
+typedef struct {
+  int code;
+  const char *name;
+  network_command_cb cb;
+  void *user_data;
+  // NETWORK_COMMAND_USES_CORE: handler calls into the Access Core API and must run under its lock
+  // NETWORK_COMMAND_BINARY: handler also serves binary requests
+  int flags;
+} network_command_t;
+
+/**
+ * @brief Register handler for a command code and its "cmd" name
+ *
+ * @param command Command code, index into the dispatch table
+ * @param name Value of the "cmd" key selecting this command
+ * @param cb Handler
+ * @param user_data Passed to every call of the handler
+ * @param flags NETWORK_COMMAND_* flags of the handler
+ * @return NETWORK_DISPATCH_OK or NETWORK_DISPATCH_ERROR
+ */
+int network_dispatch_register(int command, const char *name, network_command_cb cb, void *user_data, int flags);
+
+/**
+ * @brief Get command registered under a command code
+ *
+ * @return Registered command or NULL
+ */
+const network_command_t *network_dispatch_get(int command);
+
+/**
+ * @brief Get command selected by the "cmd" key or the code of a parsed request
+ *
+ * @return Registered command or NULL
+ */
+const network_command_t *network_dispatch_find(network_request_t *request);
+
+/**
+ * @brief Tokenize a JSON request and build its top-level key map, or split a
+ * binary request into its fields
+ *
+ * @return NETWORK_DISPATCH_OK or NETWORK_DISPATCH_ERROR
+ */
+int network_request_parse(network_request_t *request, char *json, unsigned short json_len);
+
+/**
+ * @brief Release token storage of a parsed request
+ */
+void network_request_release(network_request_t *request);
+
+/**
+ * @brief Get first field of a type in a binary request
+ *
+ * @return Field or NULL if the request has none
+ */
+network_binary_field_t *network_request_field(network_request_t *request, unsigned char type);
+
+/**
+ * @brief Get value token of a top-level key
+ *
+ * @return Value token or NULL if the key is missing
+ */
+jsmntok_t *network_request_get(network_request_t *request, const char *key);
+
+/**
+ * @brief Check if a top-level key holds exactly the given string
+ *
+ * @return 1 if it does, 0 otherwise
+ */
+int network_request_is(network_request_t *request, const char *key, const char *value);
+
+/**
+ * @brief Copy string value of a top-level key and terminate it
+ *
+ * @return Length of the value or -1 if it is missing or does not fit
+ */
+int network_request_copy(network_request_t *request, const char *key, char *buf, int buf_size);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_mac.c
+ * \brief
+ * Implementation of HMAC-SHA256 for session resumption proofs
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * SHA-256 as in FIPS 180-4, HMAC as in RFC 2104.
+ *
+ * \history
+ * 18.10.2020. Initial version.
+ ****************************************************************************/
+
+#include "network_mac.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define BLOCK_LEN 64
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+typedef struct {
+  uint32_t state[8];
+  unsigned char block[BLOCK_LEN];
+  size_t block_len;
+  uint64_t total_len;
+} sha256_ctx_t;
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static void sha256_transform(sha256_ctx_t *ctx, const unsigned char *block) {
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 |
+           (uint32_t)block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  a = ctx->state[0];
+  b = ctx->state[1];
+  c = ctx->state[2];
+  d = ctx->state[3];
+  e = ctx->state[4];
+  f = ctx->state[5];
+  g = ctx->state[6];
+  h = ctx->state[7];
+
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+    uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+  ctx->state[4] += e;
+  ctx->state[5] += f;
+  ctx->state[6] += g;
+  ctx->state[7] += h;
+}
+
+static void sha256_init(sha256_ctx_t *ctx) {
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+  memcpy(ctx->state, initial, sizeof(initial));
+  ctx->block_len = 0;
+  ctx->total_len = 0;
+}
+
+static void sha256_update(sha256_ctx_t *ctx, const unsigned char *data, size_t len) {
+  ctx->total_len += len;
+  while (len > 0) {
+    size_t take = BLOCK_LEN - ctx->block_len < len ? BLOCK_LEN - ctx->block_len : len;
+    memcpy(&ctx->block[ctx->block_len], data, take);
+    ctx->block_len += take;
+    data += take;
+    len -= take;
+    if (ctx->block_len == BLOCK_LEN) {
+      sha256_transform(ctx, ctx->block);
+      ctx->block_len = 0;
+    }
+  }
+}
+
+static void sha256_final(sha256_ctx_t *ctx, unsigned char digest[NETWORK_MAC_LEN]) {
+  uint64_t bits = ctx->total_len * 8;
+  unsigned char pad = 0x80;
+  unsigned char length[8];
+
+  sha256_update(ctx, &pad, 1);
+  pad = 0;
+  while (ctx->block_len != BLOCK_LEN - sizeof(length)) {
+    sha256_update(ctx, &pad, 1);
+  }
+  for (int i = 0; i < 8; i++) {
+    length[i] = (unsigned char)(bits >> (56 - 8 * i));
+  }
+  sha256_update(ctx, length, sizeof(length));
+
+  for (int i = 0; i < 8; i++) {
+    digest[4 * i] = (unsigned char)(ctx->state[i] >> 24);
+    digest[4 * i + 1] = (unsigned char)(ctx->state[i] >> 16);
+    digest[4 * i + 2] = (unsigned char)(ctx->state[i] >> 8);
+    digest[4 * i + 3] = (unsigned char)ctx->state[i];
+  }
+}
+
+void network_mac_compute(const unsigned char *key, size_t key_len, const unsigned char *msg, size_t msg_len,
+                         unsigned char mac[NETWORK_MAC_LEN]) {
+  unsigned char pad[BLOCK_LEN];
+  unsigned char inner[NETWORK_MAC_LEN];
+  sha256_ctx_t ctx;
+
+  // Keys are never longer than a block here, so they are only zero padded
+  memset(pad, 0x36, BLOCK_LEN);
+  for (size_t i = 0; i < key_len && i < BLOCK_LEN; i++) {
+    pad[i] ^= key[i];
+  }
+  sha256_init(&ctx);
+  sha256_update(&ctx, pad, BLOCK_LEN);
+  sha256_update(&ctx, msg, msg_len);
+  sha256_final(&ctx, inner);
+
+  memset(pad, 0x5c, BLOCK_LEN);
+  for (size_t i = 0; i < key_len && i < BLOCK_LEN; i++) {
+    pad[i] ^= key[i];
+  }
+  sha256_init(&ctx);
+  sha256_update(&ctx, pad, BLOCK_LEN);
+  sha256_update(&ctx, inner, NETWORK_MAC_LEN);
+  sha256_final(&ctx, mac);
+
+  memset(pad, 0, BLOCK_LEN);
+  memset(&ctx, 0, sizeof(ctx));
+}
+
+int network_mac_compare(const unsigned char *a, const unsigned char *b) {
+  unsigned char diff = 0;
+
+  for (int i = 0; i < NETWORK_MAC_LEN; i++) {
+    diff |= a[i] ^ b[i];
+  }
+
+  return diff != 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_mac.h
+ * \brief
+ * HMAC-SHA256 for session resumption proofs
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * The auth context keeps its keys to itself, so a resumption ticket carries
+ * its own key. The client proves it holds that key with a MAC over the ticket
+ * id and a fresh nonce before the server gives the parked session away.
+ *
+ * \history
+ * 18.10.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _NETWORK_MAC_H_
+#define _NETWORK_MAC_H_
+
+#include <stddef.h>
+
+#define NETWORK_MAC_LEN 32
+#define NETWORK_MAC_KEY_LEN 32
+
+/**
+ * @brief Compute HMAC-SHA256 of a message
+ *
+ * @param key Key, at most 64 bytes
+ * @param key_len Length of the key
+ * @param msg Message
+ * @param msg_len Length of the message
+ * @param mac Output buffer of NETWORK_MAC_LEN bytes
+ */
+void network_mac_compute(const unsigned char *key, size_t key_len, const unsigned char *msg, size_t msg_len,
+                         unsigned char mac[NETWORK_MAC_LEN]);
+
+/**
+ * @brief Compare two MACs in time independent of their content
+ *
+ * @return 0 if they are equal
+ */
+int network_mac_compare(const unsigned char *a, const unsigned char *b);
+
+#endif
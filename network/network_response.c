@@ -0,0 +1,222 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_response.c
+ * \brief
+ * Implementation of chunk chain writer for network responses
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 05.10.2020. Initial version.
+ ****************************************************************************/
+
+#include "network_response.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static network_response_chunk_t *chunk_new(void) {
+  network_response_chunk_t *chunk = malloc(sizeof(network_response_chunk_t));
+
+  if (chunk != NULL) {
+    chunk->next = NULL;
+    chunk->len = 0;
+  }
+
+  return chunk;
+}
+
+static int send_frame(network_response_t *response, char *data, unsigned int len) {
+  if (response->send == NULL || response->send(response->send_ctx, data, len) != NETWORK_RESPONSE_OK) {
+    response->error = 1;
+    return NETWORK_RESPONSE_ERROR;
+  }
+
+  return NETWORK_RESPONSE_OK;
+}
+
+// Room at the end of the chain, sending or adding a chunk when the tail is full
+static network_response_chunk_t *tail_with_room(network_response_t *response) {
+  network_response_chunk_t *tail = response->tail;
+
+  if (tail != NULL && tail->len < NETWORK_RESPONSE_CHUNK_LEN) {
+    return tail;
+  }
+
+  if (tail != NULL && response->chunked && response->stream) {
+    // Only the tail is ever kept, so the chunk is reused once it is sent
+    if (send_frame(response, tail->data, tail->len) != NETWORK_RESPONSE_OK) {
+      return NULL;
+    }
+    tail->len = 0;
+    return tail;
+  }
+
+  network_response_chunk_t *chunk = chunk_new();
+  if (chunk == NULL) {
+    response->error = 1;
+    return NULL;
+  }
+
+  if (tail == NULL) {
+    response->head = chunk;
+  } else {
+    tail->next = chunk;
+  }
+  response->tail = chunk;
+
+  return chunk;
+}
+
+void network_response_init(network_response_t *response, char *scratch, unsigned int scratch_size,
+                           network_response_send_cb send, void *send_ctx) {
+  memset(response, 0, sizeof(network_response_t));
+  response->scratch = scratch;
+  response->scratch_size = scratch_size;
+  response->send = send;
+  response->send_ctx = send_ctx;
+}
+
+int network_response_write(network_response_t *response, const char *data, unsigned int len) {
+  if (response->error) {
+    return NETWORK_RESPONSE_ERROR;
+  }
+
+  while (len > 0) {
+    network_response_chunk_t *chunk = tail_with_room(response);
+    if (chunk == NULL) {
+      return NETWORK_RESPONSE_ERROR;
+    }
+
+    unsigned int room = NETWORK_RESPONSE_CHUNK_LEN - chunk->len;
+    unsigned int part = len < room ? len : room;
+    memcpy(chunk->data + chunk->len, data, part);
+    chunk->len += part;
+    response->len += part;
+    data += part;
+    len -= part;
+  }
+
+  return NETWORK_RESPONSE_OK;
+}
+
+int network_response_printf(network_response_t *response, const char *format, ...) {
+  char line[256];
+  va_list args;
+
+  va_start(args, format);
+  int len = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+
+  if (len < 0) {
+    response->error = 1;
+    return NETWORK_RESPONSE_ERROR;
+  }
+  if ((unsigned int)len < sizeof(line)) {
+    return network_response_write(response, line, len);
+  }
+
+  // Longer text is formatted again into a buffer of its own
+  char *text = malloc(len + 1);
+  if (text == NULL) {
+    response->error = 1;
+    return NETWORK_RESPONSE_ERROR;
+  }
+  va_start(args, format);
+  vsnprintf(text, len + 1, format, args);
+  va_end(args);
+
+  int ret = network_response_write(response, text, len);
+  free(text);
+
+  return ret;
+}
+
+int network_response_finish(network_response_t *response) {
+  if (response->error) {
+    return -1;
+  }
+
+  if (response->chunked) {
+    for (network_response_chunk_t *chunk = response->head; chunk != NULL; chunk = chunk->next) {
+      if (chunk->len > 0 && send_frame(response, chunk->data, chunk->len) != NETWORK_RESPONSE_OK) {
+        return -1;
+      }
+    }
+
+    // Empty frame ends the stream
+    if (send_frame(response, "", 0) != NETWORK_RESPONSE_OK) {
+      return -1;
+    }
+
+    return response->len;
+  }
+
+  if (response->head == NULL) {
+    return send_frame(response, "", 0) == NETWORK_RESPONSE_OK ? 0 : -1;
+  }
+  if (response->head == response->tail) {
+    return send_frame(response, response->head->data, response->head->len) == NETWORK_RESPONSE_OK ? (int)response->len
+                                                                                                  : -1;
+  }
+  if (response->len > NETWORK_RESPONSE_FRAME_MAX) {
+    response->error = 1;
+    return -1;
+  }
+
+  // Single frame response spanning chunks goes out from one buffer
+  char *frame = malloc(response->len);
+  if (frame == NULL) {
+    response->error = 1;
+    return -1;
+  }
+
+  unsigned int pos = 0;
+  for (network_response_chunk_t *chunk = response->head; chunk != NULL; chunk = chunk->next) {
+    memcpy(frame + pos, chunk->data, chunk->len);
+    pos += chunk->len;
+  }
+
+  int ret = send_frame(response, frame, pos) == NETWORK_RESPONSE_OK ? (int)pos : -1;
+  free(frame);
+
+  return ret;
+}
+
+void network_response_release(network_response_t *response) {
+  network_response_chunk_t *chunk = response->head;
+
+  while (chunk != NULL) {
+    network_response_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  response->head = NULL;
+  response->tail = NULL;
+  response->len = 0;
+  response->error = 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_response.h
+ * \brief
+ * Chunk chain writer for network responses
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * A response is either sent as one frame (the default), or, when the client
+ * asked for it, as a stream of frames holding consecutive pieces of the
+ * response, ended by an empty frame. A streamed response that may be sent
+ * while it is written never holds more than one chunk in memory.
+ *
+ * \history
+ * 05.10.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _NETWORK_RESPONSE_H_
+#define _NETWORK_RESPONSE_H_
+
+#define NETWORK_RESPONSE_CHUNK_LEN 4096
+#define NETWORK_RESPONSE_FRAME_MAX 65535
+
+#define NETWORK_RESPONSE_OK 0
+#define NETWORK_RESPONSE_ERROR -1
+
+typedef struct network_response_chunk {
+  struct network_response_chunk *next;
+  unsigned int len;
+  char data[NETWORK_RESPONSE_CHUNK_LEN];
+} network_response_chunk_t;
+
+/**
+ * @brief Send one frame of a response to the client
+ *
+ * @return NETWORK_RESPONSE_OK or NETWORK_RESPONSE_ERROR
+ */
+typedef int (*network_response_send_cb)(void *send_ctx, char *data, unsigned int len);
+
+typedef struct {
+  network_response_chunk_t *head;
+  network_response_chunk_t *tail;
+  unsigned int len;
+
+  // Client takes the response as a stream of frames
+  int chunked;
+  // Full chunks of a chunked response go out while the handler still writes
+  int stream;
+  int error;
+
+  network_response_send_cb send;
+  void *send_ctx;
+
+  // Staging buffer for renderers that need one contiguous buffer
+  char *scratch;
+  unsigned int scratch_size;
+} network_response_t;
+
+/**
+ * @brief Prepare an empty response
+ */
+void network_response_init(network_response_t *response, char *scratch, unsigned int scratch_size,
+                           network_response_send_cb send, void *send_ctx);
+
+/**
+ * @brief Append data to the response
+ *
+ * @return NETWORK_RESPONSE_OK or NETWORK_RESPONSE_ERROR
+ */
+int network_response_write(network_response_t *response, const char *data, unsigned int len);
+
+/**
+ * @brief Append formatted text to the response
+ *
+ * @return NETWORK_RESPONSE_OK or NETWORK_RESPONSE_ERROR
+ */
+int network_response_printf(network_response_t *response, const char *format, ...);
+
+/**
+ * @brief Send what is left of the response
+ *
+ * @return Number of bytes in the response or -1 on error
+ */
+int network_response_finish(network_response_t *response);
+
+/**
+ * @brief Free the chunks of the response
+ */
+void network_response_release(network_response_t *response);
+
+#endif
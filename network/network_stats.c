@@ -0,0 +1,185 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_stats.c
+ * \brief
+ * Implementation of latency histograms and counters of the network module
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 21.09.2020. Initial version.
+ ****************************************************************************/
+
+#include "network_stats.h"
+
+#include <stdio.h>
+
+static const char *phase_names[NETWORK_PHASE_NUM] = {"accept_wait", "auth", "receive", "decide", "send"};
+
+static int bucket_index(unsigned long long value) {
+  if (value < NETWORK_STATS_LINEAR) {
+    return (int)value;
+  }
+
+  int exponent = 63 - __builtin_clzll(value);
+  if (exponent >= NETWORK_STATS_MAX_BITS) {
+    return NETWORK_STATS_BUCKETS - 1;
+  }
+
+  // Top NETWORK_STATS_SUB_BITS bits below the leading one pick the sub-bucket
+  int sub = (int)(value >> (exponent - NETWORK_STATS_SUB_BITS)) & (NETWORK_STATS_SUB_BUCKETS - 1);
+  return NETWORK_STATS_LINEAR + (exponent - NETWORK_STATS_LINEAR_BITS) * NETWORK_STATS_SUB_BUCKETS + sub;
+}
+
+static unsigned long long bucket_upper_bound(int index) {
+  if (index < NETWORK_STATS_LINEAR) {
+    return index;
+  }
+
+  int exponent = (index - NETWORK_STATS_LINEAR) / NETWORK_STATS_SUB_BUCKETS + NETWORK_STATS_LINEAR_BITS;
+  int sub = (index - NETWORK_STATS_LINEAR) % NETWORK_STATS_SUB_BUCKETS;
+  return (1ULL << exponent) + ((unsigned long long)(sub + 1) << (exponent - NETWORK_STATS_SUB_BITS)) - 1;
+}
+
+static unsigned long long load(unsigned long long *value) { return __atomic_load_n(value, __ATOMIC_RELAXED); }
+
+void network_stats_record(network_histogram_t *histogram, unsigned long long value_us) {
+  unsigned long long *count = &histogram->counts[bucket_index(value_us)];
+
+  // Single writer: relaxed atomics only keep concurrent readers from tearing
+  __atomic_store_n(count, load(count) + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&histogram->sum_us, load(&histogram->sum_us) + value_us, __ATOMIC_RELAXED);
+  if (value_us > load(&histogram->max_us)) {
+    __atomic_store_n(&histogram->max_us, value_us, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&histogram->total, load(&histogram->total) + 1, __ATOMIC_RELAXED);
+}
+
+static void merge_histogram(network_histogram_t *merged, network_histogram_t *histogram) {
+  for (int i = 0; i < NETWORK_STATS_BUCKETS; i++) {
+    merged->counts[i] += load(&histogram->counts[i]);
+  }
+  merged->total += load(&histogram->total);
+  merged->sum_us += load(&histogram->sum_us);
+  if (load(&histogram->max_us) > merged->max_us) {
+    merged->max_us = load(&histogram->max_us);
+  }
+}
+
+void network_stats_merge(network_stats_t *merged, network_stats_t *stats) {
+  for (int i = 0; i < NETWORK_PHASE_NUM; i++) {
+    merge_histogram(&merged->phases[i], &stats->phases[i]);
+  }
+  for (int i = 0; i < NETWORK_COMMAND_MAX; i++) {
+    merge_histogram(&merged->commands[i], &stats->commands[i]);
+  }
+}
+
+unsigned long long network_stats_percentile(network_histogram_t *histogram, double percentile) {
+  unsigned long long total = 0;
+  unsigned long long seen = 0;
+
+  // Counts are summed again instead of using total, which a merge may have
+  // read at a slightly different moment
+  for (int i = 0; i < NETWORK_STATS_BUCKETS; i++) {
+    total += histogram->counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  unsigned long long rank = (unsigned long long)(percentile / 100.0 * total + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  for (int i = 0; i < NETWORK_STATS_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      unsigned long long bound = bucket_upper_bound(i);
+      return bound < histogram->max_us ? bound : histogram->max_us;
+    }
+  }
+
+  return histogram->max_us;
+}
+
+unsigned long long network_stats_requests(network_stats_t *stats) {
+  unsigned long long requests = 0;
+
+  for (int i = 0; i < NETWORK_COMMAND_MAX; i++) {
+    requests += stats->commands[i].total;
+  }
+
+  return requests;
+}
+
+static unsigned int render_histogram(network_histogram_t *histogram, const char *name, int first, char *buf,
+                                     unsigned int buf_size) {
+  int len = snprintf(buf, buf_size,
+                     "%s\"%s\":{\"count\":%llu,\"avg_us\":%llu,\"p50_us\":%llu,\"p90_us\":%llu,\"p99_us\":%llu,"
+                     "\"max_us\":%llu}",
+                     first ? "" : ",", name, histogram->total,
+                     histogram->total > 0 ? histogram->sum_us / histogram->total : 0,
+                     network_stats_percentile(histogram, 50.0), network_stats_percentile(histogram, 90.0),
+                     network_stats_percentile(histogram, 99.0), histogram->max_us);
+
+  return len < 0 ? 0 : (unsigned int)len;
+}
+
+unsigned int network_stats_render(network_stats_t *stats, char *buf, unsigned int buf_size) {
+  unsigned int pos = 0;
+  int first = 1;
+
+#define RENDER_APPEND(call)        \
+  do {                             \
+    if (pos < buf_size) {          \
+      pos += (call);               \
+    }                              \
+  } while (0)
+
+  RENDER_APPEND(snprintf(buf + pos, buf_size - pos, "{\"phases\":{"));
+  for (int i = 0; i < NETWORK_PHASE_NUM; i++) {
+    RENDER_APPEND(render_histogram(&stats->phases[i], phase_names[i], i == 0, buf + pos, buf_size - pos));
+  }
+
+  // Only commands that are registered and were used
+  RENDER_APPEND(snprintf(buf + pos, buf_size - pos, "},\"commands\":{"));
+  for (int i = 0; i < NETWORK_COMMAND_MAX; i++) {
+    const network_command_t *command = network_dispatch_get(i);
+    if (command != NULL && stats->commands[i].total > 0) {
+      RENDER_APPEND(render_histogram(&stats->commands[i], command->name, first, buf + pos, buf_size - pos));
+      first = 0;
+    }
+  }
+  RENDER_APPEND(snprintf(buf + pos, buf_size - pos, "}}"));
+
+#undef RENDER_APPEND
+
+  // Truncated output still has to be a terminated string
+  if (pos >= buf_size) {
+    pos = buf_size - 1;
+  }
+
+  return pos;
+}
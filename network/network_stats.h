@@ -0,0 +1,100 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_stats.h
+ * \brief
+ * Latency histograms and counters of the network module
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Every worker thread owns one network_stats_t and is its only writer.
+ * Readers merge the per-thread copies, so recording never takes a lock.
+ *
+ * \history
+ * 21.09.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _NETWORK_STATS_H_
+#define _NETWORK_STATS_H_
+
+#include "network_dispatch.h"
+
+// Log-linear buckets: values below NETWORK_STATS_LINEAR microseconds get a
+// bucket each, every power of two above that is split in
+// NETWORK_STATS_SUB_BUCKETS equal parts (12.5% worst case error).
+#define NETWORK_STATS_LINEAR_BITS 4
+#define NETWORK_STATS_LINEAR (1 << NETWORK_STATS_LINEAR_BITS)
+#define NETWORK_STATS_SUB_BITS 3
+#define NETWORK_STATS_SUB_BUCKETS (1 << NETWORK_STATS_SUB_BITS)
+#define NETWORK_STATS_MAX_BITS 36
+#define NETWORK_STATS_BUCKETS \
+  (NETWORK_STATS_LINEAR + (NETWORK_STATS_MAX_BITS - NETWORK_STATS_LINEAR_BITS) * NETWORK_STATS_SUB_BUCKETS)
+
+typedef enum {
+  NETWORK_PHASE_ACCEPT_WAIT,
+  NETWORK_PHASE_AUTH,
+  NETWORK_PHASE_RECEIVE,
+  NETWORK_PHASE_DECIDE,
+  NETWORK_PHASE_SEND,
+  NETWORK_PHASE_NUM
+} network_phase_e;
+
+typedef struct {
+  unsigned long long counts[NETWORK_STATS_BUCKETS];
+  unsigned long long total;
+  unsigned long long sum_us;
+  unsigned long long max_us;
+} network_histogram_t;
+
+typedef struct {
+  network_histogram_t phases[NETWORK_PHASE_NUM];
+  network_histogram_t commands[NETWORK_COMMAND_MAX];
+} network_stats_t;
+
+/**
+ * @brief Record one latency sample, from the thread owning the histogram
+ */
+void network_stats_record(network_histogram_t *histogram, unsigned long long value_us);
+
+/**
+ * @brief Add a snapshot of one thread's stats to a merged copy
+ */
+void network_stats_merge(network_stats_t *merged, network_stats_t *stats);
+
+/**
+ * @brief Upper bound of the bucket holding the given percentile (0 - 100)
+ */
+unsigned long long network_stats_percentile(network_histogram_t *histogram, double percentile);
+
+/**
+ * @brief Total number of requests across all commands
+ */
+unsigned long long network_stats_requests(network_stats_t *stats);
+
+/**
+ * @brief Render merged stats as JSON
+ *
+ * @return Length of the rendered string
+ */
+unsigned int network_stats_render(network_stats_t *stats, char *buf, unsigned int buf_size);
+
+#endif
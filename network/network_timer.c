@@ -0,0 +1,159 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_timer.c
+ * \brief
+ * Implementation of hierarchical timer wheel for connection deadlines
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 12.10.2020. Initial version.
+ ****************************************************************************/
+
+#include "network_timer.h"
+
+#include <stddef.h>
+
+#define SLOT_MASK (NETWORK_TIMER_SLOTS - 1)
+#define LEVEL_SHIFT(level) ((level)*NETWORK_TIMER_LEVEL_BITS)
+#define WHEEL_RANGE (1ULL << LEVEL_SHIFT(NETWORK_TIMER_LEVELS))
+
+static void slot_add(network_timer_t *head, network_timer_t *timer) {
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+static void slot_remove(network_timer_t *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = NULL;
+  timer->next = NULL;
+}
+
+static void place(network_timer_wheel_t *wheel, network_timer_t *timer) {
+  unsigned long long expires = timer->expires;
+
+  if (expires < wheel->now) {
+    // Already due: the slot processed next
+    expires = wheel->now;
+  } else if (expires - wheel->now >= WHEEL_RANGE) {
+    // Beyond the top level: parked at its far end, placed again when it cascades
+    expires = wheel->now + WHEEL_RANGE - 1;
+  }
+
+  unsigned long long delta = expires - wheel->now;
+  int level = 0;
+  while (level < NETWORK_TIMER_LEVELS - 1 && delta >= (1ULL << LEVEL_SHIFT(level + 1))) {
+    level++;
+  }
+
+  slot_add(&wheel->slots[level][(expires >> LEVEL_SHIFT(level)) & SLOT_MASK], timer);
+}
+
+// Move the timers of one slot of a level down to the levels below it
+static void cascade(network_timer_wheel_t *wheel, int level) {
+  int index = (wheel->now >> LEVEL_SHIFT(level)) & SLOT_MASK;
+  network_timer_t *head = &wheel->slots[level][index];
+
+  while (head->next != head) {
+    network_timer_t *timer = head->next;
+    slot_remove(timer);
+    place(wheel, timer);
+  }
+}
+
+void network_timer_wheel_init(network_timer_wheel_t *wheel, unsigned long long tick_us, unsigned long long now_us) {
+  for (int level = 0; level < NETWORK_TIMER_LEVELS; level++) {
+    for (int slot = 0; slot < NETWORK_TIMER_SLOTS; slot++) {
+      wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+      wheel->slots[level][slot].next = &wheel->slots[level][slot];
+    }
+  }
+
+  wheel->tick_us = tick_us;
+  wheel->now = now_us / tick_us;
+  wheel->pending = 0;
+}
+
+void network_timer_init(network_timer_t *timer, void *data) {
+  timer->expires = 0;
+  timer->pending = 0;
+  timer->data = data;
+  timer->prev = NULL;
+  timer->next = NULL;
+}
+
+void network_timer_schedule(network_timer_wheel_t *wheel, network_timer_t *timer, unsigned long long expires_us) {
+  network_timer_cancel(wheel, timer);
+
+  // Rounded up, so a timer fires at or after its expiry, never before
+  timer->expires = (expires_us + wheel->tick_us - 1) / wheel->tick_us;
+  timer->pending = 1;
+  wheel->pending++;
+  place(wheel, timer);
+}
+
+void network_timer_cancel(network_timer_wheel_t *wheel, network_timer_t *timer) {
+  if (timer->pending) {
+    slot_remove(timer);
+    timer->pending = 0;
+    wheel->pending--;
+  }
+}
+
+void network_timer_advance(network_timer_wheel_t *wheel, unsigned long long now_us, network_timer_cb cb) {
+  unsigned long long target = now_us / wheel->tick_us;
+
+  while (wheel->now <= target) {
+    if (wheel->pending == 0) {
+      // Nothing to fire or cascade, so idle ticks are skipped at once
+      wheel->now = target + 1;
+      break;
+    }
+
+    // Each time a level wraps around, the next slot of the level above comes down
+    for (int level = 1; level < NETWORK_TIMER_LEVELS && ((wheel->now >> LEVEL_SHIFT(level - 1)) & SLOT_MASK) == 0;
+         level++) {
+      cascade(wheel, level);
+    }
+
+    network_timer_t *head = &wheel->slots[0][wheel->now & SLOT_MASK];
+    while (head->next != head) {
+      network_timer_t *timer = head->next;
+      slot_remove(timer);
+      if (timer->expires > wheel->now) {
+        // Parked beyond the top level and not due yet
+        place(wheel, timer);
+        continue;
+      }
+      timer->pending = 0;
+      wheel->pending--;
+      cb(timer);
+    }
+
+    wheel->now++;
+  }
+}
@@ -0,0 +1,100 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_timer.h
+ * \brief
+ * Hierarchical timer wheel for connection deadlines
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Level 0 has one slot per tick; every higher level has slots that are
+ * NETWORK_TIMER_SLOTS times wider. A timer goes into the lowest level whose
+ * range covers it and moves down a level each time the wheel below wraps
+ * around, so scheduling and cancelling are O(1) and advancing costs one slot
+ * per tick. The wheel does no locking of its own.
+ *
+ * \history
+ * 12.10.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _NETWORK_TIMER_H_
+#define _NETWORK_TIMER_H_
+
+#define NETWORK_TIMER_LEVEL_BITS 6
+#define NETWORK_TIMER_SLOTS (1 << NETWORK_TIMER_LEVEL_BITS)
+#define NETWORK_TIMER_LEVELS 4
+
+typedef struct network_timer {
+  // Expiry in ticks of the wheel
+  unsigned long long expires;
+  int pending;
+  void *data;
+
+  struct network_timer *prev;
+  struct network_timer *next;
+} network_timer_t;
+
+typedef void (*network_timer_cb)(network_timer_t *timer);
+
+typedef struct {
+  // Each slot is a circular list with a sentinel
+  network_timer_t slots[NETWORK_TIMER_LEVELS][NETWORK_TIMER_SLOTS];
+  unsigned long long tick_us;
+  // Next tick to process
+  unsigned long long now;
+  unsigned int pending;
+} network_timer_wheel_t;
+
+/**
+ * @brief Prepare an empty wheel
+ *
+ * @param wheel Wheel to initialize
+ * @param tick_us Length of one tick in microseconds
+ * @param now_us Current time in microseconds
+ */
+void network_timer_wheel_init(network_timer_wheel_t *wheel, unsigned long long tick_us, unsigned long long now_us);
+
+/**
+ * @brief Prepare a timer that is not scheduled
+ */
+void network_timer_init(network_timer_t *timer, void *data);
+
+/**
+ * @brief Schedule a timer, moving it if it is already pending
+ *
+ * @param expires_us Absolute expiry in microseconds; the timer never fires before it
+ */
+void network_timer_schedule(network_timer_wheel_t *wheel, network_timer_t *timer, unsigned long long expires_us);
+
+/**
+ * @brief Cancel a timer if it is pending
+ */
+void network_timer_cancel(network_timer_wheel_t *wheel, network_timer_t *timer);
+
+/**
+ * @brief Fire every timer that expired up to now_us
+ *
+ * Callbacks may schedule or cancel timers, including the one that fired.
+ */
+void network_timer_advance(network_timer_wheel_t *wheel, unsigned long long now_us, network_timer_cb cb);
+
+#endif
@@ -0,0 +1,579 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file pep_obligation.c
+ * \brief
+ * Implementation of the obligation queue
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * The journal is a text file with one record per line: "E <id> <type> <hex
+ * payload>" when an obligation is enqueued, "D <id>" when it is done and
+ * "F <id>" when it failed for good. On start, and whenever
+ * PEP_OBLIGATION_COMPACT_RECORDS obligations have ended since, it is
+ * rewritten with the pending obligations only.
+ *
+ * The journal has its own locks, so no fsync is made under the queue lock.
+ * Writers append under journal_lock, one fsync then covers the records of
+ * all writers before it. Locks are taken in the order sync_lock,
+ * journal_lock, obligation_lock.
+ *
+ * \history
+ * 28.12.2020. Initial version.
+ ****************************************************************************/
+
+#include "pep_obligation.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "plugin_logger.h"
+
+#define PEP_OBLIGATION_ENTRIES_MAX 256
+#define PEP_OBLIGATION_HANDLERS_MAX 8
+#define PEP_OBLIGATION_WORKERS_MAX 8
+#define PEP_OBLIGATION_RETRY_DELAY_MAX_MS 60000
+#define PEP_OBLIGATION_PATH_LEN 256
+#define PEP_OBLIGATION_LINE_LEN (PEP_OBLIGATION_TYPE_LEN + 2 * PEP_OBLIGATION_PAYLOAD_LEN + 32)
+#define PEP_OBLIGATION_COMPACT_RECORDS 1024
+
+typedef enum {
+  PEP_OBLIGATION_PENDING,
+  PEP_OBLIGATION_RUNNING,
+  PEP_OBLIGATION_DONE,
+  PEP_OBLIGATION_FAILED
+} pep_obligation_status_e;
+
+typedef enum {
+  PEP_OBLIGATION_UNJOURNALED,
+  // The enqueue record is in the journal file
+  PEP_OBLIGATION_WRITTEN,
+  // The enqueue record is on disk, only then the obligation is run
+  PEP_OBLIGATION_SYNCED
+} pep_obligation_journaled_e;
+
+typedef struct {
+  // 0 for a free entry
+  int id;
+  pep_obligation_status_e status;
+  pep_obligation_journaled_e journaled;
+  int attempts;
+  unsigned long long next_attempt_ms;
+  char type[PEP_OBLIGATION_TYPE_LEN];
+  char payload[PEP_OBLIGATION_PAYLOAD_LEN];
+} pep_obligation_entry_t;
+
+typedef struct {
+  char type[PEP_OBLIGATION_TYPE_LEN];
+  pep_obligation_cb cb;
+  void *user_data;
+} pep_obligation_handler_t;
+
+static pthread_mutex_t obligation_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t obligation_cond;
+static pthread_t threads[PEP_OBLIGATION_WORKERS_MAX];
+static int threads_num;
+static int running;
+static int stopping;
+static pep_obligation_entry_t entries[PEP_OBLIGATION_ENTRIES_MAX];
+static pep_obligation_handler_t handlers[PEP_OBLIGATION_HANDLERS_MAX];
+static int handlers_num;
+static int next_id = 1;
+static int attempts_max;
+static int first_retry_delay_ms;
+
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *journal;
+static char journal_path[PEP_OBLIGATION_PATH_LEN];
+// Records written to the journal file and those known to be on disk
+static unsigned long long journal_written;
+static unsigned long long journal_synced;
+// Obligations that ended since the journal was rewritten
+static int journal_ended;
+
+static unsigned long long now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000ULL + now.tv_nsec / 1000000L;
+}
+
+static pep_obligation_handler_t *find_handler(const char *type) {
+  for (int i = 0; i < handlers_num; i++) {
+    if (strcmp(handlers[i].type, type) == 0) {
+      return &handlers[i];
+    }
+  }
+  return NULL;
+}
+
+static pep_obligation_entry_t *find_entry(int id) {
+  for (int i = 0; i < PEP_OBLIGATION_ENTRIES_MAX && id > 0; i++) {
+    if (entries[i].id == id) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+// A free entry, or else the oldest finished one
+static pep_obligation_entry_t *new_entry(void) {
+  pep_obligation_entry_t *oldest = NULL;
+
+  for (int i = 0; i < PEP_OBLIGATION_ENTRIES_MAX; i++) {
+    if (entries[i].id == 0) {
+      return &entries[i];
+    }
+    if ((entries[i].status == PEP_OBLIGATION_DONE || entries[i].status == PEP_OBLIGATION_FAILED) &&
+        (oldest == NULL || entries[i].id < oldest->id)) {
+      oldest = &entries[i];
+    }
+  }
+  return oldest;
+}
+
+static void hex_encode(const char *str, char *hex) {
+  for (; *str != '\0'; str++) {
+    *hex++ = "0123456789abcdef"[(unsigned char)*str >> 4];
+    *hex++ = "0123456789abcdef"[(unsigned char)*str & 0xF];
+  }
+  *hex = '\0';
+}
+
+static int hex_decode(const char *hex, char *str, int str_size) {
+  int len = strlen(hex) / 2;
+  unsigned int byte;
+
+  if (len >= str_size) {
+    return -1;
+  }
+  for (int i = 0; i < len; i++) {
+    if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+      return -1;
+    }
+    str[i] = byte;
+  }
+  str[len] = '\0';
+  return len;
+}
+
+static int journal_print(FILE *file, char record, const pep_obligation_entry_t *entry) {
+  char hex[2 * PEP_OBLIGATION_PAYLOAD_LEN];
+
+  if (record == 'E') {
+    hex_encode(entry->payload, hex);
+    return fprintf(file, "E %d %s %s\n", entry->id, entry->type, hex) < 0 ? -1 : 0;
+  }
+  return fprintf(file, "%c %d\n", record, entry->id) < 0 ? -1 : 0;
+}
+
+static int journal_replay(const char *path) {
+  char line[PEP_OBLIGATION_LINE_LEN];
+  char type[PEP_OBLIGATION_TYPE_LEN];
+  char hex[2 * PEP_OBLIGATION_PAYLOAD_LEN];
+  char record;
+  int id;
+  int complete = 1;
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL) {
+    return complete;
+  }
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    hex[0] = '\0';
+    if (sscanf(line, "E %d %31s %1023s", &id, type, hex) >= 2) {
+      pep_obligation_entry_t *entry = new_entry();
+      if (entry == NULL) {
+        complete = 0;
+        continue;
+      }
+      memset(entry, 0, sizeof(pep_obligation_entry_t));
+      entry->id = id;
+      entry->status = PEP_OBLIGATION_PENDING;
+      entry->journaled = PEP_OBLIGATION_SYNCED;
+      strcpy(entry->type, type);
+      if (hex_decode(hex, entry->payload, PEP_OBLIGATION_PAYLOAD_LEN) < 0) {
+        entry->status = PEP_OBLIGATION_FAILED;
+      }
+      next_id = id >= next_id ? id + 1 : next_id;
+    } else if (sscanf(line, "%c %d", &record, &id) == 2 && (record == 'D' || record == 'F')) {
+      pep_obligation_entry_t *entry = find_entry(id);
+      if (entry != NULL) {
+        entry->status = record == 'D' ? PEP_OBLIGATION_DONE : PEP_OBLIGATION_FAILED;
+      }
+    }
+  }
+  fclose(file);
+
+  return complete;
+}
+
+// Write the obligations still to run to a new journal, which replaces the one at path and is appended to
+static FILE *journal_rewrite(const char *path) {
+  char tmp_path[PEP_OBLIGATION_PATH_LEN];
+
+  if (snprintf(tmp_path, PEP_OBLIGATION_PATH_LEN, "%s.tmp", path) >= PEP_OBLIGATION_PATH_LEN) {
+    return NULL;
+  }
+  FILE *file = fopen(tmp_path, "w");
+  if (file == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < PEP_OBLIGATION_ENTRIES_MAX; i++) {
+    if (entries[i].id != 0 && entries[i].journaled != PEP_OBLIGATION_UNJOURNALED &&
+        (entries[i].status == PEP_OBLIGATION_PENDING || entries[i].status == PEP_OBLIGATION_RUNNING) &&
+        journal_print(file, 'E', &entries[i]) != 0) {
+      fclose(file);
+      return NULL;
+    }
+  }
+  if (fflush(file) != 0 || fsync(fileno(file)) != 0 || rename(tmp_path, path) != 0) {
+    fclose(file);
+    return NULL;
+  }
+
+  return file;
+}
+
+static FILE *journal_open(const char *path) {
+  if (!journal_replay(path)) {
+    // Obligations that did not fit are kept in the journal for the next start
+    log_error(plugin_logger_id, "[%s:%d] Too many pending obligations in %s.\n", __func__, __LINE__, path);
+    return fopen(path, "a");
+  }
+  return journal_rewrite(path);
+}
+
+// Called with journal_lock held. Records written so far stay on disk in the new journal.
+static void journal_compact(void) {
+  pthread_mutex_lock(&obligation_lock);
+  FILE *file = journal_rewrite(journal_path);
+  pthread_mutex_unlock(&obligation_lock);
+
+  // Tried again after as many obligations have ended
+  journal_ended = 0;
+  if (file == NULL) {
+    log_error(plugin_logger_id, "[%s:%d] Could not compact obligation journal %s.\n", __func__, __LINE__,
+              journal_path);
+    return;
+  }
+  fclose(journal);
+  journal = file;
+}
+
+// Appends a record of an entry, which is on disk once journal_sync() has returned for seq
+static int journal_write(char record, pep_obligation_entry_t *entry, unsigned long long *seq) {
+  int ret = 0;
+
+  pthread_mutex_lock(&journal_lock);
+  if (journal != NULL && (journal_print(journal, record, entry) != 0 || fflush(journal) != 0)) {
+    log_error(plugin_logger_id, "[%s:%d] Could not write obligation %d to the journal.\n", __func__, __LINE__,
+              entry->id);
+    ret = -1;
+  }
+  *seq = ++journal_written;
+  if (record == 'E') {
+    // Under journal_lock, so a compaction either sees the entry or comes before its record
+    pthread_mutex_lock(&obligation_lock);
+    entry->journaled = ret == 0 ? PEP_OBLIGATION_WRITTEN : PEP_OBLIGATION_UNJOURNALED;
+    pthread_mutex_unlock(&obligation_lock);
+  } else if (journal != NULL && ++journal_ended >= PEP_OBLIGATION_COMPACT_RECORDS) {
+    journal_compact();
+  }
+  pthread_mutex_unlock(&journal_lock);
+
+  return ret;
+}
+
+// One fsync covers the records of all writers before it
+static int journal_sync(unsigned long long seq) {
+  int ret = 0;
+
+  pthread_mutex_lock(&sync_lock);
+  if (journal_synced < seq) {
+    pthread_mutex_lock(&journal_lock);
+    unsigned long long written = journal_written;
+    // A duplicate, since a compaction may close the journal meanwhile. The records are then in the new one.
+    int fd = -1;
+    if (journal != NULL && (fd = dup(fileno(journal))) < 0) {
+      ret = -1;
+    }
+    pthread_mutex_unlock(&journal_lock);
+
+    if (fd >= 0) {
+      ret = fsync(fd);
+      close(fd);
+    }
+    if (ret == 0) {
+      journal_synced = written;
+    } else {
+      log_error(plugin_logger_id, "[%s:%d] Could not sync the obligation journal.\n", __func__, __LINE__);
+    }
+  }
+  pthread_mutex_unlock(&sync_lock);
+
+  return ret;
+}
+
+// Pending obligation with a handler that is due first, NULL if there is none
+static pep_obligation_entry_t *next_due(unsigned long long now, unsigned long long *wait_ms) {
+  pep_obligation_entry_t *due = NULL;
+
+  *wait_ms = 0;
+  for (int i = 0; i < PEP_OBLIGATION_ENTRIES_MAX; i++) {
+    pep_obligation_entry_t *entry = &entries[i];
+    if (entry->id == 0 || entry->status != PEP_OBLIGATION_PENDING || entry->journaled != PEP_OBLIGATION_SYNCED ||
+        find_handler(entry->type) == NULL) {
+      continue;
+    }
+    if (entry->next_attempt_ms <= now) {
+      if (due == NULL || entry->id < due->id) {
+        due = entry;
+      }
+    } else if (*wait_ms == 0 || entry->next_attempt_ms - now < *wait_ms) {
+      *wait_ms = entry->next_attempt_ms - now;
+    }
+  }
+  return due;
+}
+
+static void *worker_function(void *arg) {
+  pep_obligation_handler_t handler;
+  pep_obligation_entry_t ended;
+  char payload[PEP_OBLIGATION_PAYLOAD_LEN];
+  unsigned long long wait_ms;
+  unsigned long long seq;
+
+  pthread_mutex_lock(&obligation_lock);
+  while (!stopping) {
+    pep_obligation_entry_t *entry = next_due(now_ms(), &wait_ms);
+    if (entry == NULL) {
+      if (wait_ms == 0) {
+        pthread_cond_wait(&obligation_cond, &obligation_lock);
+      } else {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (wait_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&obligation_cond, &obligation_lock, &deadline);
+      }
+      continue;
+    }
+
+    // The handler runs unlocked, from copies of the entry and the handler
+    int id = entry->id;
+    entry->status = PEP_OBLIGATION_RUNNING;
+    entry->attempts++;
+    handler = *find_handler(entry->type);
+    strcpy(payload, entry->payload);
+    pthread_mutex_unlock(&obligation_lock);
+    int ret = handler.cb(payload, handler.user_data);
+    pthread_mutex_lock(&obligation_lock);
+
+    // Entries in progress are never evicted
+    entry = find_entry(id);
+    if (ret == 0) {
+      entry->status = PEP_OBLIGATION_DONE;
+    } else if (entry->attempts >= attempts_max) {
+      entry->status = PEP_OBLIGATION_FAILED;
+      log_error(plugin_logger_id, "[%s:%d] Obligation %d (%s) failed after %d attempts.\n", __func__, __LINE__, id,
+                entry->type, entry->attempts);
+    } else {
+      int doublings = entry->attempts - 1 < 16 ? entry->attempts - 1 : 16;
+      unsigned long long delay_ms = (unsigned long long)first_retry_delay_ms << doublings;
+      entry->status = PEP_OBLIGATION_PENDING;
+      entry->next_attempt_ms =
+          now_ms() + (delay_ms < PEP_OBLIGATION_RETRY_DELAY_MAX_MS ? delay_ms : PEP_OBLIGATION_RETRY_DELAY_MAX_MS);
+      continue;
+    }
+
+    // Not synced: a lost end record only runs the obligation once more after a crash, and it reaches
+    // the disk with the sync of the next enqueue
+    ended = *entry;
+    pthread_mutex_unlock(&obligation_lock);
+    journal_write(ended.status == PEP_OBLIGATION_DONE ? 'D' : 'F', &ended, &seq);
+    pthread_mutex_lock(&obligation_lock);
+  }
+  pthread_mutex_unlock(&obligation_lock);
+
+  return NULL;
+}
+
+int pep_obligation_init(const char *path, int workers, int retries_max, int retry_delay_ms) {
+  pthread_condattr_t attr;
+
+  pep_obligation_term();
+  if (workers <= 0 || retries_max <= 0 || retry_delay_ms < 0) {
+    return PEP_OBLIGATION_ERROR;
+  }
+
+  if (path != NULL && strlen(path) >= PEP_OBLIGATION_PATH_LEN) {
+    return PEP_OBLIGATION_ERROR;
+  }
+
+  pthread_mutex_lock(&journal_lock);
+  pthread_mutex_lock(&obligation_lock);
+  memset(entries, 0, sizeof(entries));
+  next_id = 1;
+  journal = NULL;
+  journal_ended = 0;
+  strcpy(journal_path, path != NULL ? path : "");
+  if (journal_path[0] != '\0' && (journal = journal_open(journal_path)) == NULL) {
+    log_error(plugin_logger_id, "[%s:%d] Could not open obligation journal %s.\n", __func__, __LINE__, journal_path);
+    pthread_mutex_unlock(&obligation_lock);
+    pthread_mutex_unlock(&journal_lock);
+    return PEP_OBLIGATION_ERROR;
+  }
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&obligation_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  attempts_max = retries_max;
+  first_retry_delay_ms = retry_delay_ms;
+  stopping = 0;
+  threads_num = 0;
+  for (int i = 0; i < workers && i < PEP_OBLIGATION_WORKERS_MAX; i++) {
+    if (pthread_create(&threads[threads_num], NULL, worker_function, NULL) == 0) {
+      threads_num++;
+    }
+  }
+  running = threads_num > 0;
+  if (!running) {
+    pthread_cond_destroy(&obligation_cond);
+    if (journal != NULL) {
+      fclose(journal);
+      journal = NULL;
+    }
+  }
+  pthread_mutex_unlock(&obligation_lock);
+  pthread_mutex_unlock(&journal_lock);
+
+  return running ? PEP_OBLIGATION_OK : PEP_OBLIGATION_ERROR;
+}
+
+void pep_obligation_term(void) {
+  pthread_mutex_lock(&obligation_lock);
+  int was_running = running;
+  stopping = 1;
+  running = 0;
+  if (was_running) {
+    pthread_cond_broadcast(&obligation_cond);
+  }
+  pthread_mutex_unlock(&obligation_lock);
+
+  if (!was_running) {
+    return;
+  }
+  // Workers finish the obligation they run, the others stay pending in the journal
+  for (int i = 0; i < threads_num; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_cond_destroy(&obligation_cond);
+
+  pthread_mutex_lock(&journal_lock);
+  pthread_mutex_lock(&obligation_lock);
+  threads_num = 0;
+  if (journal != NULL) {
+    fclose(journal);
+    journal = NULL;
+  }
+  pthread_mutex_unlock(&obligation_lock);
+  pthread_mutex_unlock(&journal_lock);
+}
+
+int pep_obligation_register(const char *type, pep_obligation_cb cb, void *user_data) {
+  int ret = PEP_OBLIGATION_OK;
+
+  if (type == NULL || cb == NULL || strlen(type) >= PEP_OBLIGATION_TYPE_LEN || strchr(type, ' ') != NULL) {
+    return PEP_OBLIGATION_ERROR;
+  }
+
+  pthread_mutex_lock(&obligation_lock);
+  pep_obligation_handler_t *handler = find_handler(type);
+  if (handler == NULL && handlers_num < PEP_OBLIGATION_HANDLERS_MAX) {
+    handler = &handlers[handlers_num++];
+    strcpy(handler->type, type);
+  }
+  if (handler != NULL) {
+    handler->cb = cb;
+    handler->user_data = user_data;
+    // Obligations of the type may be waiting for it
+    if (running) {
+      pthread_cond_broadcast(&obligation_cond);
+    }
+  } else {
+    ret = PEP_OBLIGATION_ERROR;
+  }
+  pthread_mutex_unlock(&obligation_lock);
+
+  return ret;
+}
+
+int pep_obligation_enqueue(const char *type, const char *payload) {
+  unsigned long long seq;
+
+  if (type == NULL || payload == NULL || strlen(type) >= PEP_OBLIGATION_TYPE_LEN || strchr(type, ' ') != NULL ||
+      strlen(payload) >= PEP_OBLIGATION_PAYLOAD_LEN) {
+    return PEP_OBLIGATION_ERROR;
+  }
+
+  pthread_mutex_lock(&obligation_lock);
+  pep_obligation_entry_t *entry = running ? new_entry() : NULL;
+  if (entry != NULL) {
+    // Pending and unjournaled, the entry is neither evicted nor run until it is on disk
+    memset(entry, 0, sizeof(pep_obligation_entry_t));
+    entry->id = next_id++;
+    entry->status = PEP_OBLIGATION_PENDING;
+    strcpy(entry->type, type);
+    strcpy(entry->payload, payload);
+  }
+  pthread_mutex_unlock(&obligation_lock);
+  if (entry == NULL) {
+    return PEP_OBLIGATION_ERROR;
+  }
+
+  // Records reach the disk before the caller goes on, so no obligation is lost on a crash
+  int ret = journal_write('E', entry, &seq) == 0 && journal_sync(seq) == 0 ? PEP_OBLIGATION_OK : PEP_OBLIGATION_ERROR;
+
+  pthread_mutex_lock(&obligation_lock);
+  // Stopped meanwhile, no worker would run it
+  if (ret == PEP_OBLIGATION_OK && running) {
+    entry->journaled = PEP_OBLIGATION_SYNCED;
+    pthread_cond_signal(&obligation_cond);
+  } else {
+    entry->id = 0;
+    ret = PEP_OBLIGATION_ERROR;
+  }
+  pthread_mutex_unlock(&obligation_lock);
+
+  return ret;
+}
@@ -0,0 +1,94 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file pep_obligation.h
+ * \brief
+ * Queue of obligations PEP plugins fulfil in the background
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * A PEP plugin enforcing an action enqueues its obligations instead of
+ * fulfilling them in the request path, e.g. logging the action to the Tangle,
+ * which takes a proof of work and a round trip to the node. Worker threads
+ * run each obligation through the handler registered for its type and retry
+ * a failed one with a growing delay. Obligations are appended to a journal
+ * file when they are enqueued and when they end, so the ones still pending
+ * are run again after a restart. All functions are thread safe.
+ *
+ * \history
+ * 28.12.2020. Initial version.
+ ****************************************************************************/
+
+#ifndef _PEP_OBLIGATION_H_
+#define _PEP_OBLIGATION_H_
+
+#define PEP_OBLIGATION_TYPE_LEN 32
+#define PEP_OBLIGATION_PAYLOAD_LEN 512
+
+#define PEP_OBLIGATION_OK 0
+#define PEP_OBLIGATION_ERROR -1
+
+/**
+ * @brief Fulfil an obligation
+ *
+ * @param payload Payload given when the obligation was enqueued, terminated
+ * @param user_data Data given at registration
+ * @return 0 on success, anything else has the obligation retried
+ */
+typedef int (*pep_obligation_cb)(const char *payload, void *user_data);
+
+/**
+ * @brief Start the workers and run the obligations the journal holds as pending
+ *
+ * @param journal_path Journal file, NULL or empty keeps obligations in memory only
+ * @param workers Number of worker threads
+ * @param retries_max Attempts after which an obligation fails
+ * @param retry_delay_ms Delay before the first retry, doubled for every further one
+ * @return PEP_OBLIGATION_OK, or PEP_OBLIGATION_ERROR if the journal or the workers could not be started
+ */
+int pep_obligation_init(const char *journal_path, int workers, int retries_max, int retry_delay_ms);
+
+/**
+ * @brief Stop the workers, pending obligations stay in the journal
+ */
+void pep_obligation_term(void);
+
+/**
+ * @brief Register the handler of an obligation type, replacing an earlier one
+ *
+ * Obligations of a type without a handler wait until one is registered.
+ *
+ * @return PEP_OBLIGATION_OK, or PEP_OBLIGATION_ERROR if no more types fit
+ */
+int pep_obligation_register(const char *type, pep_obligation_cb cb, void *user_data);
+
+/**
+ * @brief Queue an obligation
+ *
+ * @param type Type of the obligation, selecting its handler
+ * @param payload Data for the handler, a terminated string of less than PEP_OBLIGATION_PAYLOAD_LEN bytes
+ * @return PEP_OBLIGATION_OK once the obligation is in the journal, or PEP_OBLIGATION_ERROR if the
+ * queue is not running or full; the caller then fulfils the obligation itself
+ */
+int pep_obligation_enqueue(const char *type, const char *payload);
+
+#endif
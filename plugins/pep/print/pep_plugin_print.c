@@ -39,6 +39,7 @@
 #include "stdlib.h"
 
 #include "config_manager.h"
+#include "pep_obligation.h"
 #include "wallet.h"
 
 #define RES_BUFF_LEN 80
@@ -46,6 +47,7 @@
 #define ACTION_NAME_SIZE 16
 #define POLICY_ID_SIZE 64
 #define ADDR_SIZE 128
+#define OBLIGATION_LOG_TANGLE "print_log_tangle"
 
 typedef int (*action_t)(pdp_action_t* action);
 
@@ -58,7 +60,8 @@ typedef struct {
 static wallet_ctx_t* dev_wallet = NULL;
 static action_set_t g_action_set;
 
-static int log_tangle(pdp_action_t* action) {
+// Obligation handler, the payload is the action performed
+static int log_tangle(const char* action_value, void* user_data) {
   char bundle_hash[NUM_TRYTES_BUNDLE + 1] = {};
 
   wallet_err_t ret =
@@ -73,7 +76,8 @@ static int log_tangle(pdp_action_t* action) {
   }
 
   log_info(plugin_logger_id, "[%s:%d] Obligation of logging Action %s to Tangle. Bundle hash: %s.\n", __func__,
-           __LINE__, action->value, bundle_hash);
+           __LINE__, action_value, bundle_hash);
+  return 0;
 }
 
 static int print_terminal(pdp_action_t* action) {
@@ -92,7 +96,10 @@ static int action_cb(plugin_t* plugin, void* data) {
 
   // handle obligations
   if (0 == memcmp(obligation, "obligation#1", strlen("obligation#1"))) {
-    log_tangle(action);
+    // Fulfilled in the background, so the decision does not wait for the Tangle
+    if (pep_obligation_enqueue(OBLIGATION_LOG_TANGLE, action->value) < 0) {
+      log_tangle(action->value, NULL);
+    }
   }
 
   // execute action
@@ -117,6 +124,8 @@ int pep_plugin_print_initializer(plugin_t* plugin, void* wallet_context) {
   strncpy(g_action_set.action_names[0], "action#1", ACTION_NAME_SIZE);
   g_action_set.count = 1;
 
+  pep_obligation_register(OBLIGATION_LOG_TANGLE, log_tangle, NULL);
+
   plugin->destroy = destroy_cb;
   plugin->callbacks = malloc(sizeof(void*) * PEP_PLUGIN_CALLBACK_COUNT);
   plugin->callbacks_num = PEP_PLUGIN_CALLBACK_COUNT;
@@ -24,6 +24,7 @@
 #include <unistd.h>
 
 #include "config_manager.h"
+#include "pep_obligation.h"
 #include "relay_interface.h"
 #include "wallet.h"
 
@@ -34,6 +35,7 @@
 #define ADDR_SIZE 128
 #define ACTION_ADDRESS "MXHYKULAXKWBY9JCNVPVSOSZHMBDJRWTTXZCTKHLHKSJARDADHJSTCKVQODBVWCYDNGWFGWVTUVENB9UA"
 #define ACTION_MSG_MAX_SIZE 512
+#define OBLIGATION_LOG_TANGLE "relay_log_tangle"
 
 typedef int (*action_t)(pdp_action_t* action);
 
@@ -46,7 +48,8 @@ typedef struct {
 static wallet_ctx_t* dev_wallet = NULL;
 static action_set_t g_action_set;
 
-static int log_tangle(char* msg) {
+// Obligation handler, the payload is the message to log
+static int log_tangle(const char* msg, void* user_data) {
   char bundle_hash[NUM_TRYTES_BUNDLE + 1] = {};
 
   wallet_err_t ret = wallet_send(dev_wallet, ACTION_ADDRESS, 0, msg, bundle_hash);
@@ -63,6 +66,13 @@ static int log_tangle(char* msg) {
   return 0;
 }
 
+// Logged in the background, so the decision does not wait for the Tangle
+static void log_action(const char* msg) {
+  if (pep_obligation_enqueue(OBLIGATION_LOG_TANGLE, msg) < 0) {
+    log_tangle(msg, NULL);
+  }
+}
+
 static int relay_on() {
   int relay_index = 0;
   relayinterface_on(relay_index);
@@ -70,7 +80,7 @@ static int relay_on() {
   // log action on Tangle
   char msg[ACTION_MSG_MAX_SIZE] = {};
   sprintf(msg, "Relay %d ON.", relay_index);
-  log_tangle(msg);
+  log_action(msg);
 
   // log action on Terminal
   log_info(plugin_logger_id, "[%s:%d] Relay %d ON.\n", __func__, __LINE__, relay_index);
@@ -85,7 +95,7 @@ static int relay_off() {
   // log action on Tangle
   char msg[ACTION_MSG_MAX_SIZE] = {};
   sprintf(msg, "Relay %d OFF.", relay_index);
-  log_tangle(msg);
+  log_action(msg);
 
   // log action on Terminal
   log_info(plugin_logger_id, "[%s:%d] Relay %d OFF.\n", __func__, __LINE__, relay_index);
@@ -132,6 +142,8 @@ int pep_plugin_relay_initializer(plugin_t* plugin, void* wallet_context) {
   strncpy(g_action_set.action_names[1], "action#2", ACTION_NAME_SIZE);
   g_action_set.count = 2;
 
+  pep_obligation_register(OBLIGATION_LOG_TANGLE, log_tangle, NULL);
+
   plugin->destroy = destroy_cb;
   plugin->callbacks = malloc(sizeof(void*) * PEP_PLUGIN_CALLBACK_COUNT);
   plugin->callbacks_num = PEP_PLUGIN_CALLBACK_COUNT;
@@ -0,0 +1,101 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file can_signals.c
+ * \brief
+ * Last values of the CAN signals served to access policies
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ *
+ * \history
+ * 07.12.2020. Initial version.
+ ****************************************************************************/
+
+#include "can_signals.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define CAN_SIGNALS_TYPE_LEN 256
+
+typedef struct {
+  char name[CAN_SIGNALS_NAME_LEN];
+  char value[CAN_SIGNALS_VALUE_LEN];
+} can_signal_t;
+
+static pthread_mutex_t signals_lock = PTHREAD_MUTEX_INITIALIZER;
+static can_signal_t signals[CAN_SIGNALS_MAX];
+static int signals_num;
+
+void can_signals_set(const char* name, const char* value) {
+  int i;
+
+  if (strlen(name) >= CAN_SIGNALS_NAME_LEN || strlen(value) >= CAN_SIGNALS_VALUE_LEN) {
+    return;
+  }
+
+  pthread_mutex_lock(&signals_lock);
+  for (i = 0; i < signals_num && strcmp(signals[i].name, name) != 0; i++)
+    ;
+  if (i == signals_num && signals_num < CAN_SIGNALS_MAX) {
+    strcpy(signals[signals_num++].name, name);
+  }
+  if (i < signals_num) {
+    strcpy(signals[i].value, value);
+  }
+  pthread_mutex_unlock(&signals_lock);
+}
+
+int can_signals_get(const char* type, int type_len, char* value, int value_size) {
+  char type_str[CAN_SIGNALS_TYPE_LEN];
+  int best = -1;
+  int len = -1;
+
+  if (type_len >= CAN_SIGNALS_TYPE_LEN) {
+    return -1;
+  }
+  memcpy(type_str, type, type_len);
+  type_str[type_len] = '\0';
+
+  pthread_mutex_lock(&signals_lock);
+  // The longest name contained in the type wins, so a name inside another one does not shadow it
+  for (int i = 0; i < signals_num; i++) {
+    if (strstr(type_str, signals[i].name) != NULL &&
+        (best < 0 || strlen(signals[i].name) > strlen(signals[best].name))) {
+      best = i;
+    }
+  }
+  if (best >= 0 && strlen(signals[best].value) < value_size) {
+    strcpy(value, signals[best].value);
+    len = strlen(value);
+  }
+  pthread_mutex_unlock(&signals_lock);
+
+  return len;
+}
+
+void can_signals_clear(void) {
+  pthread_mutex_lock(&signals_lock);
+  signals_num = 0;
+  pthread_mutex_unlock(&signals_lock);
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file can_signals.h
+ * \brief
+ * Last values of the CAN signals served to access policies
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * The frame callbacks store the value of every watched signal they decode,
+ * by its JSON name. A policy reads a signal through a request attribute
+ * whose type contains that name, e.g. "request.fuel_tank_level". All
+ * functions are thread safe.
+ *
+ * \history
+ * 07.12.2020. Initial version.
+ ****************************************************************************/
+#ifndef _CAN_SIGNALS_H_
+#define _CAN_SIGNALS_H_
+
+#define CAN_SIGNALS_MAX 16
+#define CAN_SIGNALS_NAME_LEN 64
+#define CAN_SIGNALS_VALUE_LEN 32
+
+/**
+ * @brief Store the last value of a signal
+ *
+ * @param name JSON name of the signal, terminated
+ * @param value Value, terminated
+ */
+void can_signals_set(const char* name, const char* value);
+
+/**
+ * @brief Get the value of the signal an attribute type names
+ *
+ * @param type Attribute type, not terminated
+ * @param type_len Length of the type
+ * @param value Buffer for the value, terminated
+ * @param value_size Size of the buffer
+ * @return Length of the value, or -1 if no signal seen so far matches the type
+ */
+int can_signals_get(const char* type, int type_len, char* value, int value_size);
+
+/**
+ * @brief Forget all values
+ */
+void can_signals_clear(void);
+
+#endif
@@ -37,6 +37,7 @@
 #include "pip_plugin_can.h"
 
 #include "can_msgs.h"
+#include "can_signals.h"
 #include "can_thread.h"
 #include "config_manager.h"
 #include "data_dumper.h"
@@ -66,6 +67,7 @@ typedef enum { CAN_TEMP_UNIT_C = 0x00, CAN_TEMP_UNIT_F = 0x01, CAN_TEMP_UNIT_UNK
 #define CAN_STR_LEN 1024
 #define CAN_ID_MASK 0x7ff
 #define JSON_DUMP_PERIOD_6S 6
+#define CAN_URI_AUTHORITY "iota:"
 
 static void be2le(unsigned char* in, unsigned char* out) {
   unsigned char data[DATA_SIZE];
@@ -79,6 +81,7 @@ static void be2le(unsigned char* in, unsigned char* out) {
 
 static can01_vehicle_dataset_t* wanted_signals;
 static bool is_in_use = FALSE;
+static pip_plugin_can_change_cb change_cb;
 static char body_chan[MAX_STR_SIZE];
 static char chas_chan[MAX_STR_SIZE];
 
@@ -249,6 +252,24 @@ void canreceiver_init(can01_vehicle_dataset_t* dataset, pthread_mutex_t* json_mu
   is_in_use = TRUE;
 }
 
+static int acquire_cb(plugin_t* plugin, void* data) {
+  pip_plugin_args_t* args = (pip_plugin_args_t*)data;
+  char* type;
+
+  // The URI is iota:<policy id>/<attribute type>?<value>, the type names the signal
+  if (args == NULL || args->uri == NULL || strncmp(args->uri, CAN_URI_AUTHORITY, strlen(CAN_URI_AUTHORITY)) != 0 ||
+      (type = strchr(args->uri, '/')) == NULL) {
+    return -1;
+  }
+  type++;
+
+  if (can_signals_get(type, strcspn(type, "?"), args->attribute.value, PIP_MAX_STR_LEN) < 0) {
+    return -1;
+  }
+  strcpy(args->attribute.type, "string");
+  return 0;
+}
+
 static int destroy_cb(plugin_t* plugin, void* data) {
   canreceiver_deinit();
   free(plugin->callbacks);
@@ -275,13 +296,16 @@ static int get_dataset_cb(plugin_t* plugin, void* data) {
 int pip_plugin_can_initializer(plugin_t* plugin, void* data) {
   plugin->destroy = destroy_cb;
   plugin->callbacks = malloc(sizeof(void*) * PIP_PLUGIN_CALLBACK_COUNT);
-  plugin->callbacks[PIP_PLUGIN_ACQUIRE_CB] = NULL;
+  plugin->callbacks[PIP_PLUGIN_ACQUIRE_CB] = acquire_cb;
   plugin->callbacks[PIP_PLUGIN_START_CB] = start_cb;
   plugin->callbacks[PIP_PLUGIN_GET_DATASET_CB] = get_dataset_cb;
   plugin->callbacks[PIP_PLUGIN_SET_DATASET_CB] = set_dataset_cb;
   plugin->callbacks_num = PIP_PLUGIN_CALLBACK_COUNT;
   plugin->plugin_specific_data = NULL;
 
+  pip_plugin_can_options_t* options = (pip_plugin_can_options_t*)data;
+  change_cb = options != NULL ? options->change_cb : NULL;
+
   ddstate.options = &vehicledatasetdemo01_options[0];
   ddstate.dataset = malloc(sizeof(can01_vehicle_dataset_t));
   dataset_init(&ddstate);
@@ -300,6 +324,7 @@ int canreceiver_deinit() {
   if (ddstate.dataset != 0) {
     dataset_deinit(&ddstate);
   }
+  can_signals_clear();
   is_in_use = FALSE;
 
   return 0;
@@ -319,49 +344,45 @@ void canreceiver_get_chas_channel(char* channel_buff, int channel_buff_len) {
   }
 }
 
-static fjson_object* gen_interpreted_door_status(int status) {
-  fjson_object* fj_value = fjson_object_new_object();
-  fjson_object* fj_value_string;
+static const char* door_status_name(int status) {
   switch (status) {
     case CAN_DOOR_UNKNOWN:
-      fj_value_string = fjson_object_new_string("Unknown");
-      break;
+      return "Unknown";
     case CAN_DOOR_OPENED:
-      fj_value_string = fjson_object_new_string("Opened");
-      break;
+      return "Opened";
     case CAN_DOOR_CLOSED:
-      fj_value_string = fjson_object_new_string("Closed");
-      break;
+      return "Closed";
     default:
-      fj_value_string = fjson_object_new_string("ERROR");
+      return "ERROR";
   }
-  fjson_object_object_add(fj_value, "value", fj_value_string);
-  return fj_value;
 }
 
-static fjson_object* gen_interpreted_lock_status(int status) {
-  fjson_object* fj_value = fjson_object_new_object();
-  fjson_object* fj_value_string;
+static const char* lock_status_name(int status) {
   switch (status) {
     case CAN_LOCK_UNDEF:
-      fj_value_string = fjson_object_new_string("Undefined");
-      break;
+      return "Undefined";
     case CAN_LOCK_OPENED:
-      fj_value_string = fjson_object_new_string("Opened");
-      break;
+      return "Opened";
     case CAN_LOCK_CLOSED:
-      fj_value_string = fjson_object_new_string("Closed");
-      break;
+      return "Closed";
     case CAN_LOCK_LOCKED:
-      fj_value_string = fjson_object_new_string("Locked");
-      break;
+      return "Locked";
     case CAN_LOCK_SAFE:
-      fj_value_string = fjson_object_new_string("Safe");
-      break;
+      return "Safe";
     default:
-      fj_value_string = fjson_object_new_string("ERROR");
+      return "ERROR";
   }
-  fjson_object_object_add(fj_value, "value", fj_value_string);
+}
+
+static fjson_object* gen_interpreted_door_status(int status) {
+  fjson_object* fj_value = fjson_object_new_object();
+  fjson_object_object_add(fj_value, "value", fjson_object_new_string(door_status_name(status)));
+  return fj_value;
+}
+
+static fjson_object* gen_interpreted_lock_status(int status) {
+  fjson_object* fj_value = fjson_object_new_object();
+  fjson_object_object_add(fj_value, "value", fjson_object_new_string(lock_status_name(status)));
   return fj_value;
 }
 
@@ -385,6 +406,150 @@ static fjson_object* gen_interpreted_temperature_unit(int status) {
   return fj_value;
 }
 
+static void set_number_signal(const char* name, double value) {
+  char value_str[CAN_SIGNALS_VALUE_LEN];
+  snprintf(value_str, CAN_SIGNALS_VALUE_LEN, "%g", value);
+  can_signals_set(name, value_str);
+}
+
+// Signals are kept for policies whatever the dataset selects for the JSON dump
+static void set_body_signals(unsigned canid, CanMsgs_BodyMessage_t* bm) {
+  switch (canid) {
+    case 0x40:
+      if (bm->msg_0x40.DoorDrvrReSts_UB == 1) {
+        can_signals_set(DoorDrvrReSts_JSON_NAME, door_status_name(bm->msg_0x40.DoorDrvrReSts));
+      }
+      if (bm->msg_0x40.DoorDrvrSts_UB == 1) {
+        can_signals_set(DoorDrvrSts_JSON_NAME, door_status_name(bm->msg_0x40.DoorDrvrSts));
+      }
+      break;
+    case 0xE0:
+      if (bm->msg_0xE0.TrSts_UB == 1) {
+        can_signals_set(TrSts_JSON_NAME, door_status_name(bm->msg_0xE0.TrSts));
+      }
+      if (bm->msg_0xE0.DoorPassSts_UB == 1) {
+        can_signals_set(DoorPassSts_JSON_NAME, door_status_name(bm->msg_0xE0.DoorPassSts));
+      }
+      if (bm->msg_0xE0.DoorPassReSts_UB == 1) {
+        can_signals_set(DoorPassReSts_JSON_NAME, door_status_name(bm->msg_0xE0.DoorPassReSts));
+      }
+      break;
+    case 0x100:
+      if (bm->msg_0x100.LockgCenStsForUsrFb_UB == 1) {
+        can_signals_set(LockgCenStsForUsrFb_JSON_NAME, lock_status_name(bm->msg_0x100.LockgCenStsForUsrFb));
+      }
+      break;
+    case 0x270:
+      if (bm->msg_0x270.FuLvlIndcd_UB == 1) {
+        set_number_signal(FuLvlIndcdVal_JSON_NAME, (double)bm->msg_0x270.FuLvlIndcdVal * 0.2);
+      }
+      break;
+    case 0x1D0:
+      if (bm->msg_0x1D0.AmbTIndcdWithUnit_UB == 1) {
+        set_number_signal(AmbTIndcd_JSON_NAME, (double)bm->msg_0x1D0.AmbTIndcd * 0.1 - 100.);
+      }
+      break;
+  }
+}
+
+static void set_chas_signals(unsigned canid, CanMsgs_ChasMessage_t* cm) {
+  switch (canid) {
+    case 0xE0:
+      if (cm->msg_0xE0.DrvrBrkTqAtWhlsReqdGroup_UB == 1) {
+        set_number_signal(DrvrBrkTqAtWhlsReqd_JSON_NAME, cm->msg_0xE0.DrvrBrkTqAtWhlsReqd);
+      }
+      break;
+    case 0xF0:
+      if (cm->msg_0xF0.TrSts_UB == 1) {
+        can_signals_set(TrSts_JSON_NAME, door_status_name(cm->msg_0xF0.TrSts));
+      }
+      if (cm->msg_0xF0.DoorPassReSts_UB == 1) {
+        can_signals_set(DoorPassReSts_JSON_NAME, door_status_name(cm->msg_0xF0.DoorPassReSts));
+      }
+      if (cm->msg_0xF0.DoorDrvrSts_UB == 1) {
+        can_signals_set(DoorDrvrSts_JSON_NAME, door_status_name(cm->msg_0xF0.DoorDrvrSts));
+      }
+      if (cm->msg_0xF0.DoorPassSts_UB == 1) {
+        can_signals_set(DoorPassSts_JSON_NAME, door_status_name(cm->msg_0xF0.DoorPassSts));
+      }
+      break;
+    case 0x3A0:
+      if (cm->msg_0x3A0.DoorDrvrReSts_UB == 1) {
+        can_signals_set(DoorDrvrReSts_JSON_NAME, door_status_name(cm->msg_0x3A0.DoorDrvrReSts));
+      }
+      if (cm->msg_0x3A0.AmbTIndcdWithUnit_UB == 1) {
+        set_number_signal(AmbTIndcd_JSON_NAME, (double)cm->msg_0x3A0.AmbTIndcd * 0.1 - 100.);
+      }
+      break;
+    case 0x1C0:
+      if (cm->msg_0x1C0.BrkPedlPsdSafeGroup_UB == 1) {
+        set_number_signal(BrkPedlPsd_JSON_NAME, cm->msg_0x1C0.BrkPedlPsd);
+      }
+      break;
+    case 0x240:
+      if (cm->msg_0x240.FuLvlIndcd_UB == 1) {
+        set_number_signal(FuLvlIndcdVal_JSON_NAME, (double)cm->msg_0x240.FuLvlIndcdVal * 0.2);
+      }
+      break;
+    case 0x130:
+      if (cm->msg_0x130.DrvrPrpsnTqReq_UB == 1) {
+        set_number_signal(DrvrPrpsnTqReq_JSON_NAME, cm->msg_0x130.DrvrPrpsnTqReq);
+      }
+      break;
+    case 0x210:
+      if (cm->msg_0x210.CluPedlRat_UB == 1) {
+        set_number_signal(CluPedlRat_JSON_NAME, (double)cm->msg_0x210.CluPedlRat * 0.392156862745);
+      }
+      break;
+  }
+}
+
+#define CAN_BODY_MSG_NUM 5
+#define CAN_CHAS_MSG_NUM 7
+
+static const unsigned can_body_msg_ids[CAN_BODY_MSG_NUM] = {0x40, 0xE0, 0x100, 0x270, 0x1D0};
+static unsigned char can_body_msg_last[CAN_BODY_MSG_NUM][DATA_SIZE];
+static bool can_body_msg_seen[CAN_BODY_MSG_NUM];
+
+static const unsigned can_chas_msg_ids[CAN_CHAS_MSG_NUM] = {0xE0, 0xF0, 0x3A0, 0x1C0, 0x240, 0x130, 0x210};
+// The one signal served from a chassis message, NULL for messages carrying several
+static const char* const can_chas_msg_signals[CAN_CHAS_MSG_NUM] = {DrvrBrkTqAtWhlsReqd_JSON_NAME,
+                                                                   NULL,
+                                                                   NULL,
+                                                                   BrkPedlPsd_JSON_NAME,
+                                                                   FuLvlIndcdVal_JSON_NAME,
+                                                                   DrvrPrpsnTqReq_JSON_NAME,
+                                                                   CluPedlRat_JSON_NAME};
+static unsigned char can_chas_msg_last[CAN_CHAS_MSG_NUM][DATA_SIZE];
+static bool can_chas_msg_seen[CAN_CHAS_MSG_NUM];
+
+// Messages are sent periodically, only a payload that differs from the
+// previous one of the same ID carries a change. The previous payload is
+// returned in previous, zeroed for the first one. Returns the index of the
+// message, or -1 if the payload is unchanged.
+static int msg_changed(const unsigned* ids, unsigned char (*last)[DATA_SIZE], bool* seen, int msg_num, unsigned canid,
+                       unsigned char* data, unsigned char* previous) {
+  for (int i = 0; i < msg_num; i++) {
+    if (ids[i] == canid) {
+      if (seen[i] && memcmp(last[i], data, DATA_SIZE) == 0) {
+        return -1;
+      }
+      memcpy(previous, last[i], DATA_SIZE);
+      memcpy(last[i], data, DATA_SIZE);
+      seen[i] = TRUE;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Signals policies read have changed, decisions cached under the old values must go
+static void notify_change(const char* signal) {
+  if (change_cb != NULL) {
+    change_cb(signal);
+  }
+}
+
 static void can_body_frame_read_cb(struct can_frame* frame) {
   be2le(frame->data, frame->data);
 #ifdef DEBUG_MODE
@@ -396,6 +561,24 @@ static void can_body_frame_read_cb(struct can_frame* frame) {
   if (CanMsgs_body_msg_supported(canid)) {
     CanMsgs_BodyMessage_t bm;
     memcpy(&bm, frame->data, DATA_SIZE);
+    // Stored before the change is signalled, so the evaluations it triggers read the new values
+    set_body_signals(canid, &bm);
+
+    // Door, lock and trunk states are what access policies are written
+    // against, so decisions cached under the old values must go
+    unsigned char previous[DATA_SIZE];
+    if (msg_changed(can_body_msg_ids, can_body_msg_last, can_body_msg_seen, CAN_BODY_MSG_NUM, canid, frame->data,
+                    previous) >= 0) {
+      CanMsgs_BodyMessage_t previous_bm;
+      memcpy(&previous_bm, previous, DATA_SIZE);
+      if (canid == 0x100 && previous_bm.msg_0x100.LockgCenStsForUsrFb != bm.msg_0x100.LockgCenStsForUsrFb) {
+        // Only policies watching the central lock are evaluated again, unless more has changed
+        previous_bm.msg_0x100.LockgCenStsForUsrFb = bm.msg_0x100.LockgCenStsForUsrFb;
+        notify_change(memcmp(&previous_bm, &bm, DATA_SIZE) == 0 ? LockgCenStsForUsrFb_JSON_NAME : NULL);
+      } else {
+        notify_change(NULL);
+      }
+    }
 
     pthread_mutex_lock(json_sync_lock);
     // CAN ID values are stated in can_msgs API
@@ -471,6 +654,15 @@ static void can_chas_frame_read_cb(struct can_frame* frame) {
   if (CanMsgs_chas_msg_supported(canid)) {
     CanMsgs_ChasMessage_t cm;
     memcpy(&cm, frame->data, 8);
+    set_chas_signals(canid, &cm);
+
+    // Doors and trunk are also reported here, same as for the body messages
+    unsigned char previous[DATA_SIZE];
+    int msg = msg_changed(can_chas_msg_ids, can_chas_msg_last, can_chas_msg_seen, CAN_CHAS_MSG_NUM, canid,
+                          frame->data, previous);
+    if (msg >= 0) {
+      notify_change(can_chas_msg_signals[msg]);
+    }
 
     pthread_mutex_lock(json_sync_lock);
     switch (canid) {
@@ -38,6 +38,23 @@
 #include "pip_plugin.h"
 #include "plugin.h"
 
+/**
+ * @brief Called from the CAN reader threads when a frame changes signals policies read
+ *
+ * @param signal JSON name of the changed signal, NULL if the frame carries several
+ */
+typedef void (*pip_plugin_can_change_cb)(const char* signal);
+
+typedef struct {
+  pip_plugin_can_change_cb change_cb;
+} pip_plugin_can_options_t;
+
+/**
+ * @brief Initialize the plugin
+ *
+ * @param data Options as pip_plugin_can_options_t, or NULL if no one is told about changes. The
+ * Access Core's access_notify_signal_change() is meant as change callback.
+ */
 int pip_plugin_can_initializer(plugin_t* plugin, void* data);
 
 #endif
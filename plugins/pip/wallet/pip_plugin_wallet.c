@@ -114,33 +114,46 @@ static int acquire_cb(plugin_t *plugin, void *user_data) {
   char *uri = args->uri;
 
   char temp[PROTOCOL_MAX_STR_LEN];
-  char pol_id[PROTOCOL_MAX_STR_LEN];
-  char type[PROTOCOL_MAX_STR_LEN];
-  char value[PROTOCOL_MAX_STR_LEN];
+  char pol_id[PROTOCOL_MAX_STR_LEN] = {0};
+  char type[PROTOCOL_MAX_STR_LEN] = {0};
+  char value[PROTOCOL_MAX_STR_LEN] = {0};
   char *ptr = NULL;
+  char *save = NULL;
 
   // Parse uri
-  if (strlen(uri) > PROTOCOL_MAX_STR_LEN) {
+  if (strlen(uri) >= PROTOCOL_MAX_STR_LEN) {
     printf("\nERROR[%s]: URI too long.\n", __FUNCTION__);
     return -1;
   } else {
-    memcpy(temp, uri, strlen(uri));
+    memcpy(temp, uri, strlen(uri) + 1);
   }
 
-  ptr = strtok(temp, ":");
+  // Attributes are acquired from several threads at once
+  ptr = strtok_r(temp, ":", &save);
 
-  if (memcmp(ptr, "iota", strlen("iota")) != 0)  // Only supported authority for now
+  if (ptr == NULL || memcmp(ptr, "iota", strlen("iota")) != 0)  // Only supported authority for now
   {
     printf("\nERROR[%s]: Authority not supported.\n", __FUNCTION__);
     return -1;
   }
 
-  ptr = strtok(NULL, "/");
-  memcpy(pol_id, ptr, strlen(ptr) > PROTOCOL_MAX_STR_LEN ? PROTOCOL_MAX_STR_LEN : strlen(ptr));
-  ptr = strtok(NULL, "?");
-  memcpy(type, ptr, strlen(ptr) > PROTOCOL_MAX_STR_LEN ? PROTOCOL_MAX_STR_LEN : strlen(ptr));
-  ptr = strtok(NULL, "?");
-  memcpy(value, ptr, strlen(ptr) > PROTOCOL_MAX_STR_LEN ? PROTOCOL_MAX_STR_LEN : strlen(ptr));
+  ptr = strtok_r(NULL, "/", &save);
+  if (ptr == NULL) {
+    printf("\nERROR[%s]: Policy ID missing.\n", __FUNCTION__);
+    return -1;
+  }
+  memcpy(pol_id, ptr, strlen(ptr));
+  ptr = strtok_r(NULL, "?", &save);
+  if (ptr == NULL) {
+    printf("\nERROR[%s]: Attribute type missing.\n", __FUNCTION__);
+    return -1;
+  }
+  memcpy(type, ptr, strlen(ptr));
+  // A request attribute has an empty value
+  ptr = strtok_r(NULL, "?", &save);
+  if (ptr != NULL) {
+    memcpy(value, ptr, strlen(ptr));
+  }
 
   if (memcmp(type, "request.isPayed.type", strlen("request.isPayed.type")) == 0) {
     memcpy(args->attribute.type, "string", strlen("string"));
@@ -0,0 +1,144 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_cache_test.c
+ * \brief
+ * Test of the invalidation of cached decisions
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Every way a cached decision stops being served: an attribute change, a
+ * decision computed before that change, a policy being stored again, the
+ * TTL, a lifetime extending the TTL, and eviction of the least recently used
+ * entry.
+ *
+ * \history
+ * 18.12.2020. Initial version.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "access_cache.h"
+
+#define TEST_CAPACITY 4
+#define TEST_TTL_MS 100
+#define TEST_LIFETIME_MS 400
+#define TEST_POLICY_A "aa01"
+#define TEST_POLICY_B "bb02"
+#define TEST_ACTION "open_door"
+
+static int failures;
+
+static void check(int condition, const char *name) {
+  printf("%-50s %s\n", name, condition ? "ok" : "FAILED");
+  failures += !condition;
+}
+
+static void store(const char *policy_id, const char *action, unsigned long long version, pdp_decision_e decision) {
+  access_cache_store(policy_id, strlen(policy_id), NULL, 0, action, action != NULL ? strlen(action) : 0, version,
+                     decision);
+}
+
+static int lookup(const char *policy_id, const char *action, pdp_decision_e *decision) {
+  return access_cache_lookup(policy_id, strlen(policy_id), NULL, 0, action, action != NULL ? strlen(action) : 0,
+                             decision);
+}
+
+static int hit(const char *policy_id, const char *action, pdp_decision_e expected) {
+  pdp_decision_e decision;
+  return lookup(policy_id, action, &decision) == ACCESS_CACHE_HIT && decision == expected;
+}
+
+static int miss(const char *policy_id, const char *action) {
+  pdp_decision_e decision;
+  return lookup(policy_id, action, &decision) == ACCESS_CACHE_MISS;
+}
+
+static int lifetime(const char *policy_id, int policy_id_len) {
+  return policy_id_len == strlen(TEST_POLICY_B) && memcmp(policy_id, TEST_POLICY_B, policy_id_len) == 0
+             ? TEST_LIFETIME_MS
+             : -1;
+}
+
+int main(int argc, char **argv) {
+  char policy_id[8];
+  unsigned long long version;
+
+  if (access_cache_init(TEST_CAPACITY, TEST_TTL_MS) != 0) {
+    fprintf(stderr, "could not allocate the cache\n");
+    return -1;
+  }
+
+  version = access_cache_attribute_version();
+  store(TEST_POLICY_A, TEST_ACTION, version, PDP_GRANT);
+  store(TEST_POLICY_A, NULL, version, PDP_DENY);
+  check(hit(TEST_POLICY_A, TEST_ACTION, PDP_GRANT), "hit with action");
+  check(hit(TEST_POLICY_A, NULL, PDP_DENY), "hit without action, separate key");
+  check(miss(TEST_POLICY_B, TEST_ACTION), "miss for another policy");
+
+  store(TEST_POLICY_A, "close_door", version, PDP_ERROR);
+  check(miss(TEST_POLICY_A, "close_door"), "errors are not stored");
+
+  access_cache_attributes_changed();
+  check(miss(TEST_POLICY_A, TEST_ACTION), "attribute change invalidates");
+  check(miss(TEST_POLICY_A, NULL), "attribute change invalidates every entry");
+
+  // Computed before the change, stored after it
+  store(TEST_POLICY_A, TEST_ACTION, version, PDP_GRANT);
+  check(miss(TEST_POLICY_A, TEST_ACTION), "decision of an older snapshot is not stored");
+
+  version = access_cache_attribute_version();
+  store(TEST_POLICY_A, TEST_ACTION, version, PDP_GRANT);
+  store(TEST_POLICY_B, TEST_ACTION, version, PDP_DENY);
+  access_cache_invalidate_policy(TEST_POLICY_A, strlen(TEST_POLICY_A));
+  check(miss(TEST_POLICY_A, TEST_ACTION), "policy invalidation drops its entries");
+  check(hit(TEST_POLICY_B, TEST_ACTION, PDP_DENY), "policy invalidation keeps other policies");
+
+  access_cache_set_lifetime(lifetime);
+  store(TEST_POLICY_A, TEST_ACTION, version, PDP_GRANT);
+  store(TEST_POLICY_B, TEST_ACTION, version, PDP_DENY);
+  usleep((TEST_TTL_MS + 50) * 1000);
+  check(miss(TEST_POLICY_A, TEST_ACTION), "entry expires after the TTL");
+  check(hit(TEST_POLICY_B, TEST_ACTION, PDP_DENY), "lifetime keeps an entry beyond the TTL");
+  usleep((TEST_LIFETIME_MS - TEST_TTL_MS) * 1000);
+  check(miss(TEST_POLICY_B, TEST_ACTION), "entry expires after its lifetime");
+  access_cache_set_lifetime(NULL);
+
+  // A lookup makes the first entry the most recently used, so the second one is evicted
+  for (int i = 0; i < TEST_CAPACITY; i++) {
+    snprintf(policy_id, sizeof(policy_id), "cc%02d", i);
+    store(policy_id, TEST_ACTION, version, PDP_GRANT);
+  }
+  check(hit("cc00", TEST_ACTION, PDP_GRANT), "all entries fit");
+  store(TEST_POLICY_A, TEST_ACTION, version, PDP_GRANT);
+  check(miss("cc01", TEST_ACTION), "least recently used entry is evicted");
+  check(hit("cc00", TEST_ACTION, PDP_GRANT), "recently used entry stays");
+  check(hit(TEST_POLICY_A, TEST_ACTION, PDP_GRANT), "new entry is stored");
+
+  access_cache_stats_t stats;
+  access_cache_get_stats(&stats);
+  check(stats.entries == TEST_CAPACITY && stats.evictions == 1, "stats count entries and evictions");
+
+  access_cache_term();
+  return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,303 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file access_resolve_test.c
+ * \brief
+ * Test of resolves answered from precomputed decisions
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * A policy opted into precomputation is stored through a PAP plugin of this
+ * test. The PIP plugin of this test counts the attributes it is asked for,
+ * and the PEP plugin of this test the actions it enforces. Once the PDP has
+ * granted the policy, a resolve after a signal change has to be answered by
+ * the decision the background evaluation stored, without asking for any
+ * attribute, and a grant still has to reach the PEP plugin.
+ *
+ * \history
+ * 18.01.2021. Initial version.
+ ****************************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "access.h"
+#include "access_precompute.h"
+#include "pap.h"
+#include "pap_plugin.h"
+#include "pep_plugin.h"
+#include "pip_plugin.h"
+#include "utils.h"
+
+#define TEST_POLICY_ID "c0ffee00112233445566778899aabbccddeeff00112233445566778899aabbcc"
+#define TEST_SIGNAL "lock_status"
+#define TEST_SIGNAL_ATTRIBUTE "request.lock_status"
+#define TEST_ACTION "open_door"
+#define TEST_ACTION_ATTRIBUTE "request.action.value"
+#define TEST_URI_AUTHORITY "iota:"
+#define TEST_PRECOMPUTE_WAIT_MS 2000
+
+static const char policy[] =
+    "{\"precompute\":true,\"policy_goc\":{\"operation\":\"and\",\"attribute_list\":["
+    "{\"operation\":\"eq\",\"attribute_list\":[{\"type\":\"" TEST_SIGNAL_ATTRIBUTE "\",\"value\":\"\"},"
+    "{\"type\":\"string\",\"value\":\"Locked\"}]},"
+    "{\"operation\":\"eq\",\"attribute_list\":[{\"type\":\"action\",\"value\":\"" TEST_ACTION "\"},"
+    "{\"type\":\"" TEST_ACTION_ATTRIBUTE "\",\"value\":\"\"}]}]},"
+    "\"policy_doc\":{\"operation\":\"eq\",\"attribute_list\":[{\"type\":\"" TEST_SIGNAL_ATTRIBUTE "\",\"value\":\"\"},"
+    "{\"type\":\"string\",\"value\":\"Opened\"}]}}";
+
+static pthread_mutex_t test_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *lock_status = "Opened";
+static int acquisitions;
+static int enforcements;
+static char enforced_action[PDP_STR_LEN];
+static char stored_policy[sizeof(policy)];
+
+static pthread_mutex_t core_lock = PTHREAD_MUTEX_INITIALIZER;
+static int failures;
+
+static void check(int condition, const char *name) {
+  printf("%-50s %s\n", name, condition ? "ok" : "FAILED");
+  failures += !condition;
+}
+
+static int is_test_policy(char *policy_id) {
+  char policy_id_str[PAP_POL_ID_MAX_LEN * 2 + 1] = {0};
+
+  // PAP plugins get the raw policy id
+  return hex_to_str(policy_id, policy_id_str, PAP_POL_ID_MAX_LEN) == UTILS_STRING_SUCCESS &&
+         strcasecmp(policy_id_str, TEST_POLICY_ID) == 0;
+}
+
+static int pap_put_cb(plugin_t *plugin, void *data) {
+  pap_policy_t *stored = (pap_policy_t *)data;
+
+  if (stored->policy_object.policy_object_size >= sizeof(stored_policy)) {
+    return -1;
+  }
+  memcpy(stored_policy, stored->policy_object.policy_object, stored->policy_object.policy_object_size);
+  return 0;
+}
+
+static int pap_has_cb(plugin_t *plugin, void *data) {
+  pap_plugin_has_args_t *args = (pap_plugin_has_args_t *)data;
+  args->does_have = is_test_policy(args->policy_id) && stored_policy[0] != '\0';
+  return 0;
+}
+
+static int pap_len_cb(plugin_t *plugin, void *data) {
+  pap_plugin_len_args_t *args = (pap_plugin_len_args_t *)data;
+  args->len = is_test_policy(args->policy_id) ? strlen(stored_policy) : 0;
+  return 0;
+}
+
+static int pap_get_cb(plugin_t *plugin, void *data) {
+  pap_plugin_get_args_t *args = (pap_plugin_get_args_t *)data;
+
+  if (!is_test_policy(args->policy_id) || stored_policy[0] == '\0') {
+    return -1;
+  }
+  memcpy(args->policy->policy_object.policy_object, stored_policy, strlen(stored_policy));
+  args->policy->policy_object.policy_object_size = strlen(stored_policy);
+  args->policy->policy_id_signature.signature_algorithm = PAP_ECDSA;
+  args->policy->hash_function = PAP_SHA_256;
+  memcpy(args->policy->policy_id, args->policy_id, PAP_POL_ID_MAX_LEN);
+  return 0;
+}
+
+static int pap_get_all_cb(plugin_t *plugin, void *data) {
+  *(pap_policy_id_list_t **)data = NULL;
+  return 0;
+}
+
+static int pip_acquire_cb(plugin_t *plugin, void *data) {
+  pip_plugin_args_t *args = (pip_plugin_args_t *)data;
+  const char *type;
+  const char *value = NULL;
+
+  // The URI is iota:<policy id>/<attribute type>?<value>
+  if (args == NULL || args->uri == NULL || strncmp(args->uri, TEST_URI_AUTHORITY, strlen(TEST_URI_AUTHORITY)) != 0 ||
+      (type = strchr(args->uri, '/')) == NULL) {
+    return -1;
+  }
+  type++;
+
+  pthread_mutex_lock(&test_lock);
+  acquisitions++;
+  if (strncmp(type, TEST_SIGNAL_ATTRIBUTE "?", strlen(TEST_SIGNAL_ATTRIBUTE "?")) == 0) {
+    value = lock_status;
+  } else if (strncmp(type, TEST_ACTION_ATTRIBUTE "?", strlen(TEST_ACTION_ATTRIBUTE "?")) == 0) {
+    value = TEST_ACTION;
+  }
+  pthread_mutex_unlock(&test_lock);
+
+  if (value == NULL) {
+    return -1;
+  }
+  strcpy(args->attribute.type, "string");
+  strncpy(args->attribute.value, value, PIP_MAX_STR_LEN - 1);
+  return 0;
+}
+
+static int pep_action_cb(plugin_t *plugin, void *data) {
+  pep_plugin_args_t *args = (pep_plugin_args_t *)data;
+
+  pthread_mutex_lock(&test_lock);
+  if (args->action.value[0] != '\0') {
+    enforcements++;
+    strncpy(enforced_action, args->action.value, PDP_STR_LEN - 1);
+  }
+  pthread_mutex_unlock(&test_lock);
+  return 0;
+}
+
+static int destroy_cb(plugin_t *plugin, void *data) {
+  free(plugin->callbacks);
+  return 0;
+}
+
+static int initializer(plugin_t *plugin, int callbacks_num) {
+  plugin->destroy = destroy_cb;
+  plugin->callbacks = calloc(callbacks_num, sizeof(void *));
+  plugin->callbacks_num = callbacks_num;
+  plugin->plugin_specific_data = NULL;
+  return plugin->callbacks == NULL ? -1 : 0;
+}
+
+static int pap_initializer(plugin_t *plugin, void *data) {
+  if (initializer(plugin, PAP_PLUGIN_CALLBACK_COUNT) != 0) {
+    return -1;
+  }
+  plugin->callbacks[PAP_PLUGIN_PUT_CB] = pap_put_cb;
+  plugin->callbacks[PAP_PLUGIN_GET_CB] = pap_get_cb;
+  plugin->callbacks[PAP_PLUGIN_HAS_CB] = pap_has_cb;
+  plugin->callbacks[PAP_PLUGIN_GET_POL_OBJ_LEN_CB] = pap_len_cb;
+  plugin->callbacks[PAP_PLUGIN_GET_ALL_CB] = pap_get_all_cb;
+  return 0;
+}
+
+static int pip_initializer(plugin_t *plugin, void *data) {
+  if (initializer(plugin, PIP_PLUGIN_CALLBACK_COUNT) != 0) {
+    return -1;
+  }
+  plugin->callbacks[PIP_PLUGIN_ACQUIRE_CB] = pip_acquire_cb;
+  return 0;
+}
+
+static int pep_initializer(plugin_t *plugin, void *data) {
+  if (initializer(plugin, PEP_PLUGIN_CALLBACK_COUNT) != 0) {
+    return -1;
+  }
+  plugin->callbacks[PEP_PLUGIN_ACTION_CB] = pep_action_cb;
+  return 0;
+}
+
+// Changes the lock status and waits until the background thread has evaluated the policy for it
+static int signal_lock_status(const char *status) {
+  access_precompute_stats_t stats;
+
+  access_precompute_get_stats(&stats);
+  unsigned long long evaluations = stats.evaluations;
+
+  pthread_mutex_lock(&test_lock);
+  lock_status = status;
+  pthread_mutex_unlock(&test_lock);
+  access_notify_signal_change(TEST_SIGNAL);
+
+  for (int waited_ms = 0; waited_ms < TEST_PRECOMPUTE_WAIT_MS; waited_ms++) {
+    access_precompute_get_stats(&stats);
+    if (stats.evaluations > evaluations) {
+      return 0;
+    }
+    usleep(1000);
+  }
+  return -1;
+}
+
+// Resolves the policy, returns the number of attributes the resolve asked for
+static int resolve(pdp_decision_e *decision) {
+  pthread_mutex_lock(&test_lock);
+  acquisitions = 0;
+  pthread_mutex_unlock(&test_lock);
+
+  *decision = access_resolve(TEST_POLICY_ID, strlen(TEST_POLICY_ID), &core_lock);
+
+  pthread_mutex_lock(&test_lock);
+  int asked = acquisitions;
+  pthread_mutex_unlock(&test_lock);
+  return asked;
+}
+
+static int enforced(void) {
+  pthread_mutex_lock(&test_lock);
+  int count = enforcements;
+  pthread_mutex_unlock(&test_lock);
+  return count;
+}
+
+int main(int argc, char **argv) {
+  plugin_t pap_plugin;
+  plugin_t pip_plugin;
+  plugin_t pep_plugin;
+  pap_policy_t stored;
+  pdp_decision_e decision;
+
+  access_init();
+  if (plugin_init(&pap_plugin, pap_initializer, NULL) != 0 || plugin_init(&pip_plugin, pip_initializer, NULL) != 0 ||
+      plugin_init(&pep_plugin, pep_initializer, NULL) != 0) {
+    fprintf(stderr, "could not initialize the test plugins\n");
+    return -1;
+  }
+  access_register_pap_plugin(&pap_plugin);
+  // Uncached, so every attribute a resolve needs reaches the plugin
+  access_register_pip_plugin_ttl(&pip_plugin, 0, NULL, 0);
+  access_register_pep_plugin(&pep_plugin);
+
+  // Stored the way pap_add_policy stores it, through the PAP plugin's put callback
+  memset(&stored, 0, sizeof(stored));
+  str_to_hex(TEST_POLICY_ID, stored.policy_id, PAP_POL_ID_MAX_LEN * 2);
+  stored.policy_object.policy_object = (char *)policy;
+  stored.policy_object.policy_object_size = strlen(policy);
+  pap_plugin.callbacks[PAP_PLUGIN_PUT_CB](&pap_plugin, &stored);
+
+  check(signal_lock_status("Locked") == 0, "precomputed once locked");
+  resolve(&decision);
+  check(decision == PDP_GRANT, "first grant");
+  check(enforced() == 1 && strcmp(enforced_action, TEST_ACTION) == 0, "first grant enforced");
+
+  check(signal_lock_status("Opened") == 0, "precomputed once opened");
+  check(resolve(&decision) == 0, "deny served from the precomputed entry");
+  check(decision == PDP_DENY, "deny once opened");
+  check(enforced() == 1, "deny not enforced");
+
+  check(signal_lock_status("Locked") == 0, "precomputed once locked again");
+  check(resolve(&decision) == 0, "grant served from the precomputed entry");
+  check(decision == PDP_GRANT, "grant once locked again");
+  check(enforced() == 2 && strcmp(enforced_action, TEST_ACTION) == 0, "precomputed grant enforced");
+
+  access_term();
+  return failures == 0 ? 0 : -1;
+}
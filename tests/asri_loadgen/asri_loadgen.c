@@ -0,0 +1,494 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file asri_loadgen.c
+ * \brief
+ * Closed-loop load generator for the ASRI network protocol
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Every client thread sends one request, waits for its response and sends
+ * the next one, so the offered load follows the server's capacity.
+ *
+ * \history
+ * 28.09.2020. Initial version.
+ ****************************************************************************/
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "auth.h"
+#include "network_binary.h"
+
+#define LOADGEN_HOST "127.0.0.1"
+#define LOADGEN_PORT 9998
+#define LOADGEN_CLIENTS 8
+#define LOADGEN_DURATION_S 10
+#define LOADGEN_MIX "resolve:60,get_policy_list:10,get_dataset:20,get_user:5,get_all_users:5"
+#define LOADGEN_POLICY_ID "0000000000000000000000000000000000000000000000000000000000000000"
+#define LOADGEN_USERNAME "alice"
+#define LOADGEN_MAX_CLIENTS 1024
+#define LOADGEN_REQUEST_LEN 256
+#define LOADGEN_SAMPLES_INIT 4096
+
+// Command codes of the binary encoding, as in network_dispatch.h
+#define LOADGEN_BINARY_RESOLVE 0
+#define LOADGEN_BINARY_GET_DATASET 4
+
+typedef enum {
+  LOADGEN_RESOLVE,
+  LOADGEN_GET_POL_LIST,
+  LOADGEN_GET_DATASET,
+  LOADGEN_GET_USER,
+  LOADGEN_GET_ALL_USERS,
+  LOADGEN_COMMAND_NUM
+} loadgen_command_e;
+
+static const char *command_names[LOADGEN_COMMAND_NUM] = {"resolve", "get_policy_list", "get_dataset", "get_user",
+                                                         "get_all_users"};
+
+typedef struct {
+  unsigned int *samples_us;
+  unsigned int samples_num;
+  unsigned int samples_size;
+  unsigned long long errors;
+} loadgen_series_t;
+
+typedef struct {
+  pthread_t thread;
+  unsigned int seed;
+  loadgen_series_t commands[LOADGEN_COMMAND_NUM];
+  // Connect and handshake time, in connect-rate mode
+  loadgen_series_t connects;
+  unsigned long long connect_errors;
+  unsigned long long handshakes;
+} loadgen_client_t;
+
+static struct {
+  const char *host;
+  int port;
+  int clients;
+  int duration_s;
+  int keepalive;
+  int connect_only;
+  int binary;
+  const char *policy_id;
+  const char *username;
+  int weights[LOADGEN_COMMAND_NUM];
+  int weights_total;
+  volatile int end;
+} cfg;
+
+static unsigned long long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int parse_mix(const char *mix) {
+  char buf[LOADGEN_REQUEST_LEN];
+  char *save = NULL;
+
+  strncpy(buf, mix, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  memset(cfg.weights, 0, sizeof(cfg.weights));
+  cfg.weights_total = 0;
+
+  for (char *item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    char *colon = strchr(item, ':');
+    int found = 0;
+    if (colon == NULL) {
+      return -1;
+    }
+    *colon = '\0';
+    for (int i = 0; i < LOADGEN_COMMAND_NUM; i++) {
+      if (strcmp(item, command_names[i]) == 0) {
+        cfg.weights[i] = atoi(colon + 1);
+        cfg.weights_total += cfg.weights[i];
+        found = 1;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "unknown command in mix: '%s'\n", item);
+      return -1;
+    }
+  }
+
+  return cfg.weights_total > 0 ? 0 : -1;
+}
+
+static loadgen_command_e pick_command(loadgen_client_t *client) {
+  int r = rand_r(&client->seed) % cfg.weights_total;
+
+  for (int i = 0; i < LOADGEN_COMMAND_NUM; i++) {
+    if (r < cfg.weights[i]) {
+      return i;
+    }
+    r -= cfg.weights[i];
+  }
+
+  return LOADGEN_RESOLVE;
+}
+
+static int build_binary_request(loadgen_command_e command, char *buf) {
+  unsigned char *bytes = (unsigned char *)buf;
+  int len = NETWORK_BINARY_HEADER_LEN;
+
+  bytes[0] = NETWORK_BINARY_MAGIC;
+  if (command == LOADGEN_GET_DATASET) {
+    bytes[1] = LOADGEN_BINARY_GET_DATASET;
+    return len;
+  }
+
+  int policy_id_len = strlen(cfg.policy_id);
+  bytes[1] = LOADGEN_BINARY_RESOLVE;
+  bytes[len] = NETWORK_BINARY_POLICY_ID;
+  bytes[len + 1] = (policy_id_len >> 8) & 0xFF;
+  bytes[len + 2] = policy_id_len & 0xFF;
+  memcpy(buf + len + NETWORK_BINARY_FIELD_HEADER_LEN, cfg.policy_id, policy_id_len);
+
+  return len + NETWORK_BINARY_FIELD_HEADER_LEN + policy_id_len;
+}
+
+static int build_request(loadgen_command_e command, char *buf) {
+  if (cfg.binary && (command == LOADGEN_RESOLVE || command == LOADGEN_GET_DATASET)) {
+    return build_binary_request(command, buf);
+  }
+
+  switch (command) {
+    case LOADGEN_RESOLVE:
+      return snprintf(buf, LOADGEN_REQUEST_LEN, "{\"cmd\":\"resolve\",\"policy_id\":\"%s\"}", cfg.policy_id);
+    case LOADGEN_GET_POL_LIST:
+      return snprintf(buf, LOADGEN_REQUEST_LEN, "{\"cmd\":\"get_policy_list\",\"user_id\":\"%s\"}", cfg.username);
+    case LOADGEN_GET_DATASET:
+      return snprintf(buf, LOADGEN_REQUEST_LEN, "{\"cmd\":\"get_dataset\"}");
+    case LOADGEN_GET_USER:
+      return snprintf(buf, LOADGEN_REQUEST_LEN, "{\"cmd\":\"get_user\",\"username\":\"%s\"}", cfg.username);
+    default:
+      return snprintf(buf, LOADGEN_REQUEST_LEN, "{\"cmd\":\"get_all_users\"}");
+  }
+}
+
+static void add_sample(loadgen_series_t *series, unsigned long long value_us) {
+  if (series->samples_num == series->samples_size) {
+    unsigned int size = series->samples_size ? series->samples_size * 2 : LOADGEN_SAMPLES_INIT;
+    unsigned int *samples = realloc(series->samples_us, size * sizeof(unsigned int));
+    if (samples == NULL) {
+      return;
+    }
+    series->samples_us = samples;
+    series->samples_size = size;
+  }
+
+  series->samples_us[series->samples_num++] = (unsigned int)value_us;
+}
+
+static int connect_server(int *fd) {
+  struct sockaddr_in addr;
+  int one = 1;
+
+  *fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (*fd < 0) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(cfg.port);
+  if (inet_pton(AF_INET, cfg.host, &addr.sin_addr) != 1 || connect(*fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(*fd);
+    return -1;
+  }
+  setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  return 0;
+}
+
+static int open_session(loadgen_client_t *client, int *fd, auth_ctx_t *session) {
+  if (connect_server(fd) != 0) {
+    client->connect_errors++;
+    return -1;
+  }
+
+  auth_init_client(session, fd);
+  if (auth_authenticate(session) != 0) {
+    // Also the case when the server sheds the connection as busy
+    auth_release(session);
+    close(*fd);
+    client->connect_errors++;
+    return -1;
+  }
+
+  client->handshakes++;
+  return 0;
+}
+
+static void *client_function(void *ptr) {
+  loadgen_client_t *client = (loadgen_client_t *)ptr;
+  char request[LOADGEN_REQUEST_LEN];
+  auth_ctx_t session;
+  int fd = -1;
+  int connected = 0;
+
+  while (!cfg.end && cfg.connect_only) {
+    // Only the accept path and the handshake are exercised
+    unsigned long long start_us = now_us();
+    if (open_session(client, &fd, &session) != 0) {
+      client->connects.errors++;
+      usleep(1000);
+      continue;
+    }
+    add_sample(&client->connects, now_us() - start_us);
+    auth_release(&session);
+    close(fd);
+  }
+
+  while (!cfg.end && !cfg.connect_only) {
+    loadgen_command_e command = pick_command(client);
+    int request_len = build_request(command, request);
+    unsigned char *response = NULL;
+    unsigned short response_len = 0;
+
+    // Latency is what the client sees, so it includes the handshake whenever
+    // a request needs a new session
+    unsigned long long start_us = now_us();
+    if (!connected) {
+      if (open_session(client, &fd, &session) != 0) {
+        client->commands[command].errors++;
+        usleep(1000);
+        continue;
+      }
+      connected = 1;
+    }
+
+    if (auth_send(&session, (unsigned char *)request, request_len) != 0 ||
+        auth_receive(&session, &response, &response_len) != 0 || response == NULL) {
+      client->commands[command].errors++;
+      auth_release(&session);
+      close(fd);
+      connected = 0;
+      continue;
+    }
+    add_sample(&client->commands[command], now_us() - start_us);
+    free(response);
+
+    if (!cfg.keepalive) {
+      auth_release(&session);
+      close(fd);
+      connected = 0;
+    }
+  }
+
+  if (connected) {
+    auth_release(&session);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+static int compare_samples(const void *a, const void *b) {
+  unsigned int x = *(const unsigned int *)a;
+  unsigned int y = *(const unsigned int *)b;
+  return (x > y) - (x < y);
+}
+
+static unsigned int percentile(loadgen_series_t *series, double p) {
+  if (series->samples_num == 0) {
+    return 0;
+  }
+
+  unsigned int rank = (unsigned int)(p / 100.0 * series->samples_num + 0.5);
+  rank = rank == 0 ? 1 : (rank > series->samples_num ? series->samples_num : rank);
+  return series->samples_us[rank - 1];
+}
+
+static void report_series(const char *name, loadgen_series_t *series, double elapsed_s) {
+  qsort(series->samples_us, series->samples_num, sizeof(unsigned int), compare_samples);
+  printf("%-16s %10u %8llu %10.1f %9u %9u %9u %9u\n", name, series->samples_num, series->errors,
+         series->samples_num / elapsed_s, percentile(series, 50.0), percentile(series, 90.0),
+         percentile(series, 99.0), series->samples_num ? series->samples_us[series->samples_num - 1] : 0);
+}
+
+static void merge_series(loadgen_series_t *all, loadgen_series_t *series) {
+  for (unsigned int i = 0; i < series->samples_num; i++) {
+    add_sample(all, series->samples_us[i]);
+  }
+  all->errors += series->errors;
+}
+
+static void usage(const char *name) {
+  printf(
+      "usage: %s [-h host] [-p port] [-c clients] [-d seconds] [-k | -r] [-b] [-m mix] [-i policy_id] [-u username]\n"
+      " - host: server address (default %s)\n"
+      " - port: server tcp_port (default %d)\n"
+      " - clients: concurrent clients, one thread each (default %d)\n"
+      " - seconds: test duration (default %d)\n"
+      " - k: keep the session open between requests (server needs keepalive=1)\n"
+      " - r: connect-rate mode, clients only connect, authenticate and close\n"
+      " - b: send resolve and get_dataset in the binary encoding\n"
+      " - mix: weighted command mix (default %s)\n"
+      "        commands: resolve, get_policy_list, get_dataset, get_user, get_all_users\n"
+      " - policy_id: policy resolved by resolve requests\n"
+      " - username: user asked for by get_user and get_policy_list requests (default %s)\n",
+      name, LOADGEN_HOST, LOADGEN_PORT, LOADGEN_CLIENTS, LOADGEN_DURATION_S, LOADGEN_MIX, LOADGEN_USERNAME);
+}
+
+int main(int argc, char **argv) {
+  const char *mix = LOADGEN_MIX;
+  int opt;
+
+  cfg.host = LOADGEN_HOST;
+  cfg.port = LOADGEN_PORT;
+  cfg.clients = LOADGEN_CLIENTS;
+  cfg.duration_s = LOADGEN_DURATION_S;
+  cfg.keepalive = 0;
+  cfg.connect_only = 0;
+  cfg.binary = 0;
+  cfg.policy_id = LOADGEN_POLICY_ID;
+  cfg.username = LOADGEN_USERNAME;
+
+  while ((opt = getopt(argc, argv, "h:p:c:d:krbm:i:u:")) != -1) {
+    switch (opt) {
+      case 'h':
+        cfg.host = optarg;
+        break;
+      case 'p':
+        cfg.port = atoi(optarg);
+        break;
+      case 'c':
+        cfg.clients = atoi(optarg);
+        break;
+      case 'd':
+        cfg.duration_s = atoi(optarg);
+        break;
+      case 'k':
+        cfg.keepalive = 1;
+        break;
+      case 'r':
+        cfg.connect_only = 1;
+        break;
+      case 'b':
+        cfg.binary = 1;
+        break;
+      case 'm':
+        mix = optarg;
+        break;
+      case 'i':
+        cfg.policy_id = optarg;
+        break;
+      case 'u':
+        cfg.username = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  if (cfg.clients <= 0 || cfg.clients > LOADGEN_MAX_CLIENTS || cfg.duration_s <= 0 || parse_mix(mix) != 0 ||
+      strlen(cfg.policy_id) > LOADGEN_REQUEST_LEN / 2) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  loadgen_client_t *clients = calloc(cfg.clients, sizeof(loadgen_client_t));
+  if (clients == NULL) {
+    return -1;
+  }
+
+  unsigned long long start_us = now_us();
+  for (int i = 0; i < cfg.clients; i++) {
+    clients[i].seed = (unsigned int)(start_us + i);
+    if (pthread_create(&clients[i].thread, NULL, client_function, &clients[i])) {
+      fprintf(stderr, "could not start client %d\n", i);
+      cfg.clients = i;
+      break;
+    }
+  }
+
+  sleep(cfg.duration_s);
+  cfg.end = 1;
+  for (int i = 0; i < cfg.clients; i++) {
+    pthread_join(clients[i].thread, NULL);
+  }
+  double elapsed_s = (now_us() - start_us) / 1000000.0;
+
+  // Per command figures over all clients, then the whole run
+  loadgen_series_t total = {0};
+  unsigned long long connect_errors = 0;
+  unsigned long long handshakes = 0;
+
+  if (cfg.connect_only) {
+    loadgen_series_t connects = {0};
+    for (int i = 0; i < cfg.clients; i++) {
+      merge_series(&connects, &clients[i].connects);
+      free(clients[i].connects.samples_us);
+    }
+    printf("%d clients, %.1f s, connect rate\n\n", cfg.clients, elapsed_s);
+    printf("%-16s %10s %8s %10s %9s %9s %9s %9s\n", "phase", "sessions", "errors", "conn/s", "p50_us", "p90_us",
+           "p99_us", "max_us");
+    report_series("connect", &connects, elapsed_s);
+    free(connects.samples_us);
+    free(clients);
+    return connects.errors > 0 && connects.samples_num == 0 ? -1 : 0;
+  }
+
+  printf("%d clients, %.1f s, %s%s\n\n", cfg.clients, elapsed_s, cfg.keepalive ? "keep-alive" : "one request per session",
+         cfg.binary ? ", binary encoding" : "");
+  printf("%-16s %10s %8s %10s %9s %9s %9s %9s\n", "command", "requests", "errors", "req/s", "p50_us", "p90_us",
+         "p99_us", "max_us");
+  for (int c = 0; c < LOADGEN_COMMAND_NUM; c++) {
+    loadgen_series_t series = {0};
+    for (int i = 0; i < cfg.clients; i++) {
+      merge_series(&series, &clients[i].commands[c]);
+    }
+    if (series.samples_num > 0 || series.errors > 0) {
+      report_series(command_names[c], &series, elapsed_s);
+    }
+    merge_series(&total, &series);
+    free(series.samples_us);
+  }
+  report_series("total", &total, elapsed_s);
+
+  for (int i = 0; i < cfg.clients; i++) {
+    connect_errors += clients[i].connect_errors;
+    handshakes += clients[i].handshakes;
+    for (int c = 0; c < LOADGEN_COMMAND_NUM; c++) {
+      free(clients[i].commands[c].samples_us);
+    }
+  }
+  printf("\n%llu handshakes, %llu failed connections or handshakes\n", handshakes, connect_errors);
+
+  free(total.samples_us);
+  free(clients);
+
+  return total.errors > 0 && total.samples_num == 0 ? -1 : 0;
+}
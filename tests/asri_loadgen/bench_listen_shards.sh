@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# This file is part of the IOTA Access distribution
+# (https://github.com/iotaledger/access)
+#
+# Copyright (c) 2020 IOTA Stiftung
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Connection rate of asri with 1 to K listen shards.
+#
+# usage: bench_listen_shards.sh <asri> <asri_loadgen> <config.ini> [max_shards] [clients] [seconds]
+#
+# asri is started from a scratch directory holding a copy of config.ini with
+# listen_shards and worker_threads set to the shard count, and asri_loadgen
+# runs in connect-rate mode against it.
+
+if [ $# -lt 3 ]; then
+  echo "usage: $0 <asri> <asri_loadgen> <config.ini> [max_shards] [clients] [seconds]"
+  exit 1
+fi
+
+ASRI=$(realpath "$1")
+LOADGEN=$(realpath "$2")
+CONFIG=$(realpath "$3")
+MAX_SHARDS=${4:-$(nproc)}
+CLIENTS=${5:-64}
+SECONDS_PER_RUN=${6:-10}
+PORT=$(sed -n 's/^tcp_port=//p' "$CONFIG")
+PORT=${PORT:-9998}
+
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+printf "%-8s %12s %10s %10s\n" "shards" "conn/s" "p50_us" "p99_us"
+shards=1
+while [ "$shards" -le "$MAX_SHARDS" ]; do
+  sed -e '/^listen_shards=/d' -e '/^worker_threads=/d' \
+      -e "s/^\[network\]$/[network]\nlisten_shards=$shards\nworker_threads=$shards/" "$CONFIG" > "$WORKDIR/config.ini"
+
+  (cd "$WORKDIR" && exec "$ASRI" > asri.log 2>&1) &
+  ASRI_PID=$!
+  sleep 2
+
+  "$LOADGEN" -p "$PORT" -c "$CLIENTS" -d "$SECONDS_PER_RUN" -r |
+    awk -v shards="$shards" '$1 == "connect" { printf "%-8s %12s %10s %10s\n", shards, $4, $5, $7 }'
+
+  kill -INT "$ASRI_PID"
+  wait "$ASRI_PID" 2> /dev/null
+  shards=$((shards + 1))
+done
@@ -0,0 +1,199 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_slow_client_test.c
+ * \brief
+ * Test of a client that sends its request a few bytes at a time
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * The server runs with a single worker and a trusted unix socket. While one
+ * client trickles its request in, another client has to be answered at once,
+ * so the worker must go back to the event loop instead of waiting for the
+ * rest of the frame. The trickled request, and the next one on the same
+ * connection, have to be answered once they are complete.
+ *
+ * \history
+ * 20.01.2021. Initial version.
+ ****************************************************************************/
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "network.h"
+
+#define TEST_REQUEST "{\"cmd\":\"get_ticket\"}"
+#define TEST_RESPONSE "{\"error\":\"no ticket\"}"
+#define TEST_STEP_MS 20
+#define TEST_TIMEOUT_MS 500
+#define TEST_FRAME_LEN 128
+
+static char dir[] = "/tmp/network_slow_client_XXXXXX";
+static char socket_path[sizeof(dir) + 16];
+
+static int failures;
+
+static void check(int condition, const char *name) {
+  printf("%-50s %s\n", name, condition ? "ok" : "FAILED");
+  failures += !condition;
+}
+
+static void sleep_ms(int ms) {
+  struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+
+static int write_config(void) {
+  FILE *fp = fopen("config.ini", "w");
+  if (fp == NULL) {
+    return -1;
+  }
+
+  // One worker: a worker stuck on the slow client would leave nobody to answer the other one
+  fprintf(fp,
+          "[network]\ntcp_port=0\nworker_threads=1\nlisten_shards=1\nkeepalive=1\nidle_timeout_ms=5000\n"
+          "request_timeout_ms=5000\nunix_socket_path=%s\nunix_trusted_uids=%u\n",
+          socket_path, (unsigned)getuid());
+  fclose(fp);
+  return 0;
+}
+
+static int client_connect(void) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int frame(unsigned char *buf) {
+  int len = strlen(TEST_REQUEST);
+
+  // Plain frame of trusted peers: 2-byte big endian length, then payload
+  buf[0] = (len >> 8) & 0xFF;
+  buf[1] = len & 0xFF;
+  memcpy(buf + 2, TEST_REQUEST, len);
+  return len + 2;
+}
+
+// Reads one plain frame, giving up if nothing arrives for TEST_TIMEOUT_MS
+static int receive(int fd, char *data, int size) {
+  unsigned char header[2];
+  int got = 0;
+  int len = -1;
+
+  while (len < 0 || got < len) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, TEST_TIMEOUT_MS) != 1) {
+      return -1;
+    }
+    ssize_t ret = len < 0 ? recv(fd, header + got, 2 - got, 0) : recv(fd, data + got, len - got, 0);
+    if (ret <= 0) {
+      return -1;
+    }
+    got += ret;
+    if (len < 0 && got == 2) {
+      len = (header[0] << 8) | header[1];
+      got = 0;
+      if (len >= size) {
+        return -1;
+      }
+    }
+  }
+  data[len] = '\0';
+  return len;
+}
+
+static int answered(int fd) {
+  char data[TEST_FRAME_LEN];
+
+  return receive(fd, data, sizeof(data)) >= 0 && strcmp(data, TEST_RESPONSE) == 0;
+}
+
+static int other_client_answered(void) {
+  unsigned char buf[TEST_FRAME_LEN];
+  int len = frame(buf);
+  int fd = client_connect();
+  int ret = 0;
+
+  if (fd >= 0) {
+    ret = send(fd, buf, len, 0) == len && answered(fd);
+    close(fd);
+  }
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  network_ctx_t network;
+  unsigned char buf[TEST_FRAME_LEN];
+  int len = frame(buf);
+  int others = 0;
+  int sent = 1;
+
+  signal(SIGPIPE, SIG_IGN);
+  if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+    fprintf(stderr, "could not create a working directory\n");
+    return -1;
+  }
+  snprintf(socket_path, sizeof(socket_path), "%s/asri.sock", dir);
+  if (write_config() != 0 || network_init(&network) != 0 || network_start(network) != 0) {
+    fprintf(stderr, "could not start the network\n");
+    return -1;
+  }
+
+  int slow = client_connect();
+  check(slow >= 0, "slow client connected");
+
+  // Byte by byte, with other clients served in the header and in the payload
+  for (int i = 0; i < len; i++) {
+    sent &= send(slow, buf + i, 1, 0) == 1;
+    sleep_ms(TEST_STEP_MS);
+    if (i == 0 || i == len / 2) {
+      others += other_client_answered();
+    }
+  }
+  check(sent, "slow request sent byte by byte");
+  check(others == 2, "other clients answered meanwhile");
+  check(answered(slow), "slow request answered");
+
+  // Next request on the same connection, split inside the header
+  check(send(slow, buf, 1, 0) == 1, "second request started");
+  sleep_ms(TEST_STEP_MS);
+  check(other_client_answered(), "other client answered mid-header");
+  check(send(slow, buf + 1, len - 1, 0) == len - 1 && answered(slow), "second request answered");
+  close(slow);
+
+  network_stop(network);
+  unlink("config.ini");
+  rmdir(dir);
+  return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,182 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/****************************************************************************
+ * \project IOTA Access
+ * \file network_timer_test.c
+ * \brief
+ * Test of the expiry of timers on the timer wheel
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Timers are spread over every level of the wheel and beyond its range, and
+ * the wheel is advanced in uneven steps. Each timer has to fire exactly once,
+ * in the first advance that reaches its expiry, and never before it.
+ * Cancelled timers must not fire, and a callback may schedule its own timer
+ * again.
+ *
+ * \history
+ * 18.12.2020. Initial version.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "network_timer.h"
+
+#define TEST_TICK_US 1000ULL
+#define TEST_START_US 5000000ULL
+#define TEST_TIMERS 2000
+#define TEST_REPEATS 3
+
+typedef struct {
+  network_timer_t timer;
+  unsigned long long expires_us;
+  int cancelled;
+  int fired;
+  int repeats;
+} test_timer_t;
+
+static test_timer_t timers[TEST_TIMERS];
+static network_timer_wheel_t wheel;
+static unsigned long long now_us;
+static unsigned long long seed = 1;
+static int early;
+static int late;
+
+static int failures;
+
+static void check(int condition, const char *name) {
+  printf("%-50s %s\n", name, condition ? "ok" : "FAILED");
+  failures += !condition;
+}
+
+static unsigned long long next_random(unsigned long long range) {
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (seed >> 33) % range;
+}
+
+static unsigned long long expiry_tick(unsigned long long expires_us) {
+  return (expires_us + TEST_TICK_US - 1) / TEST_TICK_US;
+}
+
+static void expired(network_timer_t *timer) {
+  test_timer_t *test = (test_timer_t *)timer->data;
+
+  if (now_us / TEST_TICK_US < expiry_tick(test->expires_us)) {
+    early++;
+  }
+  test->fired++;
+
+  if (test->repeats > 0) {
+    // Scheduled again from its own callback
+    test->repeats--;
+    test->expires_us = now_us + 1 + next_random(200 * TEST_TICK_US);
+    network_timer_schedule(&wheel, timer, test->expires_us);
+  }
+}
+
+static void advance_to(unsigned long long to_us) {
+  now_us = to_us;
+  network_timer_advance(&wheel, now_us, expired);
+
+  // Anything due by now must have fired in this advance
+  for (int i = 0; i < TEST_TIMERS; i++) {
+    if (timers[i].timer.pending && expiry_tick(timers[i].expires_us) <= now_us / TEST_TICK_US) {
+      late++;
+    }
+  }
+}
+
+static unsigned long long spread_expiry(int i) {
+  // Every level of the wheel, expiries already due and expiries beyond its range
+  unsigned long long range = 1ULL << (NETWORK_TIMER_LEVEL_BITS * (1 + i % (NETWORK_TIMER_LEVELS + 1)));
+  if (i % 17 == 0) {
+    return now_us - next_random(10 * TEST_TICK_US);
+  }
+  return now_us + next_random(range * TEST_TICK_US);
+}
+
+int main(int argc, char **argv) {
+  unsigned long long last_us = 0;
+  unsigned int cancelled = 0;
+
+  now_us = TEST_START_US;
+  network_timer_wheel_init(&wheel, TEST_TICK_US, now_us);
+
+  for (int i = 0; i < TEST_TIMERS; i++) {
+    memset(&timers[i], 0, sizeof(test_timer_t));
+    network_timer_init(&timers[i].timer, &timers[i]);
+    timers[i].expires_us = spread_expiry(i);
+    timers[i].repeats = i % 50 == 0 ? TEST_REPEATS : 0;
+    network_timer_schedule(&wheel, &timers[i].timer, timers[i].expires_us);
+    if (timers[i].expires_us > last_us) {
+      last_us = timers[i].expires_us;
+    }
+  }
+
+  // Moved timers fire at their new expiry only
+  for (int i = 1; i < TEST_TIMERS; i += 7) {
+    timers[i].expires_us = spread_expiry(i);
+    network_timer_schedule(&wheel, &timers[i].timer, timers[i].expires_us);
+    if (timers[i].expires_us > last_us) {
+      last_us = timers[i].expires_us;
+    }
+  }
+  for (int i = 3; i < TEST_TIMERS; i += 11) {
+    network_timer_cancel(&wheel, &timers[i].timer);
+    timers[i].cancelled = 1;
+    cancelled++;
+  }
+  check(wheel.pending == TEST_TIMERS - cancelled, "pending counts scheduled timers");
+
+  // Uneven steps: single ticks, partial ticks and jumps over many slots
+  while (now_us <= last_us + 300 * TEST_TICK_US) {
+    unsigned long long step = next_random(4) == 0 ? next_random(5000 * TEST_TICK_US) : next_random(3 * TEST_TICK_US);
+    advance_to(now_us + step + 1);
+  }
+
+  int once = 1;
+  int none_cancelled = 1;
+  for (int i = 0; i < TEST_TIMERS; i++) {
+    if (timers[i].cancelled) {
+      none_cancelled &= timers[i].fired == 0;
+    } else {
+      once &= timers[i].fired == 1 + (i % 50 == 0 ? TEST_REPEATS : 0);
+    }
+  }
+  check(early == 0, "no timer fires before its expiry");
+  check(late == 0, "every timer fires in the first advance reaching it");
+  check(once, "every timer fires once per schedule");
+  check(none_cancelled, "cancelled timers do not fire");
+  check(wheel.pending == 0, "wheel is empty");
+
+  // An idle wheel skips ahead, a timer scheduled afterwards still fires on time
+  advance_to((now_us / TEST_TICK_US + 1000000) * TEST_TICK_US);
+  timers[0].fired = 0;
+  timers[0].repeats = 0;
+  timers[0].expires_us = now_us + TEST_TICK_US;
+  network_timer_schedule(&wheel, &timers[0].timer, timers[0].expires_us);
+  advance_to((expiry_tick(timers[0].expires_us) - 1) * TEST_TICK_US);
+  check(timers[0].fired == 0, "idle wheel: not fired before expiry");
+  advance_to(expiry_tick(timers[0].expires_us) * TEST_TICK_US);
+  check(timers[0].fired == 1, "idle wheel: fired at expiry");
+
+  return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file pip_can_test.c
+ * \brief
+ * Test of policy attributes served by the CAN PIP plugin
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Registers the CAN plugin with the Access Core without starting its reader
+ * threads, and stores the values a decoded frame would leave. A compiled
+ * policy gated on the central lock then has to read them through the URI
+ * the Access Core builds, as the PDP does.
+ *
+ * \history
+ * 07.12.2020. Initial version.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "access.h"
+#include "can_signals.h"
+#include "pip_plugin_can.h"
+#include "policy_circuit.h"
+
+#define TEST_POLICY_ID "5c0a1e5c7d8e9f00112233445566778899aabbccddeeff00112233445566778a"
+#define TEST_LOCK_SIGNAL "central_locking_status_for_user_feedback"
+
+static const char policy[] =
+    "{\"policy_goc\":{\"operation\":\"and\",\"attribute_list\":["
+    "{\"operation\":\"eq\",\"attribute_list\":[{\"type\":\"request.central_locking_status_for_user_feedback\","
+    "\"value\":\"\"},{\"type\":\"string\",\"value\":\"Locked\"}]},"
+    "{\"operation\":\"eq\",\"attribute_list\":[{\"type\":\"action\",\"value\":\"open_door\"},"
+    "{\"type\":\"request.action.value\",\"value\":\"\"}]}]}}";
+
+static int failures;
+
+static void check(int condition, const char *name) {
+  printf("%-50s %s\n", name, condition ? "ok" : "FAILED");
+  failures += !condition;
+}
+
+static int granted_subjects(void) {
+  uint64_t granted = 0;
+  return access_resolve_subjects(TEST_POLICY_ID, strlen(TEST_POLICY_ID), "open_door", strlen("open_door"), NULL, 0, 1,
+                                 &granted);
+}
+
+static pdp_decision_e batch_decision(void) {
+  access_batch_item_t item = {TEST_POLICY_ID, strlen(TEST_POLICY_ID), "open_door", strlen("open_door")};
+  return access_resolve_batch(&item, 1) == 0 ? item.decision : PDP_ERROR;
+}
+
+int main(int argc, char **argv) {
+  plugin_t plugin;
+  policy_circuit_t *circuit;
+  pip_plugin_can_options_t options = {.change_cb = access_notify_signal_change};
+
+  access_init();
+  if (plugin_init(&plugin, pip_plugin_can_initializer, &options) != 0) {
+    fprintf(stderr, "could not initialize the CAN plugin\n");
+    return -1;
+  }
+  access_register_pip_plugin(&plugin);
+
+  if (policy_circuit_compile(policy, strlen(policy), &circuit) != POLICY_CIRCUIT_OK) {
+    fprintf(stderr, "could not compile the policy\n");
+    return -1;
+  }
+  policy_circuit_store(TEST_POLICY_ID, strlen(TEST_POLICY_ID), circuit);
+
+  check(granted_subjects() <= 0, "no grant before the lock is seen");
+
+  can_signals_set(TEST_LOCK_SIGNAL, "Locked");
+  access_notify_signal_change(TEST_LOCK_SIGNAL);
+  check(granted_subjects() == 1, "grant while locked");
+  check(batch_decision() == PDP_GRANT, "batch grant while locked");
+
+  can_signals_set(TEST_LOCK_SIGNAL, "Opened");
+  access_notify_signal_change(TEST_LOCK_SIGNAL);
+  check(granted_subjects() <= 0, "no grant once opened");
+  check(batch_decision() != PDP_GRANT, "no batch grant once opened");
+
+  // The reader threads were never started, so the plugin is not destroyed by access_term
+  return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,266 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * \project IOTA Access
+ * \file policy_bench.c
+ * \brief
+ * Benchmark of the policy evaluation engines
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Evaluates one policy object with the circuit and with the bytecode engine
+ * and reports the time and the attribute fetches per evaluation. Attributes
+ * other than the action wait for a simulated PIP round trip. With -i, the
+ * same policy, stored under that id by the policy loader, is also handed to
+ * the PDP of the Access SDK.
+ *
+ * \history
+ * 09.11.2020. Initial version.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "access.h"
+#include "config_manager.h"
+#include "pap_plugin_posix.h"
+#include "pdp.h"
+#include "policy_circuit.h"
+#include "policy_vm.h"
+
+#define BENCH_ITERATIONS 100000
+#define BENCH_LATENCY_US 50
+#define BENCH_ATTRIBUTES_MAX 16
+#define BENCH_POLICY_LEN (64 * 1024)
+#define BENCH_REQUEST_LEN 128
+#define BENCH_ACTION_ATTRIBUTE "request.action.value"
+
+typedef struct {
+  const char *type;
+  const char *value;
+} bench_attribute_t;
+
+static bench_attribute_t attributes[BENCH_ATTRIBUTES_MAX];
+static int attributes_num;
+static unsigned long long latency_ns;
+static unsigned long long fetches;
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int is_action(const char *type, int type_len) {
+  return type_len == strlen(BENCH_ACTION_ATTRIBUTE) && memcmp(type, BENCH_ACTION_ATTRIBUTE, type_len) == 0;
+}
+
+static int resolve(const char *type, int type_len, void *user_data, char *value, int value_size) {
+  fetches++;
+
+  // Spin rather than sleep, a sleep rounds up to the scheduler tick
+  if (!is_action(type, type_len) && latency_ns > 0) {
+    unsigned long long until = now_ns() + latency_ns;
+    while (now_ns() < until) {
+    }
+  }
+
+  for (int i = 0; i < attributes_num; i++) {
+    int len = strlen(attributes[i].value);
+    if (strlen(attributes[i].type) == type_len && memcmp(attributes[i].type, type, type_len) == 0 && len < value_size) {
+      memcpy(value, attributes[i].value, len);
+      return len;
+    }
+  }
+  return -1;
+}
+
+// Same weights access_init gives the bytecode engine
+static int cost(const char *type, int type_len) { return is_action(type, type_len) ? 1 : 10; }
+
+static const char *decision_name(pdp_decision_e decision) {
+  switch (decision) {
+    case PDP_GRANT:
+      return "grant";
+    case PDP_DENY:
+      return "deny";
+    case PDP_CONFLICT:
+      return "conflict";
+    case PDP_UNDEFINED:
+      return "undefined";
+    default:
+      return "error";
+  }
+}
+
+static void report(const char *engine, pdp_decision_e decision, int iterations, unsigned long long elapsed_ns) {
+  printf("%-10s %-10s %12.1f %12.3f %10.2f\n", engine, decision_name(decision), iterations * 1e9 / elapsed_ns,
+         elapsed_ns / 1000.0 / iterations, (double)fetches / iterations);
+}
+
+static int read_policy(const char *path, char *buf, int size) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return -1;
+  }
+  int len = fread(buf, 1, size - 1, f);
+  fclose(f);
+  buf[len] = '\0';
+  return len;
+}
+
+static pdp_decision_e bench_pdp(const char *policy_id, int iterations, unsigned long long *elapsed_ns) {
+  char request[BENCH_REQUEST_LEN];
+  char obligation[PDP_STR_LEN];
+  pdp_action_t action;
+  pdp_decision_e decision = PDP_ERROR;
+  plugin_t plugin;
+
+  config_manager_init("config.ini");
+  access_init();
+  if (plugin_init(&plugin, pap_plugin_posix_initializer, NULL) == 0) {
+    access_register_pap_plugin(&plugin);
+  }
+
+  snprintf(request, BENCH_REQUEST_LEN, "{\"cmd\":\"resolve\",\"policy_id\":\"%s\"}", policy_id);
+  unsigned long long start_ns = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    memset(obligation, 0, sizeof(obligation));
+    memset(&action, 0, sizeof(action));
+    decision = pdp_calculate_decision(request, obligation, &action);
+  }
+  *elapsed_ns = now_ns() - start_ns;
+
+  access_term();
+  return decision;
+}
+
+static void usage(const char *name) {
+  printf(
+      "usage: %s [-n iterations] [-l latency_us] [-i policy_id] policy_object.json [type=value ...]\n"
+      " - iterations: evaluations per engine (default %d)\n"
+      " - latency_us: simulated PIP round trip for attributes other than the action (default %d)\n"
+      " - policy_id: also evaluate the stored policy with the SDK PDP, reading config.ini\n"
+      " - type=value: request attribute, e.g. request.action.value=open_door\n",
+      name, BENCH_ITERATIONS, BENCH_LATENCY_US);
+}
+
+int main(int argc, char **argv) {
+  int iterations = BENCH_ITERATIONS;
+  const char *policy_id = NULL;
+  int opt;
+
+  latency_ns = BENCH_LATENCY_US * 1000ULL;
+  while ((opt = getopt(argc, argv, "n:l:i:")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 'l':
+        latency_ns = atoi(optarg) * 1000ULL;
+        break;
+      case 'i':
+        policy_id = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  if (optind >= argc || iterations <= 0 || (policy_id != NULL && strlen(policy_id) > BENCH_REQUEST_LEN / 2)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  for (int i = optind + 1; i < argc && attributes_num < BENCH_ATTRIBUTES_MAX; i++) {
+    char *separator = strchr(argv[i], '=');
+    if (separator == NULL) {
+      usage(argv[0]);
+      return -1;
+    }
+    *separator = '\0';
+    attributes[attributes_num].type = argv[i];
+    attributes[attributes_num].value = separator + 1;
+    attributes_num++;
+  }
+
+  char *policy = malloc(BENCH_POLICY_LEN);
+  int policy_len;
+  if (policy == NULL || (policy_len = read_policy(argv[optind], policy, BENCH_POLICY_LEN)) < 0) {
+    fprintf(stderr, "could not read %s\n", argv[optind]);
+    free(policy);
+    return -1;
+  }
+
+  policy_circuit_t *circuit;
+  policy_vm_program_t *program;
+  if (policy_circuit_compile(policy, policy_len, &circuit) != POLICY_CIRCUIT_OK) {
+    fprintf(stderr, "policy uses an operation the engines do not support\n");
+    free(policy);
+    return -1;
+  }
+  if (policy_vm_compile(circuit, cost, &program) != POLICY_CIRCUIT_OK) {
+    policy_circuit_free(circuit);
+    free(policy);
+    return -1;
+  }
+  free(policy);
+
+  printf("%d gates, %d instructions, %d iterations, %llu us per PIP fetch\n\n", policy_circuit_gates(circuit),
+         program->code_len, iterations, latency_ns / 1000);
+  printf("%-10s %-10s %12s %12s %10s\n", "engine", "decision", "evals/s", "us/eval", "fetches");
+
+  pdp_decision_e decision = PDP_ERROR;
+  unsigned long long start_ns = now_ns();
+  fetches = 0;
+  for (int i = 0; i < iterations; i++) {
+    decision = policy_circuit_evaluate(circuit, resolve, NULL);
+  }
+  report("circuit", decision, iterations, now_ns() - start_ns);
+
+  policy_slot_value_t slots[POLICY_CIRCUIT_SLOTS_MAX];
+  start_ns = now_ns();
+  fetches = 0;
+  for (int i = 0; i < iterations; i++) {
+    for (int k = 0; k < circuit->slots_num; k++) {
+      slots[k].resolved = 0;
+    }
+    decision = policy_vm_run(program, slots, resolve, NULL);
+  }
+  report("vm", decision, iterations, now_ns() - start_ns);
+
+  if (policy_id != NULL) {
+    unsigned long long elapsed_ns;
+    // The PDP fetches attributes through its own PIP plugins
+    fetches = 0;
+    decision = bench_pdp(policy_id, iterations, &elapsed_ns);
+    report("pdp", decision, iterations, elapsed_ns);
+  }
+
+  policy_vm_free(program);
+  policy_circuit_free(circuit);
+
+  return 0;
+}
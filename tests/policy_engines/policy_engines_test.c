@@ -0,0 +1,381 @@
+/*
+ * This file is part of the IOTA Access distribution
+ * (https://github.com/iotaledger/access)
+ *
+ * Copyright (c) 2020 IOTA Stiftung
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/****************************************************************************
+ * \project IOTA Access
+ * \file policy_engines_test.c
+ * \brief
+ * Test that the circuit, the bytecode engine and the PDP decide alike
+ *
+ * @Author Djordje Golubovic
+ *
+ * \notes
+ * Every sample policy is decided for every combination of values of the
+ * request attributes it reads. The circuit and the bytecode engine are given
+ * the values directly. The PDP of the Access SDK gets the policy from a PAP
+ * plugin of this test and the values from a PIP plugin of this test, which
+ * answers the URIs the PDP asks by. A PDP grant of another action than the
+ * requested one counts as a deny, as it does for batched resolves.
+ *
+ * \history
+ * 18.12.2020. Initial version.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "access.h"
+#include "pap.h"
+#include "pap_plugin.h"
+#include "pdp.h"
+#include "pip.h"
+#include "pip_plugin.h"
+#include "policy_circuit.h"
+#include "policy_vm.h"
+#include "utils.h"
+
+#define TEST_POLICY_ID "7e57e57e57e57e57e57e57e57e57e57e57e57e57e57e57e57e57e57e57e57e5a"
+#define TEST_SAMPLE_POLICY_FILE "policy_object.json"
+#define TEST_POLICY_LEN (16 * 1024)
+#define TEST_REQUEST_LEN 128
+#define TEST_VALUES_MAX 4
+#define TEST_ACTION_ATTRIBUTE "request.action.value"
+#define TEST_URI_AUTHORITY "iota:"
+
+typedef struct {
+  const char *type;
+  const char *values[TEST_VALUES_MAX];
+} test_domain_t;
+
+// Values each request attribute takes, chosen around the constants the policies compare with
+static const test_domain_t domains[] = {
+    {"request.isPayed.type", {"verified", "not_paid", NULL}},
+    {"request.vehicle.speed", {"0", "5", "30", NULL}},
+    {"request.fuel_tank_level", {"10", "20", "80", NULL}},
+    {TEST_ACTION_ATTRIBUTE, {"open_door", "start_engine", NULL}},
+};
+
+#define TEST_DOMAINS_NUM (int)(sizeof(domains) / sizeof(domains[0]))
+
+// Besides the sample policy object of the benchmark: or, the numeric comparisons,
+// negation, attributes on either side of a comparison, and grants conflicting with denies
+static const char *policies[] = {
+    "{\"policy_goc\":{\"operation\":\"and\",\"attribute_list\":["
+    "{\"operation\":\"or\",\"attribute_list\":["
+    "{\"operation\":\"gt\",\"attribute_list\":[{\"type\":\"request.vehicle.speed\",\"value\":\"\"},"
+    "{\"type\":\"number\",\"value\":\"10\"}]},"
+    "{\"operation\":\"geq\",\"attribute_list\":[{\"type\":\"request.fuel_tank_level\",\"value\":\"\"},"
+    "{\"type\":\"number\",\"value\":\"20\"}]}]},"
+    "{\"operation\":\"eq\",\"attribute_list\":[{\"type\":\"action\",\"value\":\"start_engine\"},"
+    "{\"type\":\"request.action.value\",\"value\":\"\"}]}]},"
+    "\"policy_doc\":{\"operation\":\"eq\",\"attribute_list\":["
+    "{\"type\":\"string\",\"value\":\"not_paid\"},{\"type\":\"request.isPayed.type\",\"value\":\"\"}]}}",
+
+    "{\"policy_goc\":{\"operation\":\"and\",\"attribute_list\":["
+    "{\"operation\":\"not\",\"attribute_list\":["
+    "{\"operation\":\"lt\",\"attribute_list\":[{\"type\":\"request.fuel_tank_level\",\"value\":\"\"},"
+    "{\"type\":\"number\",\"value\":\"20\"}]}]},"
+    "{\"operation\":\"eq\",\"attribute_list\":[{\"type\":\"action\",\"value\":\"open_door\"},"
+    "{\"type\":\"request.action.value\",\"value\":\"\"}]}]},"
+    "\"policy_doc\":{\"operation\":\"and\",\"attribute_list\":["
+    "{\"operation\":\"leq\",\"attribute_list\":[{\"type\":\"request.vehicle.speed\",\"value\":\"\"},"
+    "{\"type\":\"number\",\"value\":\"5\"}]},"
+    "{\"operation\":\"eq\",\"attribute_list\":[{\"type\":\"action\",\"value\":\"open_door\"},"
+    "{\"type\":\"request.action.value\",\"value\":\"\"}]}]}}",
+};
+
+#define TEST_POLICIES_NUM (int)(sizeof(policies) / sizeof(policies[0]))
+
+// Policy the PAP plugin serves and values the resolvers and the PIP plugin answer with
+static const char *current_policy;
+static const char *current_values[TEST_DOMAINS_NUM];
+
+static int failures;
+
+static void check(int condition, const char *name) {
+  printf("%-50s %s\n", name, condition ? "ok" : "FAILED");
+  failures += !condition;
+}
+
+static const char *value_of(const char *type, int type_len) {
+  for (int i = 0; i < TEST_DOMAINS_NUM; i++) {
+    if (strlen(domains[i].type) == type_len && memcmp(domains[i].type, type, type_len) == 0) {
+      return current_values[i];
+    }
+  }
+  return NULL;
+}
+
+static int resolve(const char *type, int type_len, void *user_data, char *value, int value_size) {
+  const char *current = value_of(type, type_len);
+
+  if (current == NULL || strlen(current) >= value_size) {
+    return -1;
+  }
+  memcpy(value, current, strlen(current));
+  return strlen(current);
+}
+
+// Same weights access_init gives the bytecode engine
+static int cost(const char *type, int type_len) {
+  return type_len == strlen(TEST_ACTION_ATTRIBUTE) && memcmp(type, TEST_ACTION_ATTRIBUTE, type_len) == 0 ? 1 : 10;
+}
+
+static int is_test_policy(char *policy_id) {
+  char policy_id_str[PAP_POL_ID_MAX_LEN * 2 + 1] = {0};
+
+  // PAP plugins get the raw policy id
+  return hex_to_str(policy_id, policy_id_str, PAP_POL_ID_MAX_LEN) == UTILS_STRING_SUCCESS &&
+         strcasecmp(policy_id_str, TEST_POLICY_ID) == 0;
+}
+
+static int pap_has_cb(plugin_t *plugin, void *data) {
+  pap_plugin_has_args_t *args = (pap_plugin_has_args_t *)data;
+  args->does_have = is_test_policy(args->policy_id);
+  return 0;
+}
+
+static int pap_len_cb(plugin_t *plugin, void *data) {
+  pap_plugin_len_args_t *args = (pap_plugin_len_args_t *)data;
+  args->len = is_test_policy(args->policy_id) ? strlen(current_policy) : 0;
+  return 0;
+}
+
+static int pap_get_cb(plugin_t *plugin, void *data) {
+  pap_plugin_get_args_t *args = (pap_plugin_get_args_t *)data;
+
+  if (!is_test_policy(args->policy_id)) {
+    return -1;
+  }
+  memcpy(args->policy->policy_object.policy_object, current_policy, strlen(current_policy));
+  args->policy->policy_object.policy_object_size = strlen(current_policy);
+  args->policy->policy_id_signature.signature_algorithm = PAP_ECDSA;
+  args->policy->hash_function = PAP_SHA_256;
+  memcpy(args->policy->policy_id, args->policy_id, PAP_POL_ID_MAX_LEN);
+  return 0;
+}
+
+static int pap_get_all_cb(plugin_t *plugin, void *data) {
+  *(pap_policy_id_list_t **)data = NULL;
+  return 0;
+}
+
+static int pip_acquire_cb(plugin_t *plugin, void *data) {
+  pip_plugin_args_t *args = (pip_plugin_args_t *)data;
+  const char *type;
+  const char *value;
+
+  // The URI is iota:<policy id>/<attribute type>?<value>
+  if (args == NULL || args->uri == NULL || strncmp(args->uri, TEST_URI_AUTHORITY, strlen(TEST_URI_AUTHORITY)) != 0 ||
+      (type = strchr(args->uri, '/')) == NULL) {
+    return -1;
+  }
+  type++;
+  if ((value = value_of(type, strcspn(type, "?"))) == NULL) {
+    return -1;
+  }
+
+  strcpy(args->attribute.type, "string");
+  strncpy(args->attribute.value, value, PIP_MAX_STR_LEN - 1);
+  return 0;
+}
+
+static int destroy_cb(plugin_t *plugin, void *data) {
+  free(plugin->callbacks);
+  return 0;
+}
+
+static int pap_initializer(plugin_t *plugin, void *data) {
+  plugin->destroy = destroy_cb;
+  plugin->callbacks = calloc(PAP_PLUGIN_CALLBACK_COUNT, sizeof(void *));
+  plugin->callbacks_num = PAP_PLUGIN_CALLBACK_COUNT;
+  plugin->plugin_specific_data = NULL;
+  if (plugin->callbacks == NULL) {
+    return -1;
+  }
+  plugin->callbacks[PAP_PLUGIN_GET_CB] = pap_get_cb;
+  plugin->callbacks[PAP_PLUGIN_HAS_CB] = pap_has_cb;
+  plugin->callbacks[PAP_PLUGIN_GET_POL_OBJ_LEN_CB] = pap_len_cb;
+  plugin->callbacks[PAP_PLUGIN_GET_ALL_CB] = pap_get_all_cb;
+  return 0;
+}
+
+static int pip_initializer(plugin_t *plugin, void *data) {
+  plugin->destroy = destroy_cb;
+  plugin->callbacks = calloc(PIP_PLUGIN_CALLBACK_COUNT, sizeof(void *));
+  plugin->callbacks_num = PIP_PLUGIN_CALLBACK_COUNT;
+  plugin->plugin_specific_data = NULL;
+  if (plugin->callbacks == NULL) {
+    return -1;
+  }
+  plugin->callbacks[PIP_PLUGIN_ACQUIRE_CB] = pip_acquire_cb;
+  return 0;
+}
+
+static pdp_decision_e pdp_decision(const char *action) {
+  char request[TEST_REQUEST_LEN];
+  char obligation[PDP_STR_LEN] = {0};
+  pdp_action_t granted;
+
+  memset(&granted, 0, sizeof(granted));
+  snprintf(request, TEST_REQUEST_LEN, "{\"cmd\":\"resolve\",\"policy_id\":\"%s\"}", TEST_POLICY_ID);
+  pdp_decision_e decision = pdp_calculate_decision(request, obligation, &granted);
+  if (decision == PDP_GRANT && strcmp(granted.value, action) != 0) {
+    // The policy grants a different action than the one asked about
+    decision = PDP_DENY;
+  }
+  return decision;
+}
+
+static int read_policy(const char *path, char *buf, int size) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return -1;
+  }
+  int len = fread(buf, 1, size - 1, f);
+  fclose(f);
+  buf[len] = '\0';
+  return len;
+}
+
+// Decide the policy with all three engines for every combination of values
+static void compare_engines(const char *name, const char *policy) {
+  char types[POLICY_CIRCUIT_SLOTS_MAX][POLICY_CIRCUIT_VALUE_LEN];
+  int domain_of[POLICY_CIRCUIT_SLOTS_MAX];
+  int value_index[POLICY_CIRCUIT_SLOTS_MAX] = {0};
+  policy_slot_value_t slots[POLICY_CIRCUIT_SLOTS_MAX];
+  policy_circuit_t *circuit;
+  policy_vm_program_t *program;
+  int vm_agrees = 1;
+  int pdp_agrees = 1;
+  int combinations = 0;
+  int grants = 0;
+  char label[128];
+
+  int types_num = policy_circuit_attributes(policy, strlen(policy), types, POLICY_CIRCUIT_SLOTS_MAX);
+  int compiled = types_num > 0 && policy_circuit_compile(policy, strlen(policy), &circuit) == POLICY_CIRCUIT_OK;
+  snprintf(label, sizeof(label), "%s compiles", name);
+  check(compiled, label);
+  if (!compiled) {
+    return;
+  }
+  if (policy_vm_compile(circuit, cost, &program) != POLICY_CIRCUIT_OK) {
+    check(0, "bytecode compiles");
+    policy_circuit_free(circuit);
+    return;
+  }
+
+  for (int i = 0; i < types_num; i++) {
+    domain_of[i] = -1;
+    for (int d = 0; d < TEST_DOMAINS_NUM; d++) {
+      if (strcmp(domains[d].type, types[i]) == 0) {
+        domain_of[i] = d;
+      }
+    }
+    if (domain_of[i] < 0) {
+      fprintf(stderr, "no test values for %s\n", types[i]);
+      check(0, "every attribute has test values");
+      policy_vm_free(program);
+      policy_circuit_free(circuit);
+      return;
+    }
+  }
+
+  current_policy = policy;
+  for (;;) {
+    memset(current_values, 0, sizeof(current_values));
+    for (int i = 0; i < types_num; i++) {
+      current_values[domain_of[i]] = domains[domain_of[i]].values[value_index[i]];
+    }
+    const char *action = value_of(TEST_ACTION_ATTRIBUTE, strlen(TEST_ACTION_ATTRIBUTE));
+
+    pdp_decision_e circuit_decision = policy_circuit_evaluate(circuit, resolve, NULL);
+    for (int k = 0; k < circuit->slots_num; k++) {
+      slots[k].resolved = 0;
+    }
+    pdp_decision_e vm_decision = policy_vm_run(program, slots, resolve, NULL);
+    pdp_decision_e pdp = pdp_decision(action != NULL ? action : "");
+
+    if (vm_decision != circuit_decision || pdp != circuit_decision) {
+      printf("  %s:", name);
+      for (int i = 0; i < types_num; i++) {
+        printf(" %s=%s", types[i], current_values[domain_of[i]]);
+      }
+      printf(" -> circuit %d, vm %d, pdp %d\n", circuit_decision, vm_decision, pdp);
+    }
+    vm_agrees &= vm_decision == circuit_decision;
+    pdp_agrees &= pdp == circuit_decision;
+    combinations++;
+    grants += circuit_decision == PDP_GRANT;
+
+    // Next combination, the first attribute counting fastest
+    int i = 0;
+    while (i < types_num && domains[domain_of[i]].values[++value_index[i]] == NULL) {
+      value_index[i++] = 0;
+    }
+    if (i == types_num) {
+      break;
+    }
+  }
+
+  // A policy that decides every request alike would compare nothing
+  snprintf(label, sizeof(label), "%s: grants %d of %d requests", name, grants, combinations);
+  check(grants > 0 && grants < combinations, label);
+  snprintf(label, sizeof(label), "%s: vm agrees on %d requests", name, combinations);
+  check(vm_agrees, label);
+  snprintf(label, sizeof(label), "%s: pdp agrees on %d requests", name, combinations);
+  check(pdp_agrees, label);
+
+  policy_vm_free(program);
+  policy_circuit_free(circuit);
+}
+
+int main(int argc, char **argv) {
+  plugin_t pap_plugin;
+  plugin_t pip_plugin;
+  char name[32];
+  char *sample = malloc(TEST_POLICY_LEN);
+
+  if (sample == NULL || read_policy(TEST_SAMPLE_POLICY_FILE, sample, TEST_POLICY_LEN) <= 0) {
+    fprintf(stderr, "could not read %s\n", TEST_SAMPLE_POLICY_FILE);
+    free(sample);
+    return -1;
+  }
+
+  access_init();
+  if (plugin_init(&pap_plugin, pap_initializer, NULL) != 0 || plugin_init(&pip_plugin, pip_initializer, NULL) != 0) {
+    fprintf(stderr, "could not initialize the test plugins\n");
+    free(sample);
+    return -1;
+  }
+  access_register_pap_plugin(&pap_plugin);
+  // Uncached, the values change from one request to the next
+  access_register_pip_plugin_ttl(&pip_plugin, 0, NULL, 0);
+
+  compare_engines("sample policy", sample);
+  for (int i = 0; i < TEST_POLICIES_NUM; i++) {
+    snprintf(name, sizeof(name), "policy %d", i + 1);
+    compare_engines(name, policies[i]);
+  }
+
+  access_term();
+  free(sample);
+  return failures == 0 ? 0 : -1;
+}